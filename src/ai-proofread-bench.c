@@ -0,0 +1,895 @@
+/*
+ * ai-proofread-bench.c - Benchmark for AI Proofread Plugin
+ *
+ * A command line tool which runs the API layer without Evolution:
+ * - Replays a corpus of mail bodies against an OpenAI compatible endpoint
+ * - Runs the requests with a configurable concurrency and repeat count
+ * - Reports throughput, latency percentiles and token costs
+ * - Optionally serves the requests from a built-in mock server with a
+ *   fixed delay and streaming rate, to measure the client overhead
+ *   deterministically
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
+#include <libsoup/soup.h>
+
+#include "m-chatgpt-api.h"
+#include "m-chunker.h"
+#include "m-config.h"
+#include "m-scheduler.h"
+#include "m-stats.h"
+#include "m-version.h"
+
+#define BENCH_DEFAULT_PROMPT "Proofread"
+#define BENCH_MOCK_API_KEY "mock"
+#define BENCH_MOCK_PROMPTS \
+    "[{\"name\": \"" BENCH_DEFAULT_PROMPT "\", " \
+    "\"prompt\": \"Proofread the following email.\"}]"
+#define BENCH_MOCK_MODELS \
+    "{\"object\": \"list\", \"data\": [" \
+    "{\"id\": \"gpt-4o\", \"object\": \"model\"}, " \
+    "{\"id\": \"gpt-4o-mini\", \"object\": \"model\"}]}"
+
+static gchar *opt_endpoint = NULL;
+static gboolean opt_mock = FALSE;
+static gint opt_mock_delay_ms = 200;
+static gint opt_mock_token_ms = 5;
+static gboolean opt_stream = FALSE;
+static gchar *opt_prompt = NULL;
+static gchar *opt_prompts_file = NULL;
+static gchar *opt_model = NULL;
+static gchar *opt_api_key = NULL;
+static gint opt_concurrency = M_SCHEDULER_DEFAULT_MAX_IN_FLIGHT;
+static gint opt_repeat = 1;
+static gdouble opt_price_in = 0;
+static gdouble opt_price_out = 0;
+static gchar **opt_corpus = NULL;
+
+static GOptionEntry option_entries[] = {
+    { "endpoint", 'e', 0, G_OPTION_ARG_STRING, &opt_endpoint,
+      "API base URL (default: the OpenAI API)", "URL" },
+    { "mock", 0, 0, G_OPTION_ARG_NONE, &opt_mock,
+      "Serve the requests from a local mock server", NULL },
+    { "mock-delay-ms", 0, 0, G_OPTION_ARG_INT, &opt_mock_delay_ms,
+      "Mock server delay before the first byte (default: 200)", "MS" },
+    { "mock-token-ms", 0, 0, G_OPTION_ARG_INT, &opt_mock_token_ms,
+      "Mock server delay between streamed words (default: 5)", "MS" },
+    { "stream", 's', 0, G_OPTION_ARG_NONE, &opt_stream,
+      "Request streamed completions", NULL },
+    { "prompt", 'p', 0, G_OPTION_ARG_STRING, &opt_prompt,
+      "Name of the prompt to use (default: " BENCH_DEFAULT_PROMPT ")", "NAME" },
+    { "prompts", 0, 0, G_OPTION_ARG_FILENAME, &opt_prompts_file,
+      "Read the prompts from FILE instead of prompts.json", "FILE" },
+    { "model", 'm', 0, G_OPTION_ARG_STRING, &opt_model,
+      "Model to use (default: the one selected in config.json)", "MODEL" },
+    { "api-key", 'k', 0, G_OPTION_ARG_STRING, &opt_api_key,
+      "API key (default: from ~/.authinfo)", "KEY" },
+    { "concurrency", 'c', 0, G_OPTION_ARG_INT, &opt_concurrency,
+      "Number of requests in flight (default: 4)", "N" },
+    { "repeat", 'n', 0, G_OPTION_ARG_INT, &opt_repeat,
+      "Number of times to send each mail body (default: 1)", "N" },
+    { "price-in", 0, 0, G_OPTION_ARG_DOUBLE, &opt_price_in,
+      "Price of 1M input tokens, to report the cost", "USD" },
+    { "price-out", 0, 0, G_OPTION_ARG_DOUBLE, &opt_price_out,
+      "Price of 1M output tokens, to report the cost", "USD" },
+    { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &opt_corpus,
+      NULL, "FILE|DIRECTORY..." },
+    { NULL }
+};
+
+/* Mock server: runs its own main loop in a separate thread */
+
+typedef struct
+{
+    GThread *thread;
+    GMainContext *context;
+    GMainLoop *loop;
+    SoupServer *server;
+    gchar *base_url;
+    GError *error;
+    GMutex lock;
+    GCond cond;
+    gboolean ready;
+} MockServer;
+
+typedef struct
+{
+    SoupServerMessage *msg;
+    gulong finished_id;
+    gboolean finished;
+    gchar *model;
+    gchar *content;
+    const gchar *position;
+    gboolean stream;
+    gboolean edits;
+} MockResponse;
+
+static void
+mock_response_free(gpointer data)
+{
+    MockResponse *response = data;
+
+    g_signal_handler_disconnect(response->msg, response->finished_id);
+    g_object_unref(response->msg);
+    g_free(response->model);
+    g_free(response->content);
+    g_free(response);
+}
+
+static void
+mock_message_finished_cb(SoupServerMessage *msg, gpointer user_data)
+{
+    MockResponse *response = user_data;
+
+    response->finished = TRUE;
+}
+
+/*
+ * mock_add_usage:
+ *
+ * Add the usage member of a completion which echoes the content.
+ */
+static void
+mock_add_usage(JsonBuilder *builder, MockResponse *response)
+{
+    guint tokens = m_chunker_estimate_tokens(response->content);
+
+    json_builder_set_member_name(builder, "usage");
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "prompt_tokens");
+    json_builder_add_int_value(builder, tokens);
+    json_builder_set_member_name(builder, "completion_tokens");
+    json_builder_add_int_value(builder, tokens);
+    json_builder_set_member_name(builder, "total_tokens");
+    json_builder_add_int_value(builder, 2 * tokens);
+    json_builder_end_object(builder);
+}
+
+/*
+ * mock_finish_builder:
+ *
+ * Returns: (transfer full): The JSON built by @builder, which is freed
+ */
+static gchar *
+mock_finish_builder(JsonBuilder *builder)
+{
+    JsonGenerator *generator = json_generator_new();
+    JsonNode *root = json_builder_get_root(builder);
+    gchar *data;
+
+    json_generator_set_root(generator, root);
+    data = json_generator_to_data(generator, NULL);
+
+    json_node_free(root);
+    g_object_unref(generator);
+    g_object_unref(builder);
+
+    return data;
+}
+
+/*
+ * mock_build_completion:
+ *
+ * Returns: (transfer full): A chat.completion echoing the content
+ */
+static gchar *
+mock_build_completion(MockResponse *response)
+{
+    JsonBuilder *builder = json_builder_new();
+
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "object");
+    json_builder_add_string_value(builder, "chat.completion");
+    json_builder_set_member_name(builder, "model");
+    json_builder_add_string_value(builder, response->model);
+    json_builder_set_member_name(builder, "choices");
+    json_builder_begin_array(builder);
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "index");
+    json_builder_add_int_value(builder, 0);
+    json_builder_set_member_name(builder, "message");
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "role");
+    json_builder_add_string_value(builder, "assistant");
+    json_builder_set_member_name(builder, "content");
+    /* An empty edit list leaves the text as it is */
+    json_builder_add_string_value(builder, response->edits ? "{\"edits\": []}" : response->content);
+    json_builder_end_object(builder);
+    json_builder_set_member_name(builder, "finish_reason");
+    json_builder_add_string_value(builder, "stop");
+    json_builder_end_object(builder);
+    json_builder_end_array(builder);
+    mock_add_usage(builder, response);
+    json_builder_end_object(builder);
+
+    return mock_finish_builder(builder);
+}
+
+/*
+ * mock_build_event:
+ * @delta: (nullable): The content delta, or NULL for the final usage chunk
+ *
+ * Returns: (transfer full): A chat.completion.chunk server-sent event
+ */
+static gchar *
+mock_build_event(MockResponse *response, const gchar *delta, gsize delta_length)
+{
+    JsonBuilder *builder = json_builder_new();
+    gchar *data;
+    gchar *event;
+
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "object");
+    json_builder_add_string_value(builder, "chat.completion.chunk");
+    json_builder_set_member_name(builder, "model");
+    json_builder_add_string_value(builder, response->model);
+    json_builder_set_member_name(builder, "choices");
+    json_builder_begin_array(builder);
+    if (delta)
+    {
+        gchar *text = g_strndup(delta, delta_length);
+
+        json_builder_begin_object(builder);
+        json_builder_set_member_name(builder, "index");
+        json_builder_add_int_value(builder, 0);
+        json_builder_set_member_name(builder, "delta");
+        json_builder_begin_object(builder);
+        json_builder_set_member_name(builder, "content");
+        json_builder_add_string_value(builder, text);
+        json_builder_end_object(builder);
+        json_builder_end_object(builder);
+        g_free(text);
+    }
+    json_builder_end_array(builder);
+    if (!delta)
+        mock_add_usage(builder, response);
+    json_builder_end_object(builder);
+
+    data = mock_finish_builder(builder);
+    event = g_strdup_printf("data: %s\n\n", data);
+    g_free(data);
+
+    return event;
+}
+
+static void
+mock_append(SoupServerMessage *msg, gchar *data)
+{
+    SoupMessageBody *body = soup_server_message_get_response_body(msg);
+
+    soup_message_body_append(body, SOUP_MEMORY_TAKE, data, strlen(data));
+}
+
+/*
+ * mock_next_word:
+ *
+ * Returns: The end of the word at @position, including the whitespace
+ *          after it
+ */
+static const gchar *
+mock_next_word(const gchar *position)
+{
+    while (*position && !g_ascii_isspace(*position))
+        position++;
+    while (*position && g_ascii_isspace(*position))
+        position++;
+
+    return position;
+}
+
+/*
+ * mock_stream_cb:
+ *
+ * Send the next word of a streamed completion, then the usage and the
+ * terminating event. libsoup pauses the message again once the
+ * appended chunks are written.
+ */
+static gboolean
+mock_stream_cb(gpointer user_data)
+{
+    MockResponse *response = user_data;
+
+    if (response->finished)
+        return G_SOURCE_REMOVE;
+
+    if (*response->position)
+    {
+        const gchar *end = mock_next_word(response->position);
+
+        mock_append(response->msg, mock_build_event(response, response->position,
+                                                    end - response->position));
+        response->position = end;
+        soup_server_message_unpause(response->msg);
+        return G_SOURCE_CONTINUE;
+    }
+
+    mock_append(response->msg, mock_build_event(response, NULL, 0));
+    mock_append(response->msg, g_strdup("data: [DONE]\n\n"));
+    soup_message_body_complete(soup_server_message_get_response_body(response->msg));
+    soup_server_message_unpause(response->msg);
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * mock_respond_cb:
+ *
+ * Called once the configured delay has passed. Sends a plain completion
+ * or starts streaming, which takes over @response.
+ */
+static gboolean
+mock_respond_cb(gpointer user_data)
+{
+    MockResponse *response = user_data;
+    SoupMessageHeaders *headers;
+    GSource *source;
+
+    if (response->finished)
+    {
+        mock_response_free(response);
+        return G_SOURCE_REMOVE;
+    }
+
+    soup_server_message_set_status(response->msg, SOUP_STATUS_OK, NULL);
+
+    if (!response->stream)
+    {
+        gchar *data = mock_build_completion(response);
+
+        soup_server_message_set_response(response->msg, "application/json",
+                                         SOUP_MEMORY_TAKE, data, strlen(data));
+        soup_server_message_unpause(response->msg);
+        mock_response_free(response);
+        return G_SOURCE_REMOVE;
+    }
+
+    headers = soup_server_message_get_response_headers(response->msg);
+    soup_message_headers_set_encoding(headers, SOUP_ENCODING_CHUNKED);
+    soup_message_headers_set_content_type(headers, "text/event-stream", NULL);
+    soup_message_body_set_accumulate(soup_server_message_get_response_body(response->msg), FALSE);
+
+    /* Send the headers now, the words follow one per tick */
+    soup_server_message_unpause(response->msg);
+
+    source = g_timeout_source_new(MAX(opt_mock_token_ms, 0));
+    g_source_set_callback(source, mock_stream_cb, response, mock_response_free);
+    g_source_attach(source, g_main_context_get_thread_default());
+    g_source_unref(source);
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * mock_completions:
+ *
+ * Answer a chat completion with the user message as the corrected text.
+ */
+static void
+mock_completions(SoupServerMessage *msg)
+{
+    SoupMessageBody *request_body = soup_server_message_get_request_body(msg);
+    GBytes *bytes = soup_message_body_flatten(request_body);
+    JsonParser *parser = json_parser_new();
+    JsonObject *root = NULL;
+    JsonArray *messages = NULL;
+    MockResponse *response;
+    GSource *source;
+
+    if (json_parser_load_from_data(parser, g_bytes_get_data(bytes, NULL), g_bytes_get_size(bytes), NULL) &&
+        JSON_NODE_HOLDS_OBJECT(json_parser_get_root(parser)))
+        root = json_node_get_object(json_parser_get_root(parser));
+    g_bytes_unref(bytes);
+
+    if (root)
+        messages = json_object_get_array_member_with_default(root, "messages", NULL);
+    if (!messages || json_array_get_length(messages) == 0)
+    {
+        soup_server_message_set_status(msg, SOUP_STATUS_BAD_REQUEST, NULL);
+        g_object_unref(parser);
+        return;
+    }
+
+    response = g_new0(MockResponse, 1);
+    response->msg = g_object_ref(msg);
+    response->finished_id = g_signal_connect(msg, "finished", G_CALLBACK(mock_message_finished_cb), response);
+    response->model = g_strdup(json_object_get_string_member_with_default(root, "model", "mock"));
+    response->content = g_strdup(json_object_get_string_member_with_default(
+        json_array_get_object_element(messages, json_array_get_length(messages) - 1), "content", ""));
+    response->position = response->content;
+    response->stream = json_object_get_boolean_member_with_default(root, "stream", FALSE);
+    response->edits = json_object_has_member(root, "response_format");
+    g_object_unref(parser);
+
+    soup_server_message_pause(msg);
+
+    source = g_timeout_source_new(MAX(opt_mock_delay_ms, 0));
+    g_source_set_callback(source, mock_respond_cb, response, NULL);
+    g_source_attach(source, g_main_context_get_thread_default());
+    g_source_unref(source);
+}
+
+static void
+mock_handler_cb(SoupServer *server,
+                SoupServerMessage *msg,
+                const char *path,
+                GHashTable *query,
+                gpointer user_data)
+{
+    const gchar *method = soup_server_message_get_method(msg);
+
+    if (g_strcmp0(path, "/v1/models") == 0 &&
+        (g_strcmp0(method, "GET") == 0 || g_strcmp0(method, "HEAD") == 0))
+    {
+        soup_server_message_set_status(msg, SOUP_STATUS_OK, NULL);
+        soup_server_message_set_response(msg, "application/json", SOUP_MEMORY_STATIC,
+                                         BENCH_MOCK_MODELS, strlen(BENCH_MOCK_MODELS));
+    }
+    else if (g_strcmp0(path, "/v1/chat/completions") == 0 && g_strcmp0(method, "POST") == 0)
+    {
+        mock_completions(msg);
+    }
+    else
+    {
+        soup_server_message_set_status(msg, SOUP_STATUS_NOT_FOUND, NULL);
+    }
+}
+
+static gpointer
+mock_thread_func(gpointer data)
+{
+    MockServer *mock = data;
+    GSList *uris;
+
+    g_main_context_push_thread_default(mock->context);
+
+    mock->server = soup_server_new("server-header", "ai-proofread-bench/" AI_PROOFREAD_VERSION " ", NULL);
+    soup_server_add_handler(mock->server, "/v1", mock_handler_cb, mock, NULL);
+
+    if (soup_server_listen_local(mock->server, 0, SOUP_SERVER_LISTEN_IPV4_ONLY, &mock->error))
+    {
+        uris = soup_server_get_uris(mock->server);
+        mock->base_url = g_strdup_printf("http://127.0.0.1:%d/v1", g_uri_get_port(uris->data));
+        g_slist_free_full(uris, (GDestroyNotify)g_uri_unref);
+    }
+
+    g_mutex_lock(&mock->lock);
+    mock->ready = TRUE;
+    g_cond_signal(&mock->cond);
+    g_mutex_unlock(&mock->lock);
+
+    if (!mock->error)
+        g_main_loop_run(mock->loop);
+
+    soup_server_disconnect(mock->server);
+    g_clear_object(&mock->server);
+    g_main_context_pop_thread_default(mock->context);
+
+    return NULL;
+}
+
+/*
+ * mock_server_start:
+ *
+ * Start the mock server on a free local port.
+ *
+ * Returns: (transfer full) (nullable): The server, or NULL on error
+ */
+static MockServer *
+mock_server_start(GError **error)
+{
+    MockServer *mock = g_new0(MockServer, 1);
+
+    g_mutex_init(&mock->lock);
+    g_cond_init(&mock->cond);
+    mock->context = g_main_context_new();
+    mock->loop = g_main_loop_new(mock->context, FALSE);
+    mock->thread = g_thread_new("bench-mock", mock_thread_func, mock);
+
+    g_mutex_lock(&mock->lock);
+    while (!mock->ready)
+        g_cond_wait(&mock->cond, &mock->lock);
+    g_mutex_unlock(&mock->lock);
+
+    if (mock->error)
+    {
+        g_propagate_error(error, g_steal_pointer(&mock->error));
+        g_thread_join(mock->thread);
+        g_main_loop_unref(mock->loop);
+        g_main_context_unref(mock->context);
+        g_mutex_clear(&mock->lock);
+        g_cond_clear(&mock->cond);
+        g_free(mock);
+        return NULL;
+    }
+
+    return mock;
+}
+
+static gboolean
+mock_quit_cb(gpointer user_data)
+{
+    MockServer *mock = user_data;
+
+    g_main_loop_quit(mock->loop);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+mock_server_stop(MockServer *mock)
+{
+    if (!mock)
+        return;
+
+    g_main_context_invoke(mock->context, mock_quit_cb, mock);
+    g_thread_join(mock->thread);
+
+    g_main_loop_unref(mock->loop);
+    g_main_context_unref(mock->context);
+    g_mutex_clear(&mock->lock);
+    g_cond_clear(&mock->cond);
+    g_free(mock->base_url);
+    g_free(mock);
+}
+
+/* Benchmark */
+
+typedef struct
+{
+    JsonArray *prompts;
+    const gchar *prompt;
+    MBackend *backend;
+    const gchar *model;
+    GPtrArray *corpus;
+    GMutex lock;
+    GPtrArray *records;
+    guint64 bytes;
+} Bench;
+
+static void
+bench_job_func(gpointer data, gpointer user_data)
+{
+    Bench *bench = user_data;
+    const gchar *content = g_ptr_array_index(bench->corpus, GPOINTER_TO_UINT(data) - 1);
+    MStatsRecord *stats = m_stats_record_new(M_STATS_KIND_PROOFREAD, bench->model, bench->prompt);
+    GError *error = NULL;
+    gchar *result;
+
+    if (opt_stream)
+        result = m_chatgpt_proofread_stream(content, bench->prompt, bench->prompts, bench->backend,
+                                            bench->model, NULL, NULL, stats, NULL, &error);
+    else
+        result = m_chatgpt_proofread(content, bench->prompt, bench->prompts, bench->backend,
+                                     bench->model, stats, NULL, &error);
+
+    stats->total_us = g_get_monotonic_time() - stats->start_us;
+    stats->success = result != NULL;
+    m_stats_record_set_error(stats, error);
+    if (error)
+    {
+        g_printerr("Request failed: %s\n", error->message);
+        g_error_free(error);
+    }
+    g_free(result);
+
+    g_mutex_lock(&bench->lock);
+    g_ptr_array_add(bench->records, stats);
+    bench->bytes += strlen(content);
+    g_mutex_unlock(&bench->lock);
+}
+
+static gint
+compare_paths(gconstpointer a, gconstpointer b)
+{
+    return g_strcmp0(*(const gchar *const *)a, *(const gchar *const *)b);
+}
+
+/*
+ * load_corpus:
+ *
+ * Read every file named in @paths, and every regular file in the
+ * directories among them, in name order.
+ */
+static gboolean
+load_corpus(gchar **paths, GPtrArray *corpus, GError **error)
+{
+    for (guint i = 0; paths && paths[i]; i++)
+    {
+        gchar *content;
+
+        if (g_file_test(paths[i], G_FILE_TEST_IS_DIR))
+        {
+            GDir *dir = g_dir_open(paths[i], 0, error);
+            GPtrArray *names;
+            const gchar *name;
+            gboolean loaded;
+
+            if (!dir)
+                return FALSE;
+
+            names = g_ptr_array_new_with_free_func(g_free);
+            while ((name = g_dir_read_name(dir)))
+            {
+                gchar *path = g_build_filename(paths[i], name, NULL);
+
+                if (g_file_test(path, G_FILE_TEST_IS_REGULAR))
+                    g_ptr_array_add(names, path);
+                else
+                    g_free(path);
+            }
+            g_dir_close(dir);
+
+            g_ptr_array_sort(names, compare_paths);
+            g_ptr_array_add(names, NULL);
+            loaded = load_corpus((gchar **)names->pdata, corpus, error);
+            g_ptr_array_unref(names);
+
+            if (!loaded)
+                return FALSE;
+            continue;
+        }
+
+        if (!g_file_get_contents(paths[i], &content, NULL, error))
+            return FALSE;
+        g_ptr_array_add(corpus, content);
+    }
+
+    return TRUE;
+}
+
+/*
+ * load_prompts:
+ *
+ * Returns: (transfer full) (nullable): The prompts from --prompts, the
+ *          built-in prompt for the mock server or NULL to use prompts.json
+ */
+static JsonArray *
+load_prompts(GError **error)
+{
+    JsonParser *parser = json_parser_new();
+    JsonArray *prompts = NULL;
+    gboolean loaded;
+
+    if (opt_prompts_file)
+        loaded = json_parser_load_from_file(parser, opt_prompts_file, error);
+    else if (opt_mock)
+        loaded = json_parser_load_from_data(parser, BENCH_MOCK_PROMPTS, -1, error);
+    else
+        loaded = FALSE;
+
+    if (loaded && JSON_NODE_HOLDS_ARRAY(json_parser_get_root(parser)))
+        prompts = json_array_ref(json_node_get_array(json_parser_get_root(parser)));
+    else if (loaded)
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "%s: root is not an array", opt_prompts_file);
+
+    g_object_unref(parser);
+    return prompts;
+}
+
+/* Pseudo offset for the time spent in the client */
+#define BENCH_CLIENT_OFFSET G_MAXSIZE
+
+/*
+ * record_value:
+ *
+ * Returns: The duration at @offset in @record. What is left of the
+ *          request once the queue and network phases are taken out is
+ *          the time spent in the client.
+ */
+static gint64
+record_value(MStatsRecord *record, gsize offset)
+{
+    if (offset != BENCH_CLIENT_OFFSET)
+        return G_STRUCT_MEMBER(gint64, record, offset);
+
+    return record->total_us - record->queue_us - record->dns_us - record->connect_us -
+           record->tls_us - record->ttfb_us - record->transfer_us;
+}
+
+static gint64
+percentile_of(GPtrArray *records, gsize offset, gdouble percentile)
+{
+    gint64 *values = g_new(gint64, MAX(records->len, 1));
+    guint n_values = 0;
+    gint64 value;
+
+    for (guint i = 0; i < records->len; i++)
+    {
+        MStatsRecord *record = g_ptr_array_index(records, i);
+
+        if (record->success)
+            values[n_values++] = record_value(record, offset);
+    }
+
+    value = m_stats_percentile(values, n_values, percentile);
+    g_free(values);
+
+    return value;
+}
+
+static void
+print_latency(GPtrArray *records, const gchar *label, gsize offset)
+{
+    g_print("%-12s p50 %7.1f ms   p95 %7.1f ms   p99 %7.1f ms\n", label,
+            percentile_of(records, offset, 50) / 1000.0,
+            percentile_of(records, offset, 95) / 1000.0,
+            percentile_of(records, offset, 99) / 1000.0);
+}
+
+/*
+ * print_report:
+ *
+ * Returns: The number of failed requests
+ */
+static guint
+print_report(Bench *bench, gint64 elapsed_us)
+{
+    gdouble seconds = MAX(elapsed_us, 1) / (gdouble)G_USEC_PER_SEC;
+    gint64 estimated_tokens = 0;
+    gint64 prompt_tokens = 0;
+    gint64 cached_tokens = 0;
+    gint64 completion_tokens = 0;
+    guint failed = 0;
+
+    for (guint i = 0; i < bench->records->len; i++)
+    {
+        MStatsRecord *record = g_ptr_array_index(bench->records, i);
+
+        estimated_tokens += record->estimated_tokens;
+        prompt_tokens += record->prompt_tokens;
+        cached_tokens += record->cached_tokens;
+        completion_tokens += record->completion_tokens;
+        if (!record->success)
+            failed++;
+    }
+
+    g_print("Requests:    %u (%u failed), concurrency %d, %s\n",
+            bench->records->len, failed, opt_concurrency, opt_stream ? "streamed" : "not streamed");
+    g_print("Wall time:   %.2f s\n", seconds);
+    g_print("Throughput:  %.2f requests/s, %.1f KiB/s of mail\n",
+            bench->records->len / seconds, bench->bytes / 1024.0 / seconds);
+    print_latency(bench->records, "Total:", G_STRUCT_OFFSET(MStatsRecord, total_us));
+    print_latency(bench->records, "Queue:", G_STRUCT_OFFSET(MStatsRecord, queue_us));
+    print_latency(bench->records, "TTFB:", G_STRUCT_OFFSET(MStatsRecord, ttfb_us));
+    print_latency(bench->records, "Transfer:", G_STRUCT_OFFSET(MStatsRecord, transfer_us));
+    print_latency(bench->records, "Parse:", G_STRUCT_OFFSET(MStatsRecord, parse_us));
+    print_latency(bench->records, "Client:", BENCH_CLIENT_OFFSET);
+    g_print("Tokens:      %" G_GINT64_FORMAT " in (%" G_GINT64_FORMAT " cached, %" G_GINT64_FORMAT
+            " estimated), %" G_GINT64_FORMAT " out\n",
+            prompt_tokens, cached_tokens, estimated_tokens, completion_tokens);
+    if (opt_price_in > 0 || opt_price_out > 0)
+        g_print("Cost:        $%.4f\n",
+                (prompt_tokens * opt_price_in + completion_tokens * opt_price_out) / 1e6);
+
+    return failed;
+}
+
+int
+main(int argc, char **argv)
+{
+    GOptionContext *option_context;
+    GError *error = NULL;
+    MockServer *mock = NULL;
+    MConfig *config;
+    Bench bench = { 0 };
+    GThreadPool *pool;
+    MBackend *prompt_backend;
+    const gchar *base_url;
+    const gchar *api_key;
+    gint64 start_us;
+    guint failed = 0;
+
+    option_context = g_option_context_new("FILE|DIRECTORY... - replay mail bodies against the API");
+    g_option_context_add_main_entries(option_context, option_entries, NULL);
+    if (!g_option_context_parse(option_context, &argc, &argv, &error))
+    {
+        g_printerr("%s\n", error->message);
+        return 2;
+    }
+    g_option_context_free(option_context);
+
+    if (!opt_corpus)
+    {
+        g_printerr("No corpus given, see --help\n");
+        return 2;
+    }
+
+    /* Read the configuration on the main thread before any worker does */
+    config = m_config_get();
+
+    bench.corpus = g_ptr_array_new_with_free_func(g_free);
+    bench.records = g_ptr_array_new_with_free_func((GDestroyNotify)m_stats_record_free);
+    g_mutex_init(&bench.lock);
+
+    if (!load_corpus(opt_corpus, bench.corpus, &error))
+        goto out;
+    if (bench.corpus->len == 0)
+    {
+        g_set_error(&error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "The corpus is empty");
+        goto out;
+    }
+
+    bench.prompts = load_prompts(&error);
+    if (error)
+        goto out;
+    if (!bench.prompts)
+        bench.prompts = json_array_ref(config->prompts);
+    bench.prompt = opt_prompt ? opt_prompt : BENCH_DEFAULT_PROMPT;
+    if (!m_chatgpt_find_prompt(bench.prompts, bench.prompt))
+    {
+        g_set_error(&error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "Prompt not found: %s", bench.prompt);
+        goto out;
+    }
+
+    if (opt_mock)
+    {
+        mock = mock_server_start(&error);
+        if (!mock)
+            goto out;
+        g_print("Mock server at %s\n", mock->base_url);
+    }
+
+    /* Run on the backend of the prompt, redirected by --mock or --endpoint */
+    prompt_backend = m_config_get_prompt_backend(config, m_chatgpt_find_prompt(bench.prompts, bench.prompt));
+    base_url = mock ? mock->base_url : opt_endpoint ? opt_endpoint : prompt_backend->base_url;
+    api_key = opt_api_key ? opt_api_key : prompt_backend->api_key;
+    if (!api_key && opt_mock)
+        api_key = BENCH_MOCK_API_KEY;
+    bench.backend = m_backend_new(prompt_backend->name, base_url, api_key,
+                                  opt_model ? NULL : prompt_backend->model,
+                                  prompt_backend->model_prefix);
+    if (!m_backend_is_usable(bench.backend))
+    {
+        g_set_error(&error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                    "No API key, use --api-key or add it to ~/.authinfo");
+        goto out;
+    }
+    if (opt_model)
+        bench.model = m_backend_get_model(bench.backend, opt_model);
+    else
+    {
+        MChatGPTPrompt prompt;
+
+        m_chatgpt_prompt_lookup(bench.prompts, bench.prompt, &prompt);
+        bench.model = m_chatgpt_prompt_get_model(&prompt, bench.backend, config->model);
+    }
+
+    opt_concurrency = MAX(opt_concurrency, 1);
+    m_scheduler_set_limits(opt_concurrency, 0);
+
+    pool = g_thread_pool_new(bench_job_func, &bench, opt_concurrency, FALSE, NULL);
+    start_us = g_get_monotonic_time();
+    for (gint repeat = 0; repeat < MAX(opt_repeat, 1); repeat++)
+    {
+        for (guint i = 0; i < bench.corpus->len; i++)
+            g_thread_pool_push(pool, GUINT_TO_POINTER(i + 1), NULL);
+    }
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    failed = print_report(&bench, g_get_monotonic_time() - start_us);
+
+out:
+    if (error)
+    {
+        g_printerr("%s\n", error->message);
+        g_clear_error(&error);
+        failed = 1;
+    }
+
+    m_chatgpt_shutdown();
+    mock_server_stop(mock);
+
+    if (bench.prompts)
+        json_array_unref(bench.prompts);
+    m_backend_unref(bench.backend);
+    g_ptr_array_unref(bench.records);
+    g_ptr_array_unref(bench.corpus);
+    g_mutex_clear(&bench.lock);
+    m_config_unref(config);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,548 @@
+/*
+ * ai-proofread-microbench.c - Microbenchmarks for AI Proofread Plugin
+ *
+ * Measures the hot paths of a request on synthetic mails from 1 KB to
+ * 5 MB:
+ * - Prompt lookup and authinfo parsing
+ * - Request building, serialization and copying into the message
+ * - Parsing of complete and streamed responses
+ *
+ * Every case reports the time per operation and, with glibc, the peak
+ * number of bytes allocated and the number of allocations. The modules
+ * are included directly so that their static functions can be measured.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "m-chatgpt-api.c"
+#include "m-config.c"
+
+#define MICROBENCH_MIN_TIME_US (300 * G_TIME_SPAN_MILLISECOND)
+#define MICROBENCH_MIN_ITERATIONS 3
+#define MICROBENCH_N_PROMPTS 64
+#define MICROBENCH_URL "http://127.0.0.1/v1/chat/completions"
+
+static const gsize mail_sizes[] = {
+    1024,
+    16 * 1024,
+    256 * 1024,
+    1024 * 1024,
+    5 * 1024 * 1024
+};
+
+/* Allocation accounting */
+
+#ifdef __GLIBC__
+#include <malloc.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+static gint64 alloc_current = 0;
+static gint64 alloc_peak = 0;
+static gint64 alloc_count = 0;
+
+static void
+account_alloc(void *ptr)
+{
+    gint64 current;
+    gint64 peak;
+
+    if (!ptr)
+        return;
+
+    current = __atomic_add_fetch(&alloc_current, (gint64)malloc_usable_size(ptr), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+
+    peak = __atomic_load_n(&alloc_peak, __ATOMIC_RELAXED);
+    while (current > peak &&
+           !__atomic_compare_exchange_n(&alloc_peak, &peak, current, TRUE,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void
+account_free(void *ptr)
+{
+    if (ptr)
+        __atomic_sub_fetch(&alloc_current, (gint64)malloc_usable_size(ptr), __ATOMIC_RELAXED);
+}
+
+void *
+malloc(size_t size)
+{
+    void *ptr = __libc_malloc(size);
+
+    account_alloc(ptr);
+    return ptr;
+}
+
+void *
+calloc(size_t n, size_t size)
+{
+    void *ptr = __libc_calloc(n, size);
+
+    account_alloc(ptr);
+    return ptr;
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    void *new_ptr;
+
+    account_free(ptr);
+    new_ptr = __libc_realloc(ptr, size);
+    if (new_ptr)
+        account_alloc(new_ptr);
+    else if (ptr && size > 0)
+        account_alloc(ptr);
+
+    return new_ptr;
+}
+
+void *
+memalign(size_t alignment, size_t size)
+{
+    void *ptr = __libc_memalign(alignment, size);
+
+    account_alloc(ptr);
+    return ptr;
+}
+
+void *
+aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+int
+posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+    *ptr = memalign(alignment, size);
+    return *ptr || size == 0 ? 0 : ENOMEM;
+}
+
+void
+free(void *ptr)
+{
+    account_free(ptr);
+    __libc_free(ptr);
+}
+
+/*
+ * alloc_reset:
+ *
+ * Start measuring the peak from the current allocation level.
+ */
+static void
+alloc_reset(gint64 *baseline, gint64 *count)
+{
+    *baseline = __atomic_load_n(&alloc_current, __ATOMIC_RELAXED);
+    *count = __atomic_load_n(&alloc_count, __ATOMIC_RELAXED);
+    __atomic_store_n(&alloc_peak, *baseline, __ATOMIC_RELAXED);
+}
+
+static void
+alloc_read(gint64 baseline, gint64 count, gint64 *peak_bytes, gint64 *n_allocs)
+{
+    *peak_bytes = __atomic_load_n(&alloc_peak, __ATOMIC_RELAXED) - baseline;
+    *n_allocs = __atomic_load_n(&alloc_count, __ATOMIC_RELAXED) - count;
+}
+#else
+static void
+alloc_reset(gint64 *baseline, gint64 *count)
+{
+    *baseline = 0;
+    *count = 0;
+}
+
+static void
+alloc_read(gint64 baseline, gint64 count, gint64 *peak_bytes, gint64 *n_allocs)
+{
+    *peak_bytes = -1;
+    *n_allocs = -1;
+}
+#endif
+
+/* Fixtures */
+
+typedef struct
+{
+    gchar *mail;
+    gsize size;
+    JsonArray *prompts;
+    const gchar *prompt_id;
+    GBytes *response;
+    gchar **events;
+    gchar *authinfo;
+    GError *error;
+} Fixture;
+
+typedef void (*MicrobenchFunc)(Fixture *fixture);
+
+static const gchar *const words[] = {
+    "the", "meeting", "tomorrow", "is", "moved", "to", "Thursday,", "please",
+    "confirm", "whether", "you", "can", "attend.", "Grüße", "naïve", "\"quoted\"",
+    "budget", "report", "attached", "—", "regards", "schedule", "\tindented", "€42"
+};
+
+/*
+ * build_mail:
+ *
+ * Returns: (transfer full): A deterministic mail body of about @size
+ *          bytes, most of it a deeply quoted thread as in a long reply
+ */
+static gchar *
+build_mail(gsize size)
+{
+    GString *mail = g_string_sized_new(size + 128);
+    GRand *rand = g_rand_new_with_seed(size);
+    guint depth = 0;
+
+    g_string_append(mail, "Hi all,\n\nSome thoughts on the plan below.\n\n");
+    while (mail->len < size)
+    {
+        guint n_words = g_rand_int_range(rand, 6, 16);
+
+        if (g_rand_int_range(rand, 0, 40) == 0)
+        {
+            depth = MIN(depth + 1, 6);
+            g_string_append(mail, "\nOn Mon, 1 Jan 2024 at 10:00, Someone <someone@example.com> wrote:\n");
+        }
+
+        for (guint i = 0; i < depth; i++)
+            g_string_append_c(mail, '>');
+        if (depth)
+            g_string_append_c(mail, ' ');
+
+        for (guint i = 0; i < n_words; i++)
+        {
+            if (i)
+                g_string_append_c(mail, ' ');
+            g_string_append(mail, words[g_rand_int_range(rand, 0, G_N_ELEMENTS(words))]);
+        }
+        g_string_append_c(mail, '\n');
+    }
+    g_string_append(mail, "-- \nJohn Doe\n");
+
+    g_rand_free(rand);
+    return g_string_free(mail, FALSE);
+}
+
+static JsonArray *
+build_prompts(void)
+{
+    JsonArray *prompts = json_array_new();
+
+    for (guint i = 0; i < MICROBENCH_N_PROMPTS; i++)
+    {
+        JsonObject *prompt = json_object_new();
+        gchar *name = g_strdup_printf("Prompt %u", i);
+
+        json_object_set_string_member(prompt, "name", name);
+        json_object_set_string_member(prompt, "prompt", "Proofread the following email.");
+        json_array_add_object_element(prompts, prompt);
+        g_free(name);
+    }
+
+    return prompts;
+}
+
+/*
+ * build_response:
+ *
+ * Returns: (transfer full): A chat completion whose content is @mail
+ */
+static GBytes *
+build_response(const gchar *mail)
+{
+    JsonBuilder *builder = json_builder_new();
+    JsonGenerator *generator = json_generator_new();
+    JsonNode *root;
+    gchar *data;
+
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "object");
+    json_builder_add_string_value(builder, "chat.completion");
+    json_builder_set_member_name(builder, "choices");
+    json_builder_begin_array(builder);
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "message");
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "role");
+    json_builder_add_string_value(builder, "assistant");
+    json_builder_set_member_name(builder, "content");
+    json_builder_add_string_value(builder, mail);
+    json_builder_end_object(builder);
+    json_builder_end_object(builder);
+    json_builder_end_array(builder);
+    json_builder_set_member_name(builder, "usage");
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "prompt_tokens");
+    json_builder_add_int_value(builder, strlen(mail) / 4);
+    json_builder_set_member_name(builder, "completion_tokens");
+    json_builder_add_int_value(builder, strlen(mail) / 4);
+    json_builder_end_object(builder);
+    json_builder_end_object(builder);
+
+    root = json_builder_get_root(builder);
+    json_generator_set_root(generator, root);
+    data = json_generator_to_data(generator, NULL);
+
+    json_node_free(root);
+    g_object_unref(generator);
+    g_object_unref(builder);
+
+    return g_bytes_new_take(data, strlen(data));
+}
+
+/*
+ * escape_json:
+ *
+ * Returns: (transfer full): @text quoted for a JSON string, without
+ *          the surrounding quotes
+ */
+static gchar *
+escape_json(const gchar *text)
+{
+    GString *escaped = g_string_sized_new(strlen(text) + 8);
+
+    for (const gchar *p = text; *p; p++)
+    {
+        if (*p == '"' || *p == '\\')
+            g_string_append_printf(escaped, "\\%c", *p);
+        else if ((guchar)*p < 0x20)
+            g_string_append_printf(escaped, "\\u%04x", (guchar)*p);
+        else
+            g_string_append_c(escaped, *p);
+    }
+
+    return g_string_free(escaped, FALSE);
+}
+
+/*
+ * build_events:
+ *
+ * Returns: (transfer full): The data of the stream events delivering
+ *          @mail in pieces of about the size of a token
+ */
+static gchar **
+build_events(const gchar *mail)
+{
+    GPtrArray *events = g_ptr_array_new();
+    const gchar *p = mail;
+
+    while (*p)
+    {
+        const gchar *end = g_utf8_offset_to_pointer(p, MIN(g_utf8_strlen(p, 4), 4));
+        gchar *piece = g_strndup(p, end - p);
+        gchar *escaped = escape_json(piece);
+
+        g_ptr_array_add(events, g_strdup_printf(
+            "{\"object\":\"chat.completion.chunk\",\"choices\":[{\"index\":0,\"delta\":{\"content\":\"%s\"}}]}",
+            escaped));
+        g_free(escaped);
+        g_free(piece);
+        p = end;
+    }
+    g_ptr_array_add(events, g_strdup("[DONE]"));
+    g_ptr_array_add(events, NULL);
+
+    return (gchar **)g_ptr_array_free(events, FALSE);
+}
+
+static gchar *
+build_authinfo(void)
+{
+    GString *authinfo = g_string_new(NULL);
+
+    for (guint i = 0; i < 200; i++)
+        g_string_append_printf(authinfo, "machine imap%u.example.com login user%u password secret%u\n", i, i, i);
+    g_string_append(authinfo, "machine api.openai.com login apikey password sk-0123456789abcdef\n");
+
+    return g_string_free(authinfo, FALSE);
+}
+
+/* Cases */
+
+static void
+case_prompt_lookup(Fixture *fixture)
+{
+    MChatGPTPrompt prompt;
+
+    if (!m_chatgpt_prompt_lookup(fixture->prompts, fixture->prompt_id, &prompt))
+        g_set_error(&fixture->error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "Prompt not found");
+}
+
+static void
+case_parse_authinfo_line(Fixture *fixture)
+{
+    g_free(parse_authinfo_line("machine api.openai.com login apikey password sk-0123456789abcdef", NULL));
+}
+
+static void
+case_parse_authinfo(Fixture *fixture)
+{
+    g_hash_table_unref(parse_authinfo(fixture->authinfo));
+}
+
+static const MChatGPTPrompt plain_prompt = {
+    .text = "Proofread the following email.",
+    .temperature = -1,
+};
+
+static const MChatGPTPrompt predicted_prompt = {
+    .text = "Proofread the following email.",
+    .temperature = -1,
+    .predict = TRUE,
+};
+
+static void
+case_build_request(Fixture *fixture)
+{
+    g_bytes_unref(build_request_json(&plain_prompt, fixture->mail, NULL, "gpt-4o", FALSE, NULL));
+}
+
+static void
+case_build_request_predicted(Fixture *fixture)
+{
+    g_bytes_unref(build_request_json(&predicted_prompt, fixture->mail, NULL, "gpt-4o", FALSE, NULL));
+}
+
+static void
+case_create_message(Fixture *fixture)
+{
+    GBytes *request_body = build_request_json(&plain_prompt, fixture->mail, NULL, "gpt-4o", FALSE, NULL);
+    SoupMessage *msg = create_request_message("POST", MICROBENCH_URL, "sk-test", NULL, request_body,
+                                              &fixture->error);
+
+    g_clear_object(&msg);
+    g_bytes_unref(request_body);
+}
+
+static void
+case_parse_response(Fixture *fixture)
+{
+    g_free(parse_completion_response(fixture->response, NULL, NULL, &fixture->error));
+}
+
+static void
+case_parse_stream(Fixture *fixture)
+{
+    GString *accumulated = g_string_new(NULL);
+    gboolean done = FALSE;
+
+    for (guint i = 0; fixture->events[i] && !fixture->error; i++)
+        parse_stream_event(fixture->events[i], accumulated, NULL, NULL, NULL, NULL, &done, &fixture->error);
+
+    g_string_free(accumulated, TRUE);
+}
+
+/* Runner */
+
+static void
+run_case(const gchar *name, MicrobenchFunc func, Fixture *fixture)
+{
+    gint64 baseline;
+    gint64 count;
+    gint64 peak_bytes;
+    gint64 n_allocs;
+    gint64 start_us;
+    gint64 elapsed_us;
+    guint iterations = 0;
+    gdouble per_op_us;
+    gchar *size;
+    gchar *peak;
+
+    /* The first run warms up and measures allocations */
+    alloc_reset(&baseline, &count);
+    func(fixture);
+    alloc_read(baseline, count, &peak_bytes, &n_allocs);
+
+    if (fixture->error)
+    {
+        g_printerr("%s: %s\n", name, fixture->error->message);
+        g_clear_error(&fixture->error);
+        return;
+    }
+
+    start_us = g_get_monotonic_time();
+    do
+    {
+        func(fixture);
+        iterations++;
+        elapsed_us = g_get_monotonic_time() - start_us;
+    } while (elapsed_us < MICROBENCH_MIN_TIME_US || iterations < MICROBENCH_MIN_ITERATIONS);
+
+    per_op_us = (gdouble)elapsed_us / iterations;
+    size = fixture->size ? g_format_size(fixture->size) : g_strdup("-");
+    peak = peak_bytes >= 0 ? g_format_size(peak_bytes) : g_strdup("n/a");
+
+    g_print("%-26s %10s %12.2f us", name, size, per_op_us);
+    if (fixture->size)
+        g_print(" %9.1f MB/s", fixture->size / per_op_us);
+    else
+        g_print(" %14s", "");
+    g_print(" %10s", peak);
+    if (n_allocs >= 0)
+        g_print(" %10" G_GINT64_FORMAT, n_allocs);
+    g_print("\n");
+
+    g_free(size);
+    g_free(peak);
+}
+
+int
+main(int argc, char **argv)
+{
+    Fixture fixture = { 0 };
+    gchar *filter = argc > 1 ? argv[1] : NULL;
+
+    g_print("%-26s %10s %15s %14s %10s %10s\n", "case", "size", "time/op", "throughput", "peak", "allocs");
+
+#define RUN(name, func) \
+    G_STMT_START { \
+        if (!filter || strstr(name, filter)) \
+            run_case(name, func, &fixture); \
+    } G_STMT_END
+
+    fixture.prompts = build_prompts();
+    fixture.prompt_id = "ai-proofread-Prompt 63";
+    fixture.authinfo = build_authinfo();
+    RUN("prompt_lookup", case_prompt_lookup);
+    RUN("parse_authinfo_line", case_parse_authinfo_line);
+    RUN("parse_authinfo", case_parse_authinfo);
+
+    for (guint i = 0; i < G_N_ELEMENTS(mail_sizes); i++)
+    {
+        fixture.mail = build_mail(mail_sizes[i]);
+        fixture.size = strlen(fixture.mail);
+        fixture.response = build_response(fixture.mail);
+        fixture.events = build_events(fixture.mail);
+
+        RUN("build_request_json", case_build_request);
+        RUN("build_request_json+predict", case_build_request_predicted);
+        RUN("create_request_message", case_create_message);
+        RUN("parse_completion_response", case_parse_response);
+        RUN("parse_stream_event", case_parse_stream);
+
+        g_strfreev(fixture.events);
+        g_bytes_unref(fixture.response);
+        g_free(fixture.mail);
+    }
+
+#undef RUN
+
+    g_free(fixture.authinfo);
+    json_array_unref(fixture.prompts);
+
+    return 0;
+}
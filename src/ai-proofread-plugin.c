@@ -5,6 +5,8 @@
 #include <glib-object.h>
 
 #include "m-msg-composer-extension.h"
+#include "m-chatgpt-api.h"
+#include "m-latency.h"
 #include "m-version.h"
 
 /* Module Entry Points */
@@ -21,4 +23,6 @@ e_module_load (GTypeModule *type_module)
 G_MODULE_EXPORT void
 e_module_unload (GTypeModule *type_module)
 {
+	m_chatgpt_shutdown ();
+	m_latency_flush ();
 }
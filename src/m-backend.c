@@ -0,0 +1,263 @@
+/*
+ * m-backend.c - API backends for AI Proofread Plugin
+ *
+ * Implements the backend descriptions and their construction from
+ * config.json and the API keys found in ~/.authinfo.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <json-glib/json-glib.h>
+
+#include "m-backend.h"
+
+/* Model IDs of the OpenAI API which are meant for chat completions */
+#define M_BACKEND_DEFAULT_MODEL_PREFIX "gpt-"
+
+static void
+backend_clear(gpointer data)
+{
+    MBackend *backend = data;
+
+    g_free(backend->name);
+    g_free(backend->base_url);
+    g_free(backend->api_key);
+    g_free(backend->model);
+    g_free(backend->model_prefix);
+}
+
+/*
+ * m_backend_new:
+ */
+MBackend *
+m_backend_new(const gchar *name,
+              const gchar *base_url,
+              const gchar *api_key,
+              const gchar *model,
+              const gchar *model_prefix)
+{
+    MBackend *backend;
+    gsize length;
+
+    g_return_val_if_fail(name != NULL, NULL);
+    g_return_val_if_fail(base_url != NULL, NULL);
+
+    backend = g_atomic_rc_box_new0(MBackend);
+    backend->name = g_strdup(name);
+    backend->base_url = g_strdup(base_url);
+    backend->api_key = g_strdup(api_key);
+    backend->model = g_strdup(model);
+    backend->model_prefix = g_strdup(model_prefix);
+
+    /* Tolerate a trailing slash */
+    length = strlen(backend->base_url);
+    if (length > 0 && backend->base_url[length - 1] == '/')
+        backend->base_url[length - 1] = '\0';
+
+    return backend;
+}
+
+/*
+ * m_backend_ref:
+ */
+MBackend *
+m_backend_ref(MBackend *backend)
+{
+    g_return_val_if_fail(backend != NULL, NULL);
+
+    return g_atomic_rc_box_acquire(backend);
+}
+
+/*
+ * m_backend_unref:
+ */
+void
+m_backend_unref(MBackend *backend)
+{
+    if (backend)
+        g_atomic_rc_box_release_full(backend, backend_clear);
+}
+
+/*
+ * m_backend_build_url:
+ */
+gchar *
+m_backend_build_url(const MBackend *backend, const gchar *path)
+{
+    g_return_val_if_fail(backend != NULL, NULL);
+
+    return g_strconcat(backend->base_url, path, NULL);
+}
+
+/*
+ * m_backend_get_model:
+ */
+const gchar *
+m_backend_get_model(const MBackend *backend, const gchar *selected_model)
+{
+    g_return_val_if_fail(backend != NULL, selected_model);
+
+    return backend->model ? backend->model : selected_model;
+}
+
+/*
+ * m_backend_is_usable:
+ */
+gboolean
+m_backend_is_usable(const MBackend *backend)
+{
+    g_return_val_if_fail(backend != NULL, FALSE);
+
+    return backend->api_key || g_strcmp0(backend->base_url, M_BACKEND_DEFAULT_URL) != 0;
+}
+
+/*
+ * m_backend_accepts_model:
+ */
+gboolean
+m_backend_accepts_model(const MBackend *backend, const gchar *model_id)
+{
+    g_return_val_if_fail(backend != NULL, FALSE);
+
+    if (!model_id)
+        return FALSE;
+
+    return !backend->model_prefix || g_str_has_prefix(model_id, backend->model_prefix);
+}
+
+/*
+ * get_url_host:
+ * @url: A URL
+ *
+ * Returns: (transfer full) (nullable): The host of @url, or NULL if it
+ *          cannot be parsed
+ */
+static gchar *
+get_url_host(const gchar *url)
+{
+    GUri *uri = g_uri_parse(url, G_URI_FLAGS_NONE, NULL);
+    gchar *host;
+
+    if (!uri)
+        return NULL;
+
+    host = g_strdup(g_uri_get_host(uri));
+    g_uri_unref(uri);
+
+    return host;
+}
+
+/*
+ * backend_from_object:
+ * @name: The backend name
+ * @obj: (nullable): The backend object of config.json
+ * @api_keys: Table of authinfo machine names to API keys
+ *
+ * Returns: (transfer full) (nullable): The backend, or NULL if it has no
+ *          usable URL
+ */
+static MBackend *
+backend_from_object(const gchar *name, JsonObject *obj, GHashTable *api_keys)
+{
+    gboolean is_default = g_strcmp0(name, M_BACKEND_DEFAULT) == 0;
+    const gchar *url = NULL;
+    const gchar *auth = NULL;
+    const gchar *model = NULL;
+    const gchar *model_prefix = is_default ? M_BACKEND_DEFAULT_MODEL_PREFIX : NULL;
+    gchar *host = NULL;
+    MBackend *backend;
+
+    if (obj)
+    {
+        url = json_object_get_string_member_with_default(obj, "url", NULL);
+        auth = json_object_get_string_member_with_default(obj, "auth", NULL);
+        model = json_object_get_string_member_with_default(obj, "model", NULL);
+        model_prefix = json_object_get_string_member_with_default(obj, "models", model_prefix);
+    }
+
+    if (!url && is_default)
+        url = M_BACKEND_DEFAULT_URL;
+
+    if (!url || !g_uri_is_valid(url, G_URI_FLAGS_NONE, NULL))
+    {
+        g_warning("Ignoring backend '%s' without a valid \"url\"", name);
+        return NULL;
+    }
+
+    if (!auth)
+        auth = host = get_url_host(url);
+
+    backend = m_backend_new(name, url,
+                            auth ? g_hash_table_lookup(api_keys, auth) : NULL,
+                            model, model_prefix);
+    g_debug("Backend '%s': %s (%s)", name, backend->base_url,
+            backend->api_key ? "with API key" : "without API key");
+    g_free(host);
+
+    return backend;
+}
+
+/*
+ * m_backends_parse:
+ */
+GHashTable *
+m_backends_parse(JsonObject *section, GHashTable *api_keys)
+{
+    GHashTable *backends;
+    MBackend *backend;
+
+    g_return_val_if_fail(api_keys != NULL, NULL);
+
+    backends = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                     (GDestroyNotify)m_backend_unref);
+
+    if (section)
+    {
+        GList *names = json_object_get_members(section);
+
+        for (GList *l = names; l != NULL; l = l->next)
+        {
+            JsonNode *node = json_object_get_member(section, l->data);
+
+            if (!JSON_NODE_HOLDS_OBJECT(node))
+            {
+                g_warning("Ignoring backend '%s' which is not an object", (const gchar *)l->data);
+                continue;
+            }
+
+            backend = backend_from_object(l->data, json_node_get_object(node), api_keys);
+            if (backend)
+                g_hash_table_replace(backends, backend->name, backend);
+        }
+
+        g_list_free(names);
+    }
+
+    if (!g_hash_table_contains(backends, M_BACKEND_DEFAULT))
+    {
+        backend = backend_from_object(M_BACKEND_DEFAULT, NULL, api_keys);
+        g_hash_table_replace(backends, backend->name, backend);
+    }
+
+    return backends;
+}
+
+/*
+ * m_backends_lookup:
+ */
+MBackend *
+m_backends_lookup(GHashTable *backends, const gchar *name)
+{
+    MBackend *backend = NULL;
+
+    g_return_val_if_fail(backends != NULL, NULL);
+
+    if (name)
+    {
+        backend = g_hash_table_lookup(backends, name);
+        if (!backend)
+            g_warning("Unknown backend '%s', using '%s'", name, M_BACKEND_DEFAULT);
+    }
+
+    return backend ? backend : g_hash_table_lookup(backends, M_BACKEND_DEFAULT);
+}
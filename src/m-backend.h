@@ -0,0 +1,158 @@
+/*
+ * m-backend.h - API backends for AI Proofread Plugin
+ *
+ * This module describes the OpenAI compatible servers requests go to:
+ * - The OpenAI API as the default "openai" backend
+ * - Named backends from config.json, e.g. a llama.cpp or Ollama server
+ * - API key lookup in ~/.authinfo by host
+ *
+ * Backends are configured by the "backends" object in config.json:
+ *
+ *   "backends": { "local": { "url": "http://192.168.1.20:11434/v1",
+ *                            "model": "llama3.1:8b" } }
+ *
+ * and chosen per prompt with "backend": "local".
+ */
+
+#ifndef M_BACKEND_H
+#define M_BACKEND_H
+
+#include <glib.h>
+#include <json-glib/json-glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * M_BACKEND_DEFAULT:
+ *
+ * Name of the backend used by prompts which do not choose one.
+ */
+#define M_BACKEND_DEFAULT "openai"
+
+/**
+ * M_BACKEND_DEFAULT_URL:
+ *
+ * Base URL of the default backend unless config.json overrides it.
+ */
+#define M_BACKEND_DEFAULT_URL "https://api.openai.com/v1"
+
+/**
+ * MBackend:
+ * @name: The backend name
+ * @base_url: The API base URL, without a trailing slash
+ * @api_key: (nullable): The API key, NULL to send no Authorization header
+ * @model: (nullable): The model to use instead of the selected one
+ * @model_prefix: (nullable): Only models starting with this are listed
+ *
+ * Immutable, refcounted description of an OpenAI compatible server.
+ */
+typedef struct _MBackend MBackend;
+
+struct _MBackend
+{
+    gchar *name;
+    gchar *base_url;
+    gchar *api_key;
+    gchar *model;
+    gchar *model_prefix;
+};
+
+/**
+ * m_backend_new:
+ * @name: The backend name
+ * @base_url: The API base URL; a trailing slash is removed
+ * @api_key: (nullable): The API key
+ * @model: (nullable): The model to use instead of the selected one
+ * @model_prefix: (nullable): Prefix of the models to list
+ *
+ * Returns: (transfer full): A new backend, free with m_backend_unref()
+ */
+MBackend *m_backend_new(const gchar *name,
+                        const gchar *base_url,
+                        const gchar *api_key,
+                        const gchar *model,
+                        const gchar *model_prefix);
+
+/**
+ * m_backend_ref:
+ * @backend: A backend
+ *
+ * Returns: (transfer full): @backend with an additional reference
+ */
+MBackend *m_backend_ref(MBackend *backend);
+
+/**
+ * m_backend_unref:
+ * @backend: (nullable): A backend
+ *
+ * Release a reference to a backend.
+ */
+void m_backend_unref(MBackend *backend);
+
+/**
+ * m_backend_build_url:
+ * @backend: A backend
+ * @path: The endpoint path, e.g. "/chat/completions"
+ *
+ * Returns: (transfer full): The URL of @path on @backend
+ */
+gchar *m_backend_build_url(const MBackend *backend, const gchar *path);
+
+/**
+ * m_backend_get_model:
+ * @backend: A backend
+ * @selected_model: (nullable): The model selected in the composer
+ *
+ * Returns: (transfer none) (nullable): The model of @backend if it sets
+ *          one, otherwise @selected_model
+ */
+const gchar *m_backend_get_model(const MBackend *backend, const gchar *selected_model);
+
+/**
+ * m_backend_is_usable:
+ * @backend: A backend
+ *
+ * Servers other than the OpenAI API are assumed to need no API key.
+ *
+ * Returns: FALSE if @backend is the OpenAI API and no key was found
+ */
+gboolean m_backend_is_usable(const MBackend *backend);
+
+/**
+ * m_backend_accepts_model:
+ * @backend: A backend
+ * @model_id: A model ID reported by the server
+ *
+ * Returns: TRUE if @model_id should be offered in the Model menu
+ */
+gboolean m_backend_accepts_model(const MBackend *backend, const gchar *model_id);
+
+/**
+ * m_backends_parse:
+ * @section: (nullable): The "backends" object of config.json
+ * @api_keys: Table of authinfo machine names to API keys
+ *
+ * Build the backends of a configuration. Every entry may set "url",
+ * "auth" (the authinfo machine to take the key from, by default the
+ * host of "url"), "model" and "models" (a model ID prefix, "gpt-" for
+ * the default backend). The default backend is always present and may
+ * be overridden by an "openai" entry.
+ *
+ * Returns: (transfer full): Table of backend names to #MBackend
+ */
+GHashTable *m_backends_parse(JsonObject *section, GHashTable *api_keys);
+
+/**
+ * m_backends_lookup:
+ * @backends: Table returned by m_backends_parse()
+ * @name: (nullable): The backend name, NULL for the default backend
+ *
+ * Unknown names fall back to the default backend with a warning.
+ *
+ * Returns: (transfer none): The backend
+ */
+MBackend *m_backends_lookup(GHashTable *backends, const gchar *name);
+
+G_END_DECLS
+
+#endif /* M_BACKEND_H */
@@ -0,0 +1,930 @@
+/*
+ * m-batch.c - Bulk proofreading for AI Proofread Plugin
+ *
+ * Implements collecting the messages of a folder, the saved job files
+ * and writing the corrected bodies back on top of m_chatgpt_batch_submit()
+ * and m_chatgpt_batch_poll().
+ */
+
+#include <string.h>
+#include <glib/gi18n-lib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
+
+#include <evolution/e-util/e-util.h>
+#include <libemail-engine/libemail-engine.h>
+#include <mail/e-mail-backend.h>
+#include <shell/e-shell.h>
+
+#include "m-batch.h"
+#include "m-chatgpt-api.h"
+#include "m-config.h"
+#include "m-edits.h"
+#include "m-extract.h"
+
+/* Jobs still unfinished this long after they were created have expired
+ * on the server and are given up */
+#define BATCH_MAX_AGE_S (2 * 24 * 60 * 60)
+
+/* One message of a job */
+typedef struct
+{
+    gchar *uid;          /* Of the message in the folder, also the custom ID */
+    gchar *checksum;     /* Of the body that was read */
+    gsize text_length;   /* Length of the start of the body that was sent */
+} BatchItem;
+
+/* A submitted job, saved as <batch id>.json in the batches directory */
+typedef struct
+{
+    gchar *batch_id;
+    gchar *backend;      /* Backend name */
+    gchar *prompt_id;
+    gchar *model;
+    MBatchFolder folder;
+    gint64 created;      /* Wall-clock time in seconds */
+    GPtrArray *items;    /* BatchItem */
+    guint n_ignored;     /* Messages that could not be submitted */
+
+    /* Outcome of the write-back */
+    guint n_saved;
+    guint n_unchanged;
+    guint n_skipped;
+    guint n_failed;
+} BatchJob;
+
+/* What a worker thread needs to submit or finish a job */
+typedef struct
+{
+    BatchJob *job;
+    CamelFolder *folder;
+    JsonArray *prompts;
+    MBackend *backend;
+    gboolean over;       /* Whether the polled job is over */
+} BatchTaskData;
+
+static gboolean batch_resumed = FALSE;
+
+static void batch_schedule_poll(BatchJob *job);
+
+static void
+batch_item_free(BatchItem *item)
+{
+    g_free(item->uid);
+    g_free(item->checksum);
+    g_free(item);
+}
+
+static BatchJob *
+batch_job_new(void)
+{
+    BatchJob *job = g_new0(BatchJob, 1);
+
+    job->items = g_ptr_array_new_with_free_func((GDestroyNotify)batch_item_free);
+    return job;
+}
+
+static void
+batch_job_free(BatchJob *job)
+{
+    if (!job)
+        return;
+
+    g_free(job->batch_id);
+    g_free(job->backend);
+    g_free(job->prompt_id);
+    g_free(job->model);
+    g_ptr_array_unref(job->items);
+    g_free(job);
+}
+
+static void
+batch_task_data_free(BatchTaskData *data)
+{
+    batch_job_free(data->job);
+    g_clear_object(&data->folder);
+    if (data->prompts)
+        json_array_unref(data->prompts);
+    if (data->backend)
+        m_backend_unref(data->backend);
+    g_free(data);
+}
+
+static const gchar *
+batch_folder_to_string(MBatchFolder folder)
+{
+    return folder == M_BATCH_FOLDER_OUTBOX ? "outbox" : "drafts";
+}
+
+static const gchar *
+batch_folder_display_name(MBatchFolder folder)
+{
+    return folder == M_BATCH_FOLDER_OUTBOX ? _("Outbox") : _("Drafts");
+}
+
+/*
+ * batch_get_folder:
+ *
+ * Returns: (transfer full) (nullable): The local folder, or NULL if the
+ *          mail backend is not available
+ */
+static CamelFolder *
+batch_get_folder(MBatchFolder folder)
+{
+    EShell *shell = e_shell_get_default();
+    EShellBackend *shell_backend;
+    EMailSession *session;
+    CamelFolder *camel_folder;
+
+    shell_backend = shell ? e_shell_get_backend_by_name(shell, "mail") : NULL;
+    if (!shell_backend || !E_IS_MAIL_BACKEND(shell_backend))
+        return NULL;
+
+    session = e_mail_backend_get_session(E_MAIL_BACKEND(shell_backend));
+    camel_folder = e_mail_session_get_local_folder(
+        session, folder == M_BATCH_FOLDER_OUTBOX ? E_MAIL_LOCAL_FOLDER_OUTBOX : E_MAIL_LOCAL_FOLDER_DRAFTS);
+
+    return camel_folder ? g_object_ref(camel_folder) : NULL;
+}
+
+/*
+ * batch_alert:
+ *
+ * Show an alert in the active window. A job can finish long after the
+ * composer that started it was closed.
+ */
+static void
+batch_alert(const gchar *tag, const gchar *primary, const gchar *secondary)
+{
+    EShell *shell = e_shell_get_default();
+    GtkWindow *window = shell ? e_shell_get_active_window(shell) : NULL;
+
+    if (window && E_IS_ALERT_SINK(window))
+        e_alert_submit(E_ALERT_SINK(window), tag, primary, secondary ? secondary : "", NULL);
+    else
+        g_message("%s %s", primary, secondary ? secondary : "");
+}
+
+static gchar *
+batch_dir(void)
+{
+    return g_build_filename(m_config_get_user_config_dir(), "ai-proofread", "batches", NULL);
+}
+
+static gchar *
+batch_job_path(const BatchJob *job)
+{
+    gchar *dir = batch_dir();
+    gchar *name = g_strconcat(job->batch_id, ".json", NULL);
+    gchar *path = g_build_filename(dir, name, NULL);
+
+    g_free(name);
+    g_free(dir);
+    return path;
+}
+
+/*
+ * batch_job_save:
+ *
+ * Save @job so that polling survives a restart of Evolution.
+ */
+static gboolean
+batch_job_save(const BatchJob *job, GError **error)
+{
+    JsonBuilder *builder = json_builder_new();
+    JsonGenerator *generator = json_generator_new();
+    JsonNode *root;
+    gchar *dir = batch_dir();
+    gchar *path = batch_job_path(job);
+    gboolean saved;
+
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "batch_id");
+    json_builder_add_string_value(builder, job->batch_id);
+    json_builder_set_member_name(builder, "backend");
+    json_builder_add_string_value(builder, job->backend);
+    json_builder_set_member_name(builder, "prompt");
+    json_builder_add_string_value(builder, job->prompt_id);
+    json_builder_set_member_name(builder, "model");
+    json_builder_add_string_value(builder, job->model);
+    json_builder_set_member_name(builder, "folder");
+    json_builder_add_string_value(builder, batch_folder_to_string(job->folder));
+    json_builder_set_member_name(builder, "created");
+    json_builder_add_int_value(builder, job->created);
+    json_builder_set_member_name(builder, "items");
+    json_builder_begin_array(builder);
+    for (guint i = 0; i < job->items->len; i++)
+    {
+        BatchItem *item = g_ptr_array_index(job->items, i);
+
+        json_builder_begin_object(builder);
+        json_builder_set_member_name(builder, "uid");
+        json_builder_add_string_value(builder, item->uid);
+        json_builder_set_member_name(builder, "checksum");
+        json_builder_add_string_value(builder, item->checksum);
+        json_builder_set_member_name(builder, "text_length");
+        json_builder_add_int_value(builder, item->text_length);
+        json_builder_end_object(builder);
+    }
+    json_builder_end_array(builder);
+    json_builder_end_object(builder);
+
+    root = json_builder_get_root(builder);
+    json_generator_set_root(generator, root);
+
+    g_mkdir_with_parents(dir, 0700);
+    saved = json_generator_to_file(generator, path, error);
+
+    json_node_unref(root);
+    g_object_unref(generator);
+    g_object_unref(builder);
+    g_free(path);
+    g_free(dir);
+
+    return saved;
+}
+
+/*
+ * batch_job_load:
+ *
+ * Returns: (transfer full) (nullable): The job saved in @path, or NULL
+ *          if it cannot be read
+ */
+static BatchJob *
+batch_job_load(const gchar *path)
+{
+    JsonParser *parser = json_parser_new();
+    GError *error = NULL;
+    JsonObject *obj;
+    JsonArray *items;
+    BatchJob *job = NULL;
+
+    if (!json_parser_load_from_file(parser, path, &error))
+    {
+        g_warning("Failed to read batch job %s: %s", path, error->message);
+        g_error_free(error);
+        g_object_unref(parser);
+        return NULL;
+    }
+
+    if (!JSON_NODE_HOLDS_OBJECT(json_parser_get_root(parser)))
+    {
+        g_object_unref(parser);
+        return NULL;
+    }
+
+    obj = json_node_get_object(json_parser_get_root(parser));
+    if (json_object_get_string_member_with_default(obj, "batch_id", NULL) &&
+        json_object_has_member(obj, "items") &&
+        JSON_NODE_HOLDS_ARRAY(json_object_get_member(obj, "items")))
+    {
+        job = batch_job_new();
+        job->batch_id = g_strdup(json_object_get_string_member(obj, "batch_id"));
+        job->backend = g_strdup(json_object_get_string_member_with_default(obj, "backend", NULL));
+        job->prompt_id = g_strdup(json_object_get_string_member_with_default(obj, "prompt", NULL));
+        job->model = g_strdup(json_object_get_string_member_with_default(obj, "model", NULL));
+        job->folder = g_strcmp0(json_object_get_string_member_with_default(obj, "folder", NULL), "outbox") == 0
+                          ? M_BATCH_FOLDER_OUTBOX
+                          : M_BATCH_FOLDER_DRAFTS;
+        job->created = json_object_get_int_member_with_default(obj, "created", 0);
+
+        items = json_object_get_array_member(obj, "items");
+        for (guint i = 0; i < json_array_get_length(items); i++)
+        {
+            JsonObject *item_obj = json_array_get_object_element(items, i);
+            BatchItem *item;
+
+            if (!item_obj || !json_object_get_string_member_with_default(item_obj, "uid", NULL))
+                continue;
+
+            item = g_new0(BatchItem, 1);
+            item->uid = g_strdup(json_object_get_string_member(item_obj, "uid"));
+            item->checksum = g_strdup(json_object_get_string_member_with_default(item_obj, "checksum", NULL));
+            item->text_length = MAX(json_object_get_int_member_with_default(item_obj, "text_length", 0), 0);
+            g_ptr_array_add(job->items, item);
+        }
+    }
+
+    g_object_unref(parser);
+    return job;
+}
+
+static void
+batch_job_remove(const BatchJob *job)
+{
+    gchar *path = batch_job_path(job);
+
+    g_unlink(path);
+    g_free(path);
+}
+
+/*
+ * batch_find_text_part:
+ * @part: A message or one of its parts
+ *
+ * Returns: (transfer none) (nullable): The part holding the text of the
+ *          message, or NULL if it has none that can be rewritten. An
+ *          HTML body is not (its plain text alternative would go out of
+ *          sync), the first part of a message with attachments is.
+ */
+static CamelMimePart *
+batch_find_text_part(CamelMimePart *part)
+{
+    CamelContentType *type = camel_mime_part_get_content_type(part);
+    CamelDataWrapper *content = camel_medium_get_content(CAMEL_MEDIUM(part));
+
+    if (camel_content_type_is(type, "text", "plain"))
+        return part;
+
+    if (CAMEL_IS_MULTIPART(content) && camel_content_type_is(type, "multipart", "mixed") &&
+        camel_multipart_get_number(CAMEL_MULTIPART(content)) > 0)
+        return batch_find_text_part(camel_multipart_get_part(CAMEL_MULTIPART(content), 0));
+
+    return NULL;
+}
+
+/*
+ * batch_part_get_text:
+ *
+ * Returns: (transfer full) (nullable): The decoded text of @part in UTF-8
+ */
+static gchar *
+batch_part_get_text(CamelMimePart *part, GCancellable *cancellable, GError **error)
+{
+    CamelDataWrapper *content = camel_medium_get_content(CAMEL_MEDIUM(part));
+    const gchar *charset = camel_content_type_param(camel_mime_part_get_content_type(part), "charset");
+    CamelStream *stream;
+    CamelStream *filtered;
+    gchar *text = NULL;
+
+    if (!content)
+        return NULL;
+
+    stream = camel_stream_mem_new();
+    filtered = camel_stream_filter_new(stream);
+    if (charset && g_ascii_strcasecmp(charset, "utf-8") != 0 && g_ascii_strcasecmp(charset, "us-ascii") != 0)
+    {
+        CamelMimeFilter *filter = camel_mime_filter_charset_new(charset, "UTF-8");
+
+        if (filter)
+        {
+            camel_stream_filter_add(CAMEL_STREAM_FILTER(filtered), filter);
+            g_object_unref(filter);
+        }
+    }
+
+    if (camel_data_wrapper_decode_to_stream_sync(content, filtered, cancellable, error) >= 0 &&
+        camel_stream_flush(filtered, cancellable, error) == 0)
+    {
+        GByteArray *bytes = camel_stream_mem_get_byte_array(CAMEL_STREAM_MEM(stream));
+
+        text = g_utf8_make_valid((const gchar *)bytes->data, bytes->len);
+    }
+
+    g_object_unref(filtered);
+    g_object_unref(stream);
+
+    return text;
+}
+
+/*
+ * batch_prepare:
+ * @prompt: (nullable): The prompt object
+ * @settings: The prompt settings
+ * @body: The text of a message
+ * @text_length: (out): Length of the start of @body that is corrected
+ *
+ * Apply the "quoted" and "signature" settings of the prompt like the
+ * composer does. The corrected text replaces the start of the body, so a
+ * message is skipped if quoted history sits between parts of its text.
+ *
+ * Returns: (transfer full) (nullable): The content to send, or NULL to
+ *          skip the message
+ */
+static gchar *
+batch_prepare(JsonObject *prompt,
+              const MChatGPTPrompt *settings,
+              const gchar *body,
+              gsize *text_length)
+{
+    MExtraction *extraction;
+    gchar *content = NULL;
+
+    extraction = m_extract_content(
+        body, NULL,
+        m_extract_mode_from_string(
+            prompt ? json_object_get_string_member_with_default(prompt, "quoted", NULL) : NULL,
+            M_EXTRACT_KEEP),
+        m_extract_mode_from_string(
+            prompt ? json_object_get_string_member_with_default(prompt, "signature", NULL) : NULL,
+            M_EXTRACT_KEEP));
+
+    if (extraction && *extraction->text && extraction->tail)
+    {
+        *text_length = strlen(extraction->text);
+
+        if (extraction->context && settings->max_input_tokens > 0)
+        {
+            guint text_tokens = m_chatgpt_prompt_estimate_tokens(settings, extraction->text);
+
+            m_extraction_trim_context(extraction, settings->max_input_tokens > text_tokens
+                                                      ? settings->max_input_tokens - text_tokens
+                                                      : 0);
+        }
+        content = extraction->context ? m_extraction_compose(extraction) : g_strdup(extraction->text);
+    }
+
+    m_extraction_free(extraction);
+    return content;
+}
+
+/*
+ * batch_submit_thread:
+ *
+ * Read the messages of the folder, submit them and save the job.
+ */
+static void
+batch_submit_thread(GTask *task,
+                    gpointer source_object,
+                    gpointer task_data,
+                    GCancellable *cancellable)
+{
+    BatchTaskData *data = task_data;
+    BatchJob *job = data->job;
+    JsonObject *prompt = m_chatgpt_find_prompt(data->prompts, job->prompt_id);
+    MChatGPTPrompt settings;
+    GPtrArray *uids;
+    GPtrArray *ids = g_ptr_array_new();
+    GPtrArray *contents = g_ptr_array_new_with_free_func(g_free);
+    GError *error = NULL;
+
+    m_chatgpt_prompt_lookup(data->prompts, job->prompt_id, &settings);
+
+    uids = camel_folder_get_uids(data->folder);
+    for (guint i = 0; uids && i < uids->len; i++)
+    {
+        const gchar *uid = g_ptr_array_index(uids, i);
+        CamelMessageInfo *info = camel_folder_get_message_info(data->folder, uid);
+        CamelMimeMessage *message = NULL;
+        CamelMimePart *part = NULL;
+        gchar *body = NULL;
+        gchar *content = NULL;
+        gsize text_length = 0;
+
+        if (info && !(camel_message_info_get_flags(info) & CAMEL_MESSAGE_DELETED))
+            message = camel_folder_get_message_sync(data->folder, uid, cancellable, NULL);
+        if (message)
+            part = batch_find_text_part(CAMEL_MIME_PART(message));
+        if (part)
+            body = batch_part_get_text(part, cancellable, NULL);
+        if (body)
+            content = batch_prepare(prompt, &settings, body, &text_length);
+
+        if (content)
+        {
+            BatchItem *item = g_new0(BatchItem, 1);
+
+            item->uid = g_strdup(uid);
+            item->checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA256, body, -1);
+            item->text_length = text_length;
+            g_ptr_array_add(job->items, item);
+            g_ptr_array_add(ids, item->uid);
+            g_ptr_array_add(contents, g_steal_pointer(&content));
+        }
+        else if (info && !(camel_message_info_get_flags(info) & CAMEL_MESSAGE_DELETED))
+        {
+            job->n_ignored++;
+        }
+
+        g_free(body);
+        g_clear_object(&message);
+        g_clear_object(&info);
+    }
+    if (uids)
+        camel_folder_free_uids(data->folder, uids);
+
+    if (contents->len == 0)
+    {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                                _("The %s folder has no plain text messages to proofread."),
+                                batch_folder_display_name(job->folder));
+    }
+    else
+    {
+        g_debug("Submitting %u messages of %s, skipping %u", contents->len,
+                batch_folder_to_string(job->folder), job->n_ignored);
+
+        job->batch_id = m_chatgpt_batch_submit(ids, contents, job->prompt_id, data->prompts,
+                                               data->backend, job->model, cancellable, &error);
+        if (job->batch_id && !batch_job_save(job, &error))
+        {
+            /* The job runs anyway, it just cannot be resumed after a restart */
+            g_warning("Failed to save batch job %s: %s", job->batch_id, error->message);
+            g_clear_error(&error);
+        }
+
+        if (job->batch_id)
+            g_task_return_boolean(task, TRUE);
+        else
+            g_task_return_error(task, error);
+    }
+
+    g_ptr_array_unref(contents);
+    g_ptr_array_unref(ids);
+}
+
+static void
+batch_submit_done_cb(GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+    BatchTaskData *data = g_task_get_task_data(G_TASK(result));
+    GError *error = NULL;
+    gchar *primary;
+    gchar *secondary;
+
+    if (!g_task_propagate_boolean(G_TASK(result), &error))
+    {
+        primary = g_strdup_printf(_("Could not proofread the %s folder"),
+                                  batch_folder_display_name(data->job->folder));
+        batch_alert("system:simple-error", primary, error->message);
+        g_free(primary);
+        g_error_free(error);
+        return;
+    }
+
+    primary = g_strdup_printf(ngettext("Proofreading %u message of the %s folder in the background",
+                                       "Proofreading %u messages of the %s folder in the background",
+                                       data->job->items->len),
+                              data->job->items->len, batch_folder_display_name(data->job->folder));
+    if (data->job->n_ignored > 0)
+        secondary = g_strdup_printf(
+            ngettext("%u message with an HTML body or text between quotes was skipped. "
+                     "The corrected messages are saved to the folder when the batch job finishes, usually within a few hours.",
+                     "%u messages with an HTML body or text between quotes were skipped. "
+                     "The corrected messages are saved to the folder when the batch job finishes, usually within a few hours.",
+                     data->job->n_ignored),
+            data->job->n_ignored);
+    else
+        secondary = g_strdup(_("The corrected messages are saved to the folder when the batch job "
+                               "finishes, usually within a few hours."));
+    batch_alert("system:simple-info", primary, secondary);
+    g_free(secondary);
+    g_free(primary);
+
+    /* The job now belongs to the poller */
+    batch_schedule_poll(g_steal_pointer(&data->job));
+}
+
+/*
+ * batch_write_back:
+ * @results: Custom IDs to the responses of the job
+ *
+ * Save each corrected body as a new revision of its message. Messages
+ * which were changed, sent or deleted since the job was submitted are
+ * left alone.
+ */
+static void
+batch_write_back(BatchTaskData *data, GHashTable *results, GCancellable *cancellable)
+{
+    BatchJob *job = data->job;
+    gboolean edits = m_chatgpt_prompt_wants_edits(data->prompts, job->prompt_id);
+
+    for (guint i = 0; i < job->items->len; i++)
+    {
+        BatchItem *item = g_ptr_array_index(job->items, i);
+        const gchar *response = g_hash_table_lookup(results, item->uid);
+        CamelMessageInfo *info;
+        CamelMimeMessage *message = NULL;
+        CamelMimePart *part = NULL;
+        gchar *body = NULL;
+        gchar *checksum = NULL;
+        gchar *corrected = NULL;
+        GError *error = NULL;
+
+        if (!response)
+        {
+            job->n_failed++;
+            continue;
+        }
+
+        info = camel_folder_get_message_info(data->folder, item->uid);
+        if (info && !(camel_message_info_get_flags(info) & CAMEL_MESSAGE_DELETED))
+            message = camel_folder_get_message_sync(data->folder, item->uid, cancellable, NULL);
+        if (message)
+            part = batch_find_text_part(CAMEL_MIME_PART(message));
+        if (part)
+            body = batch_part_get_text(part, cancellable, NULL);
+        if (body)
+            checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA256, body, -1);
+
+        if (!checksum || g_strcmp0(checksum, item->checksum) != 0 || item->text_length > strlen(body))
+        {
+            g_debug("Message %s changed since it was submitted, not saving its correction", item->uid);
+            job->n_skipped++;
+        }
+        else
+        {
+            gchar *text = g_strndup(body, item->text_length);
+
+            if (edits)
+                corrected = m_edits_apply(text, response, &error);
+            else
+                corrected = g_strdup(response);
+
+            if (corrected)
+            {
+                /* Quoted history or a signature that was not sent stays */
+                gchar *full = g_strconcat(corrected, body + item->text_length, NULL);
+
+                g_free(corrected);
+                corrected = full;
+            }
+            else
+            {
+                g_debug("Could not apply the correction of message %s: %s", item->uid,
+                        error ? error->message : "no text");
+                g_clear_error(&error);
+                job->n_failed++;
+            }
+            g_free(text);
+        }
+
+        if (corrected && g_strcmp0(corrected, body) == 0)
+        {
+            job->n_unchanged++;
+        }
+        else if (corrected)
+        {
+            CamelMessageInfo *revision = camel_message_info_clone(info, NULL);
+
+            camel_mime_part_set_content(part, corrected, strlen(corrected), "text/plain; charset=UTF-8");
+            camel_mime_part_set_encoding(part, CAMEL_TRANSFER_ENCODING_QUOTEDPRINTABLE);
+
+            /* Like saving a draft: append the new revision, then delete the old one */
+            if (camel_folder_append_message_sync(data->folder, message, revision, NULL, cancellable, &error))
+            {
+                camel_message_info_set_flags(info, CAMEL_MESSAGE_DELETED | CAMEL_MESSAGE_SEEN,
+                                             CAMEL_MESSAGE_DELETED | CAMEL_MESSAGE_SEEN);
+                job->n_saved++;
+            }
+            else
+            {
+                g_warning("Failed to save the corrected message %s: %s", item->uid, error->message);
+                g_clear_error(&error);
+                job->n_failed++;
+            }
+            g_clear_object(&revision);
+        }
+
+        g_free(corrected);
+        g_free(checksum);
+        g_free(body);
+        g_clear_object(&message);
+        g_clear_object(&info);
+    }
+
+    camel_folder_synchronize_sync(data->folder, FALSE, cancellable, NULL);
+}
+
+/*
+ * batch_poll_thread:
+ *
+ * Check on the job and write the results back once it is done. Returns
+ * TRUE once the job is over.
+ */
+static void
+batch_poll_thread(GTask *task,
+                  gpointer source_object,
+                  gpointer task_data,
+                  GCancellable *cancellable)
+{
+    BatchTaskData *data = task_data;
+    GHashTable *results = NULL;
+    GError *error = NULL;
+
+    data->over = m_chatgpt_batch_poll(data->backend, data->job->batch_id, &results, cancellable, &error);
+    if (results)
+    {
+        batch_write_back(data, results, cancellable);
+        g_hash_table_unref(results);
+    }
+
+    if (error)
+        g_task_return_error(task, error);
+    else
+        g_task_return_boolean(task, TRUE);
+}
+
+static void
+batch_poll_done_cb(GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+    BatchTaskData *data = g_task_get_task_data(G_TASK(result));
+    BatchJob *job = data->job;
+    GError *error = NULL;
+    gchar *primary;
+    gchar *secondary;
+
+    g_task_propagate_boolean(G_TASK(result), &error);
+
+    /* Still running, or checking failed: the server, the key or the
+     * network may be back on the next try, until the job is long expired */
+    if (!data->over && (!error || g_get_real_time() / G_USEC_PER_SEC - job->created < BATCH_MAX_AGE_S))
+    {
+        if (error)
+            g_debug("Could not check on batch %s: %s", job->batch_id, error->message);
+        g_clear_error(&error);
+        batch_schedule_poll(g_steal_pointer(&data->job));
+        return;
+    }
+
+    batch_job_remove(job);
+
+    if (error)
+    {
+        primary = g_strdup_printf(_("Proofreading the %s folder failed"),
+                                  batch_folder_display_name(job->folder));
+        batch_alert("system:simple-error", primary, error->message);
+        g_free(primary);
+        g_error_free(error);
+        return;
+    }
+
+    primary = g_strdup_printf(ngettext("Proofread %u message of the %s folder",
+                                       "Proofread %u messages of the %s folder",
+                                       job->items->len),
+                              job->items->len, batch_folder_display_name(job->folder));
+    secondary = g_strdup_printf(_("%u corrected and saved as new revisions, %u without changes, "
+                                  "%u changed in the meantime, %u failed."),
+                                job->n_saved, job->n_unchanged, job->n_skipped, job->n_failed);
+    batch_alert("system:simple-info", primary, secondary);
+    g_free(secondary);
+    g_free(primary);
+}
+
+/*
+ * batch_poll_cb:
+ *
+ * The poll interval passed: check on the job in a worker thread.
+ */
+static gboolean
+batch_poll_cb(gpointer user_data)
+{
+    BatchJob *job = user_data;
+    BatchTaskData *data;
+    MConfig *config;
+    MBackend *backend;
+    CamelFolder *folder;
+    GTask *task;
+
+    config = m_config_get();
+    backend = m_config_get_backend(config, job->backend);
+    folder = batch_get_folder(job->folder);
+    if (!m_backend_is_usable(backend) || !folder)
+    {
+        /* Try again once the key or the mail backend is there */
+        g_clear_object(&folder);
+        m_config_unref(config);
+        batch_schedule_poll(job);
+        return G_SOURCE_REMOVE;
+    }
+
+    data = g_new0(BatchTaskData, 1);
+    data->job = job;
+    data->folder = folder;
+    data->prompts = json_array_ref(config->prompts);
+    data->backend = m_backend_ref(backend);
+    m_config_unref(config);
+
+    task = g_task_new(NULL, NULL, batch_poll_done_cb, NULL);
+    g_task_set_task_data(task, data, (GDestroyNotify)batch_task_data_free);
+    g_task_run_in_thread(task, batch_poll_thread);
+    g_object_unref(task);
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * batch_schedule_poll:
+ * @job: (transfer full): The job to poll
+ */
+static void
+batch_schedule_poll(BatchJob *job)
+{
+    MConfig *config = m_config_get();
+    JsonObject *section = m_config_get_section(config, "batch");
+    gint64 poll_s = M_BATCH_DEFAULT_POLL_S;
+
+    if (section)
+        poll_s = json_object_get_int_member_with_default(section, "poll_s", M_BATCH_DEFAULT_POLL_S);
+    m_config_unref(config);
+
+    g_timeout_add_seconds(CLAMP(poll_s, 1, G_MAXUINT), batch_poll_cb, job);
+}
+
+/*
+ * m_batch_start:
+ */
+void
+m_batch_start(MBatchFolder folder, MUIActionContext *ui_context)
+{
+    BatchTaskData *data;
+    JsonArray *prompts;
+    JsonObject *section;
+    JsonObject *prompt;
+    MChatGPTPrompt settings;
+    MConfig *config;
+    MBackend *backend;
+    const gchar *prompt_id = NULL;
+    GTask *task;
+
+    g_return_if_fail(ui_context != NULL);
+
+    prompts = ui_context->prompts;
+    if (!prompts || json_array_get_length(prompts) == 0)
+        return;
+
+    config = m_config_get();
+    section = m_config_get_section(config, "batch");
+    if (section)
+        prompt_id = json_object_get_string_member_with_default(section, "prompt", NULL);
+    if (!prompt_id)
+        prompt_id = json_object_get_string_member(json_array_get_object_element(prompts, 0), "name");
+
+    prompt = m_chatgpt_find_prompt(prompts, prompt_id);
+    backend = m_backends_lookup(
+        ui_context->backends,
+        prompt ? json_object_get_string_member_with_default(prompt, "backend", NULL) : NULL);
+
+    if (!prompt || !m_backend_is_usable(backend))
+    {
+        batch_alert("system:simple-error", _("Could not start the batch job"),
+                    prompt ? _("The prompt's backend has no API key.") : _("The batch prompt was not found."));
+        m_config_unref(config);
+        return;
+    }
+
+    data = g_new0(BatchTaskData, 1);
+    data->job = batch_job_new();
+    data->job->backend = g_strdup(backend->name);
+    data->job->prompt_id = g_strdup(prompt_id);
+    m_chatgpt_prompt_lookup(prompts, prompt_id, &settings);
+    data->job->model = g_strdup(m_chatgpt_prompt_get_model(&settings, backend, ui_context->model));
+    data->job->folder = folder;
+    data->job->created = g_get_real_time() / G_USEC_PER_SEC;
+    data->folder = batch_get_folder(folder);
+    data->prompts = json_array_ref(prompts);
+    data->backend = m_backend_ref(backend);
+    m_config_unref(config);
+
+    if (!data->folder)
+    {
+        batch_alert("system:simple-error", _("Could not start the batch job"),
+                    _("The mail folders are not available."));
+        batch_task_data_free(data);
+        return;
+    }
+
+    task = g_task_new(NULL, NULL, batch_submit_done_cb, NULL);
+    g_task_set_task_data(task, data, (GDestroyNotify)batch_task_data_free);
+    g_task_run_in_thread(task, batch_submit_thread);
+    g_object_unref(task);
+}
+
+/*
+ * m_batch_resume:
+ */
+void
+m_batch_resume(void)
+{
+    gchar *dir;
+    GDir *handle;
+    const gchar *name;
+
+    if (batch_resumed)
+        return;
+    batch_resumed = TRUE;
+
+    dir = batch_dir();
+    handle = g_dir_open(dir, 0, NULL);
+    while (handle && (name = g_dir_read_name(handle)))
+    {
+        gchar *path;
+        BatchJob *job;
+
+        if (!g_str_has_suffix(name, ".json"))
+            continue;
+
+        path = g_build_filename(dir, name, NULL);
+        job = batch_job_load(path);
+        if (job)
+        {
+            g_debug("Resuming batch job %s", job->batch_id);
+            batch_schedule_poll(job);
+        }
+        g_free(path);
+    }
+
+    if (handle)
+        g_dir_close(handle);
+    g_free(dir);
+}
@@ -0,0 +1,69 @@
+/*
+ * m-batch.h - Bulk proofreading for AI Proofread Plugin
+ *
+ * This module proofreads a whole folder as one Batch API job:
+ * - The plain text messages of the local Drafts or Outbox folder are
+ *   collected and sent as a single job, at the lower batch price
+ * - The job is saved in the config dir and polled in the background,
+ *   also after Evolution was restarted
+ * - Each corrected body is saved as a new revision of its message in the
+ *   same folder, unless the message changed in the meantime
+ *
+ * It is tuned by the "batch" object in config.json:
+ *
+ *   "batch": { "prompt": "Proofread", "poll_s": 60 }
+ */
+
+#ifndef M_BATCH_H
+#define M_BATCH_H
+
+#include <glib.h>
+
+#include "m-ui-actions.h"
+
+G_BEGIN_DECLS
+
+/**
+ * M_BATCH_DEFAULT_POLL_S:
+ *
+ * Default time between two checks on a running job.
+ */
+#define M_BATCH_DEFAULT_POLL_S 60
+
+/**
+ * MBatchFolder:
+ * @M_BATCH_FOLDER_DRAFTS: The local Drafts folder
+ * @M_BATCH_FOLDER_OUTBOX: The Outbox, holding messages waiting to be sent
+ *
+ * The folders a batch job can proofread.
+ */
+typedef enum
+{
+    M_BATCH_FOLDER_DRAFTS,
+    M_BATCH_FOLDER_OUTBOX
+} MBatchFolder;
+
+/**
+ * m_batch_start:
+ * @folder: The folder to proofread
+ * @ui_context: The UI action context providing the prompts, backends and
+ *              selected model
+ *
+ * Submit every plain text message of @folder as one batch job with the
+ * prompt named in the "batch" section of config.json, or the first one.
+ * Messages with an HTML body, or whose text sits between quotes, are
+ * skipped. Progress and the outcome are shown as alerts.
+ */
+void m_batch_start(MBatchFolder folder, MUIActionContext *ui_context);
+
+/**
+ * m_batch_resume:
+ *
+ * Resume polling the jobs saved by an earlier session. Only the first
+ * call does anything.
+ */
+void m_batch_resume(void);
+
+G_END_DECLS
+
+#endif /* M_BATCH_H */
@@ -1,13 +1,324 @@
 #include <libsoup/soup.h>
 #include <json-glib/json-glib.h>
 #include "m-chatgpt-api.h"
+#include "m-scheduler.h"
+#include "m-stats.h"
+#include "m-latency.h"
+#include "m-tokens.h"
 #include "m-version.h"
 
-#define CHATGPT_API_URL "https://api.openai.com/v1/chat/completions"
+#define CHATGPT_COMPLETIONS_PATH "/chat/completions"
+#define CHATGPT_RESPONSES_PATH "/responses"
+#define CHATGPT_MODELS_PATH "/models"
+#define CHATGPT_FILES_PATH "/files"
+#define CHATGPT_BATCHES_PATH "/batches"
+// Requests in a batch name their endpoint by the path below the host
+#define CHATGPT_BATCH_ENDPOINT "/v1" CHATGPT_COMPLETIONS_PATH
+#define CHATGPT_BATCH_WINDOW "24h"
 #define CHATGPT_API_USER_AGENT "Evolution-AI-Proofread/" AI_PROOFREAD_VERSION " (" AI_PROOFREAD_URL ")"
+#define CHATGPT_API_TIMEOUT_S 30
+// Backstop of the shared session, above every request timeout
+#define CHATGPT_SESSION_TIMEOUT_S 600
+#define CHATGPT_MAX_CONNS_PER_HOST 4
+#define CHATGPT_PREWARM_INTERVAL_US (60 * G_USEC_PER_SEC)
 
-static const gchar *
-find_prompt_text(JsonArray *prompts, const gchar *prompt_id)
+// Appended to the system prompt of prompts with "output": "edits"
+#define CHATGPT_EDITS_INSTRUCTION \
+    "\n\nDo not return the corrected text. Return only the changes as a JSON " \
+    "object with an \"edits\" array. Every edit has the exact \"original\" " \
+    "text to change, copied verbatim and long enough to be unique, its " \
+    "\"replacement\" and a short \"reason\". List the edits in text order. " \
+    "Return an empty array if nothing needs to change."
+
+#define CHATGPT_EDITS_FORMAT \
+    "{\"type\": \"json_schema\", \"json_schema\": {\"name\": \"edits\", \"strict\": true, " \
+    "\"schema\": {\"type\": \"object\", \"additionalProperties\": false, " \
+    "\"required\": [\"edits\"], \"properties\": {\"edits\": {\"type\": \"array\", " \
+    "\"items\": {\"type\": \"object\", \"additionalProperties\": false, " \
+    "\"required\": [\"original\", \"replacement\", \"reason\"], \"properties\": {" \
+    "\"original\": {\"type\": \"string\"}, \"replacement\": {\"type\": \"string\"}, " \
+    "\"reason\": {\"type\": \"string\"}}}}}}}}"
+
+/*
+ * Process-wide HTTP session. libsoup keeps connections alive between
+ * messages and negotiates HTTP/2 via ALPN when the server offers it, so
+ * sharing one session lets every request after the first skip DNS, TCP
+ * and TLS setup. Requests run on worker threads through the sync API,
+ * which libsoup allows from any thread. The session's own I/O timeout is
+ * only a backstop above every request timeout; each request enforces its
+ * own with a RequestDeadline, so all of them share the connection pool.
+ */
+static GMutex session_lock;
+static SoupSession *shared_session = NULL;
+static gint64 last_activity_us = 0;
+
+/*
+ * get_session:
+ *
+ * Return the shared session, creating it on first use, and record the
+ * time of the request so that pre-warming can be skipped while the
+ * connection is known to be warm.
+ *
+ * Returns: (transfer full): A reference to the session
+ */
+static SoupSession *
+get_session(void)
+{
+    SoupSession *session;
+
+    g_mutex_lock(&session_lock);
+    if (!shared_session)
+    {
+        /* idle-timeout 0 keeps pooled connections until the server closes them */
+        shared_session = soup_session_new_with_options(
+            "timeout", CHATGPT_SESSION_TIMEOUT_S,
+            "idle-timeout", 0,
+            "max-conns-per-host", CHATGPT_MAX_CONNS_PER_HOST,
+            "user-agent", CHATGPT_API_USER_AGENT,
+            NULL);
+        g_debug("Created shared HTTP session");
+    }
+    session = g_object_ref(shared_session);
+    last_activity_us = g_get_monotonic_time();
+    g_mutex_unlock(&session_lock);
+
+    return session;
+}
+
+/*
+ * RequestDeadline:
+ *
+ * The timeout of one request: the request runs on a child of the
+ * caller's cancellable, which a timer cancels once no data was sent or
+ * received for the timeout. Asynchronous requests run the timer on
+ * their own main context; blocking ones on a private thread, since the
+ * thread they block may be the only one that would iterate a context.
+ */
+typedef struct {
+    GCancellable *cancellable;  /* Passed to libsoup */
+    GCancellable *parent;       /* The caller's, for the scheduler */
+    gulong parent_id;
+    GSource *timer;
+    guint timeout_s;
+    SoupMessage *msg;           /* The message being timed */
+} RequestDeadline;
+
+static gboolean
+request_deadline_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+    g_source_set_ready_time(source, -1);
+    return callback(user_data);
+}
+
+static GSourceFuncs request_deadline_funcs = {NULL, NULL, request_deadline_dispatch, NULL, NULL, NULL};
+
+static gboolean
+request_deadline_expired_cb(gpointer user_data)
+{
+    g_debug("No data from the server in time, cancelling the request");
+    g_cancellable_cancel(G_CANCELLABLE(user_data));
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+request_deadline_parent_cancelled_cb(GCancellable *parent, gpointer user_data)
+{
+    g_cancellable_cancel(G_CANCELLABLE(user_data));
+}
+
+static gpointer
+deadline_thread_func(gpointer user_data)
+{
+    GMainLoop *loop = user_data;
+
+    g_main_loop_run(loop);
+    g_main_loop_unref(loop);
+    return NULL;
+}
+
+/*
+ * deadline_timer_context:
+ *
+ * Returns: (transfer none): The main context of the thread timing
+ *          blocking requests, started on first use
+ */
+static GMainContext *
+deadline_timer_context(void)
+{
+    static GMainContext *timer_context;
+
+    if (g_once_init_enter(&timer_context)) {
+        GMainContext *context = g_main_context_new();
+
+        g_thread_unref(g_thread_new("ai-proofread-deadlines", deadline_thread_func,
+                                    g_main_loop_new(context, FALSE)));
+        g_once_init_leave(&timer_context, context);
+    }
+
+    return timer_context;
+}
+
+/*
+ * request_deadline_new:
+ * @timeout_s: Seconds without data before the request fails
+ * @parent: (nullable): The caller's cancellable
+ * @context: (nullable): The main context running the timer, NULL for the
+ *           private timer thread of blocking requests
+ *
+ * Returns: (transfer full): The deadline, free with request_deadline_free()
+ */
+static RequestDeadline *
+request_deadline_new(guint timeout_s, GCancellable *parent, GMainContext *context)
+{
+    RequestDeadline *deadline = g_new0(RequestDeadline, 1);
+
+    deadline->cancellable = g_cancellable_new();
+    deadline->timeout_s = timeout_s;
+
+    if (parent) {
+        deadline->parent = g_object_ref(parent);
+        deadline->parent_id = g_cancellable_connect(parent, G_CALLBACK(request_deadline_parent_cancelled_cb),
+                                                    g_object_ref(deadline->cancellable), g_object_unref);
+    }
+
+    deadline->timer = g_source_new(&request_deadline_funcs, sizeof(GSource));
+    g_source_set_callback(deadline->timer, request_deadline_expired_cb,
+                          g_object_ref(deadline->cancellable), g_object_unref);
+    g_source_attach(deadline->timer, context ? context : deadline_timer_context());
+
+    return deadline;
+}
+
+/*
+ * request_deadline_restart:
+ *
+ * Give the request another @timeout_s from now. Safe from any thread.
+ */
+static void
+request_deadline_restart(RequestDeadline *deadline)
+{
+    g_source_set_ready_time(deadline->timer,
+                            g_get_monotonic_time() + (gint64)deadline->timeout_s * G_USEC_PER_SEC);
+}
+
+static void
+request_deadline_headers_cb(SoupMessage *msg, gpointer user_data)
+{
+    request_deadline_restart(user_data);
+}
+
+static void
+request_deadline_data_cb(SoupMessage *msg, guint chunk_size, gpointer user_data)
+{
+    request_deadline_restart(user_data);
+}
+
+/*
+ * request_deadline_stop:
+ *
+ * Stop timing the current message.
+ */
+static void
+request_deadline_stop(RequestDeadline *deadline)
+{
+    g_source_set_ready_time(deadline->timer, -1);
+
+    if (deadline->msg) {
+        g_signal_handlers_disconnect_by_data(deadline->msg, deadline);
+        g_clear_object(&deadline->msg);
+    }
+}
+
+/*
+ * request_deadline_start:
+ * @msg: The message about to be sent
+ *
+ * Start the timer for @msg, and restart it whenever a part of the
+ * request was written or of the response was read.
+ */
+static void
+request_deadline_start(RequestDeadline *deadline, SoupMessage *msg)
+{
+    request_deadline_stop(deadline);
+
+    deadline->msg = g_object_ref(msg);
+    g_signal_connect(msg, "wrote-body-data", G_CALLBACK(request_deadline_data_cb), deadline);
+    g_signal_connect(msg, "got-headers", G_CALLBACK(request_deadline_headers_cb), deadline);
+    g_signal_connect(msg, "got-body-data", G_CALLBACK(request_deadline_data_cb), deadline);
+    request_deadline_restart(deadline);
+}
+
+/*
+ * request_deadline_check:
+ * @error: (inout) (nullable): The error of a failed call
+ *
+ * Report a request that was cancelled by its timer, and not by the
+ * caller, as timed out.
+ */
+static void
+request_deadline_check(RequestDeadline *deadline, GError **error)
+{
+    if (!error || !*error || !g_error_matches(*error, G_IO_ERROR, G_IO_ERROR_CANCELLED) ||
+        !g_cancellable_is_cancelled(deadline->cancellable) ||
+        (deadline->parent && g_cancellable_is_cancelled(deadline->parent)))
+        return;
+
+    g_clear_error(error);
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                "No data from the server for %u s", deadline->timeout_s);
+}
+
+static void
+request_deadline_free(RequestDeadline *deadline)
+{
+    if (!deadline)
+        return;
+
+    request_deadline_stop(deadline);
+    g_source_destroy(deadline->timer);
+    g_source_unref(deadline->timer);
+    if (deadline->parent) {
+        g_cancellable_disconnect(deadline->parent, deadline->parent_id);
+        g_object_unref(deadline->parent);
+    }
+    g_object_unref(deadline->cancellable);
+    g_free(deadline);
+}
+
+/*
+ * request_timeout_s:
+ * @prompt: The prompt settings
+ * @model: The model the request goes to
+ * @estimated_tokens: Estimated input tokens of the request
+ * @stats: (nullable): The record to note the timeout in
+ *
+ * The "timeout" of the prompt wins; otherwise the latency history of the
+ * model, prompt and request size sets it, so that slow reasoning replies
+ * get more time and stalled quick fixes fail sooner.
+ *
+ * Returns: The timeout for request_deadline_new()
+ */
+static guint
+request_timeout_s(const MChatGPTPrompt *prompt,
+                  const gchar *model,
+                  guint estimated_tokens,
+                  MStatsRecord *stats)
+{
+    guint timeout_s = prompt->timeout_s;
+
+    if (timeout_s == 0)
+        timeout_s = m_latency_timeout_s(model, prompt->name, estimated_tokens);
+    if (timeout_s == 0)
+        timeout_s = CHATGPT_API_TIMEOUT_S;
+    timeout_s = MIN(timeout_s, CHATGPT_SESSION_TIMEOUT_S);
+
+    if (stats)
+        stats->timeout_s = timeout_s;
+    return timeout_s;
+}
+
+JsonObject *
+m_chatgpt_find_prompt(JsonArray *prompts, const gchar *prompt_id)
 {
     guint length = json_array_get_length(prompts);
     // Strip "ai-proofread-" prefix from prompt_id
@@ -19,206 +330,1635 @@ find_prompt_text(JsonArray *prompts, const gchar *prompt_id)
     for (guint i = 0; i < length; i++) {
         JsonObject *prompt = json_array_get_object_element(prompts, i);
         if (g_strcmp0(json_object_get_string_member(prompt, "name"), name) == 0) {
-            return json_object_get_string_member(prompt, "prompt");
+            return prompt;
+        }
+    }
+    return NULL;
+}
+
+static gboolean
+prompt_object_wants_edits(JsonObject *prompt)
+{
+    return g_strcmp0(json_object_get_string_member_with_default(prompt, "output", NULL), "edits") == 0;
+}
+
+gboolean
+m_chatgpt_prompt_lookup(JsonArray *prompts, const gchar *prompt_id, MChatGPTPrompt *prompt)
+{
+    JsonObject *obj = m_chatgpt_find_prompt(prompts, prompt_id);
+
+    memset(prompt, 0, sizeof(*prompt));
+    prompt->temperature = -1;
+    if (!obj)
+        return FALSE;
+
+    prompt->name = json_object_get_string_member_with_default(obj, "name", NULL);
+    prompt->text = json_object_get_string_member_with_default(obj, "prompt", NULL);
+    prompt->model = json_object_get_string_member_with_default(obj, "model", NULL);
+    prompt->max_tokens = MAX(json_object_get_int_member_with_default(obj, "max_tokens", 0), 0);
+    if (json_object_has_member(obj, "temperature"))
+        prompt->temperature = json_object_get_double_member(obj, "temperature");
+    prompt->reasoning_effort = json_object_get_string_member_with_default(obj, "reasoning_effort", NULL);
+    prompt->service_tier = json_object_get_string_member_with_default(obj, "service_tier", NULL);
+    prompt->timeout_s = MAX(json_object_get_int_member_with_default(obj, "timeout", 0), 0);
+    prompt->edits = prompt_object_wants_edits(obj);
+    prompt->conversation = json_object_get_boolean_member_with_default(obj, "conversation", FALSE);
+    // Prompts which mostly return their input ("predict": true) send the
+    // content as predicted output, so unchanged spans are not generated
+    // token by token. An edit list looks nothing like the input and a
+    // partial one cannot be inserted, so edit prompts neither predict
+    // nor stream.
+    prompt->stream = !prompt->edits && json_object_get_boolean_member_with_default(obj, "stream", FALSE);
+    // The Responses API used by conversation prompts has no predicted output
+    prompt->predict = !prompt->edits && !prompt->conversation &&
+                      json_object_get_boolean_member_with_default(obj, "predict", FALSE);
+    // Nor does the API accept a prediction together with max_completion_tokens
+    if (prompt->predict && prompt->max_tokens > 0) {
+        g_debug("Prompt %s sets max_tokens, not predicting its output",
+                prompt->name ? prompt->name : prompt_id);
+        prompt->predict = FALSE;
+    }
+    // Requests of one prompt share their prefix, which helps the server
+    // route them to the same prompt cache
+    prompt->cache_key = json_object_get_string_member_with_default(obj, "prompt_cache_key", prompt->name);
+    prompt->max_input_tokens = MAX(json_object_get_int_member_with_default(obj, "max_input_tokens", 0), 0);
+    prompt->small_model = json_object_get_string_member_with_default(obj, "small_model", NULL);
+    prompt->small_below_tokens = MAX(json_object_get_int_member_with_default(
+        obj, "small_below_tokens", M_CHATGPT_DEFAULT_SMALL_BELOW_TOKENS), 0);
+
+    return prompt->text != NULL;
+}
+
+const gchar *
+m_chatgpt_prompt_get_model(const MChatGPTPrompt *prompt,
+                           const MBackend *backend,
+                           const gchar *selected_model)
+{
+    return m_backend_get_model(backend, prompt && prompt->model ? prompt->model : selected_model);
+}
+
+guint
+m_chatgpt_prompt_estimate_tokens(const MChatGPTPrompt *prompt, const gchar *content)
+{
+    guint tokens = m_tokens_estimate_request(prompt->text, content);
+
+    if (prompt->edits)
+        tokens += m_tokens_estimate(CHATGPT_EDITS_INSTRUCTION);
+    return tokens;
+}
+
+const gchar *
+m_chatgpt_prompt_route_model(const MChatGPTPrompt *prompt,
+                             const MBackend *backend,
+                             const gchar *model,
+                             guint estimated_tokens)
+{
+    if (prompt && prompt->small_model && estimated_tokens < prompt->small_below_tokens) {
+        g_debug("Routing a request of about %u tokens to %s", estimated_tokens, prompt->small_model);
+        model = prompt->small_model;
+    }
+    return m_backend_get_model(backend, model);
+}
+
+gboolean
+m_chatgpt_prompt_wants_edits(JsonArray *prompts, const gchar *prompt_id)
+{
+    JsonObject *prompt = m_chatgpt_find_prompt(prompts, prompt_id);
+
+    return prompt && prompt_object_wants_edits(prompt);
+}
+
+/*
+ * log_usage:
+ *
+ * Log the token usage of a completion, including how much of the
+ * predicted output was accepted, and record it in @stats if not NULL.
+ */
+static void
+log_usage(JsonObject *obj, MStatsRecord *stats)
+{
+    JsonObject *usage;
+    JsonObject *details;
+    const gchar *details_name;
+    gint64 prompt_tokens;
+    gint64 cached_tokens = 0;
+    gint64 completion_tokens;
+
+    if (!json_object_has_member(obj, "usage") ||
+        !JSON_NODE_HOLDS_OBJECT(json_object_get_member(obj, "usage")))
+        return;
+
+    usage = json_object_get_object_member(obj, "usage");
+    // The Responses API names them input and output tokens
+    details_name = json_object_has_member(usage, "input_tokens_details") ?
+        "input_tokens_details" : "prompt_tokens_details";
+    if (json_object_has_member(usage, details_name) &&
+        JSON_NODE_HOLDS_OBJECT(json_object_get_member(usage, details_name))) {
+        details = json_object_get_object_member(usage, details_name);
+        cached_tokens = json_object_get_int_member_with_default(details, "cached_tokens", 0);
+    }
+    prompt_tokens = json_object_get_int_member_with_default(
+        usage, "prompt_tokens", json_object_get_int_member_with_default(usage, "input_tokens", 0));
+    completion_tokens = json_object_get_int_member_with_default(
+        usage, "completion_tokens", json_object_get_int_member_with_default(usage, "output_tokens", 0));
+    if (stats) {
+        stats->prompt_tokens = prompt_tokens;
+        stats->cached_tokens = cached_tokens;
+        stats->completion_tokens = completion_tokens;
+    }
+    g_debug("Usage: %" G_GINT64_FORMAT " prompt tokens (%" G_GINT64_FORMAT " cached), "
+            "%" G_GINT64_FORMAT " completion tokens",
+            prompt_tokens, cached_tokens, completion_tokens);
+
+    if (!json_object_has_member(usage, "completion_tokens_details") ||
+        !JSON_NODE_HOLDS_OBJECT(json_object_get_member(usage, "completion_tokens_details")))
+        return;
+
+    details = json_object_get_object_member(usage, "completion_tokens_details");
+    if (json_object_has_member(details, "accepted_prediction_tokens") ||
+        json_object_has_member(details, "rejected_prediction_tokens")) {
+        g_debug("Prediction: %" G_GINT64_FORMAT " tokens accepted, %" G_GINT64_FORMAT " rejected",
+                json_object_get_int_member_with_default(details, "accepted_prediction_tokens", 0),
+                json_object_get_int_member_with_default(details, "rejected_prediction_tokens", 0));
+    }
+}
+
+/*
+ * debug_enabled:
+ *
+ * Request and response bodies can be megabytes, so they are only
+ * formatted for the log when debug messages are actually shown.
+ */
+static gboolean
+debug_enabled(void)
+{
+    return !g_log_writer_default_would_drop(G_LOG_LEVEL_DEBUG, G_LOG_DOMAIN);
+}
+
+/*
+ * serialize_request:
+ * @builder: (transfer full): A builder holding a complete request
+ *
+ * The tree is freed before returning, so that only the serialized body
+ * stays around while the request is sent and retried.
+ * Returns: (transfer full): The serialized JSON
+ */
+static GBytes *
+serialize_request(JsonBuilder *builder)
+{
+    JsonGenerator *generator;
+    JsonNode *root;
+    gchar *json_data;
+    gsize length;
+
+    generator = json_generator_new();
+    root = json_builder_get_root(builder);
+    g_object_unref(builder);
+    json_generator_set_root(generator, root);
+    json_node_unref(root);
+    json_data = json_generator_to_data(generator, &length);
+    g_object_unref(generator);
+
+    if (debug_enabled())
+        g_debug("Sending request: %s", json_data);
+
+    return g_bytes_new_take(json_data, length);
+}
+
+/*
+ * build_responses_json:
+ *
+ * Build the Responses API request body of a conversation prompt. The
+ * response is stored on the server, so that a follow-up request can
+ * name it as @previous_response_id and send only the new text.
+ * Returns: (transfer full): The serialized JSON
+ */
+static GBytes *
+build_responses_json(const MChatGPTPrompt *prompt,
+                     const gchar *content,
+                     const gchar *model,
+                     gboolean stream,
+                     const gchar *previous_response_id)
+{
+    JsonBuilder *builder = json_builder_new();
+    gchar *instructions;
+
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "model");
+    json_builder_add_string_value(builder, model ? model : "gpt-4o");
+    json_builder_set_member_name(builder, "store");
+    json_builder_add_boolean_value(builder, TRUE);
+    if (previous_response_id) {
+        json_builder_set_member_name(builder, "previous_response_id");
+        json_builder_add_string_value(builder, previous_response_id);
+    }
+    if (stream) {
+        json_builder_set_member_name(builder, "stream");
+        json_builder_add_boolean_value(builder, TRUE);
+    }
+    if (prompt->max_tokens > 0) {
+        json_builder_set_member_name(builder, "max_output_tokens");
+        json_builder_add_int_value(builder, prompt->max_tokens);
+    }
+    if (prompt->temperature >= 0) {
+        json_builder_set_member_name(builder, "temperature");
+        json_builder_add_double_value(builder, prompt->temperature);
+    }
+    if (prompt->reasoning_effort) {
+        json_builder_set_member_name(builder, "reasoning");
+        json_builder_begin_object(builder);
+        json_builder_set_member_name(builder, "effort");
+        json_builder_add_string_value(builder, prompt->reasoning_effort);
+        json_builder_end_object(builder);
+    }
+    if (prompt->service_tier) {
+        json_builder_set_member_name(builder, "service_tier");
+        json_builder_add_string_value(builder, prompt->service_tier);
+    }
+    if (prompt->cache_key) {
+        json_builder_set_member_name(builder, "prompt_cache_key");
+        json_builder_add_string_value(builder, prompt->cache_key);
+    }
+    if (prompt->edits) {
+        // Same schema as for chat completions, with the name and schema
+        // next to the type
+        JsonNode *format = json_from_string(CHATGPT_EDITS_FORMAT, NULL);
+        JsonNode *schema = json_node_copy(
+            json_object_get_member(json_node_get_object(format), "json_schema"));
+
+        json_object_set_string_member(json_node_get_object(schema), "type", "json_schema");
+        json_builder_set_member_name(builder, "text");
+        json_builder_begin_object(builder);
+        json_builder_set_member_name(builder, "format");
+        json_builder_add_value(builder, schema);
+        json_builder_end_object(builder);
+        json_node_unref(format);
+    }
+
+    // Instructions are not carried over from the previous response, so
+    // every pass sends its own
+    instructions = g_strconcat(prompt->text, prompt->edits ? CHATGPT_EDITS_INSTRUCTION : "", NULL);
+    json_builder_set_member_name(builder, "instructions");
+    json_builder_add_string_value(builder, instructions);
+    g_free(instructions);
+    json_builder_set_member_name(builder, "input");
+    json_builder_add_string_value(builder, content);
+    json_builder_end_object(builder);
+
+    return serialize_request(builder);
+}
+
+/*
+ * build_request_json:
+ *
+ * Build the request body for the given prompt and content: a chat
+ * completion, or a Responses API request for conversation prompts, which
+ * continue @previous_response_id if not NULL.
+ * Prompts with "predict" send @prediction, or @content if NULL, as
+ * predicted output; edit prompts ask the model for an edit list instead
+ * of the corrected text.
+ * Returns: (transfer full): The serialized JSON
+ */
+static GBytes *
+build_request_json(const MChatGPTPrompt *prompt,
+                   const gchar *content,
+                   const gchar *prediction,
+                   const gchar *model,
+                   gboolean stream,
+                   const gchar *previous_response_id)
+{
+    JsonBuilder *builder;
+    gchar *system_text;
+
+    if (prompt->conversation)
+        return build_responses_json(prompt, content, model, stream, previous_response_id);
+
+    // Build request JSON
+    builder = json_builder_new();
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "model");
+    json_builder_add_string_value(builder, model ? model : "gpt-4o");
+    if (stream) {
+        json_builder_set_member_name(builder, "stream");
+        json_builder_add_boolean_value(builder, TRUE);
+        // Ask for a final chunk with the usage
+        json_builder_set_member_name(builder, "stream_options");
+        json_builder_begin_object(builder);
+        json_builder_set_member_name(builder, "include_usage");
+        json_builder_add_boolean_value(builder, TRUE);
+        json_builder_end_object(builder);
+    }
+    if (prompt->max_tokens > 0) {
+        json_builder_set_member_name(builder, "max_completion_tokens");
+        json_builder_add_int_value(builder, prompt->max_tokens);
+    }
+    if (prompt->temperature >= 0) {
+        json_builder_set_member_name(builder, "temperature");
+        json_builder_add_double_value(builder, prompt->temperature);
+    }
+    if (prompt->reasoning_effort) {
+        json_builder_set_member_name(builder, "reasoning_effort");
+        json_builder_add_string_value(builder, prompt->reasoning_effort);
+    }
+    if (prompt->service_tier) {
+        json_builder_set_member_name(builder, "service_tier");
+        json_builder_add_string_value(builder, prompt->service_tier);
+    }
+    if (prompt->cache_key) {
+        json_builder_set_member_name(builder, "prompt_cache_key");
+        json_builder_add_string_value(builder, prompt->cache_key);
+    }
+    if (prompt->predict) {
+        json_builder_set_member_name(builder, "prediction");
+        json_builder_begin_object(builder);
+        json_builder_set_member_name(builder, "type");
+        json_builder_add_string_value(builder, "content");
+        json_builder_set_member_name(builder, "content");
+        json_builder_add_string_value(builder, prediction ? prediction : content);
+        json_builder_end_object(builder);
+    }
+    if (prompt->edits) {
+        json_builder_set_member_name(builder, "response_format");
+        json_builder_add_value(builder, json_from_string(CHATGPT_EDITS_FORMAT, NULL));
+    }
+    json_builder_set_member_name(builder, "messages");
+    json_builder_begin_array(builder);
+    
+    // System message with prompt. It comes first and is byte-identical for
+    // every request of the prompt, so the server can reuse its cached prefix.
+    system_text = g_strconcat(prompt->text, prompt->edits ? CHATGPT_EDITS_INSTRUCTION : "", NULL);
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "role");
+    json_builder_add_string_value(builder, "system");
+    json_builder_set_member_name(builder, "content");
+    json_builder_add_string_value(builder, system_text);
+    json_builder_end_object(builder);
+    g_free(system_text);
+    
+    // User message with content
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "role");
+    json_builder_add_string_value(builder, "user");
+    json_builder_set_member_name(builder, "content");
+    json_builder_add_string_value(builder, content);
+    json_builder_end_object(builder);
+    
+    json_builder_end_array(builder);
+    json_builder_end_object(builder);
+
+    return serialize_request(builder);
+}
+
+/*
+ * request_path:
+ *
+ * Returns: The endpoint of requests of @prompt
+ */
+static const gchar *
+request_path(const MChatGPTPrompt *prompt)
+{
+    return prompt->conversation ? CHATGPT_RESPONSES_PATH : CHATGPT_COMPLETIONS_PATH;
+}
+
+/*
+ * create_request_message:
+ * @content_type: (nullable): The type of @request_body, NULL for JSON
+ *
+ * Create an authorized message to an API endpoint, with @request_body as
+ * body if not NULL. The body is shared, not copied, so retries of a
+ * large request do not copy it again.
+ * Returns: (transfer full) (nullable): The message, or NULL on error
+ */
+static SoupMessage *
+create_request_message(const gchar *method,
+                       const gchar *url,
+                       const gchar *api_key,
+                       const gchar *content_type,
+                       GBytes *request_body,
+                       GError **error)
+{
+    SoupMessage *msg;
+    
+    msg = soup_message_new(method, url);
+    if (!msg) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                    "Failed to create HTTP message for URL: %s", url);
+        return NULL;
+    }
+    soup_message_add_flags(msg, SOUP_MESSAGE_COLLECT_METRICS);
+    
+    // Set headers; local servers usually need no key
+    if (api_key) {
+        gchar *auth_header = g_strdup_printf("Bearer %s", api_key);
+        soup_message_headers_append(soup_message_get_request_headers(msg),
+                                  "Authorization", auth_header);
+        g_free(auth_header);
+    }
+    
+    // Set request body
+    if (request_body)
+        soup_message_set_request_body_from_bytes(msg, content_type ? content_type : "application/json",
+                                                 request_body);
+
+    return msg;
+}
+
+static gint64
+metrics_span(guint64 start, guint64 end)
+{
+    return start > 0 && end >= start ? (gint64)(end - start) : 0;
+}
+
+/*
+ * record_message_metrics:
+ *
+ * Copy the status and the connection and transfer timings of @msg into
+ * @stats. DNS, connect and TLS are 0 when a pooled connection was used.
+ */
+static void
+record_message_metrics(SoupMessage *msg, MStatsRecord *stats)
+{
+    SoupMessageMetrics *metrics;
+
+    if (!stats || !msg)
+        return;
+
+    stats->status = soup_message_get_status(msg);
+
+    metrics = soup_message_get_metrics(msg);
+    if (!metrics)
+        return;
+
+    guint64 connect_end = soup_message_metrics_get_connect_end(metrics);
+    guint64 tls_start = soup_message_metrics_get_tls_start(metrics);
+
+    stats->dns_us = metrics_span(soup_message_metrics_get_dns_start(metrics),
+                                 soup_message_metrics_get_dns_end(metrics));
+    stats->connect_us = metrics_span(soup_message_metrics_get_connect_start(metrics),
+                                     tls_start > 0 ? tls_start : connect_end);
+    stats->tls_us = metrics_span(tls_start, connect_end);
+    stats->ttfb_us = metrics_span(soup_message_metrics_get_request_start(metrics),
+                                  soup_message_metrics_get_response_start(metrics));
+    stats->transfer_us = metrics_span(soup_message_metrics_get_response_start(metrics),
+                                      soup_message_metrics_get_response_end(metrics));
+}
+
+/*
+ * scheduler_acquire_timed:
+ *
+ * Acquire a scheduler slot, adding the time spent waiting to @stats.
+ */
+static gboolean
+scheduler_acquire_timed(MSchedulerPriority priority,
+                        MStatsRecord *stats,
+                        GCancellable *cancellable,
+                        GError **error)
+{
+    gint64 start = g_get_monotonic_time();
+    gboolean acquired = m_scheduler_acquire(priority, cancellable, error);
+
+    if (stats)
+        stats->queue_us += g_get_monotonic_time() - start;
+
+    return acquired;
+}
+
+/*
+ * scheduler_sleep_timed:
+ *
+ * Wait before a retry, counting the wait as queue time in @stats.
+ */
+static gboolean
+scheduler_sleep_timed(gint64 delay_us,
+                      MStatsRecord *stats,
+                      GCancellable *cancellable,
+                      GError **error)
+{
+    gint64 start = g_get_monotonic_time();
+    gboolean slept = m_scheduler_sleep(delay_us, cancellable, error);
+
+    if (stats) {
+        stats->queue_us += g_get_monotonic_time() - start;
+        stats->retries++;
+    }
+
+    return slept;
+}
+
+/*
+ * send_and_read_scheduled:
+ * @out_msg: (out): The last message sent, set whenever a request was made
+ * @deadline: The timeout of the request, and the caller's cancellable
+ *
+ * Send a request through the scheduler and read the whole response,
+ * retrying while the scheduler asks for it.
+ * Returns: (transfer full) (nullable): The response body
+ */
+static GBytes *
+send_and_read_scheduled(SoupSession *session,
+                        const gchar *method,
+                        const gchar *url,
+                        const gchar *api_key,
+                        const gchar *content_type,
+                        GBytes *request_body,
+                        MSchedulerPriority priority,
+                        MStatsRecord *stats,
+                        SoupMessage **out_msg,
+                        RequestDeadline *deadline,
+                        GError **error)
+{
+    GCancellable *cancellable = deadline->parent;
+
+    *out_msg = NULL;
+
+    for (guint attempt = 0; ; attempt++) {
+        SoupMessage *msg;
+        GBytes *response;
+        GError *local_error = NULL;
+        gint64 delay_us;
+
+        if (!scheduler_acquire_timed(priority, stats, cancellable, error))
+            return NULL;
+
+        msg = create_request_message(method, url, api_key, content_type, request_body, error);
+        if (!msg) {
+            m_scheduler_release();
+            return NULL;
+        }
+
+        g_debug("Sending request to %s", url);
+        request_deadline_start(deadline, msg);
+        response = soup_session_send_and_read(session, msg, deadline->cancellable, &local_error);
+        request_deadline_stop(deadline);
+        request_deadline_check(deadline, &local_error);
+        m_scheduler_release();
+
+        delay_us = m_scheduler_handle_response(msg, response, attempt);
+        if (delay_us < 0) {
+            if (local_error)
+                g_propagate_error(error, local_error);
+            record_message_metrics(msg, stats);
+            *out_msg = msg;
+            return response;
+        }
+
+        g_clear_error(&local_error);
+        if (response)
+            g_bytes_unref(response);
+        g_object_unref(msg);
+
+        if (!scheduler_sleep_timed(delay_us, stats, cancellable, error))
+            return NULL;
+    }
+}
+
+/*
+ * send_scheduled:
+ * @out_msg: (out): The message sent, set if a stream is returned
+ *
+ * Like send_and_read_scheduled(), but return the response body as a
+ * stream. On success the scheduler slot stays taken while the caller
+ * reads the stream; it must call m_scheduler_release() afterwards, and
+ * record_message_metrics() once the stream is read. @deadline keeps
+ * timing the stream, which is to be read with its cancellable.
+ * Returns: (transfer full) (nullable): The response stream
+ */
+static GInputStream *
+send_scheduled(SoupSession *session,
+               const gchar *url,
+               const gchar *api_key,
+               GBytes *request_body,
+               MSchedulerPriority priority,
+               MStatsRecord *stats,
+               SoupMessage **out_msg,
+               RequestDeadline *deadline,
+               GError **error)
+{
+    GCancellable *cancellable = deadline->parent;
+
+    *out_msg = NULL;
+
+    for (guint attempt = 0; ; attempt++) {
+        SoupMessage *msg;
+        GInputStream *stream;
+        GBytes *body = NULL;
+        gint64 delay_us;
+
+        if (!scheduler_acquire_timed(priority, stats, cancellable, error))
+            return NULL;
+
+        msg = create_request_message("POST", url, api_key, NULL, request_body, error);
+        if (!msg) {
+            m_scheduler_release();
+            return NULL;
+        }
+
+        g_debug("Sending streaming request to %s", url);
+        request_deadline_start(deadline, msg);
+        stream = soup_session_send(session, msg, deadline->cancellable, error);
+        if (!stream) {
+            request_deadline_stop(deadline);
+            request_deadline_check(deadline, error);
+            m_scheduler_release();
+            g_object_unref(msg);
+            return NULL;
+        }
+
+        // Error bodies are small; read them for the retry decision
+        if (!SOUP_STATUS_IS_SUCCESSFUL(soup_message_get_status(msg))) {
+            GOutputStream *output = g_memory_output_stream_new_resizable();
+
+            g_output_stream_splice(output, stream,
+                                   G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+                                   G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                                   deadline->cancellable, NULL);
+            body = g_memory_output_stream_steal_as_bytes(G_MEMORY_OUTPUT_STREAM(output));
+            g_object_unref(output);
+            g_object_unref(stream);
+            stream = g_memory_input_stream_new_from_bytes(body);
         }
+
+        delay_us = m_scheduler_handle_response(msg, body, attempt);
+        if (body)
+            g_bytes_unref(body);
+
+        if (delay_us < 0) {
+            *out_msg = msg;
+            return stream;
+        }
+
+        request_deadline_stop(deadline);
+        g_object_unref(stream);
+        g_object_unref(msg);
+        m_scheduler_release();
+
+        if (!scheduler_sleep_timed(delay_us, stats, cancellable, error))
+            return NULL;
+    }
+}
+
+/*
+ * parse_responses_output:
+ * @obj: A Responses API response
+ *
+ * Returns: (transfer full) (nullable): The text of the output messages,
+ *          or NULL if there is none or the response failed
+ */
+static gchar *
+parse_responses_output(JsonObject *obj, GError **error)
+{
+    JsonArray *output;
+    GString *text;
+
+    if (json_object_has_member(obj, "error") &&
+        JSON_NODE_HOLDS_OBJECT(json_object_get_member(obj, "error"))) {
+        JsonObject *err = json_object_get_object_member(obj, "error");
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Response failed: %s",
+                    json_object_get_string_member_with_default(err, "message", "Unknown error"));
+        return NULL;
+    }
+
+    output = JSON_NODE_HOLDS_ARRAY(json_object_get_member(obj, "output")) ?
+        json_object_get_array_member(obj, "output") : NULL;
+    text = g_string_new(NULL);
+    for (guint i = 0; output && i < json_array_get_length(output); i++) {
+        JsonObject *item = json_array_get_object_element(output, i);
+        JsonArray *parts;
+
+        if (!item || g_strcmp0(json_object_get_string_member_with_default(item, "type", NULL), "message") != 0 ||
+            !json_object_has_member(item, "content"))
+            continue;
+
+        parts = json_object_get_array_member(item, "content");
+        for (guint j = 0; parts && j < json_array_get_length(parts); j++) {
+            JsonObject *part = json_array_get_object_element(parts, j);
+
+            if (part && g_strcmp0(json_object_get_string_member_with_default(part, "type", NULL), "output_text") == 0)
+                g_string_append(text, json_object_get_string_member_with_default(part, "text", ""));
+        }
+    }
+
+    if (text->len == 0) {
+        g_string_free(text, TRUE);
+        return NULL;
+    }
+    return g_string_free(text, FALSE);
+}
+
+/*
+ * parse_completion_object:
+ * @obj: A chat completion or Responses API response
+ * @stats: (nullable): Record to add the usage to
+ * @response_id: (out) (optional): Return location for the ID of a stored response
+ *
+ * Returns: (transfer full) (nullable): The content of the first choice,
+ *          or NULL on error
+ */
+static gchar *
+parse_completion_object(JsonObject *obj, MStatsRecord *stats, gchar **response_id, GError **error)
+{
+    JsonArray *choices;
+
+    log_usage(obj, stats);
+    if (json_object_has_member(obj, "output")) {
+        if (response_id) {
+            g_free(*response_id);
+            *response_id = g_strdup(json_object_get_string_member_with_default(obj, "id", NULL));
+        }
+        return parse_responses_output(obj, error);
+    }
+    if (!json_object_has_member(obj, "choices")) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "Invalid JSON response: no 'choices' array");
+        return NULL;
+    }
+
+    choices = json_object_get_array_member(obj, "choices");
+    if (choices && json_array_get_length(choices) > 0) {
+        JsonObject *choice = json_array_get_object_element(choices, 0);
+        JsonObject *message;
+
+        if (!json_object_has_member(choice, "message")) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                        "Invalid JSON response: no 'message' object in choice");
+            return NULL;
+        }
+
+        message = json_object_get_object_member(choice, "message");
+        if (!json_object_has_member(message, "content")) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                        "Invalid JSON response: no 'content' in message");
+            return NULL;
+        }
+
+        return g_strdup(json_object_get_string_member(message, "content"));
+    }
+
+    return NULL;
+}
+
+/*
+ * parse_completion_response:
+ * @response: The body of a successful chat completion or Responses API response
+ * @stats: (nullable): Record to add parse time and usage to
+ * @response_id: (out) (optional): Return location for the ID of a stored response
+ *
+ * Returns: (transfer full) (nullable): The content of the first choice,
+ *          or NULL on error
+ */
+static gchar *
+parse_completion_response(GBytes *response, MStatsRecord *stats, gchar **response_id, GError **error)
+{
+    gsize response_length;
+    const gchar *response_data = g_bytes_get_data(response, &response_length);
+    JsonParser *parser;
+    gchar *response_text;
+    gint64 parse_start;
+    gboolean parsed;
+
+    if (debug_enabled())
+        g_debug("Got response: %.*s", (int)response_length, response_data);
+
+    parser = json_parser_new();
+    parse_start = g_get_monotonic_time();
+    parsed = json_parser_load_from_data(parser, response_data, response_length, error);
+    if (stats)
+        stats->parse_us = g_get_monotonic_time() - parse_start;
+    if (!parsed) {
+        g_object_unref(parser);
+        return NULL;
+    }
+
+    if (!JSON_NODE_HOLDS_OBJECT(json_parser_get_root(parser))) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "Invalid JSON response: root is not an object");
+        g_object_unref(parser);
+        return NULL;
+    }
+
+    response_text = parse_completion_object(json_node_get_object(json_parser_get_root(parser)),
+                                            stats, response_id, error);
+    g_object_unref(parser);
+    return response_text;
+}
+
+gchar *
+m_chatgpt_proofread(const gchar *content,
+                    const gchar *prompt_id,
+                    JsonArray *prompts,
+                    const MBackend *backend,
+                    const gchar *model,
+                    MStatsRecord *stats,
+                    GCancellable *cancellable,
+                    GError **error)
+{
+    SoupSession *session;
+    SoupMessage *msg;
+    GBytes *request_body;
+    gchar *url;
+    MChatGPTPrompt prompt;
+    guint estimated_tokens;
+    RequestDeadline *deadline;
+    gchar *response_text = NULL;
+    
+    model = m_backend_get_model(backend, model);
+    if (!m_chatgpt_prompt_lookup(prompts, prompt_id, &prompt)) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "Prompt not found for ID: %s", prompt_id);
+        return NULL;
+    }
+    estimated_tokens = m_chatgpt_prompt_estimate_tokens(&prompt, content);
+    if (stats)
+        stats->estimated_tokens = estimated_tokens;
+
+    request_body = build_request_json(&prompt, content, NULL, model, FALSE, NULL);
+
+    // Use the shared HTTP session with the timeout of the request
+    session = get_session();
+    deadline = request_deadline_new(request_timeout_s(&prompt, model, estimated_tokens, stats),
+                                    cancellable, NULL);
+
+    // Send request
+    GBytes *response = NULL;
+    GError *local_error = NULL;
+    
+    url = m_backend_build_url(backend, request_path(&prompt));
+    response = send_and_read_scheduled(session, "POST", url, backend->api_key, NULL, request_body,
+                                       M_SCHEDULER_PRIORITY_INTERACTIVE, stats, &msg,
+                                       deadline, &local_error);
+    g_free(url);
+    if (!msg) {
+        // Cancelled while queued, no request was made
+        g_propagate_error(error, local_error);
+        goto cleanup;
+    }
+    
+    // Check HTTP status code
+    guint status_code = soup_message_get_status(msg);
+    const char *reason = soup_message_get_reason_phrase(msg);
+    g_debug("HTTP Status: %d %s", status_code, reason ? reason : "Unknown");
+    
+    if (SOUP_STATUS_IS_SUCCESSFUL(status_code)) {
+        g_debug("HTTP request successful with status %d", status_code);
+    } else if (!response && local_error) {
+        // Transport failure, there is no HTTP status to report
+        g_propagate_error(error, local_error);
+        goto cleanup;
+    } else {
+        const char *response_body = "";
+        if (response) {
+            gsize length;
+            response_body = g_bytes_get_data(response, &length);
+        }
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                    "HTTP request failed with status %d: %s. Response: %s",
+                    status_code,
+                    reason ? reason : "Unknown error",
+                    response_body);
+        if (response)
+            g_bytes_unref(response);
+        g_clear_error(&local_error);
+        goto cleanup;
+    }
+
+    if (response) {
+        response_text = parse_completion_response(response, stats, NULL, error);
+        g_bytes_unref(response);
+    } else if (local_error) {
+        g_propagate_error(error, local_error);
+    } else {
+        if (!*error) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "No response from API");
+        }
+    }
+
+cleanup:
+    // Cleanup
+    g_bytes_unref(request_body);
+    g_clear_object(&msg);
+    request_deadline_free(deadline);
+    g_object_unref(session);
+
+    return response_text;
+}
+
+/*
+ * parse_responses_event:
+ * @obj: A Responses API stream event
+ *
+ * Like parse_stream_event() for the typed events of the Responses API.
+ * The stream ends with the response.completed event, which carries the
+ * response ID and the usage.
+ * Returns: FALSE if the event reports an error
+ */
+static gboolean
+parse_responses_event(JsonObject *obj,
+                      GString *accumulated,
+                      MChatGPTDeltaFunc delta_func,
+                      gpointer user_data,
+                      MStatsRecord *stats,
+                      gchar **response_id,
+                      gboolean *done,
+                      GError **error)
+{
+    const gchar *type = json_object_get_string_member_with_default(obj, "type", "");
+    JsonObject *response = NULL;
+
+    if (json_object_has_member(obj, "response") &&
+        JSON_NODE_HOLDS_OBJECT(json_object_get_member(obj, "response")))
+        response = json_object_get_object_member(obj, "response");
+
+    if (g_str_equal(type, "response.output_text.delta")) {
+        const gchar *text = json_object_get_string_member_with_default(obj, "delta", NULL);
+
+        if (text && *text) {
+            g_string_append(accumulated, text);
+            if (delta_func)
+                delta_func(text, user_data);
+        }
+    } else if (g_str_equal(type, "error") || g_str_equal(type, "response.failed")) {
+        JsonObject *err = obj;
+
+        if (response && json_object_has_member(response, "error") &&
+            JSON_NODE_HOLDS_OBJECT(json_object_get_member(response, "error")))
+            err = json_object_get_object_member(response, "error");
+
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Stream failed: %s",
+                    json_object_get_string_member_with_default(err, "message", "Unknown error"));
+        return FALSE;
+    } else if (response && (g_str_equal(type, "response.created") ||
+                            g_str_equal(type, "response.completed") ||
+                            g_str_equal(type, "response.incomplete"))) {
+        if (response_id) {
+            g_free(*response_id);
+            *response_id = g_strdup(json_object_get_string_member_with_default(response, "id", NULL));
+        }
+        if (!g_str_equal(type, "response.created")) {
+            log_usage(response, stats);
+            *done = TRUE;
+        }
+    }
+
+    return TRUE;
+}
+
+/*
+ * parse_stream_event:
+ * @data: The data payload of one server-sent event
+ * @accumulated: The text received so far
+ * @delta_func: Function to call with the new text
+ * @user_data: Data to pass to @delta_func
+ * @stats: (nullable): Record to add parse time and usage to
+ * @response_id: (out) (optional): Return location for the ID of a stored response
+ * @done: (out): Set to TRUE once the terminating event was seen
+ * @error: Return location for error
+ *
+ * Parse one chat completion chunk or Responses API event and append its
+ * content delta.
+ * Returns: FALSE if the event reports an error or cannot be parsed
+ */
+static gboolean
+parse_stream_event(const gchar *data,
+                   GString *accumulated,
+                   MChatGPTDeltaFunc delta_func,
+                   gpointer user_data,
+                   MStatsRecord *stats,
+                   gchar **response_id,
+                   gboolean *done,
+                   GError **error)
+{
+    JsonParser *parser;
+    JsonObject *obj;
+    gboolean success = TRUE;
+    gint64 parse_start;
+    gboolean parsed;
+
+    if (g_strcmp0(data, "[DONE]") == 0) {
+        *done = TRUE;
+        return TRUE;
+    }
+
+    parser = json_parser_new();
+    parse_start = g_get_monotonic_time();
+    parsed = json_parser_load_from_data(parser, data, -1, error);
+    if (stats)
+        stats->parse_us += g_get_monotonic_time() - parse_start;
+    if (!parsed) {
+        g_object_unref(parser);
+        return FALSE;
+    }
+
+    if (!JSON_NODE_HOLDS_OBJECT(json_parser_get_root(parser))) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "Invalid stream event: root is not an object");
+        g_object_unref(parser);
+        return FALSE;
+    }
+
+    obj = json_node_get_object(json_parser_get_root(parser));
+
+    if (json_object_has_member(obj, "error")) {
+        JsonObject *err = json_object_get_object_member(obj, "error");
+        const gchar *message = err ? json_object_get_string_member_with_default(err, "message", NULL) : NULL;
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                    "Stream failed: %s", message ? message : "Unknown error");
+        success = FALSE;
+    } else if (json_object_has_member(obj, "type")) {
+        success = parse_responses_event(obj, accumulated, delta_func, user_data, stats,
+                                        response_id, done, error);
+    } else if (json_object_has_member(obj, "choices")) {
+        JsonArray *choices = json_object_get_array_member(obj, "choices");
+        if (choices && json_array_get_length(choices) > 0) {
+            JsonObject *choice = json_array_get_object_element(choices, 0);
+            JsonObject *delta = json_object_has_member(choice, "delta") ?
+                json_object_get_object_member(choice, "delta") : NULL;
+            const gchar *text = delta ?
+                json_object_get_string_member_with_default(delta, "content", NULL) : NULL;
+
+            if (text && *text) {
+                g_string_append(accumulated, text);
+                if (delta_func)
+                    delta_func(text, user_data);
+            }
+        }
+        log_usage(obj, stats);
+    }
+
+    g_object_unref(parser);
+    return success;
+}
+
+/*
+ * parse_stream_line:
+ * @event_data: The data of the event being received
+ *
+ * Handle one line of a server-sent event stream: "data:" lines are
+ * collected in @event_data, and the empty line ending an event passes
+ * it to parse_stream_event().
+ * Returns: FALSE if an event reports an error or cannot be parsed
+ */
+static gboolean
+parse_stream_line(const gchar *line,
+                  gsize line_length,
+                  GString *event_data,
+                  GString *accumulated,
+                  MChatGPTDeltaFunc delta_func,
+                  gpointer user_data,
+                  MStatsRecord *stats,
+                  gchar **response_id,
+                  gboolean *done,
+                  GError **error)
+{
+    gboolean success = TRUE;
+
+    if (line_length == 0) {
+        if (event_data->len > 0) {
+            success = parse_stream_event(event_data->str, accumulated,
+                                         delta_func, user_data, stats, response_id, done, error);
+            g_string_truncate(event_data, 0);
+        }
+    } else if (g_str_has_prefix(line, "data:")) {
+        const gchar *value = line + strlen("data:");
+        if (*value == ' ')
+            value++;
+        if (event_data->len > 0)
+            g_string_append_c(event_data, '\n');
+        g_string_append(event_data, value);
+    }
+    // Comments (":") and other fields are ignored
+
+    return success;
+}
+
+gchar *
+m_chatgpt_proofread_stream(const gchar *content,
+                           const gchar *prompt_id,
+                           JsonArray *prompts,
+                           const MBackend *backend,
+                           const gchar *model,
+                           MChatGPTDeltaFunc delta_func,
+                           gpointer user_data,
+                           MStatsRecord *stats,
+                           GCancellable *cancellable,
+                           GError **error)
+{
+    SoupSession *session;
+    SoupMessage *msg;
+    GInputStream *stream;
+    GDataInputStream *data_stream;
+    GString *accumulated;
+    GString *event_data;
+    GBytes *request_body;
+    gchar *url;
+    MChatGPTPrompt prompt;
+    guint estimated_tokens;
+    RequestDeadline *deadline;
+    gboolean done = FALSE;
+    gboolean failed = FALSE;
+    GError *local_error = NULL;
+
+    model = m_backend_get_model(backend, model);
+    if (!m_chatgpt_prompt_lookup(prompts, prompt_id, &prompt)) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "Prompt not found for ID: %s", prompt_id);
+        return NULL;
+    }
+    estimated_tokens = m_chatgpt_prompt_estimate_tokens(&prompt, content);
+    if (stats)
+        stats->estimated_tokens = estimated_tokens;
+
+    request_body = build_request_json(&prompt, content, NULL, model, TRUE, NULL);
+    session = get_session();
+    deadline = request_deadline_new(request_timeout_s(&prompt, model, estimated_tokens, stats),
+                                    cancellable, NULL);
+
+    url = m_backend_build_url(backend, request_path(&prompt));
+    stream = send_scheduled(session, url, backend->api_key, request_body,
+                            M_SCHEDULER_PRIORITY_INTERACTIVE, stats, &msg,
+                            deadline, error);
+    g_bytes_unref(request_body);
+    g_free(url);
+    if (!stream) {
+        request_deadline_free(deadline);
+        g_object_unref(session);
+        return NULL;
+    }
+
+    guint status_code = soup_message_get_status(msg);
+    const char *reason = soup_message_get_reason_phrase(msg);
+    g_debug("HTTP Status: %d %s", status_code, reason ? reason : "Unknown");
+
+    if (!SOUP_STATUS_IS_SUCCESSFUL(status_code)) {
+        GOutputStream *body = g_memory_output_stream_new_resizable();
+        gchar *response_body;
+
+        // The error body is small; read it whole for the message
+        g_output_stream_splice(body, stream,
+                               G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                               deadline->cancellable, NULL);
+        g_output_stream_write(body, "", 1, NULL, NULL);
+        response_body = g_memory_output_stream_steal_data(G_MEMORY_OUTPUT_STREAM(body));
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                    "HTTP request failed with status %d: %s. Response: %s",
+                    status_code,
+                    reason ? reason : "Unknown error",
+                    response_body ? response_body : "");
+        g_free(response_body);
+        g_object_unref(body);
+        g_object_unref(stream);
+        record_message_metrics(msg, stats);
+        g_object_unref(msg);
+        request_deadline_free(deadline);
+        g_object_unref(session);
+        m_scheduler_release();
+        return NULL;
+    }
+
+    data_stream = g_data_input_stream_new(stream);
+    g_data_input_stream_set_newline_type(data_stream, G_DATA_STREAM_NEWLINE_TYPE_ANY);
+    accumulated = g_string_new(NULL);
+    event_data = g_string_new(NULL);
+
+    // Server-sent events: "data:" lines, terminated by an empty line
+    while (!done && !failed) {
+        gsize line_length;
+        gchar *line = g_data_input_stream_read_line(data_stream, &line_length,
+                                                    deadline->cancellable, &local_error);
+
+        if (!line) {
+            if (local_error) {
+                request_deadline_check(deadline, &local_error);
+                g_propagate_error(error, local_error);
+                local_error = NULL;
+                failed = TRUE;
+            } else if (event_data->len > 0) {
+                // Connection closed after an unterminated event
+                failed = !parse_stream_event(event_data->str, accumulated,
+                                             delta_func, user_data, stats, NULL, &done, error);
+            }
+            break;
+        }
+
+        failed = !parse_stream_line(line, line_length, event_data, accumulated,
+                                    delta_func, user_data, stats, NULL, &done, error);
+        g_free(line);
+    }
+
+    g_input_stream_close(G_INPUT_STREAM(data_stream), NULL, NULL);
+    g_object_unref(data_stream);
+    g_object_unref(stream);
+    record_message_metrics(msg, stats);
+    g_object_unref(msg);
+    request_deadline_free(deadline);
+    g_object_unref(session);
+    g_string_free(event_data, TRUE);
+    m_scheduler_release();
+
+    if (failed) {
+        g_string_free(accumulated, TRUE);
+        return NULL;
+    }
+
+    g_debug("Stream finished: %" G_GSIZE_FORMAT " bytes", accumulated->len);
+
+    if (accumulated->len == 0) {
+        g_string_free(accumulated, TRUE);
+        return NULL;
+    }
+
+    return g_string_free(accumulated, FALSE);
+}
+
+/*
+ * ProofreadRequest:
+ *
+ * The state of an asynchronous completion, the task data of its GTask.
+ * The scheduler slot is held from admission until the body is read.
+ */
+typedef struct {
+    SoupSession *session;
+    RequestDeadline *deadline;
+    gchar *url;
+    gchar *api_key;
+    GBytes *request_body;
+    gboolean stream;
+    MChatGPTDeltaFunc delta_func;
+    MChatGPTSentFunc sent_func;
+    gpointer user_data;
+    MStatsRecord *stats;
+    MSchedulerPriority priority;
+    guint attempt;
+    gint64 wait_start;
+    gboolean has_slot;
+    SoupMessage *msg;
+    GDataInputStream *lines;
+    GString *accumulated;
+    GString *event_data;
+    gboolean done;
+    gchar *response_id;
+} ProofreadRequest;
+
+static void
+proofread_request_release(ProofreadRequest *request)
+{
+    if (request->has_slot) {
+        m_scheduler_release();
+        request->has_slot = FALSE;
+    }
+}
+
+static void
+proofread_request_free(ProofreadRequest *request)
+{
+    proofread_request_release(request);
+    g_clear_object(&request->lines);
+    request_deadline_free(request->deadline);
+    g_clear_object(&request->msg);
+    g_object_unref(request->session);
+    g_free(request->url);
+    g_free(request->api_key);
+    g_bytes_unref(request->request_body);
+    if (request->accumulated)
+        g_string_free(request->accumulated, TRUE);
+    g_string_free(request->event_data, TRUE);
+    g_free(request->response_id);
+    g_free(request);
+}
+
+/*
+ * proofread_request_fail:
+ *
+ * Give up the slot and complete the task with @error.
+ */
+static void
+proofread_request_fail(GTask *task, GError *error)
+{
+    ProofreadRequest *request = g_task_get_task_data(task);
+
+    request_deadline_stop(request->deadline);
+    request_deadline_check(request->deadline, &error);
+    proofread_request_release(request);
+    record_message_metrics(request->msg, request->stats);
+    g_task_return_error(task, error);
+    g_object_unref(task);
+}
+
+static void proofread_request_acquire(GTask *task);
+static void proofread_request_read_line(GTask *task);
+
+static void
+proofread_request_slept_cb(GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+    GTask *task = user_data;
+    ProofreadRequest *request = g_task_get_task_data(task);
+    GError *error = NULL;
+
+    if (request->stats)
+        request->stats->queue_us += g_get_monotonic_time() - request->wait_start;
+
+    if (!m_scheduler_sleep_finish(result, &error)) {
+        proofread_request_fail(task, error);
+        return;
+    }
+
+    request->attempt++;
+    proofread_request_acquire(task);
+}
+
+/*
+ * proofread_request_body_cb:
+ *
+ * The whole body of a plain completion or of an error response was
+ * read: retry, fail or parse it.
+ */
+static void
+proofread_request_body_cb(GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+    GTask *task = user_data;
+    ProofreadRequest *request = g_task_get_task_data(task);
+    GOutputStream *output = G_OUTPUT_STREAM(source_object);
+    GError *error = NULL;
+    GBytes *body;
+    gint64 delay_us;
+    guint status;
+
+    if (g_output_stream_splice_finish(output, result, &error) < 0) {
+        proofread_request_fail(task, error);
+        return;
+    }
+
+    body = g_memory_output_stream_steal_as_bytes(G_MEMORY_OUTPUT_STREAM(output));
+    request_deadline_stop(request->deadline);
+    proofread_request_release(request);
+
+    delay_us = m_scheduler_handle_response(request->msg, body, request->attempt);
+    if (delay_us >= 0) {
+        g_bytes_unref(body);
+        g_clear_object(&request->msg);
+        if (request->stats)
+            request->stats->retries++;
+        request->wait_start = g_get_monotonic_time();
+        m_scheduler_sleep_async(delay_us, g_task_get_cancellable(task),
+                                proofread_request_slept_cb, task);
+        return;
+    }
+
+    record_message_metrics(request->msg, request->stats);
+    status = soup_message_get_status(request->msg);
+    g_debug("HTTP Status: %u", status);
+
+    if (SOUP_STATUS_IS_SUCCESSFUL(status)) {
+        gchar *text = parse_completion_response(body, request->stats, &request->response_id, &error);
+
+        if (error)
+            g_task_return_error(task, error);
+        else
+            g_task_return_pointer(task, text, g_free);
+    } else {
+        const char *reason = soup_message_get_reason_phrase(request->msg);
+        gchar *response_body = g_strndup(g_bytes_get_data(body, NULL), g_bytes_get_size(body));
+
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                                "HTTP request failed with status %u: %s. Response: %s",
+                                status, reason ? reason : "Unknown error", response_body);
+        g_free(response_body);
+    }
+
+    g_bytes_unref(body);
+    g_object_unref(task);
+}
+
+static void
+proofread_request_closed_cb(GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+    GTask *task = user_data;
+    ProofreadRequest *request = g_task_get_task_data(task);
+    GString *accumulated = request->accumulated;
+
+    g_input_stream_close_finish(G_INPUT_STREAM(source_object), result, NULL);
+    request_deadline_stop(request->deadline);
+    proofread_request_release(request);
+    record_message_metrics(request->msg, request->stats);
+
+    g_debug("Stream finished: %" G_GSIZE_FORMAT " bytes", accumulated->len);
+
+    // Hand the accumulated text over instead of copying it
+    if (accumulated->len == 0)
+        g_task_return_pointer(task, NULL, NULL);
+    else
+        g_task_return_pointer(task, g_string_free(g_steal_pointer(&request->accumulated), FALSE), g_free);
+    g_object_unref(task);
+}
+
+static void
+proofread_request_line_cb(GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+    GTask *task = user_data;
+    ProofreadRequest *request = g_task_get_task_data(task);
+    GError *error = NULL;
+    gboolean success = TRUE;
+    gboolean eof;
+    gsize line_length;
+    gchar *line;
+
+    line = g_data_input_stream_read_line_finish(request->lines, result, &line_length, &error);
+    eof = line == NULL;
+
+    if (line) {
+        success = parse_stream_line(line, line_length, request->event_data, request->accumulated,
+                                    request->delta_func, request->user_data, request->stats,
+                                    &request->response_id, &request->done, &error);
+    } else if (!error && request->event_data->len > 0) {
+        // Connection closed after an unterminated event
+        success = parse_stream_event(request->event_data->str, request->accumulated,
+                                     request->delta_func, request->user_data, request->stats,
+                                     &request->response_id, &request->done, &error);
+    }
+    g_free(line);
+
+    if (error || !success) {
+        if (!error)
+            error = g_error_new(G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid stream event");
+        proofread_request_fail(task, error);
+        return;
+    }
+
+    if (eof || request->done) {
+        g_input_stream_close_async(G_INPUT_STREAM(request->lines), G_PRIORITY_DEFAULT, NULL,
+                                   proofread_request_closed_cb, task);
+        return;
+    }
+
+    proofread_request_read_line(task);
+}
+
+static void
+proofread_request_read_line(GTask *task)
+{
+    ProofreadRequest *request = g_task_get_task_data(task);
+
+    g_data_input_stream_read_line_async(request->lines, G_PRIORITY_DEFAULT,
+                                        request->deadline->cancellable,
+                                        proofread_request_line_cb, task);
+}
+
+/*
+ * proofread_request_sent_cb:
+ *
+ * The response headers arrived: stream the events of a successful
+ * streamed completion, read anything else whole.
+ */
+static void
+proofread_request_sent_cb(GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+    GTask *task = user_data;
+    ProofreadRequest *request = g_task_get_task_data(task);
+    GError *error = NULL;
+    GInputStream *stream;
+
+    stream = soup_session_send_finish(SOUP_SESSION(source_object), result, &error);
+    if (!stream) {
+        proofread_request_fail(task, error);
+        return;
+    }
+
+    if (request->stream && SOUP_STATUS_IS_SUCCESSFUL(soup_message_get_status(request->msg))) {
+        m_scheduler_handle_response(request->msg, NULL, request->attempt);
+        request->lines = g_data_input_stream_new(stream);
+        g_data_input_stream_set_newline_type(request->lines, G_DATA_STREAM_NEWLINE_TYPE_ANY);
+        proofread_request_read_line(task);
+    } else {
+        GOutputStream *output = g_memory_output_stream_new_resizable();
+
+        g_output_stream_splice_async(output, stream,
+                                     G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+                                     G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                                     G_PRIORITY_DEFAULT, request->deadline->cancellable,
+                                     proofread_request_body_cb, task);
+        g_object_unref(output);
+    }
+
+    g_object_unref(stream);
+}
+
+static void
+proofread_request_acquired_cb(GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+    GTask *task = user_data;
+    ProofreadRequest *request = g_task_get_task_data(task);
+    GError *error = NULL;
+
+    if (request->stats)
+        request->stats->queue_us += g_get_monotonic_time() - request->wait_start;
+
+    if (!m_scheduler_acquire_finish(result, &error)) {
+        proofread_request_fail(task, error);
+        return;
+    }
+    request->has_slot = TRUE;
+
+    request->msg = create_request_message("POST", request->url, request->api_key, NULL,
+                                          request->request_body, &error);
+    if (!request->msg) {
+        proofread_request_fail(task, error);
+        return;
     }
-    return NULL;
+
+    g_debug("Sending %srequest to %s", request->stream ? "streaming " : "", request->url);
+    request_deadline_start(request->deadline, request->msg);
+    soup_session_send_async(request->session, request->msg, G_PRIORITY_DEFAULT,
+                            request->deadline->cancellable, proofread_request_sent_cb, task);
+
+    if (request->sent_func)
+        request->sent_func(request->user_data);
 }
 
-gchar *
-m_chatgpt_proofread(const gchar *content,
-                    const gchar *prompt_id,
-                    JsonArray *prompts,
-                    const gchar *api_key,
-                    const gchar *model,
-                    GError **error)
+static void
+proofread_request_acquire(GTask *task)
 {
-    SoupSession *session;
-    SoupMessage *msg;
-    JsonBuilder *builder;
-    JsonGenerator *generator;
-    JsonNode *root;
-    gchar *json_data;
-    const gchar *prompt_text;
-    gchar *response_text = NULL;
-    
-    prompt_text = find_prompt_text(prompts, prompt_id);
-    if (!prompt_text) {
-        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
-                   "Prompt not found for ID: %s", prompt_id);
-        return NULL;
-    }
+    ProofreadRequest *request = g_task_get_task_data(task);
 
-    // Build request JSON
-    builder = json_builder_new();
-    json_builder_begin_object(builder);
-    json_builder_set_member_name(builder, "model");
-    json_builder_add_string_value(builder, model ? model : "gpt-4o");
-    json_builder_set_member_name(builder, "messages");
-    json_builder_begin_array(builder);
-    
-    // System message with prompt
-    json_builder_begin_object(builder);
-    json_builder_set_member_name(builder, "role");
-    json_builder_add_string_value(builder, "system");
-    json_builder_set_member_name(builder, "content");
-    json_builder_add_string_value(builder, prompt_text);
-    json_builder_end_object(builder);
-    
-    // User message with content
-    json_builder_begin_object(builder);
-    json_builder_set_member_name(builder, "role");
-    json_builder_add_string_value(builder, "user");
-    json_builder_set_member_name(builder, "content");
-    json_builder_add_string_value(builder, content);
-    json_builder_end_object(builder);
-    
-    json_builder_end_array(builder);
-    json_builder_end_object(builder);
+    request->wait_start = g_get_monotonic_time();
+    m_scheduler_acquire_async(request->priority, g_task_get_cancellable(task),
+                              proofread_request_acquired_cb, task);
+}
 
-    // Generate JSON string
-    generator = json_generator_new();
-    root = json_builder_get_root(builder);
-    json_generator_set_root(generator, root);
-    json_data = json_generator_to_data(generator, NULL);
-    g_debug("Sending request: %s", json_data);
-
-    // Create HTTP session and message
-    session = soup_session_new_with_options(
-        "timeout", 30,
-        "idle-timeout", 0,
-        NULL);
-    
-    msg = soup_message_new("POST", CHATGPT_API_URL);
-    if (!msg) {
-        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                    "Failed to create HTTP message for URL: %s", CHATGPT_API_URL);
-        g_object_unref(session);
-        return NULL;
-    }
-    
-    // Set headers
-    gchar *auth_header = g_strdup_printf("Bearer %s", api_key);
-    soup_message_headers_append(soup_message_get_request_headers(msg),
-                              "Authorization", auth_header);
-    soup_message_headers_append(soup_message_get_request_headers(msg),
-                              "Content-Type", "application/json");
-    soup_message_headers_append(soup_message_get_request_headers(msg),
-                               "User-Agent", CHATGPT_API_USER_AGENT);
-    
-    // Set request body
-    GBytes *request_body = g_bytes_new(json_data, strlen(json_data));
-    soup_message_set_request_body_from_bytes(msg, "application/json", request_body);
-    g_bytes_unref(request_body);
+void
+m_chatgpt_proofread_async(const gchar *content,
+                          const gchar *prediction,
+                          const gchar *prompt_id,
+                          JsonArray *prompts,
+                          const MBackend *backend,
+                          const gchar *model,
+                          const gchar *previous_response_id,
+                          gboolean stream,
+                          MChatGPTDeltaFunc delta_func,
+                          MChatGPTSentFunc sent_func,
+                          gpointer user_data,
+                          MStatsRecord *stats,
+                          MSchedulerPriority priority,
+                          GCancellable *cancellable,
+                          GAsyncReadyCallback callback,
+                          gpointer callback_data)
+{
+    ProofreadRequest *request;
+    MChatGPTPrompt prompt;
+    guint estimated_tokens;
+    GTask *task;
 
-    // Send request
-    GBytes *response = NULL;
-    GError *local_error = NULL;
-    
-    g_debug("Sending request to %s", CHATGPT_API_URL);
-    response = soup_session_send_and_read(session, msg, NULL, &local_error);
-    
-    // Check HTTP status code
-    guint status_code = soup_message_get_status(msg);
-    const char *reason = soup_message_get_reason_phrase(msg);
-    g_debug("HTTP Status: %d %s", status_code, reason ? reason : "Unknown");
-    
-    if (SOUP_STATUS_IS_SUCCESSFUL(status_code)) {
-        g_debug("HTTP request successful with status %d", status_code);
-    } else {
-        const char *response_body = "";
-        if (response) {
-            gsize length;
-            response_body = g_bytes_get_data(response, &length);
-        }
-        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                    "HTTP request failed with status %d: %s. Response: %s",
-                    status_code,
-                    reason ? reason : "Unknown error",
-                    response_body);
-        goto cleanup;
-    }
+    task = g_task_new(NULL, cancellable, callback, callback_data);
+    g_task_set_source_tag(task, m_chatgpt_proofread_async);
 
-    if (response) {
-        gsize response_length;
-        const gchar *response_data = g_bytes_get_data(response, &response_length);
-        g_debug("Got response: %.*s", (int)response_length, response_data);
-        
-        // Parse response JSON
-        JsonParser *parser = json_parser_new();
-        if (json_parser_load_from_data(parser, response_data, response_length, error)) {
-            JsonNode *root = json_parser_get_root(parser);
-            if (!JSON_NODE_HOLDS_OBJECT(root)) {
-                g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
-                           "Invalid JSON response: root is not an object");
-                g_object_unref(parser);
-                g_bytes_unref(response);
-                return NULL;
-            }
-            
-            JsonObject *obj = json_node_get_object(root);
-            if (!json_object_has_member(obj, "choices")) {
-                g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
-                           "Invalid JSON response: no 'choices' array");
-                g_object_unref(parser);
-                g_bytes_unref(response);
-                return NULL;
-            }
-            
-            JsonArray *choices = json_object_get_array_member(obj, "choices");
-            if (choices && json_array_get_length(choices) > 0) {
-                JsonObject *choice = json_array_get_object_element(choices, 0);
-                if (!json_object_has_member(choice, "message")) {
-                    g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
-                               "Invalid JSON response: no 'message' object in choice");
-                    g_object_unref(parser);
-                    g_bytes_unref(response);
-                    return NULL;
-                }
-                
-                JsonObject *message = json_object_get_object_member(choice, "message");
-                if (!json_object_has_member(message, "content")) {
-                    g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
-                               "Invalid JSON response: no 'content' in message");
-                    g_object_unref(parser);
-                    g_bytes_unref(response);
-                    return NULL;
-                }
-                
-                response_text = g_strdup(json_object_get_string_member(message, "content"));
-            }
-        } else {
-            if (!*error) {
-                g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
-                           "Failed to parse JSON response");
-            }
-        }
-        
-        g_object_unref(parser);
-        g_bytes_unref(response);
-    } else if (local_error) {
-        g_propagate_error(error, local_error);
-    } else {
-        if (!*error) {
-            g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                       "No response from API");
-        }
+    model = m_backend_get_model(backend, model);
+    if (!m_chatgpt_prompt_lookup(prompts, prompt_id, &prompt)) {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                                "Prompt not found for ID: %s", prompt_id);
+        g_object_unref(task);
+        return;
     }
+    estimated_tokens = m_chatgpt_prompt_estimate_tokens(&prompt, content);
+    if (stats)
+        stats->estimated_tokens = estimated_tokens;
 
-cleanup:
-    // Cleanup
-    g_free(auth_header);
-    g_free(json_data);
-    g_object_unref(generator);
-    json_node_free(root);
-    g_object_unref(builder);
-    g_object_unref(msg);
-    g_object_unref(session);
+    request = g_new0(ProofreadRequest, 1);
+    request->session = get_session();
+    request->deadline = request_deadline_new(request_timeout_s(&prompt, model, estimated_tokens, stats),
+                                             cancellable, g_task_get_context(task));
+    request->url = m_backend_build_url(backend, request_path(&prompt));
+    request->api_key = g_strdup(backend->api_key);
+    request->request_body = build_request_json(&prompt, content, prediction, model, stream, previous_response_id);
+    request->stream = stream;
+    request->delta_func = delta_func;
+    request->sent_func = sent_func;
+    request->user_data = user_data;
+    request->stats = stats;
+    request->priority = priority;
+    request->accumulated = g_string_new(NULL);
+    request->event_data = g_string_new(NULL);
+    g_task_set_task_data(task, request, (GDestroyNotify)proofread_request_free);
 
-    return response_text;
+    proofread_request_acquire(task);
+}
+
+gchar *
+m_chatgpt_proofread_finish(GAsyncResult *result, GError **error)
+{
+    g_return_val_if_fail(g_task_is_valid(result, NULL), NULL);
+
+    return g_task_propagate_pointer(G_TASK(result), error);
 }
 
-#define CHATGPT_MODELS_URL "https://api.openai.com/v1/models"
+const gchar *
+m_chatgpt_proofread_get_response_id(GAsyncResult *result)
+{
+    ProofreadRequest *request;
+
+    g_return_val_if_fail(g_task_is_valid(result, NULL), NULL);
+
+    request = g_task_get_task_data(G_TASK(result));
+    return request ? request->response_id : NULL;
+}
 
 static gint
 compare_model_ids(gconstpointer a, gconstpointer b)
@@ -227,42 +1967,42 @@ compare_model_ids(gconstpointer a, gconstpointer b)
 }
 
 GList *
-m_chatgpt_fetch_models(const gchar *api_key, GError **error)
+m_chatgpt_fetch_models(const MBackend *backend,
+                       GCancellable *cancellable,
+                       GError **error)
 {
     SoupSession *session;
     SoupMessage *msg;
     GBytes *response = NULL;
     GError *local_error = NULL;
     GList *models = NULL;
+    MStatsRecord *stats;
+    RequestDeadline *deadline;
+    gchar *url;
 
-    g_return_val_if_fail(api_key != NULL, NULL);
+    g_return_val_if_fail(backend != NULL, NULL);
 
-    // Create HTTP session and message
-    session = soup_session_new_with_options(
-        "timeout", 30,
-        "idle-timeout", 0,
-        NULL);
+    // Use the shared HTTP session
+    session = get_session();
+    stats = m_stats_record_new(M_STATS_KIND_MODELS, NULL, NULL);
+    deadline = request_deadline_new(CHATGPT_API_TIMEOUT_S, cancellable, NULL);
 
-    msg = soup_message_new("GET", CHATGPT_MODELS_URL);
+    // Send request, after any interactive ones
+    url = m_backend_build_url(backend, CHATGPT_MODELS_PATH);
+    g_debug("Fetching models from %s", url);
+    response = send_and_read_scheduled(session, "GET", url, backend->api_key, NULL, NULL,
+                                       M_SCHEDULER_PRIORITY_BACKGROUND, stats, &msg,
+                                       deadline, &local_error);
+    request_deadline_free(deadline);
+    g_free(url);
     if (!msg)
     {
-        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                    "Failed to create HTTP message for URL: %s", CHATGPT_MODELS_URL);
+        g_propagate_error(error, local_error);
+        m_stats_record_free(stats);
         g_object_unref(session);
         return NULL;
     }
 
-    // Set headers
-    gchar *auth_header = g_strdup_printf("Bearer %s", api_key);
-    soup_message_headers_append(soup_message_get_request_headers(msg),
-                                "Authorization", auth_header);
-    soup_message_headers_append(soup_message_get_request_headers(msg),
-                                "User-Agent", CHATGPT_API_USER_AGENT);
-
-    // Send request
-    g_debug("Fetching models from %s", CHATGPT_MODELS_URL);
-    response = soup_session_send_and_read(session, msg, NULL, &local_error);
-
     // Check HTTP status code
     guint status_code = soup_message_get_status(msg);
     const char *reason = soup_message_get_reason_phrase(msg);
@@ -291,7 +2031,10 @@ m_chatgpt_fetch_models(const gchar *api_key, GError **error)
 
         // Parse response JSON
         JsonParser *parser = json_parser_new();
-        if (json_parser_load_from_data(parser, response_data, response_length, error))
+        gint64 parse_start = g_get_monotonic_time();
+        gboolean parsed = json_parser_load_from_data(parser, response_data, response_length, error);
+        stats->parse_us = g_get_monotonic_time() - parse_start;
+        if (parsed)
         {
             JsonNode *root = json_parser_get_root(parser);
             if (!JSON_NODE_HOLDS_OBJECT(root))
@@ -319,8 +2062,8 @@ m_chatgpt_fetch_models(const gchar *api_key, GError **error)
                 JsonObject *model_obj = json_array_get_object_element(data, i);
                 const gchar *model_id = json_object_get_string_member(model_obj, "id");
 
-                // Only include gpt models suitable for chat completions
-                if (model_id && g_str_has_prefix(model_id, "gpt-"))
+                // Only include models suitable for chat completions
+                if (m_backend_accepts_model(backend, model_id))
                 {
                     models = g_list_prepend(models, g_strdup(model_id));
                 }
@@ -343,9 +2086,438 @@ cleanup:
         g_bytes_unref(response);
     if (local_error)
         g_error_free(local_error);
-    g_free(auth_header);
+    stats->success = models != NULL;
+    m_stats_record_set_error(stats, error ? *error : NULL);
+    m_stats_commit(stats);
     g_object_unref(msg);
     g_object_unref(session);
 
     return models;
-}
\ No newline at end of file
+}
+
+/*
+ * batch_request:
+ * @content_type: (nullable): The type of @request_body, NULL for JSON
+ *
+ * Send a request of the Batch or Files API after any interactive ones.
+ * Nobody is waiting for these, so they are not recorded in the stats.
+ * Returns: (transfer full) (nullable): The body of a successful response
+ */
+static GBytes *
+batch_request(const MBackend *backend,
+              const gchar *method,
+              const gchar *path,
+              const gchar *content_type,
+              GBytes *request_body,
+              GCancellable *cancellable,
+              GError **error)
+{
+    SoupSession *session = get_session();
+    RequestDeadline *deadline = request_deadline_new(CHATGPT_API_TIMEOUT_S, cancellable, NULL);
+    SoupMessage *msg;
+    GBytes *response;
+    GError *local_error = NULL;
+    gchar *url;
+
+    url = m_backend_build_url(backend, path);
+    response = send_and_read_scheduled(session, method, url, backend->api_key, content_type, request_body,
+                                       M_SCHEDULER_PRIORITY_BACKGROUND, NULL, &msg,
+                                       deadline, &local_error);
+    request_deadline_free(deadline);
+    g_free(url);
+    g_object_unref(session);
+    if (!msg) {
+        g_propagate_error(error, local_error);
+        return NULL;
+    }
+
+    if (local_error) {
+        g_propagate_error(error, local_error);
+        g_clear_pointer(&response, g_bytes_unref);
+    } else if (!SOUP_STATUS_IS_SUCCESSFUL(soup_message_get_status(msg))) {
+        const char *reason = soup_message_get_reason_phrase(msg);
+        gsize length = 0;
+        const gchar *response_body = response ? g_bytes_get_data(response, &length) : "";
+
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                    "HTTP request failed with status %d: %s. Response: %.*s",
+                    soup_message_get_status(msg),
+                    reason ? reason : "Unknown error",
+                    (int)length, response_body);
+        g_clear_pointer(&response, g_bytes_unref);
+    }
+
+    g_object_unref(msg);
+    return response;
+}
+
+/*
+ * batch_request_object:
+ *
+ * Like batch_request() for requests answered with a JSON object.
+ * Returns: (transfer full) (nullable): The object
+ */
+static JsonObject *
+batch_request_object(const MBackend *backend,
+                     const gchar *method,
+                     const gchar *path,
+                     const gchar *content_type,
+                     GBytes *request_body,
+                     GCancellable *cancellable,
+                     GError **error)
+{
+    GBytes *response;
+    JsonParser *parser;
+    JsonObject *obj = NULL;
+    gsize length;
+    const gchar *data;
+
+    response = batch_request(backend, method, path, content_type, request_body, cancellable, error);
+    if (!response)
+        return NULL;
+
+    data = g_bytes_get_data(response, &length);
+    parser = json_parser_new();
+    if (json_parser_load_from_data(parser, data, length, error)) {
+        if (JSON_NODE_HOLDS_OBJECT(json_parser_get_root(parser)))
+            obj = json_object_ref(json_node_get_object(json_parser_get_root(parser)));
+        else
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                        "Invalid JSON response: root is not an object");
+    }
+
+    g_object_unref(parser);
+    g_bytes_unref(response);
+    return obj;
+}
+
+/*
+ * batch_object_get_id:
+ * @obj: (transfer full) (nullable): A created file or batch
+ *
+ * Returns: (transfer full) (nullable): The ID of @obj
+ */
+static gchar *
+batch_object_get_id(JsonObject *obj, GError **error)
+{
+    gchar *id;
+
+    if (!obj)
+        return NULL;
+
+    id = g_strdup(json_object_get_string_member_with_default(obj, "id", NULL));
+    if (!id)
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "Invalid JSON response: no 'id'");
+    json_object_unref(obj);
+    return id;
+}
+
+/*
+ * build_batch_input:
+ *
+ * Build the JSONL input file of a batch: one line per request, wrapping
+ * the same chat completion body an interactive request would send.
+ * Returns: (transfer full): The file contents
+ */
+static GBytes *
+build_batch_input(const MChatGPTPrompt *prompt,
+                  GPtrArray *ids,
+                  GPtrArray *contents,
+                  const gchar *model)
+{
+    GString *input = g_string_new(NULL);
+
+    for (guint i = 0; i < contents->len; i++) {
+        GBytes *body = build_request_json(prompt, g_ptr_array_index(contents, i), NULL, model, FALSE, NULL);
+        JsonNode *id_node = json_node_init_string(json_node_alloc(), g_ptr_array_index(ids, i));
+        gchar *id_json = json_to_string(id_node, FALSE);
+        gsize length;
+        const gchar *data = g_bytes_get_data(body, &length);
+
+        g_string_append_printf(input, "{\"custom_id\": %s, \"method\": \"POST\", \"url\": \"%s\", \"body\": ",
+                               id_json, CHATGPT_BATCH_ENDPOINT);
+        g_string_append_len(input, data, length);
+        g_string_append(input, "}\n");
+
+        g_free(id_json);
+        json_node_unref(id_node);
+        g_bytes_unref(body);
+    }
+
+    return g_string_free_to_bytes(input);
+}
+
+gchar *
+m_chatgpt_batch_submit(GPtrArray *ids,
+                       GPtrArray *contents,
+                       const gchar *prompt_id,
+                       JsonArray *prompts,
+                       const MBackend *backend,
+                       const gchar *model,
+                       GCancellable *cancellable,
+                       GError **error)
+{
+    MChatGPTPrompt prompt;
+    SoupMultipart *multipart;
+    SoupMessageHeaders *headers;
+    JsonBuilder *builder;
+    GBytes *input;
+    GBytes *upload;
+    GBytes *request_body;
+    gchar *file_id;
+    gchar *batch_id;
+
+    g_return_val_if_fail(ids != NULL && contents != NULL, NULL);
+    g_return_val_if_fail(ids->len == contents->len, NULL);
+    g_return_val_if_fail(backend != NULL, NULL);
+
+    model = m_backend_get_model(backend, model);
+    if (!m_chatgpt_prompt_lookup(prompts, prompt_id, &prompt)) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "Prompt not found for ID: %s", prompt_id);
+        return NULL;
+    }
+    // Nobody waits for a batch, so predicted output would only add billed
+    // rejections, and a conversation has no earlier response to continue
+    prompt.predict = FALSE;
+    prompt.conversation = FALSE;
+
+    // Upload the requests as a JSONL file
+    input = build_batch_input(&prompt, ids, contents, model);
+    multipart = soup_multipart_new(SOUP_FORM_MIME_TYPE_MULTIPART);
+    soup_multipart_append_form_string(multipart, "purpose", "batch");
+    soup_multipart_append_form_file(multipart, "file", "proofread.jsonl", "application/jsonl", input);
+    headers = soup_message_headers_new(SOUP_MESSAGE_HEADERS_MULTIPART);
+    soup_multipart_to_message(multipart, headers, &upload);
+    soup_multipart_free(multipart);
+    g_bytes_unref(input);
+
+    g_debug("Uploading %u batch requests (%" G_GSIZE_FORMAT " bytes)", contents->len, g_bytes_get_size(upload));
+    file_id = batch_object_get_id(
+        batch_request_object(backend, "POST", CHATGPT_FILES_PATH,
+                             soup_message_headers_get_one(headers, "Content-Type"), upload,
+                             cancellable, error),
+        error);
+    soup_message_headers_unref(headers);
+    g_bytes_unref(upload);
+    if (!file_id)
+        return NULL;
+
+    // Start the job on it
+    builder = json_builder_new();
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "input_file_id");
+    json_builder_add_string_value(builder, file_id);
+    json_builder_set_member_name(builder, "endpoint");
+    json_builder_add_string_value(builder, CHATGPT_BATCH_ENDPOINT);
+    json_builder_set_member_name(builder, "completion_window");
+    json_builder_add_string_value(builder, CHATGPT_BATCH_WINDOW);
+    json_builder_end_object(builder);
+    request_body = serialize_request(builder);
+
+    batch_id = batch_object_get_id(
+        batch_request_object(backend, "POST", CHATGPT_BATCHES_PATH, NULL, request_body,
+                             cancellable, error),
+        error);
+    if (batch_id)
+        g_debug("Created batch %s from file %s", batch_id, file_id);
+
+    g_bytes_unref(request_body);
+    g_free(file_id);
+    return batch_id;
+}
+
+/*
+ * parse_batch_output:
+ * @output: The JSONL output file of a batch
+ *
+ * Returns: (transfer full): Table of custom IDs to the content of their
+ *          response, without the requests that failed
+ */
+static GHashTable *
+parse_batch_output(GBytes *output)
+{
+    GHashTable *results = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    JsonParser *parser = json_parser_new();
+    gsize length;
+    const gchar *data = g_bytes_get_data(output, &length);
+    const gchar *end = data + length;
+
+    while (data < end) {
+        const gchar *line_end = memchr(data, '\n', end - data);
+        gsize line_length = (line_end ? line_end : end) - data;
+        GError *error = NULL;
+
+        if (line_length > 0 && json_parser_load_from_data(parser, data, line_length, &error) &&
+            JSON_NODE_HOLDS_OBJECT(json_parser_get_root(parser))) {
+            JsonObject *obj = json_node_get_object(json_parser_get_root(parser));
+            const gchar *custom_id = json_object_get_string_member_with_default(obj, "custom_id", NULL);
+            JsonObject *response = NULL;
+            JsonObject *body = NULL;
+            gchar *text = NULL;
+
+            if (json_object_has_member(obj, "response") &&
+                JSON_NODE_HOLDS_OBJECT(json_object_get_member(obj, "response")))
+                response = json_object_get_object_member(obj, "response");
+            if (response && json_object_has_member(response, "body") &&
+                JSON_NODE_HOLDS_OBJECT(json_object_get_member(response, "body")) &&
+                SOUP_STATUS_IS_SUCCESSFUL(json_object_get_int_member_with_default(response, "status_code", 0)))
+                body = json_object_get_object_member(response, "body");
+
+            if (body)
+                text = parse_completion_object(body, NULL, NULL, &error);
+            if (custom_id && text)
+                g_hash_table_insert(results, g_strdup(custom_id), g_steal_pointer(&text));
+            else
+                g_debug("Batch request %s failed%s%s", custom_id ? custom_id : "(unknown)",
+                        error ? ": " : "", error ? error->message : "");
+            g_free(text);
+        } else if (error) {
+            g_debug("Invalid line in batch output: %s", error->message);
+        }
+
+        g_clear_error(&error);
+        data += line_length + 1;
+    }
+
+    g_object_unref(parser);
+    return results;
+}
+
+gboolean
+m_chatgpt_batch_poll(const MBackend *backend,
+                     const gchar *batch_id,
+                     GHashTable **results,
+                     GCancellable *cancellable,
+                     GError **error)
+{
+    JsonObject *batch;
+    const gchar *status;
+    const gchar *output_file_id;
+    gchar *path;
+    gboolean over = TRUE;
+
+    g_return_val_if_fail(backend != NULL, FALSE);
+    g_return_val_if_fail(batch_id != NULL, FALSE);
+    g_return_val_if_fail(results != NULL, FALSE);
+
+    *results = NULL;
+
+    path = g_strconcat(CHATGPT_BATCHES_PATH, "/", batch_id, NULL);
+    batch = batch_request_object(backend, "GET", path, NULL, NULL, cancellable, error);
+    g_free(path);
+    if (!batch)
+        return FALSE;
+
+    status = json_object_get_string_member_with_default(batch, "status", "");
+    output_file_id = json_object_get_string_member_with_default(batch, "output_file_id", NULL);
+    g_debug("Batch %s is %s", batch_id, status);
+
+    // An expired job still returns what it finished in time
+    if (g_str_equal(status, "completed") || g_str_equal(status, "expired")) {
+        GBytes *output;
+
+        if (!output_file_id) {
+            *results = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+        } else {
+            path = g_strconcat(CHATGPT_FILES_PATH, "/", output_file_id, "/content", NULL);
+            output = batch_request(backend, "GET", path, NULL, NULL, cancellable, error);
+            g_free(path);
+            if (output) {
+                *results = parse_batch_output(output);
+                g_bytes_unref(output);
+            } else {
+                // The results are still there on the next poll
+                over = FALSE;
+            }
+        }
+    } else if (g_str_equal(status, "failed") || g_str_equal(status, "cancelled") ||
+               g_str_equal(status, "cancelling")) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                    "Batch job %s %s", batch_id, status);
+    } else {
+        over = FALSE;
+    }
+
+    json_object_unref(batch);
+    return over;
+}
+
+static void
+prewarm_task_thread(GTask *task,
+                    gpointer source_object,
+                    gpointer task_data,
+                    GCancellable *cancellable)
+{
+    SoupSession *session = get_session();
+    RequestDeadline *deadline = request_deadline_new(CHATGPT_API_TIMEOUT_S, cancellable, NULL);
+    const gchar *url = task_data;
+    SoupMessage *msg;
+    GBytes *response;
+    GError *error = NULL;
+
+    /* An unauthenticated HEAD is answered immediately (usually with 401),
+     * but it leaves a resolved, TLS-established connection in the pool. */
+    msg = soup_message_new("HEAD", url);
+    if (msg)
+    {
+        request_deadline_start(deadline, msg);
+        response = soup_session_send_and_read(session, msg, deadline->cancellable, &error);
+        request_deadline_check(deadline, &error);
+        if (error)
+        {
+            g_debug("Connection pre-warm failed: %s", error->message);
+            g_error_free(error);
+        }
+        else
+        {
+            g_debug("Connection pre-warmed (HTTP %u)", soup_message_get_status(msg));
+        }
+
+        if (response)
+            g_bytes_unref(response);
+        g_object_unref(msg);
+    }
+
+    request_deadline_free(deadline);
+    g_object_unref(session);
+    g_task_return_boolean(task, TRUE);
+}
+
+void
+m_chatgpt_prewarm(const MBackend *backend)
+{
+    GTask *task;
+    gboolean warm;
+
+    g_mutex_lock(&session_lock);
+    warm = shared_session != NULL &&
+           g_get_monotonic_time() - last_activity_us < CHATGPT_PREWARM_INTERVAL_US;
+    g_mutex_unlock(&session_lock);
+
+    if (warm)
+        return;
+
+    task = g_task_new(NULL, NULL, NULL, NULL);
+    g_task_set_task_data(task, m_backend_build_url(backend, CHATGPT_MODELS_PATH), g_free);
+    g_task_run_in_thread(task, prewarm_task_thread);
+    g_object_unref(task);
+}
+
+void
+m_chatgpt_shutdown(void)
+{
+    SoupSession *session;
+
+    g_mutex_lock(&session_lock);
+    session = shared_session;
+    shared_session = NULL;
+    g_mutex_unlock(&session_lock);
+
+    if (session)
+    {
+        soup_session_abort(session);
+        g_object_unref(session);
+    }
+}
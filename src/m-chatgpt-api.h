@@ -1,39 +1,376 @@
 #ifndef M_CHATGPT_API_H
 #define M_CHATGPT_API_H
 
+#include <gio/gio.h>
 #include <json-glib/json-glib.h>
 
+#include "m-backend.h"
+#include "m-scheduler.h"
+#include "m-stats.h"
+
+/**
+ * MChatGPTDeltaFunc:
+ * @delta: The newly received piece of text
+ * @user_data: The data passed to m_chatgpt_proofread_stream()
+ *
+ * Called for every content delta of a streamed completion. It is invoked
+ * on the thread running the request, or in the main context of the
+ * caller of m_chatgpt_proofread_async().
+ */
+typedef void (*MChatGPTDeltaFunc)(const gchar *delta, gpointer user_data);
+
+/**
+ * MChatGPTSentFunc:
+ * @user_data: The data passed to m_chatgpt_proofread_async()
+ *
+ * Called when the scheduler admitted a request and it was handed to the
+ * connection, again for every retry.
+ */
+typedef void (*MChatGPTSentFunc)(gpointer user_data);
+
+/**
+ * m_chatgpt_find_prompt:
+ * @prompts: Array of prompt configurations
+ * @prompt_id: The prompt identifier, with or without the "ai-proofread-" prefix
+ *
+ * Look up a prompt configuration by its name.
+ *
+ * Returns: (transfer none) (nullable): The prompt object, or NULL if not found
+ */
+JsonObject *m_chatgpt_find_prompt(JsonArray *prompts, const gchar *prompt_id);
+
+/**
+ * MChatGPTPrompt:
+ * @name: The prompt name
+ * @text: The system prompt
+ * @model: (nullable): The model to use instead of the selected one
+ * @max_tokens: Maximum number of output tokens, 0 for no limit
+ * @temperature: The sampling temperature, negative for the server default
+ * @reasoning_effort: (nullable): The reasoning effort of reasoning models,
+ *                    e.g. "low"
+ * @service_tier: (nullable): The service tier, e.g. "priority" or "flex"
+ * @timeout_s: Seconds without data before the request fails, 0 for the
+ *             default of 30; at most 600 are used
+ * @stream: Whether to stream the reply
+ * @predict: Whether to send the content as predicted output
+ * @edits: Whether the reply is an edit list, see m_edits_apply()
+ * @conversation: Whether the prompt runs on the Responses API with stored
+ *                responses, which follow-up requests can continue
+ * @cache_key: (nullable): The prompt_cache_key sent with the request, by
+ *             default the prompt name
+ * @max_input_tokens: Estimated input tokens to trim quoted context to, 0
+ *                    for no limit
+ * @small_model: (nullable): The model to use for requests estimated below
+ *               @small_below_tokens
+ * @small_below_tokens: Size of a small request, see m_chatgpt_prompt_route_model()
+ *
+ * The settings of one entry of prompts.json. The strings belong to the
+ * prompts array and stay valid as long as it does. Edit lists can neither
+ * be streamed nor predicted, so @stream and @predict are FALSE for them;
+ * @predict is also FALSE for conversation prompts and with @max_tokens.
+ */
+typedef struct _MChatGPTPrompt MChatGPTPrompt;
+
+struct _MChatGPTPrompt
+{
+    const gchar *name;
+    const gchar *text;
+    const gchar *model;
+    gint64 max_tokens;
+    gdouble temperature;
+    const gchar *reasoning_effort;
+    const gchar *service_tier;
+    guint timeout_s;
+    gboolean stream;
+    gboolean predict;
+    gboolean edits;
+    gboolean conversation;
+    const gchar *cache_key;
+    guint max_input_tokens;
+    const gchar *small_model;
+    guint small_below_tokens;
+};
+
+/**
+ * M_CHATGPT_DEFAULT_SMALL_BELOW_TOKENS:
+ *
+ * Default size below which a request goes to the "small_model" of its prompt.
+ */
+#define M_CHATGPT_DEFAULT_SMALL_BELOW_TOKENS 1000
+
+/**
+ * m_chatgpt_prompt_lookup:
+ * @prompts: Array of prompt configurations
+ * @prompt_id: The prompt identifier, with or without the "ai-proofread-" prefix
+ * @prompt: (out caller-allocates): Return location for the prompt settings
+ *
+ * Look up a prompt and parse its settings.
+ *
+ * Returns: TRUE if the prompt was found and has a prompt text
+ */
+gboolean m_chatgpt_prompt_lookup(JsonArray *prompts,
+                                 const gchar *prompt_id,
+                                 MChatGPTPrompt *prompt);
+
+/**
+ * m_chatgpt_prompt_get_model:
+ * @prompt: (nullable): The prompt settings
+ * @backend: The server the prompt runs on
+ * @selected_model: (nullable): The model selected in the composer
+ *
+ * A model set by @backend wins over the model of @prompt, which wins
+ * over @selected_model.
+ *
+ * Returns: (transfer none) (nullable): The model to use
+ */
+const gchar *m_chatgpt_prompt_get_model(const MChatGPTPrompt *prompt,
+                                        const MBackend *backend,
+                                        const gchar *selected_model);
+
+/**
+ * m_chatgpt_prompt_estimate_tokens:
+ * @prompt: The prompt settings
+ * @content: The content to send
+ *
+ * Returns: The estimated number of input tokens of a request sending
+ *          @content with @prompt, see m_tokens_estimate_request()
+ */
+guint m_chatgpt_prompt_estimate_tokens(const MChatGPTPrompt *prompt, const gchar *content);
+
+/**
+ * m_chatgpt_prompt_route_model:
+ * @prompt: (nullable): The prompt settings
+ * @backend: The server the prompt runs on
+ * @model: (nullable): The model the request would use
+ * @estimated_tokens: The estimated input tokens of the request
+ *
+ * Small requests of a prompt with a "small_model" go to that model,
+ * which is cheaper and faster for a few lines of text. A model set by
+ * @backend still wins.
+ *
+ * Returns: (transfer none) (nullable): The model to use
+ */
+const gchar *m_chatgpt_prompt_route_model(const MChatGPTPrompt *prompt,
+                                          const MBackend *backend,
+                                          const gchar *model,
+                                          guint estimated_tokens);
+
+/**
+ * m_chatgpt_prompt_wants_edits:
+ * @prompts: Array of prompt configurations
+ * @prompt_id: The prompt identifier
+ *
+ * Prompts with "output": "edits" ask the model for a list of edits
+ * instead of the full corrected text. The response of
+ * m_chatgpt_proofread() is then the edit list, see m_edits_apply().
+ *
+ * Returns: TRUE if the prompt uses edit list output
+ */
+gboolean m_chatgpt_prompt_wants_edits(JsonArray *prompts, const gchar *prompt_id);
+
 /**
  * m_chatgpt_proofread:
  * @content: The text content to proofread
  * @prompt_id: The prompt identifier
  * @prompts: Array of prompt configurations
- * @api_key: The OpenAI API key
- * @model: The model to use (e.g., "gpt-4o")
+ * @backend: The server to send the request to
+ * @model: The model to use (e.g., "gpt-4o"), unless @backend sets one
+ * @stats: (nullable): Record to fill with timings, status and token usage
+ * @cancellable: (nullable): A #GCancellable to abort the request
  * @error: Return location for error
  *
- * Send content to ChatGPT for proofreading.
+ * Send content to ChatGPT for proofreading. Cancelling @cancellable aborts
+ * the HTTP transfer and fails with %G_IO_ERROR_CANCELLED. The caller
+ * commits @stats with m_stats_commit() once the result is used.
  *
  * Returns: (transfer full) (nullable): The proofread text, or NULL on error
  */
 gchar *m_chatgpt_proofread(const gchar *content,
                            const gchar *prompt_id,
                            JsonArray *prompts,
-                           const gchar *api_key,
+                           const MBackend *backend,
                            const gchar *model,
+                           MStatsRecord *stats,
+                           GCancellable *cancellable,
                            GError **error);
 
+/**
+ * m_chatgpt_proofread_stream:
+ * @content: The text content to proofread
+ * @prompt_id: The prompt identifier
+ * @prompts: Array of prompt configurations
+ * @backend: The server to send the request to
+ * @model: The model to use (e.g., "gpt-4o"), unless @backend sets one
+ * @delta_func: (nullable): Function called with each piece of received text
+ * @user_data: Data to pass to @delta_func
+ * @stats: (nullable): Record to fill with timings, status and token usage
+ * @cancellable: (nullable): A #GCancellable to abort the request
+ * @error: Return location for error
+ *
+ * Like m_chatgpt_proofread(), but requests a streamed completion and
+ * parses the server-sent events as they arrive, so the caller can show
+ * the text before generation has finished.
+ *
+ * Returns: (transfer full) (nullable): The complete proofread text, or NULL on error
+ */
+gchar *m_chatgpt_proofread_stream(const gchar *content,
+                                  const gchar *prompt_id,
+                                  JsonArray *prompts,
+                                  const MBackend *backend,
+                                  const gchar *model,
+                                  MChatGPTDeltaFunc delta_func,
+                                  gpointer user_data,
+                                  MStatsRecord *stats,
+                                  GCancellable *cancellable,
+                                  GError **error);
+
+/**
+ * m_chatgpt_proofread_async:
+ * @content: The text content to proofread
+ * @prediction: (nullable): For prompts with "predict", the part of
+ *              @content the reply is expected to resemble, NULL for all
+ *              of it; quoted context never appears in the reply
+ * @prompt_id: The prompt identifier
+ * @prompts: Array of prompt configurations
+ * @backend: The server to send the request to
+ * @model: The model to use (e.g., "gpt-4o"), unless @backend sets one
+ * @previous_response_id: (nullable): For conversation prompts, the stored
+ *                        response to continue
+ * @stream: Whether to request a streamed completion
+ * @delta_func: (nullable): Function called with each piece of streamed text
+ * @sent_func: (nullable): Function called when the request is sent
+ * @user_data: Data to pass to @delta_func and @sent_func
+ * @stats: (nullable): Record to fill with timings, status and token usage,
+ *         which must stay alive until @callback runs
+ * @priority: The scheduler priority of the request
+ * @cancellable: (nullable): A #GCancellable to abort the request
+ * @callback: Called when the request is complete
+ * @callback_data: Data to pass to @callback
+ *
+ * Non-blocking variant of m_chatgpt_proofread() and
+ * m_chatgpt_proofread_stream(). The request runs on the thread-default
+ * main context of the caller, where @delta_func and @callback are
+ * invoked; no thread waits for the response.
+ */
+void m_chatgpt_proofread_async(const gchar *content,
+                               const gchar *prediction,
+                               const gchar *prompt_id,
+                               JsonArray *prompts,
+                               const MBackend *backend,
+                               const gchar *model,
+                               const gchar *previous_response_id,
+                               gboolean stream,
+                               MChatGPTDeltaFunc delta_func,
+                               MChatGPTSentFunc sent_func,
+                               gpointer user_data,
+                               MStatsRecord *stats,
+                               MSchedulerPriority priority,
+                               GCancellable *cancellable,
+                               GAsyncReadyCallback callback,
+                               gpointer callback_data);
+
+/**
+ * m_chatgpt_proofread_finish:
+ * @result: The #GAsyncResult passed to the callback
+ * @error: Return location for error
+ *
+ * Returns: (transfer full) (nullable): The proofread text, or NULL on
+ *          error or if the model returned nothing
+ */
+gchar *m_chatgpt_proofread_finish(GAsyncResult *result, GError **error);
+
+/**
+ * m_chatgpt_proofread_get_response_id:
+ * @result: The #GAsyncResult passed to the callback
+ *
+ * Returns: (transfer none) (nullable): The ID of the response stored by
+ *          a successful request of a conversation prompt, valid as long
+ *          as @result is
+ */
+const gchar *m_chatgpt_proofread_get_response_id(GAsyncResult *result);
+
 /**
  * m_chatgpt_fetch_models:
- * @api_key: The OpenAI API key
+ * @backend: The server to ask
+ * @cancellable: (nullable): A #GCancellable to abort the request
  * @error: Return location for error
  *
- * Fetch the list of available models from the OpenAI API.
- * Only returns models suitable for chat completions (gpt-* models).
+ * Fetch the list of available models from @backend. Only returns the
+ * models accepted by m_backend_accepts_model(), which for the OpenAI API
+ * are the gpt-* models suitable for chat completions.
  *
  * Returns: (transfer full) (nullable): A list of model IDs (GList of gchar*),
  *          or NULL on error. Free with g_list_free_full(list, g_free).
  */
-GList *m_chatgpt_fetch_models(const gchar *api_key, GError **error);
+GList *m_chatgpt_fetch_models(const MBackend *backend,
+                              GCancellable *cancellable,
+                              GError **error);
+
+/**
+ * m_chatgpt_batch_submit:
+ * @ids: The custom IDs of the requests (gchar*), unique within the batch
+ * @contents: The content of each request (gchar*), in the order of @ids
+ * @prompt_id: The prompt identifier to use
+ * @prompts: Array of available prompts
+ * @backend: The server to send the batch to
+ * @model: (nullable): The selected model, used unless the prompt or @backend sets one
+ * @cancellable: (nullable): A #GCancellable to abort the upload
+ * @error: Return location for error
+ *
+ * Upload one chat completion request per content as a JSONL file and
+ * start a Batch API job on it. Batch jobs finish within a day at a lower
+ * price than interactive requests; use m_chatgpt_batch_poll() to collect
+ * the results. Runs synchronously, call it from a worker thread.
+ *
+ * Returns: (transfer full) (nullable): The ID of the batch job, or NULL on error
+ */
+gchar *m_chatgpt_batch_submit(GPtrArray *ids,
+                              GPtrArray *contents,
+                              const gchar *prompt_id,
+                              JsonArray *prompts,
+                              const MBackend *backend,
+                              const gchar *model,
+                              GCancellable *cancellable,
+                              GError **error);
+
+/**
+ * m_chatgpt_batch_poll:
+ * @backend: The server the batch was sent to
+ * @batch_id: The ID returned by m_chatgpt_batch_submit()
+ * @results: (out) (transfer full): Return location for the results once
+ *           the job finished: a table of custom IDs to response contents,
+ *           without the requests that failed
+ * @cancellable: (nullable): A #GCancellable to abort the request
+ * @error: Return location for error
+ *
+ * Check on a batch job and download its results once it finished.
+ * Runs synchronously, call it from a worker thread.
+ *
+ * Returns: TRUE once the job is over, with @results set if it finished
+ *          and @error set if it failed or was cancelled. FALSE while it
+ *          is still running, with @error set if it could not be checked.
+ */
+gboolean m_chatgpt_batch_poll(const MBackend *backend,
+                              const gchar *batch_id,
+                              GHashTable **results,
+                              GCancellable *cancellable,
+                              GError **error);
+
+/**
+ * m_chatgpt_prewarm:
+ * @backend: The server to connect to
+ *
+ * Open a connection to the host of @backend in the background so that
+ * the next request starts on a warm socket. Does nothing if the shared
+ * session was used recently.
+ */
+void m_chatgpt_prewarm(const MBackend *backend);
+
+/**
+ * m_chatgpt_shutdown:
+ *
+ * Abort pending requests and release the shared HTTP sessions.
+ */
+void m_chatgpt_shutdown(void);
 
 #endif /* M_CHATGPT_API_H */ 
\ No newline at end of file
@@ -0,0 +1,252 @@
+/*
+ * m-chunker.c - Text chunking for AI Proofread Plugin
+ *
+ * Implements paragraph and sentence splitting and the packing of the
+ * pieces into token-bounded chunks.
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "m-chunker.h"
+#include "m-tokens.h"
+
+static MChunk *
+chunk_new(const gchar *text, gsize text_len, const gchar *separator, gsize separator_len)
+{
+    MChunk *chunk = g_new0(MChunk, 1);
+
+    chunk->text = g_strndup(text, text_len);
+    chunk->separator = g_strndup(separator, separator_len);
+
+    return chunk;
+}
+
+/*
+ * m_chunk_free:
+ */
+void
+m_chunk_free(MChunk *chunk)
+{
+    if (!chunk)
+        return;
+
+    g_free(chunk->text);
+    g_free(chunk->separator);
+    g_free(chunk);
+}
+
+/*
+ * m_chunker_estimate_tokens:
+ */
+guint
+m_chunker_estimate_tokens(const gchar *text)
+{
+    return m_tokens_estimate(text);
+}
+
+/*
+ * add_tail:
+ *
+ * Add the text between @start and @end as the last piece, with its
+ * trailing whitespace as separator.
+ */
+static void
+add_tail(GPtrArray *pieces, const gchar *start, const gchar *end)
+{
+    const gchar *text_end = end;
+
+    while (text_end > start && g_ascii_isspace(text_end[-1]))
+        text_end--;
+
+    if (end > start)
+        g_ptr_array_add(pieces, chunk_new(start, text_end - start, text_end, end - text_end));
+}
+
+/*
+ * m_chunker_split_paragraphs:
+ */
+GPtrArray *
+m_chunker_split_paragraphs(const gchar *text)
+{
+    GPtrArray *paragraphs = g_ptr_array_new_with_free_func((GDestroyNotify)m_chunk_free);
+    const gchar *start = text;
+    const gchar *p = text;
+
+    g_return_val_if_fail(text != NULL, paragraphs);
+
+    while (*p)
+    {
+        if (*p == '\n')
+        {
+            const gchar *q = p + 1;
+
+            while (*q == ' ' || *q == '\t' || *q == '\r')
+                q++;
+
+            if (*q == '\n')
+            {
+                /* A blank line ends the paragraph at p */
+                const gchar *text_end = p;
+                const gchar *separator_end = q;
+
+                while (text_end > start && g_ascii_isspace(text_end[-1]))
+                    text_end--;
+                while (g_ascii_isspace(*separator_end))
+                    separator_end++;
+
+                g_ptr_array_add(paragraphs,
+                                chunk_new(start, text_end - start,
+                                          text_end, separator_end - text_end));
+                start = p = separator_end;
+                continue;
+            }
+        }
+        p++;
+    }
+
+    add_tail(paragraphs, start, p);
+
+    return paragraphs;
+}
+
+/*
+ * split_sentences:
+ * @paragraph: The paragraph to split
+ * @pieces: Array to append the sentences to
+ *
+ * Split a paragraph after sentence-ending punctuation which is followed
+ * by whitespace. The last sentence keeps the paragraph separator.
+ */
+static void
+split_sentences(MChunk *paragraph, GPtrArray *pieces)
+{
+    const gchar *start = paragraph->text;
+    const gchar *p = paragraph->text;
+
+    while (*p)
+    {
+        if ((*p == '.' || *p == '!' || *p == '?') && g_ascii_isspace(p[1]))
+        {
+            const gchar *separator_end = p + 1;
+
+            while (g_ascii_isspace(*separator_end))
+                separator_end++;
+
+            if (*separator_end)
+            {
+                g_ptr_array_add(pieces,
+                                chunk_new(start, p + 1 - start,
+                                          p + 1, separator_end - (p + 1)));
+                start = p = separator_end;
+                continue;
+            }
+        }
+        p++;
+    }
+
+    g_ptr_array_add(pieces, chunk_new(start, p - start,
+                                      paragraph->separator,
+                                      strlen(paragraph->separator)));
+}
+
+/*
+ * m_chunker_split:
+ */
+GPtrArray *
+m_chunker_split(const gchar *text, guint max_tokens)
+{
+    GPtrArray *paragraphs;
+    GPtrArray *pieces;
+    GPtrArray *chunks;
+    GString *current;
+    const gchar *current_separator = "";
+    guint current_tokens = 0;
+    guint current_pieces = 0;
+
+    g_return_val_if_fail(text != NULL, NULL);
+
+    paragraphs = m_chunker_split_paragraphs(text);
+    pieces = g_ptr_array_new_with_free_func((GDestroyNotify)m_chunk_free);
+
+    for (guint i = 0; i < paragraphs->len; i++)
+    {
+        MChunk *paragraph = g_ptr_array_index(paragraphs, i);
+
+        if (m_chunker_estimate_tokens(paragraph->text) > max_tokens)
+        {
+            split_sentences(paragraph, pieces);
+        }
+        else
+        {
+            g_ptr_array_add(pieces, chunk_new(paragraph->text, strlen(paragraph->text),
+                                              paragraph->separator,
+                                              strlen(paragraph->separator)));
+        }
+    }
+
+    chunks = g_ptr_array_new_with_free_func((GDestroyNotify)m_chunk_free);
+    current = g_string_new(NULL);
+
+    /* Greedily pack consecutive pieces up to max_tokens */
+    for (guint i = 0; i < pieces->len; i++)
+    {
+        MChunk *piece = g_ptr_array_index(pieces, i);
+        guint piece_tokens = m_chunker_estimate_tokens(piece->text);
+
+        if (current_pieces > 0 && current_tokens + piece_tokens > max_tokens)
+        {
+            g_ptr_array_add(chunks, chunk_new(current->str, current->len,
+                                              current_separator,
+                                              strlen(current_separator)));
+            g_string_truncate(current, 0);
+            current_tokens = 0;
+            current_pieces = 0;
+        }
+
+        if (current_pieces > 0)
+            g_string_append(current, current_separator);
+        g_string_append(current, piece->text);
+        current_tokens += piece_tokens;
+        current_separator = piece->separator;
+        current_pieces++;
+    }
+
+    if (current_pieces > 0)
+        g_ptr_array_add(chunks, chunk_new(current->str, current->len,
+                                          current_separator,
+                                          strlen(current_separator)));
+
+    g_string_free(current, TRUE);
+    g_ptr_array_unref(pieces);
+    g_ptr_array_unref(paragraphs);
+
+    return chunks;
+}
+
+/*
+ * m_chunker_join:
+ */
+gchar *
+m_chunker_join(GPtrArray *chunks, gchar **results)
+{
+    GString *joined = g_string_new(NULL);
+
+    g_return_val_if_fail(chunks != NULL, NULL);
+    g_return_val_if_fail(results != NULL, NULL);
+
+    for (guint i = 0; i < chunks->len; i++)
+    {
+        MChunk *chunk = g_ptr_array_index(chunks, i);
+        const gchar *result = results[i] ? results[i] : "";
+        gsize length = strlen(result);
+
+        while (length > 0 && g_ascii_isspace(result[length - 1]))
+            length--;
+
+        g_string_append_len(joined, result, length);
+        g_string_append(joined, chunk->separator);
+    }
+
+    return g_string_free(joined, FALSE);
+}
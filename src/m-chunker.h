@@ -0,0 +1,87 @@
+/*
+ * m-chunker.h - Text chunking for AI Proofread Plugin
+ *
+ * This module splits long messages into pieces that can be proofread
+ * independently:
+ * - Splitting at paragraph boundaries (blank lines)
+ * - Falling back to sentence boundaries for oversized paragraphs
+ * - Packing the pieces into token-bounded chunks and joining results
+ */
+
+#ifndef M_CHUNKER_H
+#define M_CHUNKER_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * MChunk:
+ * @text: The text of the chunk, without surrounding whitespace
+ * @separator: The whitespace which followed @text in the original
+ *
+ * A piece of a message. Concatenating text and separator of all chunks
+ * of a split reproduces the original message.
+ */
+typedef struct _MChunk MChunk;
+
+struct _MChunk
+{
+    gchar *text;
+    gchar *separator;
+};
+
+/**
+ * m_chunk_free:
+ * @chunk: The chunk to free
+ */
+void m_chunk_free(MChunk *chunk);
+
+/**
+ * m_chunker_estimate_tokens:
+ * @text: The text
+ *
+ * Estimate of the number of tokens in @text, see m_tokens_estimate().
+ *
+ * Returns: The estimated token count
+ */
+guint m_chunker_estimate_tokens(const gchar *text);
+
+/**
+ * m_chunker_split_paragraphs:
+ * @text: The message text
+ *
+ * Split @text at blank lines.
+ *
+ * Returns: (transfer full): A GPtrArray of MChunk, one per paragraph
+ */
+GPtrArray *m_chunker_split_paragraphs(const gchar *text);
+
+/**
+ * m_chunker_split:
+ * @text: The message text
+ * @max_tokens: The target upper bound of tokens per chunk
+ *
+ * Split @text into chunks of whole paragraphs of at most @max_tokens.
+ * Paragraphs larger than that are split between sentences. A single
+ * sentence larger than @max_tokens becomes a chunk of its own.
+ *
+ * Returns: (transfer full): A GPtrArray of MChunk
+ */
+GPtrArray *m_chunker_split(const gchar *text, guint max_tokens);
+
+/**
+ * m_chunker_join:
+ * @chunks: The chunks from m_chunker_split()
+ * @results: The result text for every chunk, in the same order
+ *
+ * Join per-chunk results using the original separators. Trailing
+ * whitespace added by the model to a result is dropped.
+ *
+ * Returns: (transfer full): The joined text
+ */
+gchar *m_chunker_join(GPtrArray *chunks, gchar **results);
+
+G_END_DECLS
+
+#endif /* M_CHUNKER_H */
@@ -1,36 +1,41 @@
 /*
  * m-config.c - Configuration management for AI Proofread Plugin
  *
- * Implements loading of prompts from JSON and API key from authinfo.
+ * Implements loading of prompts from JSON and API key from authinfo,
+ * and the process-wide configuration snapshot kept current by file
+ * monitors.
  */
 
 #include <glib.h>
+#include <gio/gio.h>
 #include <json-glib/json-glib.h>
+#ifndef M_CONFIG_STANDALONE
 #include <evolution/e-util/e-util.h>
+#endif
 
 #include "m-config.h"
 
 /*
- * m_config_load_prompts:
+ * parse_prompts:
+ * @data: The contents of prompts.json
+ * @length: Length of @data
+ * @origin: The file the data was read from, for messages
  *
- * Read the prompts configuration file from the user's config directory
- * ($XDG_CONFIG_HOME/ai-proofread/prompts.json) and return a referenced
- * JsonArray containing the prompt objects.
+ * Parse the prompts configuration. On error or when the root is not an
+ * array, an empty array is returned.
+ *
+ * Returns: (transfer full): A JsonArray with prompt configurations
  */
-JsonArray *
-m_config_load_prompts(void)
+static JsonArray *
+parse_prompts(const gchar *data, gsize length, const gchar *origin)
 {
-    const gchar *config_dir = e_get_user_config_dir();
-    gchar *config_path = g_build_filename(config_dir, "ai-proofread", "prompts.json", NULL);
     JsonParser *parser = NULL;
     JsonNode *root = NULL;
     JsonArray *prompts = NULL;
     GError *error = NULL;
 
-    g_debug("Loading prompts from: %s", config_path);
-
     parser = json_parser_new();
-    if (json_parser_load_from_file(parser, config_path, &error))
+    if (json_parser_load_from_data(parser, data, length, &error))
     {
         root = json_parser_get_root(parser);
         if (JSON_NODE_HOLDS_ARRAY(root))
@@ -46,28 +51,97 @@ m_config_load_prompts(void)
     }
     else
     {
-        g_warning("Error loading prompts: %s", error->message);
+        g_warning("Error loading prompts from %s: %s", origin, error->message);
         g_error_free(error);
         prompts = json_array_new();
     }
 
     g_object_unref(parser);
+
+    return prompts;
+}
+
+/*
+ * m_config_get_user_config_dir:
+ */
+const gchar *
+m_config_get_user_config_dir(void)
+{
+#ifdef M_CONFIG_STANDALONE
+    static gchar *config_dir = NULL;
+
+    if (g_once_init_enter(&config_dir))
+        g_once_init_leave(&config_dir, g_build_filename(g_get_user_config_dir(), "evolution", NULL));
+
+    return config_dir;
+#else
+    return e_get_user_config_dir();
+#endif
+}
+
+/*
+ * get_prompts_file_path:
+ *
+ * Get the path to the prompts.json file.
+ * Returns: (transfer full): The path. The caller must free the returned string.
+ */
+static gchar *
+get_prompts_file_path(void)
+{
+    const gchar *config_dir = m_config_get_user_config_dir();
+    return g_build_filename(config_dir, "ai-proofread", "prompts.json", NULL);
+}
+
+/*
+ * m_config_load_prompts:
+ *
+ * Read the prompts configuration file from the user's config directory
+ * ($XDG_CONFIG_HOME/ai-proofread/prompts.json) and return a referenced
+ * JsonArray containing the prompt objects.
+ */
+JsonArray *
+m_config_load_prompts(void)
+{
+    gchar *config_path = get_prompts_file_path();
+    gchar *data = NULL;
+    gsize length = 0;
+    JsonArray *prompts = NULL;
+    GError *error = NULL;
+
+    g_debug("Loading prompts from: %s", config_path);
+
+    if (g_file_get_contents(config_path, &data, &length, &error))
+    {
+        prompts = parse_prompts(data, length, config_path);
+        g_free(data);
+    }
+    else
+    {
+        g_warning("Error loading prompts: %s", error->message);
+        g_error_free(error);
+        prompts = json_array_new();
+    }
+
     g_free(config_path);
 
     return prompts;
 }
 
+/* The authinfo machine holding the OpenAI API key */
+#define M_CONFIG_OPENAI_HOST "api.openai.com"
+
 /*
  * parse_authinfo_line:
  * @line: A line from the authinfo file
+ * @out_machine: (out) (optional): The machine of the key
  *
- * Parse a single line looking for the OpenAI API key pattern:
- * "machine api.openai.com login apikey password <key>"
+ * Parse a single line looking for the API key pattern:
+ * "machine <host> login apikey password <key>"
  *
  * Returns: (transfer full) (nullable): The API key if found, or NULL
  */
 static gchar *
-parse_authinfo_line(const gchar *line)
+parse_authinfo_line(const gchar *line, gchar **out_machine)
 {
     gchar **tokens = NULL;
     gint token_count;
@@ -79,22 +153,70 @@ parse_authinfo_line(const gchar *line)
     tokens = g_strsplit(line, " ", -1);
     token_count = g_strv_length(tokens);
 
-    /* Look for: machine api.openai.com login apikey password <key> */
+    /* Look for: machine <host> login apikey password <key> */
     if (token_count >= 6 &&
         g_strcmp0(tokens[0], "machine") == 0 &&
-        g_strcmp0(tokens[1], "api.openai.com") == 0 &&
+        tokens[1][0] != '\0' &&
         g_strcmp0(tokens[2], "login") == 0 &&
         g_strcmp0(tokens[3], "apikey") == 0 &&
         g_strcmp0(tokens[4], "password") == 0)
     {
         api_key = g_strdup(tokens[5]);
-        g_debug("Found API key");
+        if (out_machine)
+            *out_machine = g_strdup(tokens[1]);
+        g_debug("Found API key for %s", tokens[1]);
     }
 
     g_strfreev(tokens);
     return api_key;
 }
 
+/*
+ * parse_authinfo:
+ * @content: The contents of the authinfo file
+ *
+ * The first key of every machine is used.
+ *
+ * Returns: (transfer full): Table of machine names to API keys
+ */
+static GHashTable *
+parse_authinfo(const gchar *content)
+{
+    GHashTable *api_keys = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    gchar **lines = g_strsplit(content, "\n", -1);
+
+    for (gint i = 0; lines[i] != NULL; i++)
+    {
+        gchar *machine = NULL;
+        gchar *api_key = parse_authinfo_line(lines[i], &machine);
+
+        if (api_key && !g_hash_table_contains(api_keys, machine))
+        {
+            g_hash_table_insert(api_keys, machine, api_key);
+        }
+        else
+        {
+            g_free(machine);
+            g_free(api_key);
+        }
+    }
+
+    g_strfreev(lines);
+    return api_keys;
+}
+
+/*
+ * get_authinfo_file_path:
+ *
+ * Get the path to ~/.authinfo.
+ * Returns: (transfer full): The path. The caller must free the returned string.
+ */
+static gchar *
+get_authinfo_file_path(void)
+{
+    return g_build_filename(g_get_home_dir(), ".authinfo", NULL);
+}
+
 /*
  * m_config_load_api_key:
  *
@@ -103,8 +225,7 @@ parse_authinfo_line(const gchar *line)
 gchar *
 m_config_load_api_key(void)
 {
-    const gchar *home_dir = g_get_home_dir();
-    gchar *authinfo_path = g_build_filename(home_dir, ".authinfo", NULL);
+    gchar *authinfo_path = get_authinfo_file_path();
     gchar *content = NULL;
     gchar *api_key = NULL;
     GError *error = NULL;
@@ -113,16 +234,10 @@ m_config_load_api_key(void)
 
     if (g_file_get_contents(authinfo_path, &content, NULL, &error))
     {
-        gchar **lines = g_strsplit(content, "\n", -1);
+        GHashTable *api_keys = parse_authinfo(content);
 
-        for (gint i = 0; lines[i] != NULL; i++)
-        {
-            api_key = parse_authinfo_line(lines[i]);
-            if (api_key)
-                break;
-        }
-
-        g_strfreev(lines);
+        api_key = g_strdup(g_hash_table_lookup(api_keys, M_CONFIG_OPENAI_HOST));
+        g_hash_table_unref(api_keys);
         g_free(content);
     }
     else
@@ -144,10 +259,55 @@ m_config_load_api_key(void)
 static gchar *
 get_config_file_path(void)
 {
-    const gchar *config_dir = e_get_user_config_dir();
+    const gchar *config_dir = m_config_get_user_config_dir();
     return g_build_filename(config_dir, "ai-proofread", "config.json", NULL);
 }
 
+/*
+ * parse_settings:
+ * @data: The contents of config.json
+ * @length: Length of @data
+ *
+ * Returns: (transfer full): The settings object, empty if @data does not
+ *          hold a JSON object
+ */
+static JsonObject *
+parse_settings(const gchar *data, gsize length)
+{
+    JsonParser *parser = json_parser_new();
+    JsonObject *settings = NULL;
+    GError *error = NULL;
+
+    if (json_parser_load_from_data(parser, data, length, &error))
+    {
+        JsonNode *root = json_parser_get_root(parser);
+        if (JSON_NODE_HOLDS_OBJECT(root))
+            settings = json_object_ref(json_node_get_object(root));
+    }
+    else
+    {
+        g_warning("Error parsing config file: %s", error->message);
+        g_error_free(error);
+    }
+
+    g_object_unref(parser);
+
+    return settings ? settings : json_object_new();
+}
+
+/*
+ * settings_get_model:
+ *
+ * Returns: (transfer full): The model stored in @settings, or the default model
+ */
+static gchar *
+settings_get_model(JsonObject *settings)
+{
+    const gchar *model = json_object_get_string_member_with_default(settings, "model", NULL);
+
+    return g_strdup(model ? model : M_CONFIG_DEFAULT_MODEL);
+}
+
 /*
  * m_config_load_model:
  */
@@ -155,58 +315,465 @@ gchar *
 m_config_load_model(void)
 {
     gchar *config_path = get_config_file_path();
-    JsonParser *parser = NULL;
+    JsonObject *settings = NULL;
+    gchar *data = NULL;
+    gsize length = 0;
     gchar *model = NULL;
     GError *error = NULL;
 
     g_debug("Loading model from: %s", config_path);
 
-    parser = json_parser_new();
-    if (json_parser_load_from_file(parser, config_path, &error))
+    if (g_file_get_contents(config_path, &data, &length, &error))
     {
-        JsonNode *root = json_parser_get_root(parser);
-        if (JSON_NODE_HOLDS_OBJECT(root))
-        {
-            JsonObject *obj = json_node_get_object(root);
-            if (json_object_has_member(obj, "model"))
-            {
-                model = g_strdup(json_object_get_string_member(obj, "model"));
-                g_debug("Loaded model: %s", model);
-            }
-        }
+        settings = parse_settings(data, length);
+        model = settings_get_model(settings);
+        g_debug("Loaded model: %s", model);
+        json_object_unref(settings);
+        g_free(data);
     }
     else
     {
         g_debug("No config file found or error loading: %s", error->message);
         g_error_free(error);
+        model = g_strdup(M_CONFIG_DEFAULT_MODEL);
     }
 
-    g_object_unref(parser);
     g_free(config_path);
 
-    if (!model)
-        model = g_strdup(M_CONFIG_DEFAULT_MODEL);
-
     return model;
 }
 
+/*
+ * Configuration store
+ *
+ * The current snapshot is replaced (never modified) when a monitored file
+ * changes. Files are compared by checksum, so monitor events for
+ * unchanged contents, including our own writes, do not re-parse.
+ */
+
+typedef enum
+{
+    CONFIG_FILE_PROMPTS,
+    CONFIG_FILE_AUTHINFO,
+    CONFIG_FILE_SETTINGS,
+    N_CONFIG_FILES
+} ConfigFile;
+
+typedef struct
+{
+    gchar *path;
+    GFileMonitor *monitor;
+    gchar *checksum; /* Checksum of the loaded contents, NULL if missing */
+} ConfigFileState;
+
+static GMutex config_lock;
+static MConfig *current_config = NULL;
+static ConfigFileState config_files[N_CONFIG_FILES];
+static GHookList config_listeners;
+static gboolean config_initialized = FALSE;
+
+static void
+config_clear(gpointer data)
+{
+    MConfig *config = data;
+
+    if (config->prompts)
+        json_array_unref(config->prompts);
+    if (config->settings)
+        json_object_unref(config->settings);
+    if (config->api_keys)
+        g_hash_table_unref(config->api_keys);
+    if (config->backends)
+        g_hash_table_unref(config->backends);
+    g_free(config->api_key);
+    g_free(config->model);
+}
+
+/*
+ * config_copy:
+ * @config: (nullable): The snapshot to copy
+ *
+ * Returns: (transfer full): A new snapshot sharing the contents of @config
+ */
+static MConfig *
+config_copy(MConfig *config)
+{
+    MConfig *copy = g_atomic_rc_box_new0(MConfig);
+
+    if (config)
+    {
+        copy->prompts = json_array_ref(config->prompts);
+        copy->settings = json_object_ref(config->settings);
+        copy->api_keys = g_hash_table_ref(config->api_keys);
+        copy->backends = g_hash_table_ref(config->backends);
+        copy->api_key = g_strdup(config->api_key);
+        copy->model = g_strdup(config->model);
+        copy->generation = config->generation + 1;
+    }
+    else
+    {
+        copy->api_keys = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    }
+
+    return copy;
+}
+
+/*
+ * config_apply_file:
+ * @config: The snapshot being built
+ * @which: The file the contents belong to
+ * @data: (nullable): The file contents, NULL if the file is missing
+ * @length: Length of @data
+ *
+ * Replace the part of @config which comes from @which.
+ */
+static void
+config_apply_file(MConfig *config, ConfigFile which, const gchar *data, gsize length)
+{
+    switch (which)
+    {
+    case CONFIG_FILE_PROMPTS:
+        if (config->prompts)
+            json_array_unref(config->prompts);
+        config->prompts = data ? parse_prompts(data, length, config_files[which].path)
+                               : json_array_new();
+        break;
+    case CONFIG_FILE_AUTHINFO:
+        if (config->api_keys)
+            g_hash_table_unref(config->api_keys);
+        config->api_keys = data ? parse_authinfo(data)
+                                : g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+        g_free(config->api_key);
+        config->api_key = g_strdup(g_hash_table_lookup(config->api_keys, M_CONFIG_OPENAI_HOST));
+        break;
+    case CONFIG_FILE_SETTINGS:
+        if (config->settings)
+            json_object_unref(config->settings);
+        config->settings = data ? parse_settings(data, length) : json_object_new();
+        g_free(config->model);
+        config->model = settings_get_model(config->settings);
+        break;
+    default:
+        g_warn_if_reached();
+        return;
+    }
+
+    /* Backends combine config.json and the keys of ~/.authinfo; until
+     * both files are applied they are built from what is known */
+    if (config->backends)
+        g_hash_table_unref(config->backends);
+    config->backends = m_backends_parse(
+        config->settings ? m_config_get_section(config, "backends") : NULL,
+        config->api_keys);
+}
+
+/*
+ * config_read_file:
+ * @which: The file to read
+ * @out_length: (out): Length of the returned contents
+ * @out_changed: (out): Whether the contents differ from the last load
+ *
+ * Read a configuration file and update its stored checksum.
+ *
+ * Returns: (transfer full) (nullable): The contents, or NULL if the file
+ *          cannot be read
+ */
+static gchar *
+config_read_file(ConfigFile which, gsize *out_length, gboolean *out_changed)
+{
+    ConfigFileState *state = &config_files[which];
+    gchar *data = NULL;
+    gchar *checksum = NULL;
+    GError *error = NULL;
+
+    *out_length = 0;
+
+    if (g_file_get_contents(state->path, &data, out_length, &error))
+    {
+        checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA256, (const guchar *)data, *out_length);
+    }
+    else
+    {
+        g_debug("Cannot read %s: %s", state->path, error->message);
+        g_error_free(error);
+    }
+
+    *out_changed = g_strcmp0(checksum, state->checksum) != 0;
+    g_free(state->checksum);
+    state->checksum = checksum;
+
+    return data;
+}
+
+static void
+notify_listener(GHook *hook, gpointer marshal_data)
+{
+    ((MConfigChangedFunc)hook->func)(marshal_data, hook->data);
+}
+
+/*
+ * config_replace:
+ * @config: (transfer full): The new snapshot
+ *
+ * Make @config the current snapshot and notify listeners.
+ */
+static void
+config_replace(MConfig *config)
+{
+    MConfig *old;
+
+    g_mutex_lock(&config_lock);
+    old = current_config;
+    current_config = config;
+    g_mutex_unlock(&config_lock);
+
+    if (old)
+        m_config_unref(old);
+
+    g_debug("Configuration changed (generation %u)", config->generation);
+    g_hook_list_marshal(&config_listeners, FALSE, notify_listener, config);
+}
+
+static void
+config_file_changed_cb(GFileMonitor *monitor,
+                       GFile *file,
+                       GFile *other_file,
+                       GFileMonitorEvent event_type,
+                       gpointer user_data)
+{
+    ConfigFile which = GPOINTER_TO_INT(user_data);
+    MConfig *config;
+    gchar *data;
+    gsize length;
+    gboolean changed;
+
+    switch (event_type)
+    {
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_DELETED:
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+    case G_FILE_MONITOR_EVENT_MOVED_OUT:
+    case G_FILE_MONITOR_EVENT_RENAMED:
+        break;
+    default:
+        return;
+    }
+
+    data = config_read_file(which, &length, &changed);
+    if (!changed)
+    {
+        g_free(data);
+        return;
+    }
+
+    g_debug("Reloading %s", config_files[which].path);
+
+    g_mutex_lock(&config_lock);
+    config = config_copy(current_config);
+    g_mutex_unlock(&config_lock);
+
+    config_apply_file(config, which, data, length);
+    g_free(data);
+
+    config_replace(config);
+}
+
+/*
+ * config_init:
+ *
+ * Load all configuration files and start monitoring them. Called with
+ * config_lock held.
+ */
+static void
+config_init(void)
+{
+    MConfig *config = config_copy(NULL);
+
+    config_files[CONFIG_FILE_PROMPTS].path = get_prompts_file_path();
+    config_files[CONFIG_FILE_AUTHINFO].path = get_authinfo_file_path();
+    config_files[CONFIG_FILE_SETTINGS].path = get_config_file_path();
+
+    for (gint i = 0; i < N_CONFIG_FILES; i++)
+    {
+        GFile *file = g_file_new_for_path(config_files[i].path);
+        GError *error = NULL;
+        gboolean changed;
+        gsize length;
+        gchar *data;
+
+        data = config_read_file(i, &length, &changed);
+        config_apply_file(config, i, data, length);
+        g_free(data);
+
+        config_files[i].monitor = g_file_monitor_file(file, G_FILE_MONITOR_WATCH_MOVES, NULL, &error);
+        if (config_files[i].monitor)
+        {
+            g_signal_connect(config_files[i].monitor, "changed",
+                             G_CALLBACK(config_file_changed_cb), GINT_TO_POINTER(i));
+        }
+        else
+        {
+            g_warning("Cannot monitor %s: %s", config_files[i].path, error->message);
+            g_error_free(error);
+        }
+
+        g_object_unref(file);
+    }
+
+    if (!config->api_key)
+        g_warning("No API key found in %s", config_files[CONFIG_FILE_AUTHINFO].path);
+
+    g_hook_list_init(&config_listeners, sizeof(GHook));
+    current_config = config;
+    config_initialized = TRUE;
+}
+
+/*
+ * m_config_get:
+ */
+MConfig *
+m_config_get(void)
+{
+    MConfig *config;
+
+    g_mutex_lock(&config_lock);
+    if (!config_initialized)
+        config_init();
+    config = m_config_ref(current_config);
+    g_mutex_unlock(&config_lock);
+
+    return config;
+}
+
+/*
+ * m_config_ref:
+ */
+MConfig *
+m_config_ref(MConfig *config)
+{
+    g_return_val_if_fail(config != NULL, NULL);
+
+    return g_atomic_rc_box_acquire(config);
+}
+
+/*
+ * m_config_unref:
+ */
+void
+m_config_unref(MConfig *config)
+{
+    if (config)
+        g_atomic_rc_box_release_full(config, config_clear);
+}
+
+/*
+ * m_config_get_section:
+ */
+JsonObject *
+m_config_get_section(MConfig *config, const gchar *name)
+{
+    JsonNode *node;
+
+    g_return_val_if_fail(config != NULL, NULL);
+    g_return_val_if_fail(name != NULL, NULL);
+
+    node = json_object_get_member(config->settings, name);
+    if (!node || !JSON_NODE_HOLDS_OBJECT(node))
+        return NULL;
+
+    return json_node_get_object(node);
+}
+
+/*
+ * m_config_get_backend:
+ */
+MBackend *
+m_config_get_backend(MConfig *config, const gchar *name)
+{
+    g_return_val_if_fail(config != NULL, NULL);
+
+    return m_backends_lookup(config->backends, name);
+}
+
+/*
+ * m_config_get_prompt_backend:
+ */
+MBackend *
+m_config_get_prompt_backend(MConfig *config, JsonObject *prompt)
+{
+    const gchar *name = NULL;
+
+    g_return_val_if_fail(config != NULL, NULL);
+
+    if (prompt)
+        name = json_object_get_string_member_with_default(prompt, "backend", NULL);
+
+    return m_backends_lookup(config->backends, name);
+}
+
+/*
+ * m_config_add_listener:
+ */
+guint
+m_config_add_listener(MConfigChangedFunc func, gpointer user_data)
+{
+    MConfig *config;
+    GHook *hook;
+
+    g_return_val_if_fail(func != NULL, 0);
+
+    /* Make sure the store and its listener list exist */
+    config = m_config_get();
+    m_config_unref(config);
+
+    hook = g_hook_alloc(&config_listeners);
+    hook->func = func;
+    hook->data = user_data;
+    g_hook_append(&config_listeners, hook);
+
+    return (guint)hook->hook_id;
+}
+
+/*
+ * m_config_remove_listener:
+ */
+void
+m_config_remove_listener(guint listener_id)
+{
+    if (!config_initialized || listener_id == 0)
+        return;
+
+    g_hook_destroy(&config_listeners, listener_id);
+}
+
 /*
  * m_config_save_model:
+ *
+ * The settings are serialized from the in-memory snapshot rather than
+ * re-read from disk.
  */
 gboolean
 m_config_save_model(const gchar *model)
 {
-    gchar *config_path = get_config_file_path();
-    gchar *config_dir = g_path_get_dirname(config_path);
-    JsonBuilder *builder = NULL;
+    MConfig *config;
+    MConfig *updated;
+    gchar *config_dir = NULL;
+    JsonObject *settings = NULL;
     JsonGenerator *generator = NULL;
     JsonNode *root = NULL;
+    GList *members;
+    gchar *data = NULL;
+    gsize length = 0;
     gboolean success = FALSE;
     GError *error = NULL;
 
     g_return_val_if_fail(model != NULL, FALSE);
 
-    g_debug("Saving model to: %s", config_path);
+    config = m_config_get();
+    config_dir = g_path_get_dirname(config_files[CONFIG_FILE_SETTINGS].path);
+
+    g_debug("Saving model to: %s", config_files[CONFIG_FILE_SETTINGS].path);
 
     /* Ensure directory exists */
     if (g_mkdir_with_parents(config_dir, 0700) != 0)
@@ -215,71 +782,58 @@ m_config_save_model(const gchar *model)
         goto cleanup;
     }
 
-    /* Load existing config or create new */
-    JsonParser *parser = json_parser_new();
-    JsonObject *config_obj = NULL;
-
-    if (json_parser_load_from_file(parser, config_path, NULL))
-    {
-        JsonNode *existing_root = json_parser_get_root(parser);
-        if (JSON_NODE_HOLDS_OBJECT(existing_root))
-        {
-            config_obj = json_object_ref(json_node_get_object(existing_root));
-        }
-    }
-
-    if (!config_obj)
-        config_obj = json_object_new();
-
-    /* Update model */
-    if (json_object_has_member(config_obj, "model"))
-        json_object_remove_member(config_obj, "model");
-    json_object_set_string_member(config_obj, "model", model);
-
-    /* Generate JSON */
-    builder = json_builder_new();
-    json_builder_begin_object(builder);
-
-    GList *members = json_object_get_members(config_obj);
+    /* Copy the current settings and update the model */
+    settings = json_object_new();
+    members = json_object_get_members(config->settings);
     for (GList *l = members; l != NULL; l = l->next)
     {
         const gchar *member_name = l->data;
-        JsonNode *member_node = json_object_get_member(config_obj, member_name);
-        json_builder_set_member_name(builder, member_name);
-        json_builder_add_value(builder, json_node_copy(member_node));
+        json_object_set_member(settings, member_name,
+                               json_node_copy(json_object_get_member(config->settings, member_name)));
     }
     g_list_free(members);
 
-    json_builder_end_object(builder);
+    json_object_set_string_member(settings, "model", model);
 
+    /* Generate JSON */
+    root = json_node_init_object(json_node_alloc(), settings);
     generator = json_generator_new();
     json_generator_set_pretty(generator, TRUE);
-    root = json_builder_get_root(builder);
     json_generator_set_root(generator, root);
+    data = json_generator_to_data(generator, &length);
 
-    success = json_generator_to_file(generator, config_path, &error);
+    success = g_file_set_contents(config_files[CONFIG_FILE_SETTINGS].path, data, length, &error);
     if (!success)
     {
         g_warning("Failed to save config: %s", error->message);
         g_error_free(error);
-    }
-    else
-    {
-        g_debug("Model saved: %s", model);
+        goto cleanup;
     }
 
-    json_object_unref(config_obj);
-    g_object_unref(parser);
+    g_debug("Model saved: %s", model);
+
+    /* Remember what we wrote so the monitor event is not reloaded */
+    g_free(config_files[CONFIG_FILE_SETTINGS].checksum);
+    config_files[CONFIG_FILE_SETTINGS].checksum =
+        g_compute_checksum_for_data(G_CHECKSUM_SHA256, (const guchar *)data, length);
+
+    updated = config_copy(config);
+    json_object_unref(updated->settings);
+    updated->settings = json_object_ref(settings);
+    g_free(updated->model);
+    updated->model = g_strdup(model);
+    config_replace(updated);
 
 cleanup:
     if (root)
         json_node_free(root);
     if (generator)
         g_object_unref(generator);
-    if (builder)
-        g_object_unref(builder);
+    if (settings)
+        json_object_unref(settings);
+    g_free(data);
     g_free(config_dir);
-    g_free(config_path);
+    m_config_unref(config);
 
     return success;
 }
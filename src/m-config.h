@@ -5,6 +5,7 @@
  * - Loading prompts from JSON config file
  * - Loading API key from ~/.authinfo
  * - Managing selected AI model
+ * - Sharing one hot-reloaded configuration snapshot per process
  */
 
 #ifndef M_CONFIG_H
@@ -12,6 +13,8 @@
 
 #include <json-glib/json-glib.h>
 
+#include "m-backend.h"
+
 G_BEGIN_DECLS
 
 /**
@@ -21,6 +24,135 @@ G_BEGIN_DECLS
  */
 #define M_CONFIG_DEFAULT_MODEL "gpt-4o"
 
+/**
+ * m_config_get_user_config_dir:
+ *
+ * The Evolution user config directory, which holds the ai-proofread
+ * directory. Builds with M_CONFIG_STANDALONE, which do not link
+ * Evolution, use the same location below the XDG config directory.
+ *
+ * Returns: (transfer none): The directory
+ */
+const gchar *m_config_get_user_config_dir(void);
+
+/**
+ * MConfig:
+ * @prompts: Array of prompt configurations from prompts.json
+ * @api_key: (nullable): The OpenAI API key from ~/.authinfo
+ * @model: The selected model from config.json (or the default)
+ * @settings: The contents of config.json
+ * @api_keys: Table of ~/.authinfo machine names to API keys
+ * @backends: Table of backend names to #MBackend, see m_config_get_backend()
+ * @generation: Counter incremented whenever any of the files changed
+ *
+ * Immutable, refcounted snapshot of the plugin configuration. A new
+ * snapshot replaces the current one when a configuration file changes,
+ * so holders of a reference never see it change under them.
+ */
+typedef struct _MConfig MConfig;
+
+struct _MConfig
+{
+    JsonArray *prompts;
+    gchar *api_key;
+    gchar *model;
+    JsonObject *settings;
+    GHashTable *api_keys;
+    GHashTable *backends;
+    guint generation;
+};
+
+/**
+ * MConfigChangedFunc:
+ * @config: The new configuration snapshot
+ * @user_data: The data passed to m_config_add_listener()
+ *
+ * Called on the main thread after a configuration file changed.
+ */
+typedef void (*MConfigChangedFunc)(MConfig *config, gpointer user_data);
+
+/**
+ * m_config_get:
+ *
+ * Return the current configuration snapshot. The files are read on the
+ * first call and afterwards only when a file monitor reports a change.
+ * The first call must be made from the main thread.
+ *
+ * Returns: (transfer full): A reference to the snapshot, release it
+ *          with m_config_unref()
+ */
+MConfig *m_config_get(void);
+
+/**
+ * m_config_ref:
+ * @config: A configuration snapshot
+ *
+ * Returns: (transfer full): @config with an additional reference
+ */
+MConfig *m_config_ref(MConfig *config);
+
+/**
+ * m_config_unref:
+ * @config: A configuration snapshot
+ *
+ * Release a reference to a configuration snapshot.
+ */
+void m_config_unref(MConfig *config);
+
+/**
+ * m_config_get_section:
+ * @config: A configuration snapshot
+ * @name: The member name in config.json
+ *
+ * Look up an object-valued member of config.json, such as "cache".
+ *
+ * Returns: (transfer none) (nullable): The object, or NULL if @name is
+ *          missing or not an object
+ */
+JsonObject *m_config_get_section(MConfig *config, const gchar *name);
+
+/**
+ * m_config_get_backend:
+ * @config: A configuration snapshot
+ * @name: (nullable): The backend name, NULL for %M_BACKEND_DEFAULT
+ *
+ * Look up a backend configured in config.json. Unknown names fall back to
+ * the default backend.
+ *
+ * Returns: (transfer none): The backend, take a reference with
+ *          m_backend_ref() to keep it beyond @config
+ */
+MBackend *m_config_get_backend(MConfig *config, const gchar *name);
+
+/**
+ * m_config_get_prompt_backend:
+ * @config: A configuration snapshot
+ * @prompt: (nullable): A prompt object
+ *
+ * Returns: (transfer none): The backend chosen by the "backend" member of
+ *          @prompt, or the default backend
+ */
+MBackend *m_config_get_prompt_backend(MConfig *config, JsonObject *prompt);
+
+/**
+ * m_config_add_listener:
+ * @func: The function to call when the configuration changes
+ * @user_data: Data to pass to @func
+ *
+ * Register a listener for configuration changes.
+ *
+ * Returns: A listener ID for m_config_remove_listener()
+ */
+guint m_config_add_listener(MConfigChangedFunc func, gpointer user_data);
+
+/**
+ * m_config_remove_listener:
+ * @listener_id: The ID returned by m_config_add_listener()
+ *
+ * Unregister a configuration listener.
+ */
+void m_config_remove_listener(guint listener_id);
+
 /**
  * m_config_load_prompts:
  *
@@ -41,6 +173,7 @@ JsonArray *m_config_load_prompts(void);
  * Read ~/.authinfo and try to find a line matching the expected format
  * for the OpenAI API key:
  * "machine api.openai.com login apikey password <key>"
+ * Keys for other backends use the same format with their host.
  *
  * Returns: (transfer full) (nullable): A newly allocated string with
  *          the API key, or NULL if none is found. The caller must free
@@ -63,7 +196,8 @@ gchar *m_config_load_model(void);
  * m_config_save_model:
  * @model: The model ID to save
  *
- * Save the selected AI model to the configuration file.
+ * Save the selected AI model to the configuration file and the current
+ * configuration snapshot.
  *
  * Returns: TRUE on success, FALSE on error
  */
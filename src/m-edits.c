@@ -0,0 +1,177 @@
+/*
+ * m-edits.c - Edit list handling for AI Proofread Plugin
+ *
+ * Implements parsing of edit lists and their application to the
+ * original text.
+ */
+
+#include <string.h>
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
+
+#include "m-edits.h"
+
+typedef struct
+{
+    gsize start;                /* Offset of the span in the original text */
+    gsize length;               /* Length of the span */
+    const gchar *replacement;   /* Owned by the parsed response */
+} EditMatch;
+
+static gint
+compare_matches(gconstpointer a, gconstpointer b)
+{
+    const EditMatch *match_a = a;
+    const EditMatch *match_b = b;
+
+    if (match_a->start < match_b->start)
+        return -1;
+    return match_a->start > match_b->start ? 1 : 0;
+}
+
+/*
+ * match_overlaps:
+ *
+ * Returns: TRUE if the span at @start overlaps a span in @matches
+ */
+static gboolean
+match_overlaps(GArray *matches, gsize start, gsize length)
+{
+    for (guint i = 0; i < matches->len; i++)
+    {
+        EditMatch *match = &g_array_index(matches, EditMatch, i);
+
+        if (start < match->start + match->length && match->start < start + length)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+ * find_edit:
+ * @text: The original text
+ * @original: The span to find
+ * @cursor: Offset to search from first
+ * @matches: The spans matched so far
+ * @start: (out): Offset of the span
+ *
+ * Edits usually come in text order, so search after the previous edit
+ * first and from the beginning otherwise.
+ *
+ * Returns: TRUE if a free occurrence of @original was found
+ */
+static gboolean
+find_edit(const gchar *text, const gchar *original, gsize cursor, GArray *matches, gsize *start)
+{
+    gsize length = strlen(original);
+    const gchar *found = strstr(text + cursor, original);
+
+    if (found && !match_overlaps(matches, found - text, length))
+    {
+        *start = found - text;
+        return TRUE;
+    }
+
+    for (found = strstr(text, original); found; found = strstr(found + 1, original))
+    {
+        if (!match_overlaps(matches, found - text, length))
+        {
+            *start = found - text;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/*
+ * m_edits_apply:
+ */
+gchar *
+m_edits_apply(const gchar *text, const gchar *response, GError **error)
+{
+    JsonParser *parser;
+    JsonNode *root;
+    JsonArray *edits;
+    GArray *matches;
+    GString *result;
+    gsize cursor = 0;
+    gsize position = 0;
+
+    g_return_val_if_fail(text != NULL, NULL);
+    g_return_val_if_fail(response != NULL, NULL);
+
+    parser = json_parser_new();
+    if (!json_parser_load_from_data(parser, response, -1, error))
+    {
+        g_object_unref(parser);
+        return NULL;
+    }
+
+    root = json_parser_get_root(parser);
+    if (!JSON_NODE_HOLDS_OBJECT(root) ||
+        !json_object_has_member(json_node_get_object(root), "edits") ||
+        !JSON_NODE_HOLDS_ARRAY(json_object_get_member(json_node_get_object(root), "edits")))
+    {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "Invalid edit list: no 'edits' array");
+        g_object_unref(parser);
+        return NULL;
+    }
+
+    edits = json_object_get_array_member(json_node_get_object(root), "edits");
+    matches = g_array_new(FALSE, FALSE, sizeof(EditMatch));
+
+    for (guint i = 0; i < json_array_get_length(edits); i++)
+    {
+        JsonNode *node = json_array_get_element(edits, i);
+        JsonObject *edit;
+        const gchar *original;
+        const gchar *replacement;
+        EditMatch match;
+
+        if (!JSON_NODE_HOLDS_OBJECT(node))
+            continue;
+
+        edit = json_node_get_object(node);
+        original = json_object_get_string_member_with_default(edit, "original", NULL);
+        replacement = json_object_get_string_member_with_default(edit, "replacement", NULL);
+
+        if (!original || !*original || !replacement || g_strcmp0(original, replacement) == 0)
+            continue;
+
+        if (!find_edit(text, original, cursor, matches, &match.start))
+        {
+            g_debug("Skipping edit, original not found: %s", original);
+            continue;
+        }
+
+        match.length = strlen(original);
+        match.replacement = replacement;
+        g_array_append_val(matches, match);
+        cursor = match.start + match.length;
+
+        g_debug("Edit: \"%s\" -> \"%s\" (%s)", original, replacement,
+                json_object_get_string_member_with_default(edit, "reason", ""));
+    }
+
+    g_array_sort(matches, compare_matches);
+
+    result = g_string_sized_new(strlen(text));
+    for (guint i = 0; i < matches->len; i++)
+    {
+        EditMatch *match = &g_array_index(matches, EditMatch, i);
+
+        g_string_append_len(result, text + position, match->start - position);
+        g_string_append(result, match->replacement);
+        position = match->start + match->length;
+    }
+    g_string_append(result, text + position);
+
+    g_debug("Applied %u of %u edits", matches->len, json_array_get_length(edits));
+
+    g_array_unref(matches);
+    g_object_unref(parser);
+
+    return g_string_free(result, FALSE);
+}
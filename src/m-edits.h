@@ -0,0 +1,34 @@
+/*
+ * m-edits.h - Edit list handling for AI Proofread Plugin
+ *
+ * This module handles the "edits" output mode of prompts:
+ * - Parsing the list of edits returned by the model
+ * - Applying the edits to the original text locally
+ */
+
+#ifndef M_EDITS_H
+#define M_EDITS_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * m_edits_apply:
+ * @text: The text that was sent
+ * @response: The model response, a JSON object with an "edits" array of
+ *            objects with "original", "replacement" and "reason"
+ * @error: Return location for error
+ *
+ * Apply the edits of @response to @text. Edits are located in order;
+ * an edit whose original text cannot be found, or which overlaps an
+ * earlier edit, is skipped.
+ *
+ * Returns: (transfer full) (nullable): The corrected text, or NULL if
+ *          @response is not a valid edit list
+ */
+gchar *m_edits_apply(const gchar *text, const gchar *response, GError **error);
+
+G_END_DECLS
+
+#endif /* M_EDITS_H */
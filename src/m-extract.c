@@ -0,0 +1,512 @@
+/*
+ * m-extract.c - Content extraction for AI Proofread Plugin
+ *
+ * Implements line classification of plain text bodies into own text,
+ * quoted history and signature.
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "m-extract.h"
+#include "m-tokens.h"
+
+#define EXTRACT_CONTEXT_HEADER \
+    "Quoted earlier messages, for context only. " \
+    "Do not correct, repeat or include them in the answer:"
+
+#define EXTRACT_TEXT_HEADER "The text to work on:"
+
+/* Marks where trimmed context was */
+#define EXTRACT_TRIMMED_MARKER "[...]"
+
+typedef enum
+{
+    LINE_TEXT,
+    LINE_QUOTED,
+    LINE_SIGNATURE
+} LineKind;
+
+/*
+ * m_extract_mode_from_string:
+ */
+MExtractMode
+m_extract_mode_from_string(const gchar *value, MExtractMode default_mode)
+{
+    if (g_strcmp0(value, "keep") == 0)
+        return M_EXTRACT_KEEP;
+    if (g_strcmp0(value, "drop") == 0)
+        return M_EXTRACT_DROP;
+    if (g_strcmp0(value, "context") == 0)
+        return M_EXTRACT_CONTEXT;
+
+    if (value)
+        g_warning("Unknown extraction mode '%s'", value);
+
+    return default_mode;
+}
+
+/*
+ * normalize_whitespace:
+ *
+ * Returns: (transfer full): @text with every whitespace run replaced by
+ *          a single space and without leading or trailing whitespace
+ */
+static gchar *
+normalize_whitespace(const gchar *text)
+{
+    GString *normalized = g_string_sized_new(strlen(text));
+    gboolean in_space = TRUE;
+
+    for (const gchar *p = text; *p; p++)
+    {
+        if (g_ascii_isspace(*p))
+        {
+            in_space = TRUE;
+            continue;
+        }
+
+        if (in_space && normalized->len > 0)
+            g_string_append_c(normalized, ' ');
+        g_string_append_c(normalized, *p);
+        in_space = FALSE;
+    }
+
+    return g_string_free(normalized, FALSE);
+}
+
+/*
+ * m_extract_selection_matches:
+ */
+gboolean
+m_extract_selection_matches(const gchar *body, const gchar *selection)
+{
+    gchar *normalized_body;
+    gchar *normalized_selection;
+    gboolean matches;
+
+    if (!body || !selection)
+        return FALSE;
+
+    normalized_selection = normalize_whitespace(selection);
+    if (!*normalized_selection)
+    {
+        g_free(normalized_selection);
+        return FALSE;
+    }
+
+    normalized_body = normalize_whitespace(body);
+    matches = strstr(normalized_body, normalized_selection) != NULL;
+
+    g_free(normalized_body);
+    g_free(normalized_selection);
+
+    return matches;
+}
+
+static gboolean
+line_is_blank(const gchar *line)
+{
+    for (; *line; line++)
+    {
+        if (!g_ascii_isspace(*line))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean
+line_is_quoted(const gchar *line)
+{
+    while (*line == ' ' || *line == '\t')
+        line++;
+    return *line == '>';
+}
+
+static gboolean
+line_is_signature_delimiter(const gchar *line)
+{
+    /* Only the standard delimiter, a bare "--" is too often a separator
+     * within the text */
+    return g_strcmp0(line, "-- ") == 0 || g_strcmp0(line, "-- \r") == 0;
+}
+
+static gboolean
+line_is_original_message_header(const gchar *line)
+{
+    return strstr(line, "-----Original Message-----") != NULL;
+}
+
+/*
+ * classify_lines:
+ * @lines: The lines of the body
+ * @n_lines: Number of lines
+ *
+ * Returns: (transfer full): The kind of every line
+ */
+static LineKind *
+classify_lines(gchar **lines, guint n_lines)
+{
+    LineKind *kinds = g_new0(LineKind, MAX(n_lines, 1));
+    gboolean in_original = FALSE;
+
+    /* Quoted lines, and everything after an "Original Message" header */
+    for (guint i = 0; i < n_lines; i++)
+    {
+        if (line_is_original_message_header(lines[i]))
+            in_original = TRUE;
+        if (in_original || line_is_quoted(lines[i]))
+            kinds[i] = LINE_QUOTED;
+    }
+
+    /* The attribution line ("On ... wrote:") right above a quote */
+    for (guint i = 1; i < n_lines; i++)
+    {
+        if (kinds[i] != LINE_QUOTED || kinds[i - 1] == LINE_QUOTED)
+            continue;
+
+        for (gint j = (gint)i - 1; j >= 0; j--)
+        {
+            gchar *stripped;
+
+            if (line_is_blank(lines[j]))
+                continue;
+
+            stripped = g_strchomp(g_strdup(lines[j]));
+            if (kinds[j] == LINE_TEXT && g_str_has_suffix(stripped, ":"))
+                kinds[j] = LINE_QUOTED;
+            g_free(stripped);
+            break;
+        }
+    }
+
+    /* The signature runs from its delimiter to the next quoted block */
+    for (guint i = 0; i < n_lines; i++)
+    {
+        if (kinds[i] != LINE_TEXT || !line_is_signature_delimiter(lines[i]))
+            continue;
+
+        for (; i < n_lines && kinds[i] == LINE_TEXT; i++)
+            kinds[i] = LINE_SIGNATURE;
+        break;
+    }
+
+    return kinds;
+}
+
+/*
+ * selection_has_quotes:
+ * @selection: The selected text
+ *
+ * Returns: TRUE if any line of @selection is classified as quoted
+ *          history, the same way as the lines of the body
+ */
+static gboolean
+selection_has_quotes(const gchar *selection)
+{
+    gchar **lines = g_strsplit(selection, "\n", -1);
+    guint n_lines = g_strv_length(lines);
+    LineKind *kinds = classify_lines(lines, n_lines);
+    gboolean has_quotes = FALSE;
+
+    for (guint i = 0; i < n_lines && !has_quotes; i++)
+        has_quotes = kinds[i] == LINE_QUOTED;
+
+    g_free(kinds);
+    g_strfreev(lines);
+
+    return has_quotes;
+}
+
+/*
+ * m_extract_content:
+ */
+MExtraction *
+m_extract_content(const gchar *body,
+                  const gchar *selection,
+                  MExtractMode quoted_mode,
+                  MExtractMode signature_mode)
+{
+    MExtraction *extraction;
+    GString *text;
+    GString *context;
+    gboolean has_text = FALSE;
+    gchar **lines;
+    guint n_lines;
+    LineKind *kinds;
+
+    g_return_val_if_fail(body != NULL, NULL);
+
+    extraction = g_new0(MExtraction, 1);
+    text = g_string_new(NULL);
+    context = g_string_new(NULL);
+
+    /* A selection reaching into the quotes is sent with them as its text,
+     * the same quotes must not go along as context again */
+    if (selection && quoted_mode == M_EXTRACT_CONTEXT && selection_has_quotes(selection))
+    {
+        g_debug("Selection contains quoted lines, sending no context");
+        quoted_mode = M_EXTRACT_DROP;
+    }
+
+    lines = g_strsplit(body, "\n", -1);
+    n_lines = g_strv_length(lines);
+    kinds = classify_lines(lines, n_lines);
+
+    for (guint i = 0; i < n_lines; i++)
+    {
+        MExtractMode mode = M_EXTRACT_KEEP;
+
+        if (kinds[i] == LINE_QUOTED)
+            mode = quoted_mode;
+        else if (kinds[i] == LINE_SIGNATURE)
+            mode = signature_mode == M_EXTRACT_KEEP ? M_EXTRACT_KEEP : M_EXTRACT_DROP;
+
+        if (mode == M_EXTRACT_KEEP)
+        {
+            if (has_text)
+                g_string_append_c(text, '\n');
+            g_string_append(text, lines[i]);
+            has_text = TRUE;
+        }
+        else if (mode == M_EXTRACT_CONTEXT)
+        {
+            if (context->len > 0)
+                g_string_append_c(context, '\n');
+            g_string_append(context, lines[i]);
+        }
+    }
+
+    /* Dropped blocks usually leave trailing blank lines behind */
+    if (quoted_mode != M_EXTRACT_KEEP || signature_mode != M_EXTRACT_KEEP)
+        g_string_set_size(text, strlen(g_strchomp(text->str)));
+    g_string_set_size(context, strlen(g_strchomp(context->str)));
+
+    if (selection)
+    {
+        extraction->text = g_strdup(selection);
+        g_string_free(text, TRUE);
+    }
+    else
+    {
+        /* Whatever follows the text is put back behind its result */
+        if (g_str_has_prefix(body, text->str))
+            extraction->tail = g_strdup(body + text->len);
+        extraction->text = g_string_free(text, FALSE);
+    }
+
+    if (context->len > 0)
+        extraction->context = g_string_free(context, FALSE);
+    else
+        g_string_free(context, TRUE);
+
+    g_debug("Extracted %" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT " bytes%s",
+            strlen(extraction->text), strlen(body),
+            extraction->context ? " plus context" : "");
+
+    g_free(kinds);
+    g_strfreev(lines);
+
+    return extraction;
+}
+
+/*
+ * m_extract_content_take:
+ */
+MExtraction *
+m_extract_content_take(gchar *body,
+                       const gchar *selection,
+                       MExtractMode quoted_mode,
+                       MExtractMode signature_mode)
+{
+    MExtraction *extraction;
+
+    g_return_val_if_fail(body != NULL, NULL);
+
+    if (selection || quoted_mode != M_EXTRACT_KEEP || signature_mode != M_EXTRACT_KEEP)
+    {
+        extraction = m_extract_content(body, selection, quoted_mode, signature_mode);
+        g_free(body);
+        return extraction;
+    }
+
+    /* Keeping every line gives back the body as is */
+    extraction = g_new0(MExtraction, 1);
+    extraction->text = body;
+    extraction->tail = g_strdup("");
+
+    return extraction;
+}
+
+/*
+ * m_extraction_compose:
+ */
+gchar *
+m_extraction_compose(const MExtraction *extraction)
+{
+    g_return_val_if_fail(extraction != NULL, NULL);
+
+    if (!extraction->context)
+        return g_strdup(extraction->text);
+
+    /* The context goes first: it stays the same while the text is revised,
+     * so repeated passes share a longer cacheable prefix */
+    return g_strconcat(EXTRACT_CONTEXT_HEADER, "\n",
+                       extraction->context, "\n\n",
+                       EXTRACT_TEXT_HEADER, "\n",
+                       extraction->text, NULL);
+}
+
+/*
+ * quote_depth:
+ *
+ * Returns: The number of ">" in front of @line
+ */
+static guint
+quote_depth(const gchar *line)
+{
+    guint depth = 0;
+
+    for (; *line == '>' || *line == ' ' || *line == '\t'; line++)
+    {
+        if (*line == '>')
+            depth++;
+    }
+    return depth;
+}
+
+/*
+ * m_extraction_trim_context:
+ */
+gboolean
+m_extraction_trim_context(MExtraction *extraction, guint max_tokens)
+{
+    gchar **lines;
+    guint n_lines;
+    guint *depths;
+    guint *tokens;
+    gboolean *kept;
+    guint total;
+    guint overhead;
+    GString *context;
+
+    g_return_val_if_fail(extraction != NULL, FALSE);
+
+    if (!extraction->context)
+        return FALSE;
+
+    overhead = m_tokens_estimate(EXTRACT_CONTEXT_HEADER) + m_tokens_estimate(EXTRACT_TEXT_HEADER);
+    total = overhead + m_tokens_estimate(extraction->context);
+    if (total <= max_tokens)
+        return FALSE;
+
+    lines = g_strsplit(extraction->context, "\n", -1);
+    n_lines = g_strv_length(lines);
+    depths = g_new0(guint, MAX(n_lines, 1));
+    tokens = g_new0(guint, MAX(n_lines, 1));
+    kept = g_new0(gboolean, MAX(n_lines, 1));
+
+    /* Each line costs its text and the line break, and an attribution line
+     * ("> On ... wrote:") goes with the deeper quote below it */
+    total = overhead + m_tokens_estimate(EXTRACT_TRIMMED_MARKER);
+    for (guint i = 0; i < n_lines; i++)
+    {
+        depths[i] = quote_depth(lines[i]);
+        tokens[i] = m_tokens_estimate(lines[i]) + 1;
+        kept[i] = TRUE;
+        total += tokens[i];
+    }
+    for (guint i = n_lines; i > 1; i--)
+    {
+        gchar *stripped;
+
+        if (depths[i - 1] <= depths[i - 2])
+            continue;
+
+        stripped = g_strchomp(g_strdup(lines[i - 2]));
+        if (g_str_has_suffix(stripped, ":"))
+            depths[i - 2] = depths[i - 1];
+        g_free(stripped);
+    }
+
+    /* Drop the deepest quotes first, keeping at least one level */
+    while (total > max_tokens)
+    {
+        guint deepest = 0;
+
+        for (guint i = 0; i < n_lines; i++)
+        {
+            if (kept[i])
+                deepest = MAX(deepest, depths[i]);
+        }
+        if (deepest <= 1)
+            break;
+
+        for (guint i = 0; i < n_lines; i++)
+        {
+            if (kept[i] && depths[i] == deepest)
+            {
+                kept[i] = FALSE;
+                total -= tokens[i];
+            }
+        }
+    }
+
+    /* Then cut the rest from the end */
+    for (guint i = n_lines; i > 0 && total > max_tokens; i--)
+    {
+        if (kept[i - 1])
+        {
+            kept[i - 1] = FALSE;
+            total -= tokens[i - 1];
+        }
+    }
+
+    context = g_string_new(NULL);
+    for (guint i = 0; i < n_lines; i++)
+    {
+        if (!kept[i])
+            continue;
+        if (context->len > 0)
+            g_string_append_c(context, '\n');
+        g_string_append(context, lines[i]);
+    }
+    g_string_set_size(context, strlen(g_strchomp(context->str)));
+
+    g_debug("Trimmed quoted context from %" G_GSIZE_FORMAT " to %" G_GSIZE_FORMAT " bytes",
+            strlen(extraction->context), context->len);
+
+    g_free(extraction->context);
+    if (context->len > 0)
+    {
+        g_string_append(context, "\n" EXTRACT_TRIMMED_MARKER);
+        extraction->context = g_string_free(context, FALSE);
+    }
+    else
+    {
+        extraction->context = NULL;
+        g_string_free(context, TRUE);
+    }
+
+    g_free(kept);
+    g_free(tokens);
+    g_free(depths);
+    g_strfreev(lines);
+
+    return TRUE;
+}
+
+/*
+ * m_extraction_free:
+ */
+void
+m_extraction_free(MExtraction *extraction)
+{
+    if (!extraction)
+        return;
+
+    g_free(extraction->text);
+    g_free(extraction->context);
+    g_free(extraction->tail);
+    g_free(extraction);
+}
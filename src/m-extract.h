@@ -0,0 +1,151 @@
+/*
+ * m-extract.h - Content extraction for AI Proofread Plugin
+ *
+ * This module decides what part of a message is sent:
+ * - Only the selection, when the user selected text
+ * - Detection of quoted history (">" lines and their attribution)
+ *   and of the signature ("-- " delimiter)
+ * - Dropping them, or keeping quoted history as read-only context
+ * - Trimming that context to a token budget, oldest quotes first
+ */
+
+#ifndef M_EXTRACT_H
+#define M_EXTRACT_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * MExtractMode:
+ * @M_EXTRACT_KEEP: Send the block as part of the text
+ * @M_EXTRACT_DROP: Do not send the block
+ * @M_EXTRACT_CONTEXT: Send the block separately as read-only context
+ *
+ * What to do with quoted history or the signature. Configured per prompt
+ * with "quoted" and "signature" set to "keep", "drop" or "context".
+ */
+typedef enum
+{
+    M_EXTRACT_KEEP,
+    M_EXTRACT_DROP,
+    M_EXTRACT_CONTEXT
+} MExtractMode;
+
+/**
+ * MExtraction:
+ * @text: The text to work on
+ * @context: (nullable): Read-only context to send along, or NULL
+ * @tail: (nullable): The rest of the body after @text, holding the
+ *        quoted history and signature which were not sent as text, or
+ *        NULL if @text is not the start of the body (a selection, or
+ *        quoted history between parts of the text)
+ *
+ * The result of m_extract_content(). When @tail is set, a result for
+ * @text can replace it in place; batch jobs write the result followed
+ * by @tail as the new body.
+ */
+typedef struct _MExtraction MExtraction;
+
+struct _MExtraction
+{
+    gchar *text;
+    gchar *context;
+    gchar *tail;
+};
+
+/**
+ * m_extract_mode_from_string:
+ * @value: (nullable): "keep", "drop" or "context"
+ * @default_mode: The mode to use if @value is NULL or unknown
+ *
+ * Returns: The parsed mode
+ */
+MExtractMode m_extract_mode_from_string(const gchar *value, MExtractMode default_mode);
+
+/**
+ * m_extract_selection_matches:
+ * @body: The plain text body of the message
+ * @selection: The candidate selection
+ *
+ * Check that @selection occurs in @body, ignoring differences in
+ * whitespace such as line wrapping.
+ *
+ * Returns: TRUE if @selection is part of @body
+ */
+gboolean m_extract_selection_matches(const gchar *body, const gchar *selection);
+
+/**
+ * m_extract_content:
+ * @body: The plain text body of the message
+ * @selection: (nullable): The selected text, if any
+ * @quoted_mode: What to do with quoted history
+ * @signature_mode: What to do with the signature (%M_EXTRACT_CONTEXT
+ *                  is treated as %M_EXTRACT_DROP)
+ *
+ * Split the message into the text to send and optional context. With a
+ * selection, the text is the selection as is and only the context is
+ * taken from @body, unless the selection contains quoted lines itself;
+ * then no context is sent.
+ *
+ * Returns: (transfer full): The extraction, free with m_extraction_free(),
+ *          or NULL if @body is NULL
+ */
+MExtraction *m_extract_content(const gchar *body,
+                               const gchar *selection,
+                               MExtractMode quoted_mode,
+                               MExtractMode signature_mode);
+
+/**
+ * m_extract_content_take:
+ * @body: (transfer full): The plain text body of the message
+ * @selection: (nullable): The selected text, if any
+ * @quoted_mode: What to do with quoted history
+ * @signature_mode: What to do with the signature
+ *
+ * Like m_extract_content(), but takes @body. When everything is kept and
+ * nothing is selected, @body becomes the text without being copied.
+ *
+ * Returns: (transfer full): The extraction, free with m_extraction_free(),
+ *          or NULL if @body is NULL
+ */
+MExtraction *m_extract_content_take(gchar *body,
+                                    const gchar *selection,
+                                    MExtractMode quoted_mode,
+                                    MExtractMode signature_mode);
+
+/**
+ * m_extraction_compose:
+ * @extraction: An extraction
+ *
+ * Build the content to send: the context in a clearly marked block if
+ * there is any, followed by the text. Keeping the context in front lets
+ * repeated passes over a revised text share a cached prompt prefix.
+ *
+ * Returns: (transfer full): The content to send
+ */
+gchar *m_extraction_compose(const MExtraction *extraction);
+
+/**
+ * m_extraction_trim_context:
+ * @extraction: An extraction
+ * @max_tokens: The estimated tokens the context may use, see m_tokens_estimate()
+ *
+ * Shorten the context of @extraction to fit @max_tokens. The most deeply
+ * quoted messages, which are the oldest of the thread, are dropped first,
+ * then lines from the end of the rest. The context becomes NULL if nothing
+ * fits. The text is never changed.
+ *
+ * Returns: TRUE if the context was shortened
+ */
+gboolean m_extraction_trim_context(MExtraction *extraction, guint max_tokens);
+
+/**
+ * m_extraction_free:
+ * @extraction: The extraction to free
+ */
+void m_extraction_free(MExtraction *extraction);
+
+G_END_DECLS
+
+#endif /* M_EXTRACT_H */
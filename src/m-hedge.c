@@ -0,0 +1,461 @@
+/*
+ * m-hedge.c - Hedged requests for AI Proofread Plugin
+ *
+ * Implements the hedging policy from config.json and the race between
+ * the primary and the hedge request on top of m_chatgpt_proofread_async().
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
+
+#include "m-hedge.h"
+
+#define HEDGE_PRIMARY 0
+#define HEDGE_SECONDARY 1
+
+typedef struct _HedgeRequest HedgeRequest;
+
+/* One of the two racing requests */
+typedef struct
+{
+    HedgeRequest *request;
+    GTask *task;              /* Reference held while the leg runs */
+    GCancellable *cancellable;
+    MStatsRecord *stats;
+    gboolean running;
+} HedgeLeg;
+
+/* The task data of a hedged request */
+struct _HedgeRequest
+{
+    const gchar *content;     /* The caller's, alive until completion */
+    const gchar *prediction;  /* Likewise */
+    gchar *prompt_id;
+    JsonArray *prompts;
+    MBackend *hedge_backend;
+    gchar *hedge_model;
+    gchar *previous_response_id;
+    gchar *response_id;       /* Of the winning leg */
+    gboolean stream;
+    MChatGPTDeltaFunc delta_func;
+    gpointer user_data;
+    MStatsRecord *stats;      /* The caller's record, not touched once completed */
+    GCancellable *cancellable;
+    gulong cancelled_id;
+    guint after_ms;
+    GTask *task;              /* Not referenced, for the timer */
+    GSource *timer;
+    gboolean timer_started;
+    HedgeLeg legs[2];
+    HedgeLeg *winner;
+    GError *error;            /* Failure of the first leg to fail */
+    gboolean completed;
+};
+
+static void
+hedge_clear_timer(HedgeRequest *request)
+{
+    if (request->timer)
+    {
+        g_source_destroy(request->timer);
+        g_clear_pointer(&request->timer, g_source_unref);
+    }
+}
+
+static void
+hedge_request_free(HedgeRequest *request)
+{
+    hedge_clear_timer(request);
+    if (request->cancelled_id)
+        g_cancellable_disconnect(request->cancellable, request->cancelled_id);
+    g_clear_object(&request->cancellable);
+
+    for (guint i = 0; i < G_N_ELEMENTS(request->legs); i++)
+    {
+        g_clear_object(&request->legs[i].cancellable);
+        m_stats_record_free(request->legs[i].stats);
+    }
+
+    g_clear_error(&request->error);
+    g_free(request->prompt_id);
+    json_array_unref(request->prompts);
+    m_backend_unref(request->hedge_backend);
+    g_free(request->hedge_model);
+    g_free(request->previous_response_id);
+    g_free(request->response_id);
+    g_free(request);
+}
+
+/*
+ * m_hedge_policy_new:
+ */
+MHedgePolicy *
+m_hedge_policy_new(MConfig *config, JsonObject *prompt, MBackend *primary)
+{
+    JsonObject *section;
+    MHedgePolicy *policy;
+    const gchar *backend_name;
+    MBackend *backend;
+
+    g_return_val_if_fail(config != NULL, NULL);
+    g_return_val_if_fail(primary != NULL, NULL);
+
+    section = m_config_get_section(config, "hedge");
+    if (!section || !json_object_get_boolean_member_with_default(section, "enabled", TRUE))
+        return NULL;
+    if (prompt && !json_object_get_boolean_member_with_default(prompt, "hedge", TRUE))
+        return NULL;
+    /* A conversation continues a response stored on one backend */
+    if (prompt && json_object_get_boolean_member_with_default(prompt, "conversation", FALSE))
+        return NULL;
+
+    backend_name = json_object_get_string_member_with_default(section, "backend", NULL);
+    backend = backend_name ? m_config_get_backend(config, backend_name) : primary;
+    if (!m_backend_is_usable(backend))
+    {
+        g_debug("Not hedging on backend '%s' without an API key", backend->name);
+        return NULL;
+    }
+
+    policy = g_new0(MHedgePolicy, 1);
+    policy->after_ms = MAX(json_object_get_int_member_with_default(section, "after_ms",
+                                                                   M_HEDGE_DEFAULT_AFTER_MS), 0);
+    policy->backend = m_backend_ref(backend);
+    policy->model = g_strdup(json_object_get_string_member_with_default(section, "model", NULL));
+
+    return policy;
+}
+
+/*
+ * m_hedge_policy_free:
+ */
+void
+m_hedge_policy_free(MHedgePolicy *policy)
+{
+    if (!policy)
+        return;
+
+    m_backend_unref(policy->backend);
+    g_free(policy->model);
+    g_free(policy);
+}
+
+/*
+ * hedge_copy_timings:
+ *
+ * Report the request of @src in @dest, which keeps its own start time,
+ * prompt and editor insertion time.
+ */
+static void
+hedge_copy_timings(MStatsRecord *dest, const MStatsRecord *src)
+{
+    g_free(dest->model);
+    dest->model = g_strdup(src->model);
+    dest->status = src->status;
+    dest->retries = src->retries;
+    dest->queue_us = src->queue_us;
+    dest->dns_us = src->dns_us;
+    dest->connect_us = src->connect_us;
+    dest->tls_us = src->tls_us;
+    dest->ttfb_us = src->ttfb_us;
+    dest->transfer_us = src->transfer_us;
+    dest->parse_us = src->parse_us;
+    dest->estimated_tokens = src->estimated_tokens;
+    dest->prompt_tokens = src->prompt_tokens;
+    dest->cached_tokens = src->cached_tokens;
+    dest->completion_tokens = src->completion_tokens;
+    dest->timeout_s = src->timeout_s;
+}
+
+/*
+ * hedge_cancel_others:
+ *
+ * Cancel every running leg but @keep.
+ */
+static void
+hedge_cancel_others(HedgeRequest *request, HedgeLeg *keep)
+{
+    for (guint i = 0; i < G_N_ELEMENTS(request->legs); i++)
+    {
+        if (&request->legs[i] != keep && request->legs[i].running)
+            g_cancellable_cancel(request->legs[i].cancellable);
+    }
+}
+
+static void
+hedge_cancelled_cb(GCancellable *cancellable, gpointer user_data)
+{
+    HedgeRequest *request = user_data;
+
+    /* May run on any thread; cancelling is thread-safe */
+    for (guint i = 0; i < G_N_ELEMENTS(request->legs); i++)
+        g_cancellable_cancel(request->legs[i].cancellable);
+}
+
+/*
+ * hedge_set_winner:
+ *
+ * @leg answered first: stop the timer and the other leg.
+ */
+static void
+hedge_set_winner(HedgeRequest *request, HedgeLeg *leg)
+{
+    request->winner = leg;
+    hedge_clear_timer(request);
+    hedge_cancel_others(request, leg);
+
+    if (request->legs[HEDGE_SECONDARY].stats)
+        g_debug("Hedged request won by the %s (%s)",
+                leg == &request->legs[HEDGE_PRIMARY] ? "primary" : "hedge",
+                leg->stats->model ? leg->stats->model : "-");
+}
+
+/*
+ * hedge_complete:
+ * @leg: The leg whose result completes the task
+ * @text: (transfer full) (nullable): The result
+ * @error: (transfer full) (nullable): The failure
+ *
+ * Report @leg in the caller's record and return the task. The caller's
+ * data must not be used afterwards.
+ */
+static void
+hedge_complete(HedgeRequest *request, GTask *task, HedgeLeg *leg, gchar *text, GError *error)
+{
+    request->completed = TRUE;
+    hedge_clear_timer(request);
+    hedge_cancel_others(request, leg);
+
+    if (request->stats)
+    {
+        hedge_copy_timings(request->stats, leg->stats);
+        request->stats->hedged = request->legs[HEDGE_SECONDARY].stats != NULL;
+        request->stats->hedge_won = leg == &request->legs[HEDGE_SECONDARY] && !error;
+        m_stats_record_set_error(request->stats, error);
+    }
+
+    if (error)
+        g_task_return_error(task, error);
+    else
+        g_task_return_pointer(task, text, g_free);
+}
+
+static void
+hedge_delta_cb(const gchar *delta, gpointer user_data)
+{
+    HedgeLeg *leg = user_data;
+    HedgeRequest *request = leg->request;
+
+    if (request->completed)
+        return;
+    if (!request->winner)
+        hedge_set_winner(request, leg);
+    if (request->winner == leg && request->delta_func)
+        request->delta_func(delta, request->user_data);
+}
+
+static gboolean hedge_timeout_cb(gpointer user_data);
+
+/*
+ * hedge_sent_cb:
+ *
+ * Start waiting for the primary request only once the scheduler let it
+ * out; time spent queued behind other requests is no reason to hedge.
+ */
+static void
+hedge_sent_cb(gpointer user_data)
+{
+    HedgeLeg *leg = user_data;
+    HedgeRequest *request = leg->request;
+
+    if (leg != &request->legs[HEDGE_PRIMARY] || !request->hedge_backend ||
+        request->timer_started || request->winner || request->completed)
+        return;
+
+    request->timer_started = TRUE;
+    request->timer = g_timeout_source_new(request->after_ms);
+    g_source_set_callback(request->timer, hedge_timeout_cb, request->task, NULL);
+    g_source_attach(request->timer, g_task_get_context(request->task));
+}
+
+static void
+hedge_leg_completed_cb(GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+    HedgeLeg *leg = user_data;
+    HedgeRequest *request = leg->request;
+    GTask *task = g_steal_pointer(&leg->task);
+    HedgeLeg *primary = &request->legs[HEDGE_PRIMARY];
+    HedgeLeg *other;
+    GError *error = NULL;
+    gchar *text;
+
+    text = m_chatgpt_proofread_finish(result, &error);
+    leg->running = FALSE;
+    other = leg == primary ? &request->legs[HEDGE_SECONDARY] : primary;
+
+    if (request->completed || (request->winner && request->winner != leg))
+    {
+        /* The loser, or a leg finishing after the task was cancelled */
+        g_free(text);
+        g_clear_error(&error);
+    }
+    else if (!error)
+    {
+        if (!request->winner)
+            hedge_set_winner(request, leg);
+        request->response_id = g_strdup(m_chatgpt_proofread_get_response_id(result));
+        hedge_complete(request, task, leg, text, NULL);
+    }
+    else if (request->winner == leg || !other->running)
+    {
+        /* Prefer the error of the primary request when both failed */
+        if (request->error && leg != primary)
+        {
+            g_error_free(error);
+            error = g_steal_pointer(&request->error);
+            leg = primary;
+        }
+        hedge_complete(request, task, leg, NULL, error);
+    }
+    else
+    {
+        g_debug("Hedged request failed, waiting for the other one: %s", error->message);
+        request->error = error;
+    }
+
+    g_object_unref(task);
+}
+
+/*
+ * hedge_leg_start:
+ *
+ * Send the request of @index to @backend. The leg holds a reference to
+ * @task until it completes.
+ */
+static void
+hedge_leg_start(GTask *task, guint index, const MBackend *backend, const gchar *model)
+{
+    HedgeRequest *request = g_task_get_task_data(task);
+    HedgeLeg *leg = &request->legs[index];
+
+    leg->task = g_object_ref(task);
+    leg->running = TRUE;
+    leg->stats = m_stats_record_new(M_STATS_KIND_PROOFREAD, m_backend_get_model(backend, model),
+                                    request->stats ? request->stats->prompt : request->prompt_id);
+
+    m_chatgpt_proofread_async(request->content,
+                              request->prediction,
+                              request->prompt_id,
+                              request->prompts,
+                              backend,
+                              model,
+                              request->previous_response_id,
+                              request->stream,
+                              hedge_delta_cb,
+                              hedge_sent_cb,
+                              leg,
+                              leg->stats,
+                              M_SCHEDULER_PRIORITY_INTERACTIVE,
+                              leg->cancellable,
+                              hedge_leg_completed_cb,
+                              leg);
+}
+
+static gboolean
+hedge_timeout_cb(gpointer user_data)
+{
+    GTask *task = user_data;
+    HedgeRequest *request = g_task_get_task_data(task);
+
+    g_clear_pointer(&request->timer, g_source_unref);
+
+    if (!request->winner && request->legs[HEDGE_PRIMARY].running)
+    {
+        g_debug("No answer yet, hedging on backend '%s'", request->hedge_backend->name);
+        hedge_leg_start(task, HEDGE_SECONDARY, request->hedge_backend, request->hedge_model);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+void
+m_hedge_proofread_async(const gchar *content,
+                        const gchar *prediction,
+                        const gchar *prompt_id,
+                        JsonArray *prompts,
+                        const MBackend *backend,
+                        const gchar *model,
+                        const gchar *previous_response_id,
+                        const MHedgePolicy *policy,
+                        gboolean stream,
+                        MChatGPTDeltaFunc delta_func,
+                        gpointer user_data,
+                        MStatsRecord *stats,
+                        GCancellable *cancellable,
+                        GAsyncReadyCallback callback,
+                        gpointer callback_data)
+{
+    HedgeRequest *request;
+    GTask *task;
+
+    g_return_if_fail(backend != NULL);
+
+    task = g_task_new(NULL, cancellable, callback, callback_data);
+    g_task_set_source_tag(task, m_hedge_proofread_async);
+
+    request = g_new0(HedgeRequest, 1);
+    request->content = content;
+    request->prediction = prediction;
+    request->prompt_id = g_strdup(prompt_id);
+    request->prompts = json_array_ref(prompts);
+    request->previous_response_id = g_strdup(previous_response_id);
+    request->stream = stream;
+    request->delta_func = delta_func;
+    request->user_data = user_data;
+    request->stats = stats;
+    for (guint i = 0; i < G_N_ELEMENTS(request->legs); i++)
+    {
+        request->legs[i].request = request;
+        request->legs[i].cancellable = g_cancellable_new();
+    }
+    request->task = task;
+    g_task_set_task_data(task, request, (GDestroyNotify)hedge_request_free);
+
+    if (cancellable)
+    {
+        request->cancellable = g_object_ref(cancellable);
+        request->cancelled_id = g_cancellable_connect(cancellable, G_CALLBACK(hedge_cancelled_cb),
+                                                      request, NULL);
+    }
+
+    if (policy)
+    {
+        /* The hedge uses the primary model unless the policy names one */
+        request->hedge_backend = m_backend_ref(policy->backend);
+        request->hedge_model = g_strdup(policy->model ? policy->model : m_backend_get_model(backend, model));
+        request->after_ms = policy->after_ms;
+    }
+
+    hedge_leg_start(task, HEDGE_PRIMARY, backend, model);
+    g_object_unref(task);
+}
+
+gchar *
+m_hedge_proofread_finish(GAsyncResult *result, GError **error)
+{
+    g_return_val_if_fail(g_task_is_valid(result, NULL), NULL);
+
+    return g_task_propagate_pointer(G_TASK(result), error);
+}
+
+const gchar *
+m_hedge_proofread_get_response_id(GAsyncResult *result)
+{
+    HedgeRequest *request;
+
+    g_return_val_if_fail(g_task_is_valid(result, NULL), NULL);
+
+    request = g_task_get_task_data(G_TASK(result));
+    return request ? request->response_id : NULL;
+}
@@ -0,0 +1,142 @@
+/*
+ * m-hedge.h - Hedged requests for AI Proofread Plugin
+ *
+ * This module races a second request against a slow first one:
+ * - The primary request goes out as usual
+ * - If it has not answered after a threshold, a hedge request goes to a
+ *   fallback model or backend
+ * - The first to answer wins and the other is cancelled
+ *
+ * Hedging is enabled by the "hedge" object in config.json:
+ *
+ *   "hedge": { "after_ms": 2000, "backend": "local", "model": "gpt-4o-mini" }
+ *
+ * and can be turned off per prompt with "hedge": false. Conversation
+ * prompts are never hedged.
+ */
+
+#ifndef M_HEDGE_H
+#define M_HEDGE_H
+
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
+
+#include "m-backend.h"
+#include "m-chatgpt-api.h"
+#include "m-config.h"
+#include "m-stats.h"
+
+G_BEGIN_DECLS
+
+/**
+ * M_HEDGE_DEFAULT_AFTER_MS:
+ *
+ * Default time to wait for the primary request before hedging.
+ */
+#define M_HEDGE_DEFAULT_AFTER_MS 2000
+
+/**
+ * MHedgePolicy:
+ * @after_ms: Time to wait for the first response byte of the primary request
+ * @backend: The backend of the hedge request
+ * @model: (nullable): The model of the hedge request, NULL for the primary one
+ *
+ * When and where a request is hedged.
+ */
+typedef struct _MHedgePolicy MHedgePolicy;
+
+struct _MHedgePolicy
+{
+    guint after_ms;
+    MBackend *backend;
+    gchar *model;
+};
+
+/**
+ * m_hedge_policy_new:
+ * @config: A configuration snapshot
+ * @prompt: (nullable): The prompt being run
+ * @primary: The backend of the primary request, used unless the "hedge"
+ *           section names another one
+ *
+ * Returns: (transfer full) (nullable): The hedging policy of @prompt, or
+ *          NULL if hedging is not configured, turned off for @prompt,
+ *          @prompt is a conversation or its backend has no API key
+ */
+MHedgePolicy *m_hedge_policy_new(MConfig *config, JsonObject *prompt, MBackend *primary);
+
+/**
+ * m_hedge_policy_free:
+ * @policy: (nullable): A hedging policy
+ */
+void m_hedge_policy_free(MHedgePolicy *policy);
+
+/**
+ * m_hedge_proofread_async:
+ * @content: The text content to proofread, which must stay alive until
+ *           @callback runs; it is not copied since it can be large
+ * @prediction: (nullable): The predicted output, see
+ *              m_chatgpt_proofread_async(); kept like @content
+ * @prompt_id: The prompt identifier
+ * @prompts: Array of prompt configurations
+ * @backend: The server of the primary request
+ * @model: The model of the primary request, unless @backend sets one
+ * @previous_response_id: (nullable): The stored response to continue, see
+ *                        m_chatgpt_proofread_async()
+ * @policy: (nullable): The hedging policy, NULL to send only the primary
+ * @stream: Whether to request streamed completions
+ * @delta_func: (nullable): Function called with each piece of streamed text
+ * @user_data: Data to pass to @delta_func
+ * @stats: (nullable): Record to fill with the timings of the winning
+ *         request, which must stay alive until @callback runs
+ * @cancellable: (nullable): A #GCancellable to abort both requests
+ * @callback: Called when the request is complete
+ * @callback_data: Data to pass to @callback
+ *
+ * Like m_chatgpt_proofread_async(), but if the primary request has not
+ * answered within @policy's threshold of being sent, which is counted
+ * from when the scheduler admitted it, a second request is started with
+ * the hedge backend and model. A streamed request answers with its first
+ * delta, a plain one when it completes. The first answer wins, only its
+ * deltas are passed to @delta_func and the other request is cancelled.
+ * If one request fails before answering, the other one is waited for;
+ * if both fail, the error of the primary request is returned.
+ */
+void m_hedge_proofread_async(const gchar *content,
+                             const gchar *prediction,
+                             const gchar *prompt_id,
+                             JsonArray *prompts,
+                             const MBackend *backend,
+                             const gchar *model,
+                             const gchar *previous_response_id,
+                             const MHedgePolicy *policy,
+                             gboolean stream,
+                             MChatGPTDeltaFunc delta_func,
+                             gpointer user_data,
+                             MStatsRecord *stats,
+                             GCancellable *cancellable,
+                             GAsyncReadyCallback callback,
+                             gpointer callback_data);
+
+/**
+ * m_hedge_proofread_finish:
+ * @result: The #GAsyncResult passed to the callback
+ * @error: Return location for error
+ *
+ * Returns: (transfer full) (nullable): The text of the winning request,
+ *          or NULL on error or if the model returned nothing
+ */
+gchar *m_hedge_proofread_finish(GAsyncResult *result, GError **error);
+
+/**
+ * m_hedge_proofread_get_response_id:
+ * @result: The #GAsyncResult passed to the callback
+ *
+ * Returns: (transfer none) (nullable): The stored response of the winning
+ *          request, see m_chatgpt_proofread_get_response_id()
+ */
+const gchar *m_hedge_proofread_get_response_id(GAsyncResult *result);
+
+G_END_DECLS
+
+#endif /* M_HEDGE_H */
@@ -0,0 +1,606 @@
+/*
+ * m-jobs.c - Background proofreading jobs for AI Proofread Plugin
+ *
+ * Implements the status alert of a job and the per editor queue which
+ * applies finished results.
+ */
+
+#include <glib/gi18n-lib.h>
+#include <gtk/gtk.h>
+
+#include <composer/e-msg-composer.h>
+#include <evolution/e-util/e-util.h>
+
+#include "m-jobs.h"
+#include "m-tokens.h"
+
+#define JOB_STATUS_DELAY_MS 800
+#define JOB_PREVIEW_LENGTH 160
+#define JOB_PULSE_MS 200
+#define JOB_QUEUE_KEY "ai-proofread-jobs"
+
+/* Finished jobs of an editor, stored on the editor */
+typedef struct
+{
+    GQueue pending;      /* MJob waiting to be applied */
+    MJob *applying;      /* The job being applied, NULL if none */
+} JobQueue;
+
+struct _MJob
+{
+    EMsgComposer *composer;      /* Weak pointer */
+    EContentEditor *cnt_editor;  /* Weak pointer */
+    gchar *model;
+    guint estimated_tokens;
+    gint64 start_us;             /* Monotonic time the job started */
+    gint64 estimate_us;          /* Usual duration, 0 if unknown */
+    gchar *hint;
+    gchar *range;                /* The text the result replaces */
+    GCancellable *cancellable;
+    guint status_id;             /* Timeout showing the status */
+    guint pulse_id;              /* Activity of the progress bar */
+    EAlert *alert;               /* The status, NULL if not shown */
+    GtkWidget *progress;         /* Progress bar of the status */
+    GtkWidget *preview_label;    /* End of the streamed text */
+    guint done;                  /* Parts finished */
+    guint total;                 /* Parts, 0 for a single request */
+    guint tokens;                /* Streamed tokens received */
+    GString *preview;            /* End of the streamed text */
+    gchar *text;                 /* The result being applied */
+    MStatsRecord *stats;         /* Committed when the job ends */
+    JobQueue *queue;             /* While waiting or being applied */
+    gulong find_done_id;         /* Waiting for the range to be found */
+};
+
+static void job_queue_next(JobQueue *queue);
+
+static guint
+job_seconds(gint64 us)
+{
+    return MAX((us + G_USEC_PER_SEC / 2) / G_USEC_PER_SEC, 1);
+}
+
+static void
+job_status_update(MJob *job)
+{
+    gint64 left_us = job->estimate_us - (g_get_monotonic_time() - job->start_us);
+    gchar *text;
+
+    if (!job->progress)
+        return;
+
+    if (job->total > 0)
+    {
+        text = g_strdup_printf(_("%u of %u parts done"), job->done, job->total);
+        gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(job->progress), (gdouble)job->done / job->total);
+    }
+    else if (job->estimate_us > 0 && left_us <= 0)
+    {
+        text = g_strdup(_("Taking longer than usual"));
+    }
+    else if (job->estimate_us > 0)
+    {
+        if (job->tokens > 0)
+            text = g_strdup_printf(_("About %u tokens received, %u s left"), job->tokens, job_seconds(left_us));
+        else
+            text = g_strdup_printf(_("About %u s left"), job_seconds(left_us));
+        gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(job->progress),
+                                      1.0 - (gdouble)left_us / job->estimate_us);
+    }
+    else if (job->tokens > 0)
+    {
+        text = g_strdup_printf(_("About %u tokens received"), job->tokens);
+    }
+    else
+    {
+        text = g_strdup(_("Waiting for the reply"));
+    }
+
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(job->progress), text);
+    g_free(text);
+
+    if (job->preview_label && job->preview->len > 0)
+    {
+        gchar *preview = g_strdelimit(g_strdup(job->preview->str), "\r\n\t", ' ');
+
+        gtk_label_set_text(GTK_LABEL(job->preview_label), preview);
+        gtk_widget_show(job->preview_label);
+        g_free(preview);
+    }
+}
+
+static gboolean
+job_pulse_cb(gpointer user_data)
+{
+    MJob *job = user_data;
+
+    /* Count a known duration down, otherwise only show activity */
+    if (job->total == 0 && job->estimate_us > 0)
+        job_status_update(job);
+    else if (job->progress && job->total == 0)
+        gtk_progress_bar_pulse(GTK_PROGRESS_BAR(job->progress));
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+job_cancel_clicked_cb(GtkButton *button, gpointer user_data)
+{
+    MJob *job = user_data;
+
+    g_debug("Proofreading job cancelled by the user");
+    gtk_widget_set_sensitive(GTK_WIDGET(button), FALSE);
+    g_cancellable_cancel(job->cancellable);
+}
+
+/*
+ * job_status_forget:
+ * @job: The job
+ *
+ * Stop updating the status of @job, or stop it from being shown.
+ */
+static void
+job_status_forget(MJob *job)
+{
+    if (job->status_id != 0)
+    {
+        g_source_remove(job->status_id);
+        job->status_id = 0;
+    }
+
+    if (job->pulse_id != 0)
+    {
+        g_source_remove(job->pulse_id);
+        job->pulse_id = 0;
+    }
+
+    if (job->progress)
+    {
+        g_signal_handlers_disconnect_by_func(job->progress, gtk_widget_destroyed, &job->progress);
+        job->progress = NULL;
+    }
+
+    if (job->preview_label)
+    {
+        g_signal_handlers_disconnect_by_func(job->preview_label, gtk_widget_destroyed, &job->preview_label);
+        job->preview_label = NULL;
+    }
+
+    if (job->alert)
+    {
+        g_signal_handlers_disconnect_by_data(job->alert, job);
+        g_clear_object(&job->alert);
+    }
+}
+
+/*
+ * job_status_hide:
+ * @job: The job
+ *
+ * Remove the status of @job from its composer.
+ */
+static void
+job_status_hide(MJob *job)
+{
+    EAlert *alert = job->alert ? g_object_ref(job->alert) : NULL;
+
+    job_status_forget(job);
+
+    if (alert)
+    {
+        e_alert_response(alert, GTK_RESPONSE_CLOSE);
+        g_object_unref(alert);
+    }
+}
+
+/*
+ * job_alert_response_cb:
+ *
+ * The status was closed; the job goes on without it.
+ */
+static void
+job_alert_response_cb(EAlert *alert, gint response_id, gpointer user_data)
+{
+    job_status_forget(user_data);
+}
+
+static gboolean
+job_status_show(gpointer user_data)
+{
+    MJob *job = user_data;
+    GtkWidget *box;
+    GtkWidget *row;
+    GtkWidget *button;
+    gchar *primary;
+    GString *secondary;
+
+    job->status_id = 0;
+
+    if (!job->composer)
+        return G_SOURCE_REMOVE;
+
+    primary = g_strdup_printf(_("Proofreading with %s"), job->model ? job->model : "AI");
+
+    secondary = g_string_new(NULL);
+    if (job->estimated_tokens > 0 && job->estimate_us > 0)
+        g_string_append_printf(secondary, _("About %u tokens, usually done in %u s."),
+                               job->estimated_tokens, job_seconds(job->estimate_us));
+    else if (job->estimated_tokens > 0)
+        g_string_append_printf(secondary, _("About %u tokens."), job->estimated_tokens);
+    else if (job->estimate_us > 0)
+        g_string_append_printf(secondary, _("Usually done in %u s."), job_seconds(job->estimate_us));
+    if (secondary->len > 0)
+        g_string_append_c(secondary, ' ');
+    g_string_append(secondary, _("You can keep writing, the result is applied when it is ready."));
+    if (job->hint)
+        g_string_append_printf(secondary, "\n%s", job->hint);
+
+    job->alert = e_alert_new("system:simple-info", primary, secondary->str, NULL);
+    g_free(primary);
+    g_string_free(secondary, TRUE);
+
+    box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 3);
+    row = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 6);
+    gtk_box_pack_start(GTK_BOX(box), row, FALSE, FALSE, 0);
+
+    job->progress = gtk_progress_bar_new();
+    gtk_progress_bar_set_show_text(GTK_PROGRESS_BAR(job->progress), TRUE);
+    gtk_widget_set_valign(job->progress, GTK_ALIGN_CENTER);
+    g_signal_connect(job->progress, "destroy", G_CALLBACK(gtk_widget_destroyed), &job->progress);
+    gtk_box_pack_start(GTK_BOX(row), job->progress, TRUE, TRUE, 0);
+
+    button = gtk_button_new_with_mnemonic(_("_Cancel"));
+    g_signal_connect(button, "clicked", G_CALLBACK(job_cancel_clicked_cb), job);
+    gtk_box_pack_start(GTK_BOX(row), button, FALSE, FALSE, 0);
+
+    /* Shown once streamed text arrives */
+    job->preview_label = gtk_label_new(NULL);
+    gtk_label_set_ellipsize(GTK_LABEL(job->preview_label), PANGO_ELLIPSIZE_START);
+    gtk_label_set_xalign(GTK_LABEL(job->preview_label), 0.0);
+    gtk_widget_set_no_show_all(job->preview_label, TRUE);
+    g_signal_connect(job->preview_label, "destroy", G_CALLBACK(gtk_widget_destroyed), &job->preview_label);
+    gtk_box_pack_start(GTK_BOX(box), job->preview_label, FALSE, FALSE, 0);
+
+    gtk_widget_show_all(box);
+    e_alert_add_widget(job->alert, box);
+    g_signal_connect(job->alert, "response", G_CALLBACK(job_alert_response_cb), job);
+
+    job_status_update(job);
+    job->pulse_id = g_timeout_add(JOB_PULSE_MS, job_pulse_cb, job);
+
+    e_alert_sink_submit_alert(E_ALERT_SINK(job->composer), job->alert);
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * m_job_new:
+ */
+MJob *
+m_job_new(EMsgComposer *composer,
+          EContentEditor *cnt_editor,
+          const gchar *model,
+          guint estimated_tokens,
+          const gchar *range,
+          GCancellable *cancellable)
+{
+    MJob *job = g_new0(MJob, 1);
+
+    job->composer = composer;
+    if (composer)
+        g_object_add_weak_pointer(G_OBJECT(composer), (gpointer *)&job->composer);
+    job->cnt_editor = cnt_editor;
+    if (cnt_editor)
+        g_object_add_weak_pointer(G_OBJECT(cnt_editor), (gpointer *)&job->cnt_editor);
+    job->model = g_strdup(model);
+    job->estimated_tokens = estimated_tokens;
+    job->start_us = g_get_monotonic_time();
+    job->range = g_strdup(range);
+    job->preview = g_string_new(NULL);
+    job->cancellable = g_object_ref(cancellable);
+    job->status_id = g_timeout_add(JOB_STATUS_DELAY_MS, job_status_show, job);
+
+    return job;
+}
+
+/*
+ * m_job_set_parts:
+ */
+void
+m_job_set_parts(MJob *job, guint done, guint total)
+{
+    job->done = done;
+    job->total = total;
+    job_status_update(job);
+}
+
+/*
+ * m_job_set_estimate:
+ */
+void
+m_job_set_estimate(MJob *job, gint64 estimate_us)
+{
+    job->estimate_us = MAX(estimate_us, 0);
+    job_status_update(job);
+}
+
+/*
+ * m_job_set_hint:
+ */
+void
+m_job_set_hint(MJob *job, const gchar *hint)
+{
+    g_free(job->hint);
+    job->hint = g_strdup(hint);
+}
+
+/*
+ * m_job_add_text:
+ */
+void
+m_job_add_text(MJob *job, const gchar *delta)
+{
+    job->tokens += m_tokens_estimate(delta);
+
+    /* Only the end of the text is shown */
+    g_string_append(job->preview, delta);
+    if (job->preview->len > 2 * JOB_PREVIEW_LENGTH)
+    {
+        const gchar *start = g_utf8_find_next_char(
+            job->preview->str + job->preview->len - JOB_PREVIEW_LENGTH - 1, NULL);
+
+        g_string_erase(job->preview, 0, start - job->preview->str);
+    }
+
+    job_status_update(job);
+}
+
+/*
+ * m_job_set_stats:
+ */
+void
+m_job_set_stats(MJob *job, MStatsRecord *stats)
+{
+    if (stats->total_us == 0)
+        stats->total_us = g_get_monotonic_time() - stats->start_us;
+
+    m_stats_record_free(job->stats);
+    job->stats = stats;
+}
+
+/*
+ * m_job_free:
+ */
+void
+m_job_free(MJob *job)
+{
+    if (!job)
+        return;
+
+    job_status_hide(job);
+
+    if (job->stats)
+        m_stats_commit(g_steal_pointer(&job->stats));
+
+    if (job->find_done_id != 0 && job->cnt_editor)
+        g_signal_handler_disconnect(job->cnt_editor, job->find_done_id);
+
+    if (job->composer)
+        g_object_remove_weak_pointer(G_OBJECT(job->composer), (gpointer *)&job->composer);
+    if (job->cnt_editor)
+        g_object_remove_weak_pointer(G_OBJECT(job->cnt_editor), (gpointer *)&job->cnt_editor);
+
+    g_clear_object(&job->cancellable);
+    g_free(job->model);
+    g_free(job->hint);
+    g_free(job->range);
+    g_string_free(job->preview, TRUE);
+    g_free(job->text);
+    g_free(job);
+}
+
+/*
+ * job_insert:
+ * @job: The job
+ *
+ * Replace the found range with the result. Only the range is touched,
+ * so the formatting, quotes and signature of an HTML body around it
+ * stay intact.
+ */
+static void
+job_insert(MJob *job)
+{
+    gchar *text = g_strdup(job->text);
+    gint64 start = g_get_monotonic_time();
+
+    /* Nor add a line break the range did not end with */
+    if (!g_str_has_suffix(job->range, "\n"))
+        g_strchomp(text);
+
+    e_content_editor_insert_content(
+        job->cnt_editor,
+        text,
+        E_CONTENT_EDITOR_INSERT_TEXT_PLAIN | E_CONTENT_EDITOR_INSERT_FROM_PLAIN_TEXT);
+    g_free(text);
+
+    if (job->stats)
+    {
+        job->stats->insert_us = g_get_monotonic_time() - start;
+        job->stats->total_us += job->stats->insert_us;
+    }
+}
+
+/*
+ * job_hold_back:
+ * @job: The job
+ *
+ * Keep a result which cannot be applied on the clipboard, so that
+ * nothing the user is writing is overwritten and nothing paid for is lost.
+ */
+static void
+job_hold_back(MJob *job)
+{
+    GtkClipboard *clipboard;
+    gboolean separated = !job->range;
+
+    g_debug(separated ? "Proofread text is split by quoted history, not applying the result"
+                      : "Proofread text was edited meanwhile, not applying the result");
+
+    if (!job->composer)
+        return;
+
+    clipboard = gtk_clipboard_get_for_display(gtk_widget_get_display(GTK_WIDGET(job->composer)),
+                                              GDK_SELECTION_CLIPBOARD);
+    gtk_clipboard_set_text(clipboard, job->text, -1);
+
+    e_alert_submit(E_ALERT_SINK(job->composer),
+                   "system:simple-warning",
+                   separated ? _("The proofread text is interrupted by quoted history")
+                             : _("The proofread text was edited in the meantime"),
+                   _("The result was not applied and has been copied to the clipboard."),
+                   NULL);
+}
+
+/*
+ * job_applied:
+ * @job: (transfer full): The job being applied
+ * @applied: Whether the result is in the editor
+ *
+ * End @job and go on with the next finished one.
+ */
+static void
+job_applied(MJob *job, gboolean applied)
+{
+    JobQueue *queue = job->queue;
+
+    if (!applied)
+        job_hold_back(job);
+
+    job->queue = NULL;
+    m_job_free(job);
+
+    if (queue)
+    {
+        queue->applying = NULL;
+        job_queue_next(queue);
+    }
+}
+
+/*
+ * job_find_done_cb:
+ *
+ * The search for the range finished and selected the match, if
+ * any. The user's cursor is restored afterwards.
+ */
+static void
+job_find_done_cb(EContentEditor *cnt_editor, guint match_count, gpointer user_data)
+{
+    MJob *job = user_data;
+
+    g_signal_handler_disconnect(cnt_editor, job->find_done_id);
+    job->find_done_id = 0;
+
+    if (match_count > 0)
+        job_insert(job);
+    e_content_editor_selection_restore(cnt_editor);
+
+    job_applied(job, match_count > 0);
+}
+
+/*
+ * job_apply_start:
+ * @job: The job to apply
+ *
+ * The range is searched for wherever it is now, since the user may
+ * have written before it.
+ */
+static void
+job_apply_start(MJob *job)
+{
+    if (!job->cnt_editor)
+    {
+        /* Nowhere to apply it, nor to hold it back */
+        job_applied(job, TRUE);
+        return;
+    }
+
+    if (!job->range)
+    {
+        /* Quoted history which was not sent sits between parts of the
+         * text, the result cannot say where it goes */
+        job_applied(job, FALSE);
+    }
+    else
+    {
+        e_content_editor_selection_save(job->cnt_editor);
+        job->find_done_id = g_signal_connect(job->cnt_editor, "find-done",
+                                             G_CALLBACK(job_find_done_cb), job);
+        e_content_editor_find(job->cnt_editor,
+                              E_CONTENT_EDITOR_FIND_NEXT | E_CONTENT_EDITOR_FIND_WRAP_AROUND,
+                              job->range);
+    }
+}
+
+static void
+job_queue_next(JobQueue *queue)
+{
+    MJob *job;
+
+    if (queue->applying || g_queue_is_empty(&queue->pending))
+        return;
+
+    job = g_queue_pop_head(&queue->pending);
+    queue->applying = job;
+    job_apply_start(job);
+}
+
+static void
+job_queue_free(JobQueue *queue)
+{
+    MJob *job;
+
+    while ((job = g_queue_pop_head(&queue->pending)))
+    {
+        job->queue = NULL;
+        m_job_free(job);
+    }
+
+    if (queue->applying)
+    {
+        queue->applying->queue = NULL;
+        m_job_free(queue->applying);
+    }
+
+    g_free(queue);
+}
+
+/*
+ * m_job_apply:
+ */
+void
+m_job_apply(MJob *job, const gchar *text)
+{
+    JobQueue *queue;
+
+    job_status_hide(job);
+
+    if (!job->cnt_editor)
+    {
+        m_job_free(job);
+        return;
+    }
+
+    queue = g_object_get_data(G_OBJECT(job->cnt_editor), JOB_QUEUE_KEY);
+    if (!queue)
+    {
+        queue = g_new0(JobQueue, 1);
+        g_queue_init(&queue->pending);
+        g_object_set_data_full(G_OBJECT(job->cnt_editor), JOB_QUEUE_KEY,
+                               queue, (GDestroyNotify)job_queue_free);
+    }
+
+    job->text = g_strdup(text);
+    job->queue = queue;
+    g_queue_push_tail(&queue->pending, job);
+    job_queue_next(queue);
+}
@@ -0,0 +1,125 @@
+/*
+ * m-jobs.h - Background proofreading jobs for AI Proofread Plugin
+ *
+ * This module lets proofreads run while the user keeps writing:
+ * - Each job shows a non-modal alert in its composer with progress, the
+ *   end of the streamed text, the time left and a Cancel button
+ * - Finished results are applied one at a time per editor to the text
+ *   they were made for, which is found again wherever it moved: the
+ *   selection, or the text sent from a whole message, so that the quoted
+ *   history and signature which were not sent stay as they are
+ * - A result which can no longer be applied is put on the clipboard
+ */
+
+#ifndef M_JOBS_H
+#define M_JOBS_H
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <composer/e-msg-composer.h>
+
+#include "m-stats.h"
+
+G_BEGIN_DECLS
+
+/**
+ * MJob:
+ *
+ * A proofread running in the background. The composer and the editor
+ * may go away while it runs, there is then nothing to show or apply.
+ */
+typedef struct _MJob MJob;
+
+/**
+ * m_job_new:
+ * @composer: (nullable): The composer showing the status
+ * @cnt_editor: The editor the result is applied to
+ * @model: (nullable): The model doing the work, for the status
+ * @estimated_tokens: Estimated input tokens, 0 if unknown
+ * @range: (nullable): The text the result replaces, the selection or
+ *         the text sent from the whole message; NULL if the text sent is
+ *         interrupted by quoted history and the result has no one place
+ * @cancellable: Cancelled by the Cancel button of the status
+ *
+ * Start tracking a job. The status is only shown if the job takes longer
+ * than a moment.
+ *
+ * Returns: (transfer full): The job, to be ended by m_job_apply() or
+ *          m_job_free()
+ */
+MJob *m_job_new(EMsgComposer *composer,
+                EContentEditor *cnt_editor,
+                const gchar *model,
+                guint estimated_tokens,
+                const gchar *range,
+                GCancellable *cancellable);
+
+/**
+ * m_job_set_parts:
+ * @job: The job
+ * @done: Parts finished
+ * @total: Parts of the job
+ *
+ * Report the progress of a job proofread in several parts.
+ */
+void m_job_set_parts(MJob *job, guint done, guint total);
+
+/**
+ * m_job_set_estimate:
+ * @job: The job
+ * @estimate_us: How long the job usually takes, 0 if unknown
+ *
+ * Show the time left, counted down from when the job started.
+ */
+void m_job_set_estimate(MJob *job, gint64 estimate_us);
+
+/**
+ * m_job_set_hint:
+ * @job: The job
+ * @hint: (nullable): A remark shown with the status, e.g. a faster model
+ */
+void m_job_set_hint(MJob *job, const gchar *hint);
+
+/**
+ * m_job_add_text:
+ * @job: The job
+ * @delta: Text streamed since the last call
+ *
+ * Report streamed output. The status counts its tokens and previews the
+ * last line of it; the result is only applied once it is complete.
+ */
+void m_job_add_text(MJob *job, const gchar *delta);
+
+/**
+ * m_job_set_stats:
+ * @job: The job
+ * @stats: (transfer full): The record of the finished request
+ *
+ * Commit @stats when @job ends, with the time the editor took to apply
+ * the result as @insert_us. The request itself ends now: the wait for
+ * earlier results is not counted.
+ */
+void m_job_set_stats(MJob *job, MStatsRecord *stats);
+
+/**
+ * m_job_apply:
+ * @job: (transfer full): The job
+ * @text: The result
+ *
+ * End @job and apply @text once the results finished before it are
+ * applied. If its text can no longer be found, @text is put on the
+ * clipboard instead and the user is told so.
+ */
+void m_job_apply(MJob *job, const gchar *text);
+
+/**
+ * m_job_free:
+ * @job: (nullable): The job
+ *
+ * End @job without applying anything, for example after a failure.
+ */
+void m_job_free(MJob *job);
+
+G_END_DECLS
+
+#endif /* M_JOBS_H */
@@ -0,0 +1,518 @@
+/*
+ * m-latency.c - Latency history for AI Proofread Plugin
+ *
+ * Implements the per bucket ring of request timings, its file in the
+ * config directory and the timeouts, estimates and model choice derived
+ * from it.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
+
+#include "m-latency.h"
+#include "m-config.h"
+
+#define LATENCY_FILE_NAME "latency.json"
+#define LATENCY_SAVE_DELAY_S 10
+
+/* Input size buckets: below 250 tokens, below 1000, 4000, 16000, rest */
+#define LATENCY_FIRST_BUCKET_TOKENS 250
+#define LATENCY_BUCKET_FACTOR 4
+#define LATENCY_MAX_BUCKET 4
+
+/* Timeouts leave room above the percentile, within sane bounds */
+#define LATENCY_DEFAULT_PERCENTILE 95
+#define LATENCY_TIMEOUT_FACTOR 2
+#define LATENCY_TIMEOUT_SLACK_S 5
+#define LATENCY_MIN_TIMEOUT_S 10
+#define LATENCY_MAX_TIMEOUT_S 600
+
+typedef struct
+{
+    gint64 ttfb_us;
+    gint64 total_us;            /* Without the wait for the scheduler */
+    gint64 completion_tokens;
+} LatencySample;
+
+typedef struct
+{
+    gchar *model;
+    gchar *prompt;
+    guint bucket;
+    GArray *samples;            /* LatencySample, oldest first */
+} LatencyEntry;
+
+/* Guarded by latency_lock */
+static GMutex latency_lock;
+static GHashTable *entries = NULL;  /* Key -> LatencyEntry */
+static gboolean dirty = FALSE;
+static guint save_id = 0;
+
+static void
+latency_entry_free(LatencyEntry *entry)
+{
+    g_free(entry->model);
+    g_free(entry->prompt);
+    g_array_unref(entry->samples);
+    g_free(entry);
+}
+
+static guint
+latency_bucket(guint estimated_tokens)
+{
+    guint bucket = 0;
+    guint limit = LATENCY_FIRST_BUCKET_TOKENS;
+
+    while (estimated_tokens >= limit && bucket < LATENCY_MAX_BUCKET)
+    {
+        bucket++;
+        limit *= LATENCY_BUCKET_FACTOR;
+    }
+    return bucket;
+}
+
+static gchar *
+latency_key(const gchar *model, const gchar *prompt, guint bucket)
+{
+    return g_strdup_printf("%s\n%s\n%u", model, prompt, bucket);
+}
+
+static gchar *
+latency_file_path(void)
+{
+    return g_build_filename(m_config_get_user_config_dir(), "ai-proofread", LATENCY_FILE_NAME, NULL);
+}
+
+/*
+ * latency_entry_get:
+ *
+ * Returns: (transfer none) (nullable): The entry of the bucket, created
+ *          if @create is set. Called with latency_lock held.
+ */
+static LatencyEntry *
+latency_entry_get(const gchar *model, const gchar *prompt, guint bucket, gboolean create)
+{
+    gchar *key = latency_key(model, prompt, bucket);
+    LatencyEntry *entry = g_hash_table_lookup(entries, key);
+
+    if (!entry && create)
+    {
+        entry = g_new0(LatencyEntry, 1);
+        entry->model = g_strdup(model);
+        entry->prompt = g_strdup(prompt);
+        entry->bucket = bucket;
+        entry->samples = g_array_sized_new(FALSE, FALSE, sizeof(LatencySample), M_LATENCY_HISTORY_SIZE);
+        g_hash_table_insert(entries, g_steal_pointer(&key), entry);
+    }
+
+    g_free(key);
+    return entry;
+}
+
+static void
+latency_entry_add(LatencyEntry *entry, const LatencySample *sample)
+{
+    if (entry->samples->len >= M_LATENCY_HISTORY_SIZE)
+        g_array_remove_index(entry->samples, 0);
+    g_array_append_vals(entry->samples, sample, 1);
+}
+
+/*
+ * latency_load:
+ *
+ * Load the saved history on first use. Called with latency_lock held.
+ * Builds without Evolution (the benchmarks) keep it in memory only, so
+ * that mock servers do not end up in the real history.
+ */
+static void
+latency_load(void)
+{
+#ifndef M_CONFIG_STANDALONE
+    gchar *path;
+    JsonParser *parser;
+    GError *error = NULL;
+#endif
+
+    if (entries)
+        return;
+
+    entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                    (GDestroyNotify)latency_entry_free);
+
+#ifndef M_CONFIG_STANDALONE
+    path = latency_file_path();
+    parser = json_parser_new();
+
+    if (json_parser_load_from_file(parser, path, &error))
+    {
+        JsonNode *root = json_parser_get_root(parser);
+        JsonArray *array = NULL;
+
+        if (JSON_NODE_HOLDS_OBJECT(root) &&
+            json_object_has_member(json_node_get_object(root), "entries"))
+            array = json_object_get_array_member(json_node_get_object(root), "entries");
+
+        for (guint i = 0; array && i < json_array_get_length(array); i++)
+        {
+            JsonObject *obj = json_array_get_object_element(array, i);
+            const gchar *model = obj ? json_object_get_string_member_with_default(obj, "model", NULL) : NULL;
+            const gchar *prompt = obj ? json_object_get_string_member_with_default(obj, "prompt", NULL) : NULL;
+            JsonArray *samples;
+            LatencyEntry *entry;
+
+            if (!model || !prompt || !json_object_has_member(obj, "samples"))
+                continue;
+
+            entry = latency_entry_get(model, prompt,
+                                      CLAMP(json_object_get_int_member_with_default(obj, "bucket", 0),
+                                            0, LATENCY_MAX_BUCKET),
+                                      TRUE);
+            samples = json_object_get_array_member(obj, "samples");
+            for (guint j = 0; samples && j < json_array_get_length(samples); j++)
+            {
+                JsonArray *values = json_array_get_array_element(samples, j);
+                LatencySample sample;
+
+                if (!values || json_array_get_length(values) < 3)
+                    continue;
+                sample.ttfb_us = json_array_get_int_element(values, 0) * G_TIME_SPAN_MILLISECOND;
+                sample.total_us = json_array_get_int_element(values, 1) * G_TIME_SPAN_MILLISECOND;
+                sample.completion_tokens = json_array_get_int_element(values, 2);
+                latency_entry_add(entry, &sample);
+            }
+        }
+
+        g_debug("Loaded the latency history of %u buckets", g_hash_table_size(entries));
+    }
+    else
+    {
+        g_debug("No latency history: %s", error->message);
+        g_error_free(error);
+    }
+
+    g_object_unref(parser);
+    g_free(path);
+#endif
+}
+
+/*
+ * latency_to_json:
+ *
+ * Returns: (transfer full): The history as JSON. Called with
+ *          latency_lock held.
+ */
+static gchar *
+latency_to_json(void)
+{
+    JsonBuilder *builder = json_builder_new();
+    JsonGenerator *generator;
+    JsonNode *root;
+    GHashTableIter iter;
+    LatencyEntry *entry;
+    gchar *data;
+
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "entries");
+    json_builder_begin_array(builder);
+
+    g_hash_table_iter_init(&iter, entries);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&entry))
+    {
+        json_builder_begin_object(builder);
+        json_builder_set_member_name(builder, "model");
+        json_builder_add_string_value(builder, entry->model);
+        json_builder_set_member_name(builder, "prompt");
+        json_builder_add_string_value(builder, entry->prompt);
+        json_builder_set_member_name(builder, "bucket");
+        json_builder_add_int_value(builder, entry->bucket);
+
+        /* [ttfb ms, total ms, output tokens] */
+        json_builder_set_member_name(builder, "samples");
+        json_builder_begin_array(builder);
+        for (guint i = 0; i < entry->samples->len; i++)
+        {
+            LatencySample *sample = &g_array_index(entry->samples, LatencySample, i);
+
+            json_builder_begin_array(builder);
+            json_builder_add_int_value(builder, sample->ttfb_us / G_TIME_SPAN_MILLISECOND);
+            json_builder_add_int_value(builder, sample->total_us / G_TIME_SPAN_MILLISECOND);
+            json_builder_add_int_value(builder, sample->completion_tokens);
+            json_builder_end_array(builder);
+        }
+        json_builder_end_array(builder);
+        json_builder_end_object(builder);
+    }
+
+    json_builder_end_array(builder);
+    json_builder_end_object(builder);
+
+    root = json_builder_get_root(builder);
+    generator = json_generator_new();
+    json_generator_set_root(generator, root);
+    data = json_generator_to_data(generator, NULL);
+
+    g_object_unref(generator);
+    json_node_unref(root);
+    g_object_unref(builder);
+
+    return data;
+}
+
+/*
+ * m_latency_flush:
+ */
+void
+m_latency_flush(void)
+{
+#ifndef M_CONFIG_STANDALONE
+    gchar *data = NULL;
+    gchar *path;
+    gchar *dir;
+    GError *error = NULL;
+
+    g_mutex_lock(&latency_lock);
+    if (save_id != 0)
+    {
+        g_source_remove(save_id);
+        save_id = 0;
+    }
+    if (dirty && entries)
+        data = latency_to_json();
+    dirty = FALSE;
+    g_mutex_unlock(&latency_lock);
+
+    if (!data)
+        return;
+
+    path = latency_file_path();
+    dir = g_path_get_dirname(path);
+
+    if (g_mkdir_with_parents(dir, 0700) != 0)
+        g_warning("Failed to create config directory: %s", dir);
+    else if (!g_file_set_contents(path, data, -1, &error))
+    {
+        g_warning("Failed to save the latency history: %s", error->message);
+        g_error_free(error);
+    }
+
+    g_free(dir);
+    g_free(path);
+    g_free(data);
+#endif
+}
+
+static gboolean
+latency_save_cb(gpointer user_data)
+{
+    g_mutex_lock(&latency_lock);
+    save_id = 0;
+    g_mutex_unlock(&latency_lock);
+
+    m_latency_flush();
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * m_latency_record:
+ */
+void
+m_latency_record(const MStatsRecord *record)
+{
+    LatencySample sample;
+    LatencyEntry *entry;
+    gint64 elapsed_us = record->total_us - record->queue_us;
+    guint tokens = record->estimated_tokens > 0 ? record->estimated_tokens : record->prompt_tokens;
+
+    /* A hedge which won was answered by another model or server */
+    if ((record->kind != M_STATS_KIND_PROOFREAD && record->kind != M_STATS_KIND_PREFETCH) ||
+        !record->model || !record->prompt || record->hedge_won)
+        return;
+
+    if (record->success && record->ttfb_us > 0)
+    {
+        sample.ttfb_us = record->ttfb_us;
+        sample.total_us = MAX(elapsed_us, record->ttfb_us);
+        sample.completion_tokens = record->completion_tokens;
+    }
+    else if (record->error_domain == G_IO_ERROR && record->error_code == G_IO_ERROR_TIMED_OUT &&
+             record->timeout_s > 0)
+    {
+        /* The reply did not come in time: assume it needs at least
+         * twice as long */
+        sample.ttfb_us = 2 * (gint64)record->timeout_s * G_USEC_PER_SEC;
+        sample.total_us = sample.ttfb_us;
+        sample.completion_tokens = 0;
+        g_debug("Request to %s timed out after %u s", record->model, record->timeout_s);
+    }
+    else
+    {
+        return;
+    }
+
+    g_mutex_lock(&latency_lock);
+    latency_load();
+    entry = latency_entry_get(record->model, record->prompt, latency_bucket(tokens), TRUE);
+    latency_entry_add(entry, &sample);
+    dirty = TRUE;
+#ifndef M_CONFIG_STANDALONE
+    if (save_id == 0)
+        save_id = g_timeout_add_seconds(LATENCY_SAVE_DELAY_S, latency_save_cb, NULL);
+#endif
+    g_mutex_unlock(&latency_lock);
+}
+
+/*
+ * latency_percentile:
+ * @field: Offset of the value in #LatencySample
+ *
+ * Returns: The percentile of the bucket, 0 if it has too few samples
+ */
+static gint64
+latency_percentile(const gchar *model,
+                   const gchar *prompt,
+                   guint estimated_tokens,
+                   gsize field,
+                   gdouble percentile)
+{
+    LatencyEntry *entry;
+    gint64 *values = NULL;
+    guint n_values = 0;
+    gint64 result = 0;
+
+    if (!model || !prompt)
+        return 0;
+
+    g_mutex_lock(&latency_lock);
+    latency_load();
+    entry = latency_entry_get(model, prompt, latency_bucket(estimated_tokens), FALSE);
+    if (entry && entry->samples->len >= M_LATENCY_MIN_SAMPLES)
+    {
+        n_values = entry->samples->len;
+        values = g_new(gint64, n_values);
+        for (guint i = 0; i < n_values; i++)
+            values[i] = G_STRUCT_MEMBER(gint64, &g_array_index(entry->samples, LatencySample, i), field);
+    }
+    g_mutex_unlock(&latency_lock);
+
+    if (values)
+        result = m_stats_percentile(values, n_values, percentile);
+    g_free(values);
+
+    return result;
+}
+
+/*
+ * m_latency_timeout_s:
+ */
+guint
+m_latency_timeout_s(const gchar *model, const gchar *prompt, guint estimated_tokens)
+{
+    MConfig *config = m_config_get();
+    JsonObject *section = m_config_get_section(config, "latency");
+    gboolean enabled = TRUE;
+    gdouble percentile = LATENCY_DEFAULT_PERCENTILE;
+    gint64 ttfb_us;
+    guint timeout_s;
+
+    if (section)
+    {
+        enabled = json_object_get_boolean_member_with_default(section, "adaptive_timeout", enabled);
+        percentile = json_object_get_double_member_with_default(section, "percentile", percentile);
+    }
+    m_config_unref(config);
+
+    if (!enabled)
+        return 0;
+
+    ttfb_us = latency_percentile(model, prompt, estimated_tokens,
+                                 G_STRUCT_OFFSET(LatencySample, ttfb_us),
+                                 CLAMP(percentile, 50, 100));
+    if (ttfb_us == 0)
+        return 0;
+
+    timeout_s = (guint)MIN(LATENCY_TIMEOUT_FACTOR * ttfb_us / G_USEC_PER_SEC, LATENCY_MAX_TIMEOUT_S) +
+                LATENCY_TIMEOUT_SLACK_S;
+    timeout_s = CLAMP(timeout_s, LATENCY_MIN_TIMEOUT_S, LATENCY_MAX_TIMEOUT_S);
+
+    g_debug("Timeout of %s/%s for about %u tokens: %u s", model, prompt, estimated_tokens, timeout_s);
+    return timeout_s;
+}
+
+/*
+ * m_latency_estimate_us:
+ */
+gint64
+m_latency_estimate_us(const gchar *model, const gchar *prompt, guint estimated_tokens)
+{
+    return latency_percentile(model, prompt, estimated_tokens,
+                              G_STRUCT_OFFSET(LatencySample, total_us), 50);
+}
+
+/*
+ * m_latency_get_auto_model:
+ */
+MLatencyAutoModel
+m_latency_get_auto_model(void)
+{
+    MConfig *config = m_config_get();
+    JsonObject *section = m_config_get_section(config, "latency");
+    const gchar *mode = section ? json_object_get_string_member_with_default(section, "auto_model", NULL) : NULL;
+    MLatencyAutoModel result = M_LATENCY_AUTO_MODEL_OFF;
+
+    if (g_strcmp0(mode, "suggest") == 0)
+        result = M_LATENCY_AUTO_MODEL_SUGGEST;
+    else if (g_strcmp0(mode, "select") == 0)
+        result = M_LATENCY_AUTO_MODEL_SELECT;
+
+    m_config_unref(config);
+    return result;
+}
+
+/*
+ * m_latency_fastest_model:
+ */
+gchar *
+m_latency_fastest_model(const gchar *prompt,
+                        guint estimated_tokens,
+                        GList *models,
+                        gint64 *out_estimate_us)
+{
+    MConfig *config = m_config_get();
+    JsonObject *section = m_config_get_section(config, "latency");
+    JsonObject *tiers = NULL;
+    gint64 min_tier = 0;
+    gchar *fastest = NULL;
+    gint64 fastest_us = 0;
+
+    if (section && json_object_has_member(section, "tiers"))
+    {
+        tiers = json_object_get_object_member(section, "tiers");
+        min_tier = json_object_get_int_member_with_default(section, "min_tier", 0);
+    }
+
+    for (GList *link = models; tiers && link; link = link->next)
+    {
+        const gchar *model = link->data;
+        gint64 estimate_us;
+
+        if (!json_object_has_member(tiers, model) ||
+            json_object_get_int_member(tiers, model) < min_tier)
+            continue;
+
+        estimate_us = m_latency_estimate_us(model, prompt, estimated_tokens);
+        if (estimate_us > 0 && (!fastest || estimate_us < fastest_us))
+        {
+            g_free(fastest);
+            fastest = g_strdup(model);
+            fastest_us = estimate_us;
+        }
+    }
+
+    m_config_unref(config);
+
+    if (out_estimate_us)
+        *out_estimate_us = fastest_us;
+    return fastest;
+}
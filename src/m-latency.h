@@ -0,0 +1,128 @@
+/*
+ * m-latency.h - Latency history for AI Proofread Plugin
+ *
+ * This module learns how long requests take:
+ * - The time to first byte, the total time and the output tokens of the
+ *   last requests are kept per model, prompt and input size bucket, and
+ *   saved in the config directory
+ * - Requests without their own "timeout" get one from a high percentile
+ *   of the time to first byte of their bucket
+ * - The typical total time is the ETA shown while a proofread runs
+ * - Optionally the fastest model of good enough quality is suggested or
+ *   picked for each request
+ *
+ * It is tuned by the "latency" object in config.json:
+ *
+ *   "latency": { "adaptive_timeout": true, "percentile": 95,
+ *                "auto_model": "suggest", "min_tier": 2,
+ *                "tiers": { "gpt-4o-mini": 1, "gpt-4o": 2, "o3": 3 } }
+ */
+
+#ifndef M_LATENCY_H
+#define M_LATENCY_H
+
+#include <glib.h>
+
+#include "m-stats.h"
+
+G_BEGIN_DECLS
+
+/**
+ * M_LATENCY_HISTORY_SIZE:
+ *
+ * Number of requests kept per model, prompt and size bucket.
+ */
+#define M_LATENCY_HISTORY_SIZE 32
+
+/**
+ * M_LATENCY_MIN_SAMPLES:
+ *
+ * Number of requests a bucket needs before its history is used.
+ */
+#define M_LATENCY_MIN_SAMPLES 3
+
+/**
+ * MLatencyAutoModel:
+ * @M_LATENCY_AUTO_MODEL_OFF: Always use the selected model
+ * @M_LATENCY_AUTO_MODEL_SUGGEST: Name a faster model in the job status
+ * @M_LATENCY_AUTO_MODEL_SELECT: Use the faster model
+ *
+ * What to do when another model is known to answer faster, the
+ * "auto_model" setting.
+ */
+typedef enum
+{
+    M_LATENCY_AUTO_MODEL_OFF,
+    M_LATENCY_AUTO_MODEL_SUGGEST,
+    M_LATENCY_AUTO_MODEL_SELECT
+} MLatencyAutoModel;
+
+/**
+ * m_latency_record:
+ * @record: A finished request
+ *
+ * Add the timings of @record to the history of its model, prompt and
+ * size. Only chat completions are kept; a request which ran into its
+ * timeout counts as twice that long, so that the next one waits longer.
+ * Called by m_stats_commit(), safe to call from any thread.
+ */
+void m_latency_record(const MStatsRecord *record);
+
+/**
+ * m_latency_timeout_s:
+ * @model: The model
+ * @prompt: The prompt name
+ * @estimated_tokens: Estimated input tokens of the request
+ *
+ * Returns: The I/O timeout for the request in seconds, or 0 for the
+ *          default if there is not enough history or adaptive timeouts
+ *          are disabled
+ */
+guint m_latency_timeout_s(const gchar *model, const gchar *prompt, guint estimated_tokens);
+
+/**
+ * m_latency_estimate_us:
+ * @model: The model
+ * @prompt: The prompt name
+ * @estimated_tokens: Estimated input tokens of the request
+ *
+ * Returns: The median time the request takes once sent, in
+ *          microseconds, 0 if unknown
+ */
+gint64 m_latency_estimate_us(const gchar *model, const gchar *prompt, guint estimated_tokens);
+
+/**
+ * m_latency_get_auto_model:
+ *
+ * Returns: The "auto_model" setting
+ */
+MLatencyAutoModel m_latency_get_auto_model(void);
+
+/**
+ * m_latency_fastest_model:
+ * @prompt: The prompt name
+ * @estimated_tokens: Estimated input tokens of the request
+ * @models: (element-type utf8): The models to choose from
+ * @out_estimate_us: (out) (optional): The median time of the chosen model
+ *
+ * Among @models with a quality tier of at least "min_tier", pick the one
+ * with the lowest median time for requests of this prompt and size.
+ * Models without a tier, or without enough history, are not considered.
+ *
+ * Returns: (transfer full) (nullable): The model, NULL if none qualifies
+ */
+gchar *m_latency_fastest_model(const gchar *prompt,
+                               guint estimated_tokens,
+                               GList *models,
+                               gint64 *out_estimate_us);
+
+/**
+ * m_latency_flush:
+ *
+ * Save pending history changes now instead of after a short delay.
+ */
+void m_latency_flush(void);
+
+G_END_DECLS
+
+#endif /* M_LATENCY_H */
@@ -0,0 +1,305 @@
+/*
+ * m-model-catalog.c - Process-wide model catalog for AI Proofread Plugin
+ *
+ * Implements the in-memory model list, its on-disk copy and the
+ * background refresh. All catalog state is owned by the main thread;
+ * only the HTTP fetch itself runs on a worker thread.
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
+#include <evolution/e-util/e-util.h>
+
+#include "m-model-catalog.h"
+#include "m-chatgpt-api.h"
+
+static GList *catalog_models = NULL;
+static gint64 catalog_fetched = 0;   /* Wall-clock seconds of the last fetch */
+static gboolean catalog_loaded = FALSE;
+static gboolean catalog_fetching = FALSE;
+static GHookList catalog_listeners;
+
+static void
+free_model_list(gpointer models)
+{
+    g_list_free_full(models, g_free);
+}
+
+static GList *
+copy_model_list(GList *models)
+{
+    return g_list_copy_deep(models, (GCopyFunc)g_strdup, NULL);
+}
+
+static gboolean
+model_lists_equal(GList *a, GList *b)
+{
+    for (; a && b; a = a->next, b = b->next)
+    {
+        if (g_strcmp0(a->data, b->data) != 0)
+            return FALSE;
+    }
+
+    return a == NULL && b == NULL;
+}
+
+/*
+ * get_catalog_file_path:
+ *
+ * Get the path to the models.json file next to config.json.
+ * Returns: (transfer full): The path. The caller must free the returned string.
+ */
+static gchar *
+get_catalog_file_path(void)
+{
+    const gchar *config_dir = e_get_user_config_dir();
+    return g_build_filename(config_dir, "ai-proofread", "models.json", NULL);
+}
+
+/*
+ * load_catalog_file:
+ *
+ * Load the stored model list and its fetch time into the catalog.
+ */
+static void
+load_catalog_file(void)
+{
+    gchar *path = get_catalog_file_path();
+    JsonParser *parser = json_parser_new();
+    GError *error = NULL;
+
+    if (json_parser_load_from_file(parser, path, &error))
+    {
+        JsonNode *root = json_parser_get_root(parser);
+        if (JSON_NODE_HOLDS_OBJECT(root))
+        {
+            JsonObject *obj = json_node_get_object(root);
+            JsonArray *models = NULL;
+
+            catalog_fetched = json_object_get_int_member_with_default(obj, "fetched", 0);
+            if (json_object_has_member(obj, "models"))
+                models = json_object_get_array_member(obj, "models");
+
+            for (guint i = 0; models && i < json_array_get_length(models); i++)
+            {
+                const gchar *model_id = json_array_get_string_element(models, i);
+                if (model_id)
+                    catalog_models = g_list_prepend(catalog_models, g_strdup(model_id));
+            }
+            catalog_models = g_list_reverse(catalog_models);
+
+            g_debug("Loaded %u cached models from %s",
+                    g_list_length(catalog_models), path);
+        }
+    }
+    else
+    {
+        g_debug("No cached model list: %s", error->message);
+        g_error_free(error);
+    }
+
+    g_object_unref(parser);
+    g_free(path);
+}
+
+/*
+ * save_catalog_file:
+ *
+ * Write the current model list and fetch time to disk.
+ */
+static void
+save_catalog_file(void)
+{
+    gchar *path = get_catalog_file_path();
+    gchar *dir = g_path_get_dirname(path);
+    JsonBuilder *builder;
+    JsonGenerator *generator;
+    JsonNode *root;
+    GError *error = NULL;
+
+    if (g_mkdir_with_parents(dir, 0700) != 0)
+    {
+        g_warning("Failed to create config directory: %s", dir);
+        g_free(dir);
+        g_free(path);
+        return;
+    }
+
+    builder = json_builder_new();
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "fetched");
+    json_builder_add_int_value(builder, catalog_fetched);
+    json_builder_set_member_name(builder, "models");
+    json_builder_begin_array(builder);
+    for (GList *l = catalog_models; l != NULL; l = l->next)
+        json_builder_add_string_value(builder, l->data);
+    json_builder_end_array(builder);
+    json_builder_end_object(builder);
+
+    generator = json_generator_new();
+    json_generator_set_pretty(generator, TRUE);
+    root = json_builder_get_root(builder);
+    json_generator_set_root(generator, root);
+
+    if (!json_generator_to_file(generator, path, &error))
+    {
+        g_warning("Failed to save model list: %s", error->message);
+        g_error_free(error);
+    }
+
+    json_node_free(root);
+    g_object_unref(generator);
+    g_object_unref(builder);
+    g_free(dir);
+    g_free(path);
+}
+
+static void
+ensure_catalog_loaded(void)
+{
+    if (catalog_loaded)
+        return;
+
+    g_hook_list_init(&catalog_listeners, sizeof(GHook));
+    load_catalog_file();
+    catalog_loaded = TRUE;
+}
+
+static void
+notify_listener(GHook *hook, gpointer marshal_data)
+{
+    ((MModelCatalogChangedFunc)hook->func)(marshal_data, hook->data);
+}
+
+static void
+fetch_task_thread(GTask *task,
+                  gpointer source_object,
+                  gpointer task_data,
+                  GCancellable *cancellable)
+{
+    const MBackend *backend = task_data;
+    GError *error = NULL;
+    GList *models;
+
+    models = m_chatgpt_fetch_models(backend, cancellable, &error);
+
+    if (error)
+    {
+        g_task_return_error(task, error);
+        return;
+    }
+
+    g_task_return_pointer(task, models, free_model_list);
+}
+
+static void
+fetch_task_completed(GObject *source_object,
+                     GAsyncResult *result,
+                     gpointer user_data)
+{
+    GError *error = NULL;
+    GList *models;
+
+    catalog_fetching = FALSE;
+
+    models = g_task_propagate_pointer(G_TASK(result), &error);
+    if (error)
+    {
+        g_warning("Failed to fetch models: %s", error->message);
+        g_error_free(error);
+        return;
+    }
+
+    /* An empty answer is more likely a transient problem than a real
+     * change, so keep serving the previous list */
+    if (!models)
+        return;
+
+    catalog_fetched = g_get_real_time() / G_USEC_PER_SEC;
+
+    if (model_lists_equal(models, catalog_models))
+    {
+        free_model_list(models);
+        save_catalog_file();
+        return;
+    }
+
+    free_model_list(catalog_models);
+    catalog_models = models;
+    save_catalog_file();
+
+    g_debug("Model list updated: %u models", g_list_length(catalog_models));
+    g_hook_list_marshal(&catalog_listeners, FALSE, notify_listener, catalog_models);
+}
+
+/*
+ * m_model_catalog_get_models:
+ */
+GList *
+m_model_catalog_get_models(void)
+{
+    ensure_catalog_loaded();
+    return copy_model_list(catalog_models);
+}
+
+/*
+ * m_model_catalog_refresh:
+ */
+void
+m_model_catalog_refresh(MBackend *backend, gboolean force)
+{
+    GTask *task;
+    gint64 age;
+
+    g_return_if_fail(backend != NULL);
+
+    ensure_catalog_loaded();
+
+    if (catalog_fetching)
+        return;
+
+    age = g_get_real_time() / G_USEC_PER_SEC - catalog_fetched;
+    if (!force && catalog_models && age >= 0 && age < M_MODEL_CATALOG_TTL_S)
+        return;
+
+    g_debug("Refreshing model list in the background");
+    catalog_fetching = TRUE;
+
+    task = g_task_new(NULL, NULL, fetch_task_completed, NULL);
+    g_task_set_task_data(task, m_backend_ref(backend), (GDestroyNotify)m_backend_unref);
+    g_task_run_in_thread(task, fetch_task_thread);
+    g_object_unref(task);
+}
+
+/*
+ * m_model_catalog_add_listener:
+ */
+guint
+m_model_catalog_add_listener(MModelCatalogChangedFunc func, gpointer user_data)
+{
+    GHook *hook;
+
+    g_return_val_if_fail(func != NULL, 0);
+
+    ensure_catalog_loaded();
+
+    hook = g_hook_alloc(&catalog_listeners);
+    hook->func = func;
+    hook->data = user_data;
+    g_hook_append(&catalog_listeners, hook);
+
+    return (guint)hook->hook_id;
+}
+
+/*
+ * m_model_catalog_remove_listener:
+ */
+void
+m_model_catalog_remove_listener(guint listener_id)
+{
+    if (!catalog_loaded || listener_id == 0)
+        return;
+
+    g_hook_destroy(&catalog_listeners, listener_id);
+}
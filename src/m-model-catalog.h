@@ -0,0 +1,78 @@
+/*
+ * m-model-catalog.h - Process-wide model catalog for AI Proofread Plugin
+ *
+ * This module keeps the list of available AI models:
+ * - Serving the list from memory without blocking on the network
+ * - Persisting the list under ai-proofread/models.json with a TTL
+ * - Refreshing the list in the background and notifying listeners
+ */
+
+#ifndef M_MODEL_CATALOG_H
+#define M_MODEL_CATALOG_H
+
+#include <glib.h>
+
+#include "m-backend.h"
+
+G_BEGIN_DECLS
+
+/**
+ * M_MODEL_CATALOG_TTL_S:
+ *
+ * Age in seconds after which a stored model list is refreshed.
+ */
+#define M_MODEL_CATALOG_TTL_S (24 * 60 * 60)
+
+/**
+ * MModelCatalogChangedFunc:
+ * @models: The new list of model IDs (GList of gchar*), owned by the catalog
+ * @user_data: The data passed to m_model_catalog_add_listener()
+ *
+ * Called on the main thread when a newer model list has been fetched.
+ */
+typedef void (*MModelCatalogChangedFunc)(GList *models, gpointer user_data);
+
+/**
+ * m_model_catalog_get_models:
+ *
+ * Return the currently known models. On first use the list stored on disk
+ * is loaded; the network is never touched.
+ *
+ * Returns: (transfer full): A copy of the model list (GList of gchar*),
+ *          possibly empty. Free with g_list_free_full(list, g_free).
+ */
+GList *m_model_catalog_get_models(void);
+
+/**
+ * m_model_catalog_refresh:
+ * @backend: The backend to list the models of
+ * @force: Whether to refresh even if the stored list is still fresh
+ *
+ * Fetch the model list in the background when the stored list is older
+ * than %M_MODEL_CATALOG_TTL_S (or when @force is set). Only one fetch is
+ * in flight at a time. Must be called from the main thread.
+ */
+void m_model_catalog_refresh(MBackend *backend, gboolean force);
+
+/**
+ * m_model_catalog_add_listener:
+ * @func: The function to call when the model list changes
+ * @user_data: Data to pass to @func
+ *
+ * Register a listener for model list changes.
+ *
+ * Returns: A listener ID for m_model_catalog_remove_listener()
+ */
+guint m_model_catalog_add_listener(MModelCatalogChangedFunc func, gpointer user_data);
+
+/**
+ * m_model_catalog_remove_listener:
+ * @listener_id: The ID returned by m_model_catalog_add_listener()
+ *
+ * Unregister a model list listener.
+ */
+void m_model_catalog_remove_listener(guint listener_id);
+
+G_END_DECLS
+
+#endif /* M_MODEL_CATALOG_H */
@@ -6,10 +6,12 @@
  * UI creation, and extension lifecycle.
  *
  * The implementation is split into logical modules:
- * - m-config: Configuration loading (prompts, API key)
+ * - m-config: Shared configuration store (prompts, backends, settings)
  * - m-proofreader: Proofreading workflow and callbacks
  * - m-ui-actions: UI action entries and menu/toolbar construction
  * - m-chatgpt-api: ChatGPT API communication
+ * - m-model-catalog: Cached list of available models
+ * - m-speculative: Background proofreading while the user is idle
  */
 
 #ifdef HAVE_CONFIG_H
@@ -26,37 +28,45 @@
 #include "m-config.h"
 #include "m-ui-actions.h"
 #include "m-chatgpt-api.h"
+#include "m-model-catalog.h"
+#include "m-speculative.h"
+#include "m-batch.h"
 
 struct _MMsgComposerExtensionPrivate
 {
-    JsonArray *prompts;           /* Array of prompts loaded from config */
-    gchar *chatgpt_api_key;       /* OpenAI API key */
-    gchar *model;                 /* Selected AI model */
+    MConfig *config;              /* Shared configuration snapshot */
     GList *models;                /* List of available models */
     MUIActionContext *ui_context; /* UI action context */
+    guint models_listener_id;     /* Model catalog listener */
+    guint config_listener_id;     /* Configuration store listener */
 };
 
 G_DEFINE_DYNAMIC_TYPE_EXTENDED(MMsgComposerExtension, m_msg_composer_extension, E_TYPE_EXTENSION, 0,
                                G_ADD_PRIVATE_DYNAMIC(MMsgComposerExtension))
 
+/* Set once any composer loaded the configuration; later composers then
+ * register the full UI right away since everything is shared */
+static gboolean plugin_loaded = FALSE;
+
 /*
  * validate_configuration:
  * @extension: The message composer extension
  *
  * Check if the extension has valid configuration.
- * Returns TRUE if prompts and API key are available.
+ * Returns TRUE if prompts and a usable backend are available.
  */
 static gboolean
 validate_configuration(MMsgComposerExtension *extension)
 {
-    if (!extension->priv->prompts ||
-        json_array_get_length(extension->priv->prompts) == 0)
+    if (!extension->priv->config->prompts ||
+        json_array_get_length(extension->priv->config->prompts) == 0)
     {
         g_warning("No prompts configured, skipping UI creation");
         return FALSE;
     }
 
-    if (!extension->priv->chatgpt_api_key)
+    if (!m_backend_is_usable(m_config_get_backend(extension->priv->config, NULL)) &&
+        g_hash_table_size(extension->priv->config->backends) <= 1)
     {
         g_warning("No API key configured, skipping UI creation");
         return FALSE;
@@ -65,6 +75,50 @@ validate_configuration(MMsgComposerExtension *extension)
     return TRUE;
 }
 
+/*
+ * models_changed_cb:
+ * @models: The new model list
+ * @user_data: The message composer extension
+ *
+ * Refresh the Model submenu when the catalog fetched a newer list.
+ */
+static void
+models_changed_cb(GList *models, gpointer user_data)
+{
+    MMsgComposerExtension *extension = M_MSG_COMPOSER_EXTENSION(user_data);
+    EExtensible *extensible = e_extension_get_extensible(E_EXTENSION(extension));
+
+    if (!extension->priv->ui_context || !E_IS_MSG_COMPOSER(extensible))
+        return;
+
+    m_ui_update_models(E_MSG_COMPOSER(extensible), extension->priv->ui_context, models);
+}
+
+/*
+ * config_changed_cb:
+ * @config: The new configuration snapshot
+ * @user_data: The message composer extension
+ *
+ * Pick up edited prompts and backends without reopening the composer;
+ * the AI menu is rebuilt when the prompts changed.
+ */
+static void
+config_changed_cb(MConfig *config, gpointer user_data)
+{
+    MMsgComposerExtension *extension = M_MSG_COMPOSER_EXTENSION(user_data);
+    EExtensible *extensible = e_extension_get_extensible(E_EXTENSION(extension));
+
+    m_config_unref(extension->priv->config);
+    extension->priv->config = m_config_ref(config);
+
+    if (!extension->priv->ui_context || !E_IS_MSG_COMPOSER(extensible))
+        return;
+
+    /* Edited prompts need new menu items, not only a new context */
+    m_ui_update_prompts(E_MSG_COMPOSER(extensible), extension->priv->ui_context,
+                        config->prompts, config->backends);
+}
+
 /*
  * m_msg_composer_extension_add_ui:
  * @extension: The message composer extension
@@ -77,7 +131,7 @@ static void
 m_msg_composer_extension_add_ui(MMsgComposerExtension *extension,
                                 EMsgComposer *composer)
 {
-    MUIActionEntries *action_entries;
+    const MUIActionEntries *action_entries;
 
     g_return_if_fail(M_IS_MSG_COMPOSER_EXTENSION(extension));
     g_return_if_fail(E_IS_MSG_COMPOSER(composer));
@@ -87,27 +141,83 @@ m_msg_composer_extension_add_ui(MMsgComposerExtension *extension,
 
     /* Create UI action context */
     extension->priv->ui_context = m_ui_action_context_new(
-        extension->priv->prompts,
-        extension->priv->chatgpt_api_key,
-        extension->priv->model,
+        extension->priv->config->prompts,
+        extension->priv->config->backends,
+        extension->priv->config->model,
         extension->priv->models);
 
     /* Build action entries and EUI XML */
     action_entries = m_ui_build_action_entries(
-        extension->priv->prompts,
+        extension->priv->config->prompts,
         extension->priv->ui_context);
 
     if (!action_entries)
     {
         g_warning("No action entries built, skipping UI registration");
+        g_clear_pointer(&extension->priv->ui_context, m_ui_action_context_unref);
         return;
     }
 
-    /* Register actions with the UI manager */
+    /* Register actions with the UI manager (it copies what it needs, the
+     * entries stay cached for the next composer) */
     m_ui_register_actions(composer, action_entries, extension->priv->ui_context);
 
-    /* Free the action entries (the UI manager has copied what it needs) */
-    m_ui_action_entries_free(action_entries);
+    /* Proofread in the background while the user pauses, if enabled */
+    m_speculative_attach(composer, extension->priv->ui_context);
+
+    /* Keep the Model submenu current while the composer is open */
+    extension->priv->models_listener_id =
+        m_model_catalog_add_listener(models_changed_cb, extension);
+}
+
+/*
+ * m_msg_composer_extension_setup:
+ * @composer: The message composer
+ * @user_data: The message composer extension
+ *
+ * Load the configuration and the model list and add the full UI. Runs
+ * when the composer is created once the plugin is loaded, and otherwise
+ * on the first use of the placeholder action.
+ *
+ * Returns: TRUE if the UI was added
+ */
+static gboolean
+m_msg_composer_extension_setup(EMsgComposer *composer, gpointer user_data)
+{
+    MMsgComposerExtension *extension = M_MSG_COMPOSER_EXTENSION(user_data);
+
+    if (!extension->priv->config)
+    {
+        MBackend *backend;
+
+        /* Share the process-wide configuration; files are only read again
+         * when they change on disk */
+        extension->priv->config = m_config_get();
+        extension->priv->config_listener_id =
+            m_config_add_listener(config_changed_cb, extension);
+
+        /* Serve the known models from memory; a stale list is refreshed in
+         * the background and the Model submenu is updated when it arrives */
+        backend = m_config_get_backend(extension->priv->config, NULL);
+        extension->priv->models = m_model_catalog_get_models();
+        if (m_backend_is_usable(backend))
+            m_model_catalog_refresh(backend, FALSE);
+
+        /* Warm up the API connection so the first proofread does not pay
+         * for DNS, TCP and TLS setup */
+        if (m_backend_is_usable(backend))
+            m_chatgpt_prewarm(backend);
+
+        /* Batch jobs of an earlier session may have finished by now */
+        m_batch_resume();
+
+        plugin_loaded = TRUE;
+    }
+
+    if (!extension->priv->ui_context)
+        m_msg_composer_extension_add_ui(extension, composer);
+
+    return extension->priv->ui_context != NULL;
 }
 
 static void
@@ -122,9 +232,16 @@ m_msg_composer_extension_constructed(GObject *object)
     extension = E_EXTENSION(object);
     extensible = e_extension_get_extensible(extension);
 
-    m_msg_composer_extension_add_ui(
-        M_MSG_COMPOSER_EXTENSION(object),
-        E_MSG_COMPOSER(extensible));
+    /* Most composers never proofread, so until the AI features are used
+     * once only a placeholder is added and nothing is read. The
+     * placeholder also stays while the configuration is incomplete, so
+     * trying again after fixing it needs no new composer. */
+    if (plugin_loaded &&
+        m_msg_composer_extension_setup(E_MSG_COMPOSER(extensible), extension))
+        return;
+
+    m_ui_register_placeholder(E_MSG_COMPOSER(extensible),
+                              m_msg_composer_extension_setup, extension);
 }
 
 static void
@@ -132,14 +249,19 @@ m_msg_composer_extension_dispose(GObject *object)
 {
     MMsgComposerExtension *extension = M_MSG_COMPOSER_EXTENSION(object);
 
-    if (extension->priv->prompts)
+    if (extension->priv->models_listener_id)
+    {
+        m_model_catalog_remove_listener(extension->priv->models_listener_id);
+        extension->priv->models_listener_id = 0;
+    }
+
+    if (extension->priv->config_listener_id)
     {
-        json_array_unref(extension->priv->prompts);
-        extension->priv->prompts = NULL;
+        m_config_remove_listener(extension->priv->config_listener_id);
+        extension->priv->config_listener_id = 0;
     }
 
-    g_clear_pointer(&extension->priv->chatgpt_api_key, g_free);
-    g_clear_pointer(&extension->priv->model, g_free);
+    g_clear_pointer(&extension->priv->config, m_config_unref);
 
     if (extension->priv->models)
     {
@@ -147,11 +269,7 @@ m_msg_composer_extension_dispose(GObject *object)
         extension->priv->models = NULL;
     }
 
-    if (extension->priv->ui_context)
-    {
-        m_ui_action_context_free(extension->priv->ui_context);
-        extension->priv->ui_context = NULL;
-    }
+    g_clear_pointer(&extension->priv->ui_context, m_ui_action_context_unref);
 
     /* Chain up to parent's method */
     G_OBJECT_CLASS(m_msg_composer_extension_parent_class)->dispose(object);
@@ -183,27 +301,12 @@ m_msg_composer_extension_init(MMsgComposerExtension *extension)
 {
     extension->priv = m_msg_composer_extension_get_instance_private(extension);
 
-    /* Load configuration using the config module */
-    extension->priv->prompts = m_config_load_prompts();
-    extension->priv->chatgpt_api_key = m_config_load_api_key();
-    extension->priv->model = m_config_load_model();
+    /* Everything else is loaded by m_msg_composer_extension_setup() */
+    extension->priv->config = NULL;
     extension->priv->models = NULL;
     extension->priv->ui_context = NULL;
-
-    /* Fetch available models from API */
-    if (extension->priv->chatgpt_api_key)
-    {
-        GError *error = NULL;
-        extension->priv->models = m_chatgpt_fetch_models(
-            extension->priv->chatgpt_api_key,
-            &error);
-
-        if (error)
-        {
-            g_warning("Failed to fetch models: %s", error->message);
-            g_error_free(error);
-        }
-    }
+    extension->priv->models_listener_id = 0;
+    extension->priv->config_listener_id = 0;
 }
 
 void
@@ -13,103 +13,138 @@
 
 #include "m-proofreader.h"
 #include "m-chatgpt-api.h"
+#include "m-response-cache.h"
+#include "m-chunker.h"
+#include "m-config.h"
+#include "m-extract.h"
+#include "m-edits.h"
+#include "m-stats.h"
+#include "m-hedge.h"
+#include "m-jobs.h"
+#include "m-latency.h"
+#include "m-model-catalog.h"
 
-#define PROOFREAD_WAIT_DELAY_MS 800
+#define PROOFREAD_CHUNK_MAX_TOKENS 1000
+#define PROOFREAD_CHUNK_MIN_TOKENS 2000
+#define PROOFREAD_CHUNK_PARALLELISM 4
+#define PROOFREAD_HISTORY_KEY "ai-proofread-history"
+#define PROOFREAD_HISTORY_MAX_ENTRIES 4096
+#define PROOFREAD_CONVERSATION_KEY "ai-proofread-conversation"
 
 typedef struct
 {
     MProofreadContext *context;
     gchar *content;
+    gchar *cache_key;    /* Response cache key, NULL if not cacheable */
+    gchar *edit_base;    /* Text edit lists apply to, NULL for content */
+    gboolean stream;     /* Whether the completion is streamed */
+    MStatsRecord *stats; /* Timings of the request, committed on completion */
+    gchar *previous_response_id; /* Conversation continued, NULL to start one */
+    gchar *conversation_context; /* Fingerprint of the quoted context, NULL if not a conversation */
 } ProofreadTaskData;
 
-static void proofreader_wait_indicator_clear(MProofreadContext *context);
+/* The stored response a conversation prompt continues, per composer */
+typedef struct
+{
+    gchar *response_id;
+    gchar *backend;      /* Stored responses are only known to their server */
+    gchar *context;      /* Fingerprint of the quoted context sent with the first pass */
+} ProofreadConversation;
+
+/* A message proofread as several chunks in parallel */
+typedef struct
+{
+    MProofreadContext *context;
+    gchar *cache_key;
+    GPtrArray *chunks;   /* MChunk */
+    gchar **results;     /* One result per chunk */
+    guint next;          /* Next chunk to send */
+    guint in_flight;     /* Requests currently running */
+    guint done;          /* Requests finished */
+    guint parallelism;   /* Maximum requests running at once */
+    GError *error;       /* First failure */
+} ProofreadChunkJob;
+
+typedef struct
+{
+    ProofreadChunkJob *job;
+    guint index;
+    MStatsRecord *stats;
+} ProofreadChunkTaskData;
+
 static void show_error_alert(EMsgComposer *composer, const gchar *error_message);
 static void show_no_response_dialog(EMsgComposer *composer);
-static void insert_proofread_content(EContentEditor *cnt_editor, const gchar *content);
-static gboolean proofreader_wait_indicator_show(gpointer user_data);
-static void proofreader_wait_indicator_schedule(MProofreadContext *context);
-static ProofreadTaskData *proofread_task_data_new(MProofreadContext *context, const gchar *content);
+static ProofreadTaskData *proofread_task_data_new(MProofreadContext *context, gchar *content, const gchar *edit_base, const gchar *cache_key);
 static void proofread_task_data_free(ProofreadTaskData *data);
-static void proofread_task_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable);
 static void proofread_task_completed(GObject *source_object, GAsyncResult *result, gpointer user_data);
+static void proofreader_history_record(MProofreadContext *context, const gchar *input, const gchar *output);
+static void proofreader_conversation_update(MProofreadContext *context, const gchar *context_fingerprint, const gchar *response_id);
 
-static gboolean
-proofreader_wait_indicator_show(gpointer user_data)
+/*
+ * proofreader_composer_destroy_cb:
+ *
+ * Abort the request and forget the editor when the composer goes away,
+ * so that nothing touches it after the request completes.
+ */
+static void
+proofreader_composer_destroy_cb(GtkWidget *widget, gpointer user_data)
 {
     MProofreadContext *context = user_data;
-    GtkWidget *dialog;
-    GtkWidget *content_area;
-    GtkWidget *box;
-    GtkWidget *spinner;
-    GtkWidget *label;
-    gchar *message;
 
-    if (!context->composer || !GTK_IS_WINDOW(context->composer))
-        return G_SOURCE_REMOVE;
+    g_debug("Composer destroyed, cancelling proofreading");
 
-    dialog = gtk_dialog_new();
-    gtk_window_set_title(GTK_WINDOW(dialog), _("AI Proofreading"));
-    gtk_window_set_modal(GTK_WINDOW(dialog), TRUE);
-    gtk_window_set_transient_for(GTK_WINDOW(dialog), GTK_WINDOW(context->composer));
-    gtk_window_set_resizable(GTK_WINDOW(dialog), FALSE);
+    g_signal_handler_disconnect(context->composer, context->composer_destroy_id);
+    context->composer_destroy_id = 0;
 
-    content_area = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
-    box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 12);
-    gtk_container_add(GTK_CONTAINER(content_area), box);
+    context->composer = NULL;
+    context->cnt_editor = NULL;
 
-    spinner = gtk_spinner_new();
-    gtk_spinner_start(GTK_SPINNER(spinner));
-    gtk_box_pack_start(GTK_BOX(box), spinner, FALSE, FALSE, 0);
-
-    message = g_strdup_printf(_("Proofreading with %s may take a little longer. Please wait..."),
-                              context->model ? context->model : "AI");
-    label = gtk_label_new(message);
-    g_free(message);
-    gtk_label_set_xalign(GTK_LABEL(label), 0.0);
-    gtk_label_set_line_wrap(GTK_LABEL(label), TRUE);
-    gtk_box_pack_start(GTK_BOX(box), label, TRUE, TRUE, 0);
-
-    gtk_widget_show_all(dialog);
-
-    context->wait_dialog = dialog;
-    context->wait_timeout_id = 0;
-
-    return G_SOURCE_REMOVE;
+    g_cancellable_cancel(context->cancellable);
 }
 
-static void
-proofreader_wait_indicator_schedule(MProofreadContext *context)
+/*
+ * proofreader_prompt_name:
+ * @context: The proofreading context
+ *
+ * Returns: (transfer none): The name statistics and the latency history
+ *          know the prompt of @context by
+ */
+static const gchar *
+proofreader_prompt_name(MProofreadContext *context)
 {
-    if (context->wait_timeout_id != 0 || context->wait_dialog)
-        return;
+    JsonObject *prompt = m_chatgpt_find_prompt(context->prompts, context->prompt_id);
 
-    context->wait_timeout_id = g_timeout_add(PROOFREAD_WAIT_DELAY_MS,
-                                             proofreader_wait_indicator_show,
-                                             context);
+    return prompt ? json_object_get_string_member(prompt, "name") : context->prompt_id;
 }
 
-static void
-proofreader_wait_indicator_clear(MProofreadContext *context)
+/*
+ * proofreader_stats_new:
+ * @context: The proofreading context
+ *
+ * Returns: (transfer full): A statistics record for a request of @context
+ */
+static MStatsRecord *
+proofreader_stats_new(MProofreadContext *context)
 {
-    if (context->wait_timeout_id != 0)
-    {
-        g_source_remove(context->wait_timeout_id);
-        context->wait_timeout_id = 0;
-    }
-
-    if (context->wait_dialog)
-    {
-        gtk_widget_destroy(context->wait_dialog);
-        context->wait_dialog = NULL;
-    }
+    return m_stats_record_new(M_STATS_KIND_PROOFREAD, context->model, proofreader_prompt_name(context));
 }
 
 static ProofreadTaskData *
-proofread_task_data_new(MProofreadContext *context, const gchar *content)
+proofread_task_data_new(MProofreadContext *context,
+                        gchar *content,
+                        const gchar *edit_base,
+                        const gchar *cache_key)
 {
     ProofreadTaskData *data = g_new0(ProofreadTaskData, 1);
+    MChatGPTPrompt prompt;
+
     data->context = context;
-    data->content = g_strdup(content);
+    data->content = content;
+    data->edit_base = g_strdup(edit_base);
+    data->cache_key = g_strdup(cache_key);
+    data->stream = m_chatgpt_prompt_lookup(context->prompts, context->prompt_id, &prompt) &&
+                   prompt.stream;
+    data->stats = proofreader_stats_new(context);
     return data;
 }
 
@@ -118,36 +153,57 @@ proofread_task_data_free(ProofreadTaskData *data)
 {
     if (!data)
         return;
+    m_stats_record_free(data->stats);
+    g_free(data->cache_key);
+    g_free(data->edit_base);
     g_free(data->content);
+    g_free(data->previous_response_id);
+    g_free(data->conversation_context);
     g_free(data);
 }
 
+/*
+ * proofread_stream_delta_cb:
+ *
+ * Preview streamed text in the job status. The result is applied as a
+ * whole once it is complete, since the user may be writing elsewhere.
+ */
 static void
-proofread_task_thread(GTask *task,
-                      gpointer source_object,
-                      gpointer task_data,
-                      GCancellable *cancellable)
+proofread_stream_delta_cb(const gchar *delta, gpointer user_data)
 {
-    ProofreadTaskData *data = task_data;
-    MProofreadContext *context = data->context;
-    GError *error = NULL;
-    gchar *proofread_text;
+    ProofreadTaskData *data = user_data;
 
-    proofread_text = m_chatgpt_proofread(
-        data->content,
-        context->prompt_id,
-        context->prompts,
-        context->api_key,
-        context->model,
-        &error);
+    if (data->context->job)
+        m_job_add_text(data->context->job, delta);
+}
 
-    if (error)
-    {
-        g_task_return_error(task, error);
-        return;
-    }
+/*
+ * proofreader_apply_response:
+ * @context: The proofreading context
+ * @text: The text that was proofread
+ * @response: (transfer full): The text returned by the model
+ * @error: Return location for error
+ *
+ * For prompts with edit list output, apply the edits in @response to
+ * @text.
+ *
+ * Returns: (transfer full) (nullable): The corrected text
+ */
+static gchar *
+proofreader_apply_response(MProofreadContext *context,
+                           const gchar *text,
+                           gchar *response,
+                           GError **error)
+{
+    gchar *corrected;
+
+    if (!response || !m_chatgpt_prompt_wants_edits(context->prompts, context->prompt_id))
+        return response;
 
-    g_task_return_pointer(task, proofread_text, g_free);
+    corrected = m_edits_apply(text, response, error);
+    g_free(response);
+
+    return corrected;
 }
 
 static void
@@ -155,17 +211,40 @@ proofread_task_completed(GObject *source_object,
                          GAsyncResult *result,
                          gpointer user_data)
 {
-    GTask *task = G_TASK(result);
-    ProofreadTaskData *data = g_task_get_task_data(task);
+    ProofreadTaskData *data = user_data;
     MProofreadContext *context = data->context;
     GError *error = NULL;
     gchar *proofread_text;
 
-    proofreader_wait_indicator_clear(context);
-
-    proofread_text = g_task_propagate_pointer(task, &error);
+    proofread_text = m_hedge_proofread_finish(result, &error);
+    if (data->conversation_context && context->composer)
+    {
+        /* Continue from this response next time; after a failure, for
+         * example an expired response, start over */
+        if (!error)
+            proofreader_conversation_update(context, data->conversation_context,
+                                            m_hedge_proofread_get_response_id(result));
+        else if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            proofreader_conversation_update(context, NULL, NULL);
+    }
+    if (!error)
+        proofread_text = proofreader_apply_response(
+            context, data->edit_base ? data->edit_base : data->content,
+            proofread_text, &error);
 
-    if (error)
+    m_stats_record_set_error(data->stats, error);
+    if (error && g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+        g_debug("Proofreading cancelled");
+        g_error_free(error);
+    }
+    else if (!context->composer)
+    {
+        /* The composer is gone, there is nothing to update */
+        g_clear_error(&error);
+        g_free(proofread_text);
+    }
+    else if (error)
     {
         g_warning("ChatGPT API error: %s", error->message);
         show_error_alert(context->composer, error->message);
@@ -177,27 +256,679 @@ proofread_task_completed(GObject *source_object,
     }
     else
     {
-        insert_proofread_content(context->cnt_editor, proofread_text);
+        /* The job reports how long the editor takes to apply the result */
+        data->stats->success = TRUE;
+        m_job_set_stats(context->job, g_steal_pointer(&data->stats));
+        m_job_apply(g_steal_pointer(&context->job), proofread_text);
+        if (data->cache_key)
+            m_response_cache_store(data->cache_key, proofread_text);
+        proofreader_history_record(context, data->content, proofread_text);
         g_free(proofread_text);
     }
 
+    if (data->stats)
+        m_stats_commit(g_steal_pointer(&data->stats));
+    proofread_task_data_free(data);
     m_proofreader_context_free(context);
 }
 
+/*
+ * proofreader_job_start:
+ * @context: The proofreading context
+ * @chunked: Whether the content is sent in several parts
+ *
+ * Track the request as a background job, so that the user can go on
+ * writing. The result replaces the selection, or the text sent from the
+ * whole message, wherever it is by then. A single request shows the
+ * time it usually takes; chunked jobs show the parts done instead.
+ */
 static void
-start_proofread_task(MProofreadContext *context, const gchar *original_content)
+proofreader_job_start(MProofreadContext *context, gboolean chunked)
+{
+    context->job = m_job_new(context->composer,
+                             context->cnt_editor,
+                             context->model,
+                             context->estimated_tokens,
+                             context->range,
+                             context->cancellable);
+    m_job_set_hint(context->job, context->model_hint);
+    if (!chunked)
+        m_job_set_estimate(context->job,
+                           m_latency_estimate_us(context->model, proofreader_prompt_name(context),
+                                                 context->estimated_tokens));
+}
+
+/*
+ * start_proofread_task:
+ * @context: The proofreading context
+ * @original_content: (transfer full): The content to send, which is
+ *                    handed through to the request instead of copied
+ * @edit_base: (nullable): The part of @original_content which edit lists
+ *             apply to, NULL for all of it
+ * @cache_key: (nullable): The response cache key
+ * @previous_response_id: (nullable): The conversation to continue
+ * @conversation_context: (nullable): For conversation prompts, the
+ *                        fingerprint of the quoted context
+ */
+static void
+start_proofread_task(MProofreadContext *context,
+                     gchar *original_content,
+                     const gchar *edit_base,
+                     const gchar *cache_key,
+                     const gchar *previous_response_id,
+                     const gchar *conversation_context)
 {
     ProofreadTaskData *data;
-    GTask *task;
 
-    data = proofread_task_data_new(context, original_content);
-    task = g_task_new(NULL, NULL, proofread_task_completed, NULL);
-    g_task_set_task_data(task, data, (GDestroyNotify)proofread_task_data_free);
+    data = proofread_task_data_new(context, original_content, edit_base, cache_key);
+    data->previous_response_id = g_strdup(previous_response_id);
+    data->conversation_context = g_strdup(conversation_context);
+
+    proofreader_job_start(context, FALSE);
+
+    m_hedge_proofread_async(data->content,
+                            data->edit_base,
+                            context->prompt_id,
+                            context->prompts,
+                            context->backend,
+                            context->model,
+                            data->previous_response_id,
+                            context->hedge,
+                            data->stream,
+                            proofread_stream_delta_cb,
+                            data,
+                            data->stats,
+                            context->cancellable,
+                            proofread_task_completed,
+                            data);
+}
+
+/*
+ * proofreader_incremental_enabled:
+ * @context: The proofreading context
+ *
+ * Paragraph results can only be reused for prompts which correct text
+ * in place, that is prompts with "chunk": true. They can opt out with
+ * "incremental": false.
+ */
+static gboolean
+proofreader_incremental_enabled(MProofreadContext *context)
+{
+    JsonObject *prompt = m_chatgpt_find_prompt(context->prompts, context->prompt_id);
+
+    return prompt &&
+           json_object_get_boolean_member_with_default(prompt, "chunk", FALSE) &&
+           json_object_get_boolean_member_with_default(prompt, "incremental", TRUE);
+}
+
+/*
+ * paragraph_fingerprint:
+ *
+ * Returns: (transfer full): The fingerprint of @text ignoring surrounding whitespace
+ */
+static gchar *
+paragraph_fingerprint(const gchar *text)
+{
+    gchar *stripped = g_strstrip(g_strdup(text));
+    gchar *fingerprint = g_compute_checksum_for_string(G_CHECKSUM_SHA1, stripped, -1);
+
+    g_free(stripped);
+    return fingerprint;
+}
+
+/*
+ * proofreader_history_get:
+ * @context: The proofreading context
+ * @create: Whether to create the history if there is none
+ *
+ * The history of a composer maps paragraph fingerprints to corrected
+ * paragraphs, separately for every prompt and model. It is stored on the
+ * composer and freed with it.
+ *
+ * Returns: (transfer none) (nullable): The history table
+ */
+static GHashTable *
+proofreader_history_get(MProofreadContext *context, gboolean create)
+{
+    GHashTable *histories;
+    GHashTable *history;
+    gchar *key;
+
+    if (!context->composer)
+        return NULL;
+
+    histories = g_object_get_data(G_OBJECT(context->composer), PROOFREAD_HISTORY_KEY);
+    if (!histories)
+    {
+        if (!create)
+            return NULL;
+
+        histories = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                          (GDestroyNotify)g_hash_table_unref);
+        g_object_set_data_full(G_OBJECT(context->composer), PROOFREAD_HISTORY_KEY,
+                               histories, (GDestroyNotify)g_hash_table_unref);
+    }
+
+    key = g_strconcat(context->prompt_id, "\n", context->model ? context->model : "", NULL);
+    history = g_hash_table_lookup(histories, key);
+    if (!history && create)
+    {
+        history = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+        g_hash_table_insert(histories, key, history);
+    }
+    else
+    {
+        g_free(key);
+    }
+
+    return history;
+}
+
+/*
+ * proofreader_history_record:
+ * @context: The proofreading context
+ * @input: Text that was sent
+ * @output: The corrected text
+ *
+ * Remember the correction of @input, and that each paragraph of @output
+ * is already correct, since that is what the editor holds afterwards.
+ */
+static void
+proofreader_history_record(MProofreadContext *context, const gchar *input, const gchar *output)
+{
+    GHashTable *history;
+    GPtrArray *paragraphs;
+    gchar *corrected;
+
+    if (!proofreader_incremental_enabled(context))
+        return;
+
+    history = proofreader_history_get(context, TRUE);
+    if (!history)
+        return;
+
+    if (g_hash_table_size(history) > PROOFREAD_HISTORY_MAX_ENTRIES)
+        g_hash_table_remove_all(history);
+
+    corrected = g_strstrip(g_strdup(output));
+    g_hash_table_replace(history, paragraph_fingerprint(input), corrected);
+
+    paragraphs = m_chunker_split_paragraphs(output);
+    for (guint i = 0; i < paragraphs->len; i++)
+    {
+        MChunk *paragraph = g_ptr_array_index(paragraphs, i);
+        if (*paragraph->text)
+            g_hash_table_replace(history, paragraph_fingerprint(paragraph->text),
+                                 g_strdup(paragraph->text));
+    }
+    g_ptr_array_unref(paragraphs);
+}
+
+/*
+ * proofreader_conversation_enabled:
+ * @context: The proofreading context
+ *
+ * Prompts with "conversation": true continue the response stored by
+ * their previous run, so that follow-up passes only send the new text.
+ */
+static gboolean
+proofreader_conversation_enabled(MProofreadContext *context)
+{
+    MChatGPTPrompt prompt;
+
+    return m_chatgpt_prompt_lookup(context->prompts, context->prompt_id, &prompt) &&
+           prompt.conversation;
+}
+
+static void
+proofreader_conversation_free(ProofreadConversation *conversation)
+{
+    g_free(conversation->response_id);
+    g_free(conversation->backend);
+    g_free(conversation->context);
+    g_free(conversation);
+}
+
+/*
+ * proofreader_conversation_key:
+ *
+ * Returns: (transfer full): The key of the conversation of @context,
+ *          kept separately for every prompt and model
+ */
+static gchar *
+proofreader_conversation_key(MProofreadContext *context)
+{
+    return g_strconcat(context->prompt_id, "\n", context->model ? context->model : "", NULL);
+}
+
+/*
+ * proofreader_conversation_lookup:
+ * @context: The proofreading context
+ * @context_fingerprint: The fingerprint of the quoted context to send
+ *
+ * A conversation can only be continued on the server which stored it,
+ * and only while the quoted context it was started with is unchanged.
+ *
+ * Returns: (transfer none) (nullable): The response to continue, or NULL
+ *          to start a new conversation
+ */
+static const gchar *
+proofreader_conversation_lookup(MProofreadContext *context, const gchar *context_fingerprint)
+{
+    GHashTable *conversations;
+    ProofreadConversation *conversation;
+    gchar *key;
+
+    if (!context->composer)
+        return NULL;
+
+    conversations = g_object_get_data(G_OBJECT(context->composer), PROOFREAD_CONVERSATION_KEY);
+    if (!conversations)
+        return NULL;
+
+    key = proofreader_conversation_key(context);
+    conversation = g_hash_table_lookup(conversations, key);
+    g_free(key);
+
+    if (!conversation ||
+        g_strcmp0(conversation->backend, context->backend->name) != 0 ||
+        g_strcmp0(conversation->context, context_fingerprint) != 0)
+        return NULL;
+
+    return conversation->response_id;
+}
+
+/*
+ * proofreader_conversation_update:
+ * @context: The proofreading context
+ * @context_fingerprint: (nullable): The fingerprint of the quoted context
+ * @response_id: (nullable): The stored response, NULL to forget the conversation
+ */
+static void
+proofreader_conversation_update(MProofreadContext *context,
+                                const gchar *context_fingerprint,
+                                const gchar *response_id)
+{
+    GHashTable *conversations;
+    ProofreadConversation *conversation;
+
+    if (!context->composer)
+        return;
+
+    conversations = g_object_get_data(G_OBJECT(context->composer), PROOFREAD_CONVERSATION_KEY);
+    if (!conversations)
+    {
+        if (!response_id)
+            return;
+
+        conversations = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                              (GDestroyNotify)proofreader_conversation_free);
+        g_object_set_data_full(G_OBJECT(context->composer), PROOFREAD_CONVERSATION_KEY,
+                               conversations, (GDestroyNotify)g_hash_table_unref);
+    }
+
+    if (!response_id)
+    {
+        gchar *key = proofreader_conversation_key(context);
+
+        g_hash_table_remove(conversations, key);
+        g_free(key);
+        return;
+    }
+
+    conversation = g_new0(ProofreadConversation, 1);
+    conversation->response_id = g_strdup(response_id);
+    conversation->backend = g_strdup(context->backend->name);
+    conversation->context = g_strdup(context_fingerprint);
+    g_hash_table_replace(conversations, proofreader_conversation_key(context), conversation);
+    g_debug("Conversation of prompt %s continues from response %s", context->prompt_id, response_id);
+}
+
+/*
+ * proofreader_results_free:
+ * @results: (nullable): One result per chunk, NULL where unknown
+ * @n_results: Number of chunks
+ *
+ * Free a result array, which unlike a string vector may have holes.
+ */
+static void
+proofreader_results_free(gchar **results, guint n_results)
+{
+    if (!results)
+        return;
+
+    for (guint i = 0; i < n_results; i++)
+        g_free(results[i]);
+    g_free(results);
+}
+
+/*
+ * proofreader_reuse_paragraphs:
+ * @context: The proofreading context
+ * @content: The content to proofread
+ * @out_results: (out): Known corrections for each paragraph, NULL where unknown
+ *
+ * Look up every paragraph of @content in the composer history.
+ *
+ * Returns: (transfer full) (nullable): The paragraphs of @content, or NULL
+ *          if no paragraph is known
+ */
+static GPtrArray *
+proofreader_reuse_paragraphs(MProofreadContext *context,
+                             const gchar *content,
+                             gchar ***out_results)
+{
+    GHashTable *history;
+    GPtrArray *paragraphs;
+    gchar **results;
+    guint reused = 0;
+
+    if (!proofreader_incremental_enabled(context))
+        return NULL;
+
+    history = proofreader_history_get(context, FALSE);
+    if (!history || g_hash_table_size(history) == 0)
+        return NULL;
+
+    paragraphs = m_chunker_split_paragraphs(content);
+    results = g_new0(gchar *, paragraphs->len + 1);
+
+    for (guint i = 0; i < paragraphs->len; i++)
+    {
+        MChunk *paragraph = g_ptr_array_index(paragraphs, i);
+        gchar *fingerprint;
+        const gchar *corrected;
+
+        if (!*paragraph->text)
+        {
+            results[i] = g_strdup("");
+            continue;
+        }
+
+        fingerprint = paragraph_fingerprint(paragraph->text);
+        corrected = g_hash_table_lookup(history, fingerprint);
+        if (corrected)
+        {
+            results[i] = g_strdup(corrected);
+            reused++;
+        }
+        g_free(fingerprint);
+    }
+
+    if (reused == 0)
+    {
+        proofreader_results_free(results, paragraphs->len);
+        g_ptr_array_unref(paragraphs);
+        return NULL;
+    }
+
+    g_debug("Reusing %u of %u paragraphs from the previous run", reused, paragraphs->len);
+
+    *out_results = results;
+    return paragraphs;
+}
+
+static void
+proofread_chunk_job_free(ProofreadChunkJob *job)
+{
+    proofreader_results_free(job->results, job->chunks->len);
+    g_ptr_array_unref(job->chunks);
+    g_clear_error(&job->error);
+    g_free(job->cache_key);
+    g_free(job);
+}
+
+/*
+ * proofread_chunk_job_finish:
+ * @job: The chunk job
+ *
+ * Stitch the chunk results together and insert them once every request
+ * has finished.
+ */
+static void
+proofread_chunk_job_finish(ProofreadChunkJob *job)
+{
+    MProofreadContext *context = job->context;
+
+    if (job->error && !g_error_matches(job->error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+        if (context->composer)
+        {
+            g_warning("ChatGPT API error: %s", job->error->message);
+            show_error_alert(context->composer, job->error->message);
+        }
+    }
+    else if (job->error || !context->composer)
+    {
+        g_debug("Chunked proofreading cancelled");
+    }
+    else
+    {
+        gchar *text = m_chunker_join(job->chunks, job->results);
+
+        for (guint i = 0; i < job->chunks->len; i++)
+        {
+            MChunk *chunk = g_ptr_array_index(job->chunks, i);
+            if (*chunk->text)
+                proofreader_history_record(context, chunk->text, job->results[i]);
+        }
+
+        m_job_apply(g_steal_pointer(&context->job), text);
+        if (job->cache_key)
+            m_response_cache_store(job->cache_key, text);
+        g_free(text);
+    }
+
+    m_proofreader_context_free(context);
+    proofread_chunk_job_free(job);
+}
+
+static void proofread_chunk_job_dispatch(ProofreadChunkJob *job);
+
+static void
+proofread_chunk_task_data_free(ProofreadChunkTaskData *data)
+{
+    m_stats_record_free(data->stats);
+    g_free(data);
+}
+
+static void
+proofread_chunk_task_completed(GObject *source_object,
+                               GAsyncResult *result,
+                               gpointer user_data)
+{
+    ProofreadChunkTaskData *data = user_data;
+    ProofreadChunkJob *job = data->job;
+    guint index = data->index;
+    MChunk *chunk = g_ptr_array_index(job->chunks, index);
+    GError *error = NULL;
+    gchar *proofread_text;
+
+    proofread_text = m_hedge_proofread_finish(result, &error);
+    if (!error)
+        proofread_text = proofreader_apply_response(job->context, chunk->text, proofread_text, &error);
+
+    data->stats->success = error == NULL;
+    m_stats_record_set_error(data->stats, error);
+    m_stats_commit(g_steal_pointer(&data->stats));
+    proofread_chunk_task_data_free(data);
+
+    job->in_flight--;
+    job->done++;
+
+    if (error)
+    {
+        /* Keep the first failure and stop the remaining requests */
+        if (!job->error)
+        {
+            job->error = error;
+            g_cancellable_cancel(job->context->cancellable);
+        }
+        else
+        {
+            g_error_free(error);
+        }
+    }
+    else
+    {
+        job->results[index] = proofread_text ? proofread_text : g_strdup("");
+    }
+
+    if (job->done == job->chunks->len)
+        proofread_chunk_job_finish(job);
+    else
+        proofread_chunk_job_dispatch(job);
+}
+
+/*
+ * proofread_chunk_job_dispatch:
+ * @job: The chunk job
+ *
+ * Start requests for the next chunks until the parallelism limit is
+ * reached. Empty chunks are completed without a request.
+ */
+static void
+proofread_chunk_job_dispatch(ProofreadChunkJob *job)
+{
+    while (!job->error &&
+           job->in_flight < job->parallelism &&
+           job->next < job->chunks->len)
+    {
+        guint index = job->next++;
+        MChunk *chunk = g_ptr_array_index(job->chunks, index);
+        ProofreadChunkTaskData *data;
+
+        /* Empty chunks and reused paragraphs need no request */
+        if (!*chunk->text && !job->results[index])
+            job->results[index] = g_strdup("");
+
+        if (job->results[index])
+        {
+            job->done++;
+            continue;
+        }
+
+        data = g_new0(ProofreadChunkTaskData, 1);
+        data->job = job;
+        data->index = index;
+        data->stats = proofreader_stats_new(job->context);
+
+        job->in_flight++;
+        m_hedge_proofread_async(chunk->text,
+                                NULL,
+                                job->context->prompt_id,
+                                job->context->prompts,
+                                job->context->backend,
+                                job->context->model,
+                                NULL,
+                                job->context->hedge,
+                                FALSE,
+                                NULL,
+                                NULL,
+                                data->stats,
+                                job->context->cancellable,
+                                proofread_chunk_task_completed,
+                                data);
+    }
+
+    if (job->context->job)
+        m_job_set_parts(job->context->job, job->done, job->chunks->len);
+
+    /* Nothing left running: either all done or stopped by an error */
+    if (job->in_flight == 0 && (job->error || job->done == job->chunks->len))
+        proofread_chunk_job_finish(job);
+}
+
+/*
+ * start_chunked_proofread:
+ * @context: The proofreading context
+ * @chunks: (transfer full): The chunks to proofread
+ * @results: (transfer full) (nullable): Already known results, NULL where unknown
+ * @cache_key: (nullable): The response cache key of the whole content
+ * @parallelism: Maximum concurrent requests
+ */
+static void
+start_chunked_proofread(MProofreadContext *context,
+                        GPtrArray *chunks,
+                        gchar **results,
+                        const gchar *cache_key,
+                        guint parallelism)
+{
+    ProofreadChunkJob *job = g_new0(ProofreadChunkJob, 1);
+
+    job->context = context;
+    job->cache_key = g_strdup(cache_key);
+    job->chunks = chunks;
+    job->results = results ? results : g_new0(gchar *, chunks->len + 1);
+    job->parallelism = MAX(parallelism, 1);
+
+    g_debug("Proofreading in %u chunks, %u in parallel", chunks->len, job->parallelism);
 
-    proofreader_wait_indicator_schedule(context);
+    proofreader_job_start(context, TRUE);
+    proofread_chunk_job_dispatch(job);
+}
+
+/*
+ * get_chunking_settings:
+ *
+ * Read sizes and parallelism from the "chunking" section of config.json.
+ */
+static void
+get_chunking_settings(guint *max_tokens, guint *min_tokens, guint *parallelism)
+{
+    MConfig *config = m_config_get();
+    JsonObject *section = m_config_get_section(config, "chunking");
+
+    *max_tokens = PROOFREAD_CHUNK_MAX_TOKENS;
+    *min_tokens = PROOFREAD_CHUNK_MIN_TOKENS;
+    *parallelism = PROOFREAD_CHUNK_PARALLELISM;
+
+    if (section)
+    {
+        *max_tokens = json_object_get_int_member_with_default(section, "max_tokens", *max_tokens);
+        *min_tokens = json_object_get_int_member_with_default(section, "min_tokens", *min_tokens);
+        *parallelism = json_object_get_int_member_with_default(section, "parallelism", *parallelism);
+    }
+
+    m_config_unref(config);
+}
+
+/*
+ * proofreader_split_content:
+ * @context: The proofreading context
+ * @content: The content to proofread
+ *
+ * Decide whether the content is proofread in chunks. Only prompts with
+ * "chunk": true are split, and only when the content is large enough.
+ *
+ * Returns: (transfer full) (nullable): The chunks, or NULL for a single request
+ */
+static GPtrArray *
+proofreader_split_content(MProofreadContext *context,
+                          const gchar *content)
+{
+    JsonObject *prompt = m_chatgpt_find_prompt(context->prompts, context->prompt_id);
+    guint max_tokens;
+    guint min_tokens;
+    guint unused;
+    GPtrArray *chunks = NULL;
 
-    g_task_run_in_thread(task, proofread_task_thread);
-    g_object_unref(task);
+    if (!prompt || !json_object_get_boolean_member_with_default(prompt, "chunk", FALSE))
+        return NULL;
+
+    get_chunking_settings(&max_tokens, &min_tokens, &unused);
+
+    if (m_chunker_estimate_tokens(content) < min_tokens)
+        return NULL;
+
+    chunks = m_chunker_split(content, MAX(max_tokens, 1));
+    if (chunks->len < 2)
+    {
+        g_ptr_array_unref(chunks);
+        return NULL;
+    }
+
+    return chunks;
 }
 
 /*
@@ -209,20 +940,32 @@ MProofreadContext *
 m_proofreader_context_new(EContentEditor *cnt_editor,
                           const gchar *prompt_id,
                           JsonArray *prompts,
-                          const gchar *api_key,
+                          MBackend *backend,
                           const gchar *model,
                           EMsgComposer *composer)
 {
     MProofreadContext *context = g_new0(MProofreadContext, 1);
+    MChatGPTPrompt prompt;
+    gboolean found = m_chatgpt_prompt_lookup(prompts, prompt_id, &prompt);
 
     context->cnt_editor = cnt_editor;
     context->prompt_id = g_strdup(prompt_id);
     context->prompts = json_array_ref(prompts);
-    context->api_key = g_strdup(api_key);
-    context->model = g_strdup(model);
+    context->backend = m_backend_ref(backend);
+    context->model = g_strdup(m_chatgpt_prompt_get_model(found ? &prompt : NULL, backend, model));
     context->composer = composer;
-    context->wait_dialog = NULL;
-    context->wait_timeout_id = 0;
+    context->job = NULL;
+    context->cancellable = g_cancellable_new();
+    context->composer_destroy_id = 0;
+    context->selection = NULL;
+    context->range = NULL;
+    context->estimated_tokens = 0;
+    context->model_hint = NULL;
+
+    if (composer)
+        context->composer_destroy_id = g_signal_connect(
+            composer, "destroy",
+            G_CALLBACK(proofreader_composer_destroy_cb), context);
 
     return context;
 }
@@ -238,11 +981,19 @@ m_proofreader_context_free(MProofreadContext *context)
     if (!context)
         return;
 
-    proofreader_wait_indicator_clear(context);
+    m_job_free(context->job);
+
+    if (context->composer && context->composer_destroy_id)
+        g_signal_handler_disconnect(context->composer, context->composer_destroy_id);
 
+    g_clear_object(&context->cancellable);
     g_free(context->prompt_id);
-    g_free(context->api_key);
+    m_backend_unref(context->backend);
     g_free(context->model);
+    m_hedge_policy_free(context->hedge);
+    g_free(context->selection);
+    g_free(context->range);
+    g_free(context->model_hint);
 
     if (context->prompts)
         json_array_unref(context->prompts);
@@ -287,19 +1038,170 @@ show_no_response_dialog(EMsgComposer *composer)
 }
 
 /*
- * insert_proofread_content:
- * @cnt_editor: The content editor
- * @content: The proofread content to insert
+ * proofreader_cache_key:
+ * @context: The proofreading context
+ * @content: The content to proofread
+ *
+ * Returns: (transfer full) (nullable): The response cache key, or NULL
+ *          if the prompt is unknown
+ */
+static gchar *
+proofreader_cache_key(MProofreadContext *context, const gchar *content)
+{
+    JsonObject *prompt = m_chatgpt_find_prompt(context->prompts, context->prompt_id);
+    const gchar *prompt_text = prompt ? json_object_get_string_member(prompt, "prompt") : NULL;
+
+    if (!prompt_text)
+        return NULL;
+
+    /* Another backend or a backend's own model answers differently */
+    return m_response_cache_key(content, prompt_text, context->backend->base_url,
+                                m_backend_get_model(context->backend, context->model));
+}
+
+/*
+ * proofreader_extract:
+ * @context: The proofreading context
+ * @body: The plain text body of the message
+ *
+ * Apply the selection and the "quoted" and "signature" settings of the
+ * prompt to @body. A selection which cannot be found in @body (e.g. a
+ * stale PRIMARY selection from another window) is ignored.
+ *
+ * @body is taken, so that a message kept as a whole is not copied.
+ *
+ * Returns: (transfer full): The extraction
+ */
+static MExtraction *
+proofreader_extract(MProofreadContext *context, gchar *body)
+{
+    JsonObject *prompt = m_chatgpt_find_prompt(context->prompts, context->prompt_id);
+    const gchar *selection = context->selection;
+    MExtractMode quoted_mode = M_EXTRACT_KEEP;
+    MExtractMode signature_mode = M_EXTRACT_KEEP;
+
+    if (prompt)
+    {
+        quoted_mode = m_extract_mode_from_string(
+            json_object_get_string_member_with_default(prompt, "quoted", NULL),
+            M_EXTRACT_KEEP);
+        signature_mode = m_extract_mode_from_string(
+            json_object_get_string_member_with_default(prompt, "signature", NULL),
+            M_EXTRACT_KEEP);
+    }
+
+    if (selection && !m_extract_selection_matches(body, selection))
+    {
+        g_debug("Selection not found in the message body, ignoring it");
+        g_clear_pointer(&context->selection, g_free);
+        selection = NULL;
+    }
+
+    return m_extract_content_take(body, selection, quoted_mode, signature_mode);
+}
+
+/*
+ * proofreader_choose_model:
+ * @context: The proofreading context
+ * @prompt: The prompt settings
  *
- * Insert the proofread content into the editor.
+ * With "auto_model" set in the "latency" section of config.json, look
+ * for a model of the Model menu which meets the quality tier and usually
+ * finishes requests of this prompt and size sooner, then either use it
+ * or name it in the job status.
  */
 static void
-insert_proofread_content(EContentEditor *cnt_editor, const gchar *content)
+proofreader_choose_model(MProofreadContext *context, const MChatGPTPrompt *prompt)
 {
-    e_content_editor_insert_content(
-        cnt_editor,
-        content,
-        E_CONTENT_EDITOR_INSERT_TEXT_PLAIN | E_CONTENT_EDITOR_INSERT_FROM_PLAIN_TEXT);
+    MLatencyAutoModel mode = m_latency_get_auto_model();
+    GList *models;
+    gchar *fastest;
+    gint64 fastest_us;
+    gint64 current_us;
+
+    if (mode == M_LATENCY_AUTO_MODEL_OFF)
+        return;
+
+    models = m_model_catalog_get_models();
+    fastest = m_latency_fastest_model(prompt->name, context->estimated_tokens, models, &fastest_us);
+    g_list_free_full(models, g_free);
+
+    current_us = m_latency_estimate_us(context->model, prompt->name, context->estimated_tokens);
+    if (fastest && g_strcmp0(fastest, context->model) != 0 &&
+        (current_us == 0 || fastest_us < current_us))
+    {
+        if (mode == M_LATENCY_AUTO_MODEL_SELECT)
+        {
+            g_debug("Using %s instead of %s, usually done in %" G_GINT64_FORMAT " ms",
+                    fastest, context->model, fastest_us / G_TIME_SPAN_MILLISECOND);
+            g_free(context->model);
+            context->model = g_steal_pointer(&fastest);
+        }
+        else
+        {
+            g_free(context->model_hint);
+            context->model_hint = g_strdup_printf(_("%s is usually done with this in %u s."),
+                                                  fastest,
+                                                  (guint)MAX((fastest_us + G_USEC_PER_SEC / 2) / G_USEC_PER_SEC, 1));
+        }
+    }
+
+    g_free(fastest);
+}
+
+/*
+ * proofreader_compose:
+ * @context: The proofreading context
+ * @extraction: The extraction of the message
+ *
+ * Build the content to send. The quoted context is trimmed to what the
+ * "max_input_tokens" of the prompt leaves next to the text, and the
+ * estimated size of the request picks the "small_model" of the prompt
+ * for short messages. The estimate is kept in @context.
+ *
+ * Returns: (transfer full): The content to send, the text of
+ *          @extraction is stolen if there is no context
+ */
+static gchar *
+proofreader_compose(MProofreadContext *context, MExtraction *extraction)
+{
+    MChatGPTPrompt prompt;
+    gchar *content;
+    const gchar *model;
+
+    if (!m_chatgpt_prompt_lookup(context->prompts, context->prompt_id, &prompt))
+        return extraction->context ? m_extraction_compose(extraction)
+                                   : g_steal_pointer(&extraction->text);
+
+    if (extraction->context && prompt.max_input_tokens > 0)
+    {
+        guint text_tokens = m_chatgpt_prompt_estimate_tokens(&prompt, extraction->text);
+
+        m_extraction_trim_context(extraction, prompt.max_input_tokens > text_tokens
+                                                  ? prompt.max_input_tokens - text_tokens
+                                                  : 0);
+    }
+
+    content = extraction->context ? m_extraction_compose(extraction)
+                                  : g_steal_pointer(&extraction->text);
+
+    context->estimated_tokens = m_chatgpt_prompt_estimate_tokens(&prompt, content);
+    model = m_chatgpt_prompt_route_model(&prompt, context->backend, context->model,
+                                         context->estimated_tokens);
+    if (g_strcmp0(model, context->model) != 0)
+    {
+        gchar *routed = g_strdup(model);
+
+        g_free(context->model);
+        context->model = routed;
+    }
+    else if (!prompt.model && !context->backend->model)
+    {
+        /* Only the model picked in the menu is open to a faster choice */
+        proofreader_choose_model(context, &prompt);
+    }
+
+    return content;
 }
 
 /*
@@ -320,15 +1222,24 @@ m_proofreader_content_ready_cb(GObject *source_object,
 
     g_debug("Getting content finish for prompt: %s", context->prompt_id);
 
-    content_hash = e_content_editor_get_content_finish(cnt_editor, result, &error);
+    content_hash = e_content_editor_get_content_finish(E_CONTENT_EDITOR(source_object), result, &error);
     if (error)
     {
-        g_warning("Error getting content: %s", error->message);
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_warning("Error getting content: %s", error->message);
         g_error_free(error);
         m_proofreader_context_free(context);
         return;
     }
 
+    if (!cnt_editor || g_cancellable_is_cancelled(context->cancellable))
+    {
+        if (content_hash)
+            e_content_editor_util_free_content_hash(content_hash);
+        m_proofreader_context_free(context);
+        return;
+    }
+
     if (!content_hash)
     {
         g_warning("No content hash returned");
@@ -340,20 +1251,307 @@ m_proofreader_content_ready_cb(GObject *source_object,
         content_hash, E_CONTENT_EDITOR_GET_TO_SEND_PLAIN, NULL);
 
     gboolean handed_off = FALSE;
+    MExtraction *extraction = NULL;
 
     if (content)
     {
-        start_proofread_task(context, content);
-        handed_off = TRUE;
+        extraction = proofreader_extract(context, g_steal_pointer(&content));
+        /* The text sent from the whole message is found and replaced like
+         * a selection, if it is the start of the body */
+        if (context->selection)
+            context->range = g_strdup(context->selection);
+        else if (extraction->tail)
+            context->range = g_strchomp(g_strdup(extraction->text));
+        content = proofreader_compose(context, extraction);
+    }
+
+    if (content && *content)
+    {
+        gchar *cache_key = proofreader_cache_key(context, content);
+        gchar *cached = cache_key ? m_response_cache_lookup(cache_key) : NULL;
+
+        if (cached)
+        {
+            /* Same content, prompt and model as before: no round trip,
+             * but applied like any other result */
+            proofreader_job_start(context, FALSE);
+            m_job_apply(g_steal_pointer(&context->job), cached);
+            g_free(cached);
+        }
+        else
+        {
+            guint max_tokens, min_tokens, parallelism;
+            gchar **results = NULL;
+            GPtrArray *chunks;
+            gboolean conversation = proofreader_conversation_enabled(context);
+
+            get_chunking_settings(&max_tokens, &min_tokens, &parallelism);
+
+            /* With context attached, or as a conversation, the message has
+             * to go in one piece. Otherwise only paragraphs changed since
+             * the last run are sent again. */
+            chunks = NULL;
+            if (!extraction->context && !conversation)
+            {
+                chunks = proofreader_reuse_paragraphs(context, content, &results);
+                if (!chunks)
+                    chunks = proofreader_split_content(context, content);
+            }
+
+            if (chunks)
+            {
+                start_chunked_proofread(context, chunks, results, cache_key, parallelism);
+            }
+            else if (conversation)
+            {
+                /* The server still holds the quoted context of the first
+                 * pass, follow-ups only send the text */
+                gchar *fingerprint = paragraph_fingerprint(extraction->context ? extraction->context : "");
+                const gchar *previous = proofreader_conversation_lookup(context, fingerprint);
+
+                if (previous && extraction->context)
+                    start_proofread_task(context, g_steal_pointer(&extraction->text), NULL,
+                                         cache_key, previous, fingerprint);
+                else
+                    start_proofread_task(context, g_steal_pointer(&content), extraction->text,
+                                         cache_key, previous, fingerprint);
+                g_free(fingerprint);
+            }
+            else
+            {
+                start_proofread_task(context, g_steal_pointer(&content), extraction->text,
+                                     cache_key, NULL, NULL);
+            }
+            handed_off = TRUE;
+        }
+
+        g_free(cache_key);
     }
 
     g_free(content);
+    m_extraction_free(extraction);
     e_content_editor_util_free_content_hash(content_hash);
 
     if (!handed_off)
         m_proofreader_context_free(context);
 }
 
+/*
+ * proofreader_request_content:
+ * @context: The proofreading context
+ *
+ * Ask the editor for the plain text body.
+ */
+static void
+proofreader_request_content(MProofreadContext *context)
+{
+    e_content_editor_get_content(
+        context->cnt_editor,
+        E_CONTENT_EDITOR_GET_TO_SEND_PLAIN,
+        NULL,
+        context->cancellable,
+        m_proofreader_content_ready_cb,
+        context);
+}
+
+/*
+ * proofreader_selection_received_cb:
+ *
+ * The editor offers no getter for the selected text, but selecting text
+ * makes it the PRIMARY selection of the display.
+ */
+static void
+proofreader_selection_received_cb(GtkClipboard *clipboard,
+                                  const gchar *text,
+                                  gpointer user_data)
+{
+    MProofreadContext *context = user_data;
+
+    if (!context->cnt_editor || g_cancellable_is_cancelled(context->cancellable))
+    {
+        m_proofreader_context_free(context);
+        return;
+    }
+
+    if (text && *text)
+        context->selection = g_strdup(text);
+
+    proofreader_request_content(context);
+}
+
+/* A background proofread of the whole message, see m_proofreader_prefetch() */
+typedef struct
+{
+    MProofreadContext *context;
+    gchar *edit_base;    /* Text edit lists apply to */
+    gchar *cache_key;
+    MStatsRecord *stats;
+} ProofreadPrefetchData;
+
+static void
+proofread_prefetch_completed(GObject *source_object,
+                             GAsyncResult *result,
+                             gpointer user_data)
+{
+    ProofreadPrefetchData *data = user_data;
+    GError *error = NULL;
+    gchar *proofread_text;
+
+    proofread_text = m_chatgpt_proofread_finish(result, &error);
+    if (!error)
+        proofread_text = proofreader_apply_response(data->context, data->edit_base,
+                                                    proofread_text, &error);
+
+    m_stats_record_set_error(data->stats, error);
+    if (error)
+    {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_debug("Background proofreading failed: %s", error->message);
+        g_error_free(error);
+    }
+    else if (proofread_text)
+    {
+        /* Running the prompt on the unchanged text now needs no round trip */
+        m_response_cache_store(data->cache_key, proofread_text);
+        data->stats->success = TRUE;
+    }
+
+    g_free(proofread_text);
+    m_stats_commit(g_steal_pointer(&data->stats));
+    m_proofreader_context_free(data->context);
+    g_free(data->edit_base);
+    g_free(data->cache_key);
+    g_free(data);
+}
+
+/*
+ * proofreader_prefetch_content_ready_cb:
+ *
+ * Like m_proofreader_content_ready_cb(), but only sends the text if the
+ * response cache does not know it yet and stores the result there.
+ */
+static void
+proofreader_prefetch_content_ready_cb(GObject *source_object,
+                                      GAsyncResult *result,
+                                      gpointer user_data)
+{
+    MProofreadContext *context = user_data;
+    EContentEditorContentHash *content_hash;
+    MExtraction *extraction = NULL;
+    gchar *content = NULL;
+    gchar *cache_key = NULL;
+    gchar *cached = NULL;
+
+    content_hash = e_content_editor_get_content_finish(E_CONTENT_EDITOR(source_object), result, NULL);
+    if (!content_hash || !context->cnt_editor || g_cancellable_is_cancelled(context->cancellable))
+    {
+        if (content_hash)
+            e_content_editor_util_free_content_hash(content_hash);
+        m_proofreader_context_free(context);
+        return;
+    }
+
+    content = e_content_editor_util_steal_content_data(
+        content_hash, E_CONTENT_EDITOR_GET_TO_SEND_PLAIN, NULL);
+    e_content_editor_util_free_content_hash(content_hash);
+
+    if (content)
+    {
+        extraction = proofreader_extract(context, g_steal_pointer(&content));
+        content = proofreader_compose(context, extraction);
+        cache_key = *content ? proofreader_cache_key(context, content) : NULL;
+        cached = cache_key ? m_response_cache_lookup(cache_key) : NULL;
+    }
+
+    if (cache_key && !cached)
+    {
+        ProofreadPrefetchData *data = g_new0(ProofreadPrefetchData, 1);
+        JsonObject *prompt = m_chatgpt_find_prompt(context->prompts, context->prompt_id);
+
+        g_debug("Proofreading with prompt %s in the background", context->prompt_id);
+
+        data->context = context;
+        data->edit_base = g_strdup(extraction->context ? extraction->text : content);
+        data->cache_key = g_steal_pointer(&cache_key);
+        data->stats = m_stats_record_new(M_STATS_KIND_PREFETCH, context->model,
+                                         prompt ? json_object_get_string_member(prompt, "name") : context->prompt_id);
+
+        m_chatgpt_proofread_async(content,
+                                  data->edit_base,
+                                  context->prompt_id,
+                                  context->prompts,
+                                  context->backend,
+                                  context->model,
+                                  NULL,
+                                  FALSE,
+                                  NULL,
+                                  NULL,
+                                  NULL,
+                                  data->stats,
+                                  M_SCHEDULER_PRIORITY_BACKGROUND,
+                                  context->cancellable,
+                                  proofread_prefetch_completed,
+                                  data);
+        context = NULL;
+    }
+
+    g_free(cached);
+    g_free(cache_key);
+    g_free(content);
+    m_extraction_free(extraction);
+    m_proofreader_context_free(context);
+}
+
+/*
+ * m_proofreader_prefetch:
+ *
+ * Proofread the whole message in the background into the response cache.
+ */
+void
+m_proofreader_prefetch(EContentEditor *cnt_editor,
+                       const gchar *prompt_id,
+                       JsonArray *prompts,
+                       GHashTable *backends,
+                       const gchar *model,
+                       EMsgComposer *composer,
+                       GCancellable *cancellable)
+{
+    MProofreadContext *context;
+    MChatGPTPrompt prompt;
+    JsonObject *prompt_obj;
+    MBackend *backend;
+
+    g_return_if_fail(cnt_editor != NULL);
+    g_return_if_fail(prompt_id != NULL);
+    g_return_if_fail(prompts != NULL);
+    g_return_if_fail(backends != NULL);
+
+    /* A conversation would continue from a response the user never saw */
+    if (!m_chatgpt_prompt_lookup(prompts, prompt_id, &prompt) || prompt.conversation)
+        return;
+
+    prompt_obj = m_chatgpt_find_prompt(prompts, prompt_id);
+    backend = m_backends_lookup(
+        backends, json_object_get_string_member_with_default(prompt_obj, "backend", NULL));
+    if (!m_backend_is_usable(backend))
+        return;
+
+    context = m_proofreader_context_new(cnt_editor, prompt_id, prompts, backend, model, composer);
+    if (cancellable)
+    {
+        g_object_unref(context->cancellable);
+        context->cancellable = g_object_ref(cancellable);
+    }
+
+    e_content_editor_get_content(
+        cnt_editor,
+        E_CONTENT_EDITOR_GET_TO_SEND_PLAIN,
+        NULL,
+        context->cancellable,
+        proofreader_prefetch_content_ready_cb,
+        context);
+}
+
 /*
  * m_proofreader_start:
  *
@@ -362,26 +1560,44 @@ m_proofreader_content_ready_cb(GObject *source_object,
 void m_proofreader_start(EContentEditor *cnt_editor,
                          const gchar *prompt_id,
                          JsonArray *prompts,
-                         const gchar *api_key,
+                         GHashTable *backends,
                          const gchar *model,
                          EMsgComposer *composer)
 {
     MProofreadContext *context;
+    JsonObject *prompt;
+    MBackend *backend;
+    MConfig *config;
+    gboolean has_selection = FALSE;
 
     g_return_if_fail(cnt_editor != NULL);
     g_return_if_fail(prompt_id != NULL);
     g_return_if_fail(prompts != NULL);
-    g_return_if_fail(api_key != NULL);
+    g_return_if_fail(backends != NULL);
 
-    context = m_proofreader_context_new(cnt_editor, prompt_id, prompts, api_key, model, composer);
+    prompt = m_chatgpt_find_prompt(prompts, prompt_id);
+    backend = m_backends_lookup(
+        backends,
+        prompt ? json_object_get_string_member_with_default(prompt, "backend", NULL) : NULL);
+    context = m_proofreader_context_new(cnt_editor, prompt_id, prompts, backend, model, composer);
 
-    g_debug("Starting proofreading for prompt: %s with model: %s", prompt_id, model);
+    config = m_config_get();
+    context->hedge = m_hedge_policy_new(config, prompt, backend);
+    m_config_unref(config);
 
-    e_content_editor_get_content(
-        cnt_editor,
-        E_CONTENT_EDITOR_GET_TO_SEND_PLAIN,
-        NULL,
-        NULL,
-        m_proofreader_content_ready_cb,
-        context);
+    g_debug("Starting proofreading for prompt: %s with model: %s on %s",
+            prompt_id, context->model, backend->name);
+
+    g_object_get(cnt_editor, "can-copy", &has_selection, NULL);
+
+    if (has_selection && composer)
+    {
+        GtkClipboard *clipboard = gtk_clipboard_get_for_display(
+            gtk_widget_get_display(GTK_WIDGET(composer)), GDK_SELECTION_PRIMARY);
+
+        gtk_clipboard_request_text(clipboard, proofreader_selection_received_cb, context);
+        return;
+    }
+
+    proofreader_request_content(context);
 }
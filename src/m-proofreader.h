@@ -15,6 +15,10 @@
 #include <json-glib/json-glib.h>
 #include <composer/e-msg-composer.h>
 
+#include "m-backend.h"
+#include "m-hedge.h"
+#include "m-jobs.h"
+
 G_BEGIN_DECLS
 
 /**
@@ -22,11 +26,30 @@ G_BEGIN_DECLS
  * @cnt_editor: The content editor to proofread
  * @prompt_id: The prompt identifier to use
  * @prompts: Array of available prompts
- * @api_key: The API key for the proofreading service
+ * @backend: The server the prompt runs on
  * @model: The AI model to use
- * @composer: The message composer (for error alerts)
+ * @hedge: (nullable): The hedging policy of the prompt, NULL to not hedge
+ * @composer: (nullable): The message composer (for error alerts), NULL once destroyed
+ * @job: (nullable): The background job tracking the request, NULL until
+ *       the request is sent
+ * @cancellable: Cancelled from the job status or when the composer is destroyed
+ * @composer_destroy_id: Handler of the composer "destroy" signal
+ * @selection: (nullable): The selected text, NULL to work on the whole body
+ * @range: (nullable): The text the result replaces, the selection or the
+ *         text sent from the whole message; NULL until the body is read,
+ *         or if quoted history interrupts the text
+ * @estimated_tokens: Estimated input tokens of the request, 0 until the
+ *                    content is known
+ * @model_hint: (nullable): A faster model to suggest in the job status
  *
  * Context structure passed through async proofreading operations.
+ * @prompt_id, @prompts, @backend, @model and @hedge are a snapshot taken when the
+ * proofread starts: the strings are copied and @prompts belongs to an
+ * immutable configuration snapshot, so later model switches or
+ * configuration reloads do not affect a request in flight. Only @model
+ * may still change to the "small_model" of the prompt, or to the fastest
+ * model of the latency history, once the size of the content is known.
+ * Once the composer is destroyed, @cnt_editor and @composer are NULL.
  */
 typedef struct _MProofreadContext MProofreadContext;
 
@@ -35,11 +58,17 @@ struct _MProofreadContext
     EContentEditor *cnt_editor;
     gchar *prompt_id;
     JsonArray *prompts;
-    gchar *api_key;
+    MBackend *backend;
     gchar *model;
+    MHedgePolicy *hedge;
     EMsgComposer *composer;
-    GtkWidget *wait_dialog;
-    guint wait_timeout_id;
+    MJob *job;
+    GCancellable *cancellable;
+    gulong composer_destroy_id;
+    gchar *selection;
+    gchar *range;
+    guint estimated_tokens;
+    gchar *model_hint;
 };
 
 /**
@@ -47,8 +76,8 @@ struct _MProofreadContext
  * @cnt_editor: The content editor
  * @prompt_id: The prompt identifier (will be copied)
  * @prompts: The prompts array (will be referenced)
- * @api_key: The API key (will be copied)
- * @model: The AI model to use (will be copied)
+ * @backend: The backend to use (will be referenced)
+ * @model: The selected AI model, used unless the prompt or @backend sets one (will be copied)
  * @composer: The message composer
  *
  * Create a new proofreading context.
@@ -58,7 +87,7 @@ struct _MProofreadContext
 MProofreadContext *m_proofreader_context_new(EContentEditor *cnt_editor,
                                              const gchar *prompt_id,
                                              JsonArray *prompts,
-                                             const gchar *api_key,
+                                             MBackend *backend,
                                              const gchar *model,
                                              EMsgComposer *composer);
 
@@ -88,20 +117,46 @@ void m_proofreader_content_ready_cb(GObject *source_object,
  * @cnt_editor: The content editor
  * @prompt_id: The prompt identifier
  * @prompts: The prompts array
- * @api_key: The API key
- * @model: The AI model to use
+ * @backends: The configured backends, the prompt's "backend" is used
+ * @model: The selected AI model
  * @composer: The message composer
  *
  * Start the proofreading process by requesting editor content.
- * The content will be processed asynchronously.
+ * If text is selected, only the selection is proofread. The content
+ * will be processed asynchronously as a background job: the composer
+ * stays usable and several proofreads may run at once.
  */
 void m_proofreader_start(EContentEditor *cnt_editor,
                          const gchar *prompt_id,
                          JsonArray *prompts,
-                         const gchar *api_key,
+                         GHashTable *backends,
                          const gchar *model,
                          EMsgComposer *composer);
 
+/**
+ * m_proofreader_prefetch:
+ * @cnt_editor: The content editor
+ * @prompt_id: The prompt identifier
+ * @prompts: The prompts array
+ * @backends: The configured backends, the prompt's "backend" is used
+ * @model: The selected AI model
+ * @composer: The message composer
+ * @cancellable: (nullable): A #GCancellable to abort the request
+ *
+ * Run @prompt_id on the whole message at background priority and store
+ * the result in the response cache, so that running the prompt on the
+ * unchanged text later inserts it at once. Nothing is sent if the cache
+ * already knows the text, the prompt is a conversation or its backend
+ * has no API key. Nothing is shown, failures are only logged.
+ */
+void m_proofreader_prefetch(EContentEditor *cnt_editor,
+                            const gchar *prompt_id,
+                            JsonArray *prompts,
+                            GHashTable *backends,
+                            const gchar *model,
+                            EMsgComposer *composer,
+                            GCancellable *cancellable);
+
 G_END_DECLS
 
 #endif /* M_PROOFREADER_H */
@@ -0,0 +1,399 @@
+/*
+ * m-response-cache.c - Response cache for AI Proofread Plugin
+ *
+ * Implements the in-memory LRU and the on-disk store. Disk entries are
+ * plain files named by their key; their modification time is refreshed
+ * on every hit so that eviction removes the least recently used ones.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <evolution/e-util/e-util.h>
+
+#include "m-response-cache.h"
+#include "m-config.h"
+
+typedef struct
+{
+    gchar *key;
+    gchar *response;
+} CacheEntry;
+
+typedef struct
+{
+    gboolean enabled;
+    guint memory_entries;
+    gboolean disk;
+    goffset disk_max_bytes;
+} CacheSettings;
+
+static GMutex cache_lock;
+static GHashTable *cache_index = NULL; /* key -> GList link in cache_lru */
+static GQueue cache_lru = G_QUEUE_INIT; /* Most recently used first */
+static goffset disk_usage = -1;         /* Bytes on disk, -1 until scanned */
+static guint stat_memory_hits = 0;
+static guint stat_disk_hits = 0;
+static guint stat_misses = 0;
+
+static void
+cache_entry_free(CacheEntry *entry)
+{
+    g_free(entry->key);
+    g_free(entry->response);
+    g_free(entry);
+}
+
+/*
+ * get_cache_settings:
+ *
+ * Read the "cache" section of config.json.
+ */
+static CacheSettings
+get_cache_settings(void)
+{
+    MConfig *config = m_config_get();
+    JsonObject *section = m_config_get_section(config, "cache");
+    CacheSettings settings = {
+        TRUE,
+        M_RESPONSE_CACHE_DEFAULT_MEMORY_ENTRIES,
+        TRUE,
+        (goffset)M_RESPONSE_CACHE_DEFAULT_DISK_MAX_KB * 1024};
+
+    if (section)
+    {
+        settings.enabled = json_object_get_boolean_member_with_default(
+            section, "enabled", settings.enabled);
+        settings.memory_entries = (guint)json_object_get_int_member_with_default(
+            section, "memory_entries", settings.memory_entries);
+        settings.disk = json_object_get_boolean_member_with_default(
+            section, "disk", settings.disk);
+        settings.disk_max_bytes = json_object_get_int_member_with_default(
+            section, "disk_max_kb", settings.disk_max_bytes / 1024) * 1024;
+    }
+
+    m_config_unref(config);
+    return settings;
+}
+
+/*
+ * get_disk_cache_dir:
+ *
+ * Returns: (transfer full): The directory of the on-disk store
+ */
+static gchar *
+get_disk_cache_dir(void)
+{
+    return g_build_filename(e_get_user_cache_dir(), "ai-proofread", "responses", NULL);
+}
+
+static void
+log_stats(const gchar *outcome)
+{
+    g_debug("Response cache %s (memory hits: %u, disk hits: %u, misses: %u)",
+            outcome, stat_memory_hits, stat_disk_hits, stat_misses);
+}
+
+/*
+ * memory_insert:
+ *
+ * Insert or refresh an entry at the head of the LRU and evict from the
+ * tail. An existing entry takes the new response. Called with cache_lock
+ * held.
+ */
+static void
+memory_insert(const gchar *key, const gchar *response, guint max_entries)
+{
+    GList *link;
+    CacheEntry *entry;
+
+    if (!cache_index)
+        cache_index = g_hash_table_new(g_str_hash, g_str_equal);
+
+    link = g_hash_table_lookup(cache_index, key);
+    if (link)
+    {
+        entry = link->data;
+        if (g_strcmp0(entry->response, response) != 0)
+        {
+            g_free(entry->response);
+            entry->response = g_strdup(response);
+        }
+
+        g_queue_unlink(&cache_lru, link);
+        g_queue_push_head_link(&cache_lru, link);
+        return;
+    }
+
+    entry = g_new0(CacheEntry, 1);
+    entry->key = g_strdup(key);
+    entry->response = g_strdup(response);
+    g_queue_push_head(&cache_lru, entry);
+    g_hash_table_insert(cache_index, entry->key, cache_lru.head);
+
+    while (cache_lru.length > max_entries)
+    {
+        CacheEntry *old = g_queue_pop_tail(&cache_lru);
+        g_hash_table_remove(cache_index, old->key);
+        cache_entry_free(old);
+    }
+}
+
+/*
+ * memory_lookup:
+ *
+ * Called with cache_lock held.
+ * Returns: (transfer full) (nullable): The response, or NULL
+ */
+static gchar *
+memory_lookup(const gchar *key)
+{
+    GList *link;
+
+    if (!cache_index)
+        return NULL;
+
+    link = g_hash_table_lookup(cache_index, key);
+    if (!link)
+        return NULL;
+
+    g_queue_unlink(&cache_lru, link);
+    g_queue_push_head_link(&cache_lru, link);
+
+    return g_strdup(((CacheEntry *)link->data)->response);
+}
+
+typedef struct
+{
+    gchar *path;
+    gint64 mtime;
+    goffset size;
+} DiskEntry;
+
+static gint
+compare_disk_entries(gconstpointer a, gconstpointer b)
+{
+    const DiskEntry *ea = a;
+    const DiskEntry *eb = b;
+
+    return (ea->mtime > eb->mtime) - (ea->mtime < eb->mtime);
+}
+
+/*
+ * disk_scan:
+ * @dir: The store directory
+ * @out_usage: (out): Total size of the stored entries
+ *
+ * Returns: (transfer full): Array of DiskEntry, oldest first
+ */
+static GArray *
+disk_scan(const gchar *dir, goffset *out_usage)
+{
+    GArray *entries = g_array_new(FALSE, FALSE, sizeof(DiskEntry));
+    GDir *handle = g_dir_open(dir, 0, NULL);
+    const gchar *name;
+
+    *out_usage = 0;
+
+    while (handle && (name = g_dir_read_name(handle)) != NULL)
+    {
+        DiskEntry entry;
+        GStatBuf st;
+
+        entry.path = g_build_filename(dir, name, NULL);
+        if (g_stat(entry.path, &st) != 0)
+        {
+            g_free(entry.path);
+            continue;
+        }
+
+        entry.mtime = st.st_mtime;
+        entry.size = st.st_size;
+        *out_usage += entry.size;
+        g_array_append_val(entries, entry);
+    }
+
+    if (handle)
+        g_dir_close(handle);
+
+    g_array_sort(entries, compare_disk_entries);
+    return entries;
+}
+
+/*
+ * disk_evict:
+ *
+ * Remove the least recently used files until the store is below 80% of
+ * its limit. Called with cache_lock held.
+ */
+static void
+disk_evict(const gchar *dir, goffset max_bytes)
+{
+    GArray *entries = disk_scan(dir, &disk_usage);
+    guint removed = 0;
+
+    for (guint i = 0; i < entries->len; i++)
+    {
+        DiskEntry *entry = &g_array_index(entries, DiskEntry, i);
+
+        if (disk_usage > max_bytes * 4 / 5 && g_unlink(entry->path) == 0)
+        {
+            disk_usage -= entry->size;
+            removed++;
+        }
+        g_free(entry->path);
+    }
+
+    g_array_free(entries, TRUE);
+
+    if (removed > 0)
+        g_debug("Response cache evicted %u files from disk", removed);
+}
+
+/*
+ * m_response_cache_key:
+ */
+gchar *
+m_response_cache_key(const gchar *content,
+                     const gchar *prompt_text,
+                     const gchar *backend_url,
+                     const gchar *model)
+{
+    const gchar *fields[] = {backend_url, model, prompt_text, content};
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    gchar *key;
+
+    /* Length-prefix every field so that no two requests share a key */
+    for (guint i = 0; i < G_N_ELEMENTS(fields); i++)
+    {
+        const gchar *field = fields[i] ? fields[i] : "";
+        guint64 length = GUINT64_TO_LE(strlen(field));
+
+        g_checksum_update(checksum, (const guchar *)&length, sizeof(length));
+        g_checksum_update(checksum, (const guchar *)field, strlen(field));
+    }
+
+    key = g_strdup(g_checksum_get_string(checksum));
+    g_checksum_free(checksum);
+
+    return key;
+}
+
+/*
+ * m_response_cache_lookup:
+ */
+gchar *
+m_response_cache_lookup(const gchar *key)
+{
+    CacheSettings settings = get_cache_settings();
+    gchar *response;
+
+    g_return_val_if_fail(key != NULL, NULL);
+
+    if (!settings.enabled)
+        return NULL;
+
+    g_mutex_lock(&cache_lock);
+
+    response = memory_lookup(key);
+    if (response)
+    {
+        stat_memory_hits++;
+        log_stats("hit (memory)");
+        g_mutex_unlock(&cache_lock);
+        return response;
+    }
+
+    if (settings.disk)
+    {
+        gchar *dir = get_disk_cache_dir();
+        gchar *path = g_build_filename(dir, key, NULL);
+
+        if (g_file_get_contents(path, &response, NULL, NULL))
+        {
+            /* Mark as recently used for eviction */
+            g_utime(path, NULL);
+            memory_insert(key, response, settings.memory_entries);
+            stat_disk_hits++;
+            log_stats("hit (disk)");
+        }
+
+        g_free(path);
+        g_free(dir);
+    }
+
+    if (!response)
+    {
+        stat_misses++;
+        log_stats("miss");
+    }
+
+    g_mutex_unlock(&cache_lock);
+
+    return response;
+}
+
+/*
+ * m_response_cache_store:
+ */
+void
+m_response_cache_store(const gchar *key, const gchar *response)
+{
+    CacheSettings settings = get_cache_settings();
+
+    g_return_if_fail(key != NULL);
+    g_return_if_fail(response != NULL);
+
+    if (!settings.enabled)
+        return;
+
+    g_mutex_lock(&cache_lock);
+
+    memory_insert(key, response, settings.memory_entries);
+
+    if (settings.disk)
+    {
+        gchar *dir = get_disk_cache_dir();
+        gchar *path = g_build_filename(dir, key, NULL);
+        gsize length = strlen(response);
+        goffset replaced = 0;
+        GStatBuf st;
+        GError *error = NULL;
+
+        /* A rewritten entry no longer takes up its old size */
+        if (g_stat(path, &st) == 0)
+            replaced = st.st_size;
+
+        if (g_mkdir_with_parents(dir, 0700) != 0)
+        {
+            g_warning("Failed to create cache directory: %s", dir);
+        }
+        else if (!g_file_set_contents(path, response, length, &error))
+        {
+            g_warning("Failed to store cached response: %s", error->message);
+            g_error_free(error);
+        }
+        else
+        {
+            if (disk_usage < 0)
+            {
+                GArray *entries = disk_scan(dir, &disk_usage);
+                for (guint i = 0; i < entries->len; i++)
+                    g_free(g_array_index(entries, DiskEntry, i).path);
+                g_array_free(entries, TRUE);
+            }
+            else
+            {
+                disk_usage += (goffset)length - replaced;
+            }
+
+            if (disk_usage > settings.disk_max_bytes)
+                disk_evict(dir, settings.disk_max_bytes);
+        }
+
+        g_free(path);
+        g_free(dir);
+    }
+
+    g_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,76 @@
+/*
+ * m-response-cache.h - Response cache for AI Proofread Plugin
+ *
+ * This module avoids repeated round trips for identical requests:
+ * - Content-addressed keys over (content, prompt text, model)
+ * - A bounded in-memory LRU
+ * - An optional size-limited store under the user cache directory
+ *
+ * The cache is configured by the "cache" object in config.json:
+ *
+ *   "cache": { "enabled": true, "memory_entries": 64,
+ *              "disk": true, "disk_max_kb": 16384 }
+ */
+
+#ifndef M_RESPONSE_CACHE_H
+#define M_RESPONSE_CACHE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * M_RESPONSE_CACHE_DEFAULT_MEMORY_ENTRIES:
+ *
+ * Default number of responses kept in memory.
+ */
+#define M_RESPONSE_CACHE_DEFAULT_MEMORY_ENTRIES 64
+
+/**
+ * M_RESPONSE_CACHE_DEFAULT_DISK_MAX_KB:
+ *
+ * Default size limit of the on-disk store in KiB.
+ */
+#define M_RESPONSE_CACHE_DEFAULT_DISK_MAX_KB (16 * 1024)
+
+/**
+ * m_response_cache_key:
+ * @content: The text sent for proofreading
+ * @prompt_text: The resolved prompt text
+ * @backend_url: The base URL of the backend the request goes to
+ * @model: The model the request is sent with
+ *
+ * Compute the cache key of a request.
+ *
+ * Returns: (transfer full): A hex digest. The caller must free it.
+ */
+gchar *m_response_cache_key(const gchar *content,
+                            const gchar *prompt_text,
+                            const gchar *backend_url,
+                            const gchar *model);
+
+/**
+ * m_response_cache_lookup:
+ * @key: A key from m_response_cache_key()
+ *
+ * Look up a cached response, first in memory and then on disk.
+ * Safe to call from any thread.
+ *
+ * Returns: (transfer full) (nullable): The cached response, or NULL on a miss
+ */
+gchar *m_response_cache_lookup(const gchar *key);
+
+/**
+ * m_response_cache_store:
+ * @key: A key from m_response_cache_key()
+ * @response: The response text
+ *
+ * Store a response in memory and, if enabled, on disk. Least recently
+ * used entries are evicted to stay within the configured limits.
+ * Safe to call from any thread.
+ */
+void m_response_cache_store(const gchar *key, const gchar *response);
+
+G_END_DECLS
+
+#endif /* M_RESPONSE_CACHE_H */
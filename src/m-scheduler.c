@@ -0,0 +1,713 @@
+/*
+ * m-scheduler.c - Request scheduling for AI Proofread Plugin
+ *
+ * Implements admission of requests to a bounded number of slots and the
+ * retry policy for rate limited and failed requests.
+ */
+
+#include <string.h>
+#include <gio/gio.h>
+#include <libsoup/soup.h>
+
+#include "m-scheduler.h"
+#include "m-config.h"
+
+#define SCHEDULER_BACKOFF_BASE_US (500 * G_TIME_SPAN_MILLISECOND)
+#define SCHEDULER_BACKOFF_MAX_US (30 * G_TIME_SPAN_SECOND)
+#define SCHEDULER_RETRY_AFTER_MAX_US (60 * G_TIME_SPAN_SECOND)
+#define SCHEDULER_JITTER_US (250 * G_TIME_SPAN_MILLISECOND)
+
+/*
+ * Waiter:
+ *
+ * A request waiting for a slot. Blocking waiters poll the queue when
+ * woken; asynchronous waiters have a @task and are admitted by
+ * admit_async_waiters() on behalf of them.
+ */
+typedef struct
+{
+    MSchedulerPriority priority;
+    GTask *task;
+    GSource *cancel_source;
+} Waiter;
+
+/* All fields are guarded by scheduler_lock */
+static GMutex scheduler_lock;
+static GCond scheduler_cond;
+static guint in_flight = 0;
+static GQueue waiters[M_SCHEDULER_N_PRIORITIES];
+static gint64 paused_until_us = 0;
+static GSource *pause_source = NULL;
+static guint override_max_in_flight = 0;
+static guint override_max_retries = 0;
+
+static void wake_waiters(void);
+
+/*
+ * get_settings:
+ *
+ * Read the limits from the "scheduler" section of config.json.
+ */
+static void
+get_settings(guint *max_in_flight, guint *max_retries)
+{
+    MConfig *config = m_config_get();
+    JsonObject *section = m_config_get_section(config, "scheduler");
+
+    *max_in_flight = M_SCHEDULER_DEFAULT_MAX_IN_FLIGHT;
+    *max_retries = M_SCHEDULER_DEFAULT_MAX_RETRIES;
+
+    if (section)
+    {
+        *max_in_flight = json_object_get_int_member_with_default(section, "max_in_flight", *max_in_flight);
+        *max_retries = json_object_get_int_member_with_default(section, "max_retries", *max_retries);
+    }
+
+    m_config_unref(config);
+
+    g_mutex_lock(&scheduler_lock);
+    if (override_max_in_flight)
+        *max_in_flight = override_max_in_flight;
+    if (override_max_retries)
+        *max_retries = override_max_retries;
+    g_mutex_unlock(&scheduler_lock);
+
+    *max_in_flight = MAX(*max_in_flight, 1);
+}
+
+/*
+ * m_scheduler_set_limits:
+ */
+void
+m_scheduler_set_limits(guint max_in_flight, guint max_retries)
+{
+    g_mutex_lock(&scheduler_lock);
+    override_max_in_flight = max_in_flight;
+    override_max_retries = max_retries;
+    g_mutex_unlock(&scheduler_lock);
+
+    wake_waiters();
+}
+
+/*
+ * peek_next:
+ *
+ * The next waiter is the oldest of the highest priority waiting.
+ */
+static Waiter *
+peek_next(void)
+{
+    for (guint i = 0; i < M_SCHEDULER_N_PRIORITIES; i++)
+    {
+        if (!g_queue_is_empty(&waiters[i]))
+            return g_queue_peek_head(&waiters[i]);
+    }
+
+    return NULL;
+}
+
+static gboolean admit_after_pause_cb(gpointer user_data);
+
+/*
+ * admit_async_waiters:
+ * @max_in_flight: The slot limit
+ *
+ * Take slots for asynchronous waiters at the head of the queue. Must be
+ * called with scheduler_lock held; the admitted tasks are returned so
+ * the caller can complete them with complete_admitted() once the lock
+ * is released.
+ *
+ * Returns: (transfer full): The admitted tasks
+ */
+static GSList *
+admit_async_waiters(guint max_in_flight)
+{
+    GSList *admitted = NULL;
+    Waiter *waiter;
+
+    while ((waiter = peek_next()) && waiter->task && in_flight < max_in_flight)
+    {
+        gint64 now = g_get_monotonic_time();
+
+        if (now < paused_until_us)
+        {
+            /* Nobody polls for the end of the pause on their behalf */
+            if (!pause_source)
+            {
+                pause_source = g_timeout_source_new((paused_until_us - now) / G_TIME_SPAN_MILLISECOND + 1);
+                g_source_set_callback(pause_source, admit_after_pause_cb, NULL, NULL);
+                g_source_attach(pause_source, g_task_get_context(waiter->task));
+            }
+            break;
+        }
+
+        g_queue_pop_head(&waiters[waiter->priority]);
+        in_flight++;
+        admitted = g_slist_prepend(admitted, waiter->task);
+    }
+
+    /* Blocking waiters check for themselves */
+    g_cond_broadcast(&scheduler_cond);
+
+    return g_slist_reverse(admitted);
+}
+
+static void
+complete_admitted(GSList *admitted)
+{
+    for (GSList *l = admitted; l; l = l->next)
+    {
+        g_task_return_boolean(l->data, TRUE);
+        g_object_unref(l->data);
+    }
+    g_slist_free(admitted);
+}
+
+/*
+ * wake_waiters:
+ *
+ * Let waiters re-check for a slot after the state changed.
+ */
+static void
+wake_waiters(void)
+{
+    guint max_in_flight;
+    guint max_retries;
+    GSList *admitted;
+
+    get_settings(&max_in_flight, &max_retries);
+
+    g_mutex_lock(&scheduler_lock);
+    admitted = admit_async_waiters(max_in_flight);
+    g_mutex_unlock(&scheduler_lock);
+
+    complete_admitted(admitted);
+}
+
+static gboolean
+admit_after_pause_cb(gpointer user_data)
+{
+    g_mutex_lock(&scheduler_lock);
+    g_clear_pointer(&pause_source, g_source_unref);
+    g_mutex_unlock(&scheduler_lock);
+
+    wake_waiters();
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+scheduler_cancelled_cb(GCancellable *cancellable, gpointer user_data)
+{
+    g_mutex_lock(&scheduler_lock);
+    g_cond_broadcast(&scheduler_cond);
+    g_mutex_unlock(&scheduler_lock);
+}
+
+/*
+ * is_next:
+ *
+ * A waiter is next if it is the oldest of its priority and no request
+ * of a higher priority is waiting.
+ */
+static gboolean
+is_next(Waiter *waiter)
+{
+    return peek_next() == waiter;
+}
+
+/*
+ * m_scheduler_acquire:
+ */
+gboolean
+m_scheduler_acquire(MSchedulerPriority priority,
+                    GCancellable *cancellable,
+                    GError **error)
+{
+    guint max_in_flight;
+    guint max_retries;
+    gulong handler_id = 0;
+    gboolean acquired = FALSE;
+    Waiter waiter = { priority, NULL, NULL };
+    GSList *admitted;
+
+    g_return_val_if_fail(priority < M_SCHEDULER_N_PRIORITIES, FALSE);
+
+    get_settings(&max_in_flight, &max_retries);
+
+    if (cancellable)
+        handler_id = g_cancellable_connect(cancellable, G_CALLBACK(scheduler_cancelled_cb), NULL, NULL);
+
+    g_mutex_lock(&scheduler_lock);
+    g_queue_push_tail(&waiters[priority], &waiter);
+
+    while (!g_cancellable_is_cancelled(cancellable))
+    {
+        gint64 now = g_get_monotonic_time();
+
+        if (now < paused_until_us)
+        {
+            g_cond_wait_until(&scheduler_cond, &scheduler_lock, paused_until_us);
+            continue;
+        }
+
+        if (in_flight < max_in_flight && is_next(&waiter))
+        {
+            acquired = TRUE;
+            break;
+        }
+
+        g_cond_wait(&scheduler_cond, &scheduler_lock);
+    }
+
+    g_queue_remove(&waiters[priority], &waiter);
+    if (acquired)
+        in_flight++;
+
+    /* The next waiter may be able to go now */
+    admitted = admit_async_waiters(max_in_flight);
+    g_mutex_unlock(&scheduler_lock);
+
+    complete_admitted(admitted);
+
+    if (handler_id)
+        g_cancellable_disconnect(cancellable, handler_id);
+
+    if (!acquired)
+        g_cancellable_set_error_if_cancelled(cancellable, error);
+
+    return acquired;
+}
+
+static void
+waiter_free(Waiter *waiter)
+{
+    if (waiter->cancel_source)
+    {
+        g_source_destroy(waiter->cancel_source);
+        g_source_unref(waiter->cancel_source);
+    }
+    g_free(waiter);
+}
+
+/*
+ * acquire_cancelled_cb:
+ *
+ * Runs in the context of the task. If the waiter is still queued it is
+ * withdrawn; otherwise it was admitted already and completes as such.
+ */
+static gboolean
+acquire_cancelled_cb(GCancellable *cancellable, gpointer user_data)
+{
+    GTask *task = user_data;
+    Waiter *waiter = g_task_get_task_data(task);
+    gboolean withdrawn;
+
+    g_mutex_lock(&scheduler_lock);
+    withdrawn = g_queue_remove(&waiters[waiter->priority], waiter);
+    g_mutex_unlock(&scheduler_lock);
+
+    if (withdrawn)
+    {
+        g_task_return_error_if_cancelled(task);
+        g_object_unref(task);
+
+        /* The waiters behind it may be able to go now */
+        wake_waiters();
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * m_scheduler_acquire_async:
+ */
+void
+m_scheduler_acquire_async(MSchedulerPriority priority,
+                          GCancellable *cancellable,
+                          GAsyncReadyCallback callback,
+                          gpointer user_data)
+{
+    Waiter *waiter;
+    GTask *task;
+
+    g_return_if_fail(priority < M_SCHEDULER_N_PRIORITIES);
+
+    task = g_task_new(NULL, cancellable, callback, user_data);
+    g_task_set_source_tag(task, m_scheduler_acquire_async);
+    /* An admitted waiter holds a slot, which must not get lost to a
+     * late cancellation */
+    g_task_set_check_cancellable(task, FALSE);
+
+    if (g_task_return_error_if_cancelled(task))
+    {
+        g_object_unref(task);
+        return;
+    }
+
+    waiter = g_new0(Waiter, 1);
+    waiter->priority = priority;
+    waiter->task = task;
+    g_task_set_task_data(task, waiter, (GDestroyNotify)waiter_free);
+
+    if (cancellable)
+    {
+        waiter->cancel_source = g_cancellable_source_new(cancellable);
+        g_source_set_callback(waiter->cancel_source, G_SOURCE_FUNC(acquire_cancelled_cb), task, NULL);
+        g_source_attach(waiter->cancel_source, g_task_get_context(task));
+    }
+
+    /* The queue holds the task reference until the waiter leaves it */
+    g_mutex_lock(&scheduler_lock);
+    g_queue_push_tail(&waiters[priority], waiter);
+    g_mutex_unlock(&scheduler_lock);
+
+    wake_waiters();
+}
+
+/*
+ * m_scheduler_acquire_finish:
+ */
+gboolean
+m_scheduler_acquire_finish(GAsyncResult *result, GError **error)
+{
+    g_return_val_if_fail(g_task_is_valid(result, NULL), FALSE);
+
+    return g_task_propagate_boolean(G_TASK(result), error);
+}
+
+/*
+ * m_scheduler_release:
+ */
+void
+m_scheduler_release(void)
+{
+    g_mutex_lock(&scheduler_lock);
+    g_warn_if_fail(in_flight > 0);
+    if (in_flight > 0)
+        in_flight--;
+    g_mutex_unlock(&scheduler_lock);
+
+    wake_waiters();
+}
+
+/*
+ * parse_reset_duration:
+ * @value: A duration such as "1s", "6m0s", "1.5s" or "20ms"
+ *
+ * Returns: The duration in microseconds, or -1 if @value is invalid
+ */
+static gint64
+parse_reset_duration(const gchar *value)
+{
+    const gchar *p = value;
+    gdouble total_us = 0;
+
+    if (!value || !*value)
+        return -1;
+
+    while (*p)
+    {
+        gchar *end;
+        gdouble number = g_ascii_strtod(p, &end);
+
+        if (end == p)
+            return -1;
+        p = end;
+
+        if (g_str_has_prefix(p, "ms"))
+        {
+            total_us += number * G_TIME_SPAN_MILLISECOND;
+            p += 2;
+        }
+        else if (*p == 's')
+        {
+            total_us += number * G_TIME_SPAN_SECOND;
+            p++;
+        }
+        else if (*p == 'm')
+        {
+            total_us += number * G_TIME_SPAN_MINUTE;
+            p++;
+        }
+        else if (*p == 'h')
+        {
+            total_us += number * G_TIME_SPAN_HOUR;
+            p++;
+        }
+        else
+        {
+            return -1;
+        }
+    }
+
+    return (gint64)total_us;
+}
+
+/*
+ * parse_retry_after:
+ * @headers: The response headers
+ *
+ * Returns: The delay requested by "retry-after-ms" or "Retry-After"
+ *          (seconds or an HTTP date) in microseconds, or -1 if none
+ */
+static gint64
+parse_retry_after(SoupMessageHeaders *headers)
+{
+    const gchar *value;
+
+    value = soup_message_headers_get_one(headers, "retry-after-ms");
+    if (value && g_ascii_isdigit(*value))
+        return g_ascii_strtoll(value, NULL, 10) * G_TIME_SPAN_MILLISECOND;
+
+    value = soup_message_headers_get_one(headers, "Retry-After");
+    if (!value)
+        return -1;
+
+    if (g_ascii_isdigit(*value))
+        return g_ascii_strtoll(value, NULL, 10) * G_TIME_SPAN_SECOND;
+
+    GDateTime *date = soup_date_time_new_from_http_string(value);
+    if (date)
+    {
+        GDateTime *now = g_date_time_new_now_utc();
+        gint64 delay = g_date_time_difference(date, now);
+
+        g_date_time_unref(now);
+        g_date_time_unref(date);
+        return MAX(delay, 0);
+    }
+
+    return -1;
+}
+
+/*
+ * get_exhausted_reset:
+ * @headers: The response headers
+ *
+ * Returns: The time until the request or token budget resets if it is
+ *          used up, in microseconds, or -1 if there is budget left
+ */
+static gint64
+get_exhausted_reset(SoupMessageHeaders *headers)
+{
+    static const gchar *const kinds[] = { "requests", "tokens" };
+    gint64 reset_us = -1;
+
+    for (guint i = 0; i < G_N_ELEMENTS(kinds); i++)
+    {
+        gchar *remaining_name = g_strconcat("x-ratelimit-remaining-", kinds[i], NULL);
+        gchar *reset_name = g_strconcat("x-ratelimit-reset-", kinds[i], NULL);
+        const gchar *remaining = soup_message_headers_get_one(headers, remaining_name);
+
+        if (remaining && g_ascii_strtoll(remaining, NULL, 10) <= 0)
+            reset_us = MAX(reset_us, parse_reset_duration(
+                soup_message_headers_get_one(headers, reset_name)));
+
+        g_free(remaining_name);
+        g_free(reset_name);
+    }
+
+    return reset_us;
+}
+
+/*
+ * pause_for:
+ *
+ * Hold back all requests for @delay_us, unless a longer pause is
+ * already in effect.
+ */
+static void
+pause_for(gint64 delay_us)
+{
+    gint64 until = g_get_monotonic_time() + MIN(delay_us, SCHEDULER_RETRY_AFTER_MAX_US);
+
+    g_mutex_lock(&scheduler_lock);
+    if (until > paused_until_us)
+    {
+        paused_until_us = until;
+        g_debug("Pausing requests for %" G_GINT64_FORMAT " ms", delay_us / G_TIME_SPAN_MILLISECOND);
+    }
+    g_mutex_unlock(&scheduler_lock);
+}
+
+static gboolean
+status_is_retryable(guint status)
+{
+    return status == SOUP_STATUS_TOO_MANY_REQUESTS ||
+           status == SOUP_STATUS_INTERNAL_SERVER_ERROR ||
+           status == SOUP_STATUS_BAD_GATEWAY ||
+           status == SOUP_STATUS_SERVICE_UNAVAILABLE ||
+           status == SOUP_STATUS_GATEWAY_TIMEOUT;
+}
+
+/*
+ * body_reports_quota:
+ *
+ * A 429 caused by an exhausted quota does not go away by waiting.
+ */
+static gboolean
+body_reports_quota(GBytes *body)
+{
+    gsize length;
+    const gchar *data;
+    gboolean found;
+    gchar *text;
+
+    if (!body)
+        return FALSE;
+
+    data = g_bytes_get_data(body, &length);
+    text = g_strndup(data, length);
+    found = strstr(text, "insufficient_quota") != NULL;
+    g_free(text);
+
+    return found;
+}
+
+/*
+ * m_scheduler_handle_response:
+ */
+gint64
+m_scheduler_handle_response(SoupMessage *msg, GBytes *body, guint attempt)
+{
+    SoupMessageHeaders *headers = soup_message_get_response_headers(msg);
+    guint status = soup_message_get_status(msg);
+    guint max_in_flight;
+    guint max_retries;
+    gint64 retry_after_us;
+    gint64 delay_us;
+
+    if (!headers || status == SOUP_STATUS_NONE)
+        return -1;
+
+    if (SOUP_STATUS_IS_SUCCESSFUL(status))
+    {
+        gint64 reset_us = get_exhausted_reset(headers);
+
+        if (reset_us > 0)
+            pause_for(reset_us);
+        return -1;
+    }
+
+    get_settings(&max_in_flight, &max_retries);
+
+    if (!status_is_retryable(status) || attempt >= max_retries)
+        return -1;
+
+    if (status == SOUP_STATUS_TOO_MANY_REQUESTS && body_reports_quota(body))
+        return -1;
+
+    /* Full exponential backoff, with jitter so that retries do not
+     * arrive in lockstep */
+    delay_us = MIN(SCHEDULER_BACKOFF_BASE_US << MIN(attempt, 10), SCHEDULER_BACKOFF_MAX_US);
+    delay_us = delay_us / 2 + g_random_int_range(0, (gint32)(delay_us / 2) + 1);
+
+    retry_after_us = parse_retry_after(headers);
+    if (retry_after_us < 0 && status == SOUP_STATUS_TOO_MANY_REQUESTS)
+        retry_after_us = get_exhausted_reset(headers);
+
+    if (retry_after_us >= 0)
+    {
+        delay_us = MIN(retry_after_us, SCHEDULER_RETRY_AFTER_MAX_US) +
+                   g_random_int_range(0, SCHEDULER_JITTER_US);
+        if (status == SOUP_STATUS_TOO_MANY_REQUESTS)
+            pause_for(delay_us);
+    }
+
+    g_debug("HTTP %u, retry %u of %u in %" G_GINT64_FORMAT " ms",
+            status, attempt + 1, max_retries, delay_us / G_TIME_SPAN_MILLISECOND);
+
+    return delay_us;
+}
+
+/*
+ * m_scheduler_sleep:
+ */
+gboolean
+m_scheduler_sleep(gint64 delay_us, GCancellable *cancellable, GError **error)
+{
+    gint64 deadline = g_get_monotonic_time() + delay_us;
+    gulong handler_id = 0;
+
+    if (cancellable)
+        handler_id = g_cancellable_connect(cancellable, G_CALLBACK(scheduler_cancelled_cb), NULL, NULL);
+
+    g_mutex_lock(&scheduler_lock);
+    while (!g_cancellable_is_cancelled(cancellable) && g_get_monotonic_time() < deadline)
+        g_cond_wait_until(&scheduler_cond, &scheduler_lock, deadline);
+    g_mutex_unlock(&scheduler_lock);
+
+    if (handler_id)
+        g_cancellable_disconnect(cancellable, handler_id);
+
+    return !g_cancellable_set_error_if_cancelled(cancellable, error);
+}
+
+static gboolean
+sleep_done_cb(gpointer user_data)
+{
+    GTask *task = user_data;
+    GSource **sources = g_task_get_task_data(task);
+
+    /* Whichever of the timeout and the cancellation comes first wins */
+    for (guint i = 0; i < 2; i++)
+        g_source_destroy(sources[i]);
+
+    if (!g_task_return_error_if_cancelled(task))
+        g_task_return_boolean(task, TRUE);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+sleep_cancelled_cb(GCancellable *cancellable, gpointer user_data)
+{
+    return sleep_done_cb(user_data);
+}
+
+static void
+sleep_sources_free(GSource **sources)
+{
+    for (guint i = 0; i < 2; i++)
+        g_source_unref(sources[i]);
+    g_free(sources);
+}
+
+/*
+ * m_scheduler_sleep_async:
+ */
+void
+m_scheduler_sleep_async(gint64 delay_us,
+                        GCancellable *cancellable,
+                        GAsyncReadyCallback callback,
+                        gpointer user_data)
+{
+    GTask *task = g_task_new(NULL, cancellable, callback, user_data);
+    GSource **sources = g_new0(GSource *, 2);
+
+    g_task_set_source_tag(task, m_scheduler_sleep_async);
+    g_task_set_task_data(task, sources, (GDestroyNotify)sleep_sources_free);
+
+    sources[0] = g_timeout_source_new(MAX(delay_us, 0) / G_TIME_SPAN_MILLISECOND);
+    sources[1] = g_cancellable_source_new(cancellable);
+
+    g_source_set_callback(sources[0], sleep_done_cb, g_object_ref(task), g_object_unref);
+    g_source_set_callback(sources[1], G_SOURCE_FUNC(sleep_cancelled_cb), g_object_ref(task), g_object_unref);
+
+    for (guint i = 0; i < 2; i++)
+        g_source_attach(sources[i], g_task_get_context(task));
+
+    g_object_unref(task);
+}
+
+/*
+ * m_scheduler_sleep_finish:
+ */
+gboolean
+m_scheduler_sleep_finish(GAsyncResult *result, GError **error)
+{
+    g_return_val_if_fail(g_task_is_valid(result, NULL), FALSE);
+
+    return g_task_propagate_boolean(G_TASK(result), error);
+}
@@ -0,0 +1,164 @@
+/*
+ * m-scheduler.h - Request scheduling for AI Proofread Plugin
+ *
+ * This module coordinates all requests to the API:
+ * - A process-wide cap on requests in flight
+ * - Interactive requests are admitted before background ones
+ * - Retry decisions for 429 and 5xx responses with jittered exponential
+ *   backoff, honouring Retry-After and the x-ratelimit-* headers
+ * - Blocking calls for worker threads and asynchronous ones for the
+ *   main context, sharing the same queue
+ *
+ * The scheduler is configured by the "scheduler" object in config.json:
+ *
+ *   "scheduler": { "max_in_flight": 4, "max_retries": 4 }
+ */
+
+#ifndef M_SCHEDULER_H
+#define M_SCHEDULER_H
+
+#include <gio/gio.h>
+#include <libsoup/soup.h>
+
+G_BEGIN_DECLS
+
+/**
+ * M_SCHEDULER_DEFAULT_MAX_IN_FLIGHT:
+ *
+ * Default number of requests running at once.
+ */
+#define M_SCHEDULER_DEFAULT_MAX_IN_FLIGHT 4
+
+/**
+ * M_SCHEDULER_DEFAULT_MAX_RETRIES:
+ *
+ * Default number of retries of a rate limited or failed request.
+ */
+#define M_SCHEDULER_DEFAULT_MAX_RETRIES 4
+
+/**
+ * MSchedulerPriority:
+ * @M_SCHEDULER_PRIORITY_INTERACTIVE: A request the user is waiting for
+ * @M_SCHEDULER_PRIORITY_BACKGROUND: Prefetching, model list refreshes
+ *
+ * Waiting interactive requests are always admitted first.
+ */
+typedef enum
+{
+    M_SCHEDULER_PRIORITY_INTERACTIVE,
+    M_SCHEDULER_PRIORITY_BACKGROUND,
+    M_SCHEDULER_N_PRIORITIES
+} MSchedulerPriority;
+
+/**
+ * m_scheduler_acquire:
+ * @priority: The priority of the request
+ * @cancellable: (nullable): A #GCancellable to stop waiting
+ * @error: Return location for error
+ *
+ * Block until the request may be sent: a slot is free, no rate limit
+ * pause is in effect and no request of higher priority is waiting.
+ * Every successful call must be paired with m_scheduler_release().
+ * Called from worker threads.
+ *
+ * Returns: TRUE if a slot was acquired, FALSE if cancelled
+ */
+gboolean m_scheduler_acquire(MSchedulerPriority priority,
+                             GCancellable *cancellable,
+                             GError **error);
+
+/**
+ * m_scheduler_acquire_async:
+ * @priority: The priority of the request
+ * @cancellable: (nullable): A #GCancellable to stop waiting
+ * @callback: Called in the thread-default main context once admitted
+ * @user_data: Data to pass to @callback
+ *
+ * Like m_scheduler_acquire(), without blocking: @callback runs once a
+ * slot is taken for the request or waiting was cancelled.
+ */
+void m_scheduler_acquire_async(MSchedulerPriority priority,
+                               GCancellable *cancellable,
+                               GAsyncReadyCallback callback,
+                               gpointer user_data);
+
+/**
+ * m_scheduler_acquire_finish:
+ * @result: The #GAsyncResult passed to the callback
+ * @error: Return location for error
+ *
+ * Returns: TRUE if a slot was acquired, which must be given back with
+ *          m_scheduler_release(); FALSE if cancelled
+ */
+gboolean m_scheduler_acquire_finish(GAsyncResult *result, GError **error);
+
+/**
+ * m_scheduler_release:
+ *
+ * Give back a slot acquired with m_scheduler_acquire().
+ */
+void m_scheduler_release(void);
+
+/**
+ * m_scheduler_handle_response:
+ * @msg: The sent message
+ * @body: (nullable): The response body, if already read
+ * @attempt: Number of retries done so far
+ *
+ * Record the rate limit state reported in the response headers and
+ * decide whether to retry. A 429 response pauses all requests until its
+ * Retry-After time.
+ *
+ * Returns: The delay before the next attempt in microseconds, or -1 if
+ *          the request must not be retried
+ */
+gint64 m_scheduler_handle_response(SoupMessage *msg, GBytes *body, guint attempt);
+
+/**
+ * m_scheduler_sleep:
+ * @delay_us: Time to wait in microseconds
+ * @cancellable: (nullable): A #GCancellable to stop waiting
+ * @error: Return location for error
+ *
+ * Wait before a retry.
+ *
+ * Returns: FALSE if cancelled
+ */
+gboolean m_scheduler_sleep(gint64 delay_us, GCancellable *cancellable, GError **error);
+
+/**
+ * m_scheduler_sleep_async:
+ * @delay_us: Time to wait in microseconds
+ * @cancellable: (nullable): A #GCancellable to stop waiting
+ * @callback: Called in the thread-default main context after the delay
+ * @user_data: Data to pass to @callback
+ *
+ * Wait before a retry without blocking.
+ */
+void m_scheduler_sleep_async(gint64 delay_us,
+                             GCancellable *cancellable,
+                             GAsyncReadyCallback callback,
+                             gpointer user_data);
+
+/**
+ * m_scheduler_sleep_finish:
+ * @result: The #GAsyncResult passed to the callback
+ * @error: Return location for error
+ *
+ * Returns: FALSE if cancelled
+ */
+gboolean m_scheduler_sleep_finish(GAsyncResult *result, GError **error);
+
+/**
+ * m_scheduler_set_limits:
+ * @max_in_flight: Number of requests running at once, 0 to use config.json
+ * @max_retries: Number of retries, 0 to use config.json
+ *
+ * Override the limits of the "scheduler" section, for tools that run
+ * outside of Evolution.
+ */
+void m_scheduler_set_limits(guint max_in_flight, guint max_retries);
+
+G_END_DECLS
+
+#endif /* M_SCHEDULER_H */
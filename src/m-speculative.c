@@ -0,0 +1,212 @@
+/*
+ * m-speculative.c - Background proofreading for AI Proofread Plugin
+ *
+ * Implements the idle watch of the composer editor and the request
+ * budget on top of m_proofreader_prefetch().
+ */
+
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
+
+#include <evolution/e-util/e-util.h>
+
+#include "m-speculative.h"
+#include "m-config.h"
+#include "m-proofreader.h"
+
+#define SPECULATIVE_KEY "ai-proofread-speculative"
+
+/* The watch of one composer, alive until the composer is destroyed */
+typedef struct
+{
+    EMsgComposer *composer;
+    EContentEditor *cnt_editor;
+    MUIActionContext *ui_context;
+    gulong changed_id;
+    gulong destroy_id;
+    guint idle_id;
+    GCancellable *cancellable; /* Of the running background proofread */
+} SpeculativeWatch;
+
+/* Background proofreads in the current hour, for all composers. Only
+ * used on the main thread. */
+static gint64 budget_window_start = 0;
+static guint budget_used = 0;
+
+/*
+ * speculative_budget_take:
+ * @max_per_hour: The hourly budget
+ *
+ * Returns: TRUE if the budget allows one more request, which is counted
+ */
+static gboolean
+speculative_budget_take(guint max_per_hour)
+{
+    gint64 now = g_get_monotonic_time();
+
+    if (budget_window_start == 0 || now - budget_window_start >= G_TIME_SPAN_HOUR)
+    {
+        budget_window_start = now;
+        budget_used = 0;
+    }
+
+    if (budget_used >= max_per_hour)
+        return FALSE;
+
+    budget_used++;
+    return TRUE;
+}
+
+/*
+ * speculative_get_section:
+ * @config: A configuration snapshot
+ *
+ * Returns: (transfer none) (nullable): The "speculative" section, or NULL
+ *          if background proofreading is not enabled
+ */
+static JsonObject *
+speculative_get_section(MConfig *config)
+{
+    JsonObject *section = m_config_get_section(config, "speculative");
+
+    if (!section || !json_object_get_boolean_member_with_default(section, "enabled", FALSE))
+        return NULL;
+
+    return section;
+}
+
+static void
+speculative_cancel(SpeculativeWatch *watch)
+{
+    if (watch->cancellable)
+    {
+        g_cancellable_cancel(watch->cancellable);
+        g_clear_object(&watch->cancellable);
+    }
+}
+
+/*
+ * speculative_idle_cb:
+ *
+ * The user stopped typing: proofread the text if the network and the
+ * budget allow it.
+ */
+static gboolean
+speculative_idle_cb(gpointer user_data)
+{
+    SpeculativeWatch *watch = user_data;
+    JsonArray *prompts = watch->ui_context->prompts;
+    MConfig *config;
+    JsonObject *section;
+    const gchar *prompt_id = NULL;
+
+    watch->idle_id = 0;
+
+    config = m_config_get();
+    section = speculative_get_section(config);
+    if (!section || !prompts || json_array_get_length(prompts) == 0)
+    {
+        m_config_unref(config);
+        return G_SOURCE_REMOVE;
+    }
+
+    if (g_network_monitor_get_network_metered(g_network_monitor_get_default()))
+    {
+        g_debug("Not proofreading in the background on a metered connection");
+    }
+    else if (!speculative_budget_take(MAX(json_object_get_int_member_with_default(
+                 section, "max_per_hour", M_SPECULATIVE_DEFAULT_MAX_PER_HOUR), 0)))
+    {
+        g_debug("Background proofreading budget used up for this hour");
+    }
+    else
+    {
+        prompt_id = json_object_get_string_member_with_default(section, "prompt", NULL);
+        if (!prompt_id)
+            prompt_id = json_object_get_string_member(json_array_get_object_element(prompts, 0), "name");
+
+        watch->cancellable = g_cancellable_new();
+        m_proofreader_prefetch(watch->cnt_editor,
+                               prompt_id,
+                               prompts,
+                               watch->ui_context->backends,
+                               watch->ui_context->model,
+                               watch->composer,
+                               watch->cancellable);
+    }
+
+    m_config_unref(config);
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * speculative_content_changed_cb:
+ *
+ * Restart the idle timer. A background proofread still running is for
+ * text that no longer exists, so it is cancelled.
+ */
+static void
+speculative_content_changed_cb(EContentEditor *cnt_editor, gpointer user_data)
+{
+    SpeculativeWatch *watch = user_data;
+    MConfig *config;
+    JsonObject *section;
+
+    speculative_cancel(watch);
+    if (watch->idle_id != 0)
+    {
+        g_source_remove(watch->idle_id);
+        watch->idle_id = 0;
+    }
+
+    config = m_config_get();
+    section = speculative_get_section(config);
+    if (section)
+        watch->idle_id = g_timeout_add(
+            MAX(json_object_get_int_member_with_default(section, "idle_ms", M_SPECULATIVE_DEFAULT_IDLE_MS), 0),
+            speculative_idle_cb, watch);
+    m_config_unref(config);
+}
+
+static void
+speculative_composer_destroy_cb(GtkWidget *widget, gpointer user_data)
+{
+    SpeculativeWatch *watch = user_data;
+
+    speculative_cancel(watch);
+    if (watch->idle_id != 0)
+        g_source_remove(watch->idle_id);
+
+    g_signal_handler_disconnect(watch->cnt_editor, watch->changed_id);
+    g_signal_handler_disconnect(watch->composer, watch->destroy_id);
+    g_object_set_data(G_OBJECT(watch->composer), SPECULATIVE_KEY, NULL);
+
+    m_ui_action_context_unref(watch->ui_context);
+    g_free(watch);
+}
+
+/*
+ * m_speculative_attach:
+ */
+void
+m_speculative_attach(EMsgComposer *composer, MUIActionContext *ui_context)
+{
+    SpeculativeWatch *watch;
+
+    g_return_if_fail(E_IS_MSG_COMPOSER(composer));
+    g_return_if_fail(ui_context != NULL);
+
+    if (g_object_get_data(G_OBJECT(composer), SPECULATIVE_KEY))
+        return;
+
+    watch = g_new0(SpeculativeWatch, 1);
+    watch->composer = composer;
+    watch->cnt_editor = e_html_editor_get_content_editor(e_msg_composer_get_editor(composer));
+    watch->ui_context = m_ui_action_context_ref(ui_context);
+
+    watch->changed_id = g_signal_connect(watch->cnt_editor, "content-changed",
+                                         G_CALLBACK(speculative_content_changed_cb), watch);
+    watch->destroy_id = g_signal_connect(composer, "destroy",
+                                         G_CALLBACK(speculative_composer_destroy_cb), watch);
+    g_object_set_data(G_OBJECT(composer), SPECULATIVE_KEY, watch);
+}
@@ -0,0 +1,57 @@
+/*
+ * m-speculative.h - Background proofreading for AI Proofread Plugin
+ *
+ * This module proofreads the message while the user is idle:
+ * - The composer's editor is watched for changes
+ * - After a pause in typing, a prompt runs at background priority and
+ *   its result goes into the response cache
+ * - Running that prompt on the unchanged text then inserts it at once
+ * - An hourly request budget is shared by all composers, and nothing is
+ *   sent on metered connections
+ *
+ * It is enabled by the "speculative" object in config.json:
+ *
+ *   "speculative": { "enabled": true, "idle_ms": 3000, "max_per_hour": 20, "prompt": "Proofread" }
+ */
+
+#ifndef M_SPECULATIVE_H
+#define M_SPECULATIVE_H
+
+#include <glib.h>
+#include <composer/e-msg-composer.h>
+
+#include "m-ui-actions.h"
+
+G_BEGIN_DECLS
+
+/**
+ * M_SPECULATIVE_DEFAULT_IDLE_MS:
+ *
+ * Default time without changes before the message is proofread.
+ */
+#define M_SPECULATIVE_DEFAULT_IDLE_MS 3000
+
+/**
+ * M_SPECULATIVE_DEFAULT_MAX_PER_HOUR:
+ *
+ * Default number of background proofreads per hour.
+ */
+#define M_SPECULATIVE_DEFAULT_MAX_PER_HOUR 20
+
+/**
+ * m_speculative_attach:
+ * @composer: The message composer
+ * @ui_context: The UI action context of @composer, providing the prompts,
+ *              backends and selected model (will be referenced)
+ *
+ * Watch the editor of @composer and proofread it in the background after
+ * each pause in typing, as long as the "speculative" section of
+ * config.json enables it. The prompt is the one named there, or the
+ * first one. Changes to the section apply from the next change of the
+ * text. Watching stops when @composer is destroyed.
+ */
+void m_speculative_attach(EMsgComposer *composer, MUIActionContext *ui_context);
+
+G_END_DECLS
+
+#endif /* M_SPECULATIVE_H */
@@ -0,0 +1,458 @@
+/*
+ * m-stats.c - Request statistics for AI Proofread Plugin
+ *
+ * Implements the ring buffer of request records, the JSON-lines log and
+ * the percentile report.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+
+#include "m-stats.h"
+#include "m-config.h"
+#include "m-latency.h"
+
+#define STATS_RECENT_COUNT 20
+
+/* Guarded by stats_lock */
+static GMutex stats_lock;
+static MStatsRecord *ring[M_STATS_RING_SIZE];
+static guint ring_next = 0;
+static guint ring_count = 0;
+
+/* Serializes writes to the log so that lines do not interleave */
+static GMutex log_lock;
+
+static const gchar *
+kind_to_string(MStatsKind kind)
+{
+    switch (kind)
+    {
+    case M_STATS_KIND_MODELS:
+        return "models";
+    case M_STATS_KIND_PREFETCH:
+        return "prefetch";
+    default:
+        return "proofread";
+    }
+}
+
+/*
+ * m_stats_record_new:
+ */
+MStatsRecord *
+m_stats_record_new(MStatsKind kind, const gchar *model, const gchar *prompt)
+{
+    MStatsRecord *record = g_new0(MStatsRecord, 1);
+
+    record->kind = kind;
+    record->timestamp = g_get_real_time();
+    record->start_us = g_get_monotonic_time();
+    record->model = g_strdup(model);
+    record->prompt = g_strdup(prompt);
+
+    return record;
+}
+
+/*
+ * m_stats_record_free:
+ */
+void
+m_stats_record_free(MStatsRecord *record)
+{
+    if (!record)
+        return;
+
+    g_free(record->model);
+    g_free(record->prompt);
+    g_free(record);
+}
+
+/*
+ * m_stats_record_set_error:
+ */
+void
+m_stats_record_set_error(MStatsRecord *record, const GError *error)
+{
+    record->error_domain = error ? error->domain : 0;
+    record->error_code = error ? error->code : 0;
+}
+
+static gboolean
+log_enabled(void)
+{
+    MConfig *config = m_config_get();
+    JsonObject *section = m_config_get_section(config, "stats");
+    gboolean enabled = section && json_object_get_boolean_member_with_default(section, "log", FALSE);
+
+    m_config_unref(config);
+    return enabled;
+}
+
+/*
+ * record_to_json:
+ *
+ * Returns: (transfer full): @record as a single line of JSON
+ */
+static gchar *
+record_to_json(const MStatsRecord *record)
+{
+    JsonBuilder *builder = json_builder_new();
+    JsonGenerator *generator = json_generator_new();
+    JsonNode *root;
+    gchar *line;
+
+#define ADD_STRING(name, value) \
+    G_STMT_START { \
+        json_builder_set_member_name(builder, name); \
+        if (value) \
+            json_builder_add_string_value(builder, value); \
+        else \
+            json_builder_add_null_value(builder); \
+    } G_STMT_END
+
+#define ADD_INT(name, value) \
+    G_STMT_START { \
+        json_builder_set_member_name(builder, name); \
+        json_builder_add_int_value(builder, value); \
+    } G_STMT_END
+
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "kind");
+    json_builder_add_string_value(builder, kind_to_string(record->kind));
+    ADD_INT("timestamp", record->timestamp / G_USEC_PER_SEC);
+    ADD_STRING("model", record->model);
+    ADD_STRING("prompt", record->prompt);
+    ADD_INT("status", record->status);
+    json_builder_set_member_name(builder, "success");
+    json_builder_add_boolean_value(builder, record->success);
+    ADD_INT("retries", record->retries);
+    ADD_INT("queue_us", record->queue_us);
+    ADD_INT("dns_us", record->dns_us);
+    ADD_INT("connect_us", record->connect_us);
+    ADD_INT("tls_us", record->tls_us);
+    ADD_INT("ttfb_us", record->ttfb_us);
+    ADD_INT("transfer_us", record->transfer_us);
+    ADD_INT("parse_us", record->parse_us);
+    ADD_INT("insert_us", record->insert_us);
+    ADD_INT("total_us", record->total_us);
+    ADD_INT("estimated_tokens", record->estimated_tokens);
+    ADD_INT("prompt_tokens", record->prompt_tokens);
+    ADD_INT("cached_tokens", record->cached_tokens);
+    ADD_INT("completion_tokens", record->completion_tokens);
+    json_builder_set_member_name(builder, "hedged");
+    json_builder_add_boolean_value(builder, record->hedged);
+    json_builder_set_member_name(builder, "hedge_won");
+    json_builder_add_boolean_value(builder, record->hedge_won);
+    ADD_INT("timeout_s", record->timeout_s);
+    ADD_STRING("error_domain", g_quark_to_string(record->error_domain));
+    ADD_INT("error_code", record->error_code);
+    json_builder_end_object(builder);
+
+#undef ADD_STRING
+#undef ADD_INT
+
+    root = json_builder_get_root(builder);
+    json_generator_set_root(generator, root);
+    line = json_generator_to_data(generator, NULL);
+
+    json_node_free(root);
+    g_object_unref(generator);
+    g_object_unref(builder);
+
+    return line;
+}
+
+/*
+ * append_to_log:
+ *
+ * Append @record to ai-proofread/stats.jsonl in the config directory.
+ */
+static void
+append_to_log(const MStatsRecord *record)
+{
+    gchar *path = g_build_filename(m_config_get_user_config_dir(), "ai-proofread", "stats.jsonl", NULL);
+    gchar *line = record_to_json(record);
+    FILE *file;
+
+    g_mutex_lock(&log_lock);
+    file = g_fopen(path, "a");
+    if (file)
+    {
+        fprintf(file, "%s\n", line);
+        fclose(file);
+    }
+    else
+    {
+        g_debug("Cannot open statistics log %s", path);
+    }
+    g_mutex_unlock(&log_lock);
+
+    g_free(line);
+    g_free(path);
+}
+
+/*
+ * m_stats_commit:
+ */
+void
+m_stats_commit(MStatsRecord *record)
+{
+    g_return_if_fail(record != NULL);
+
+    if (record->total_us == 0)
+        record->total_us = g_get_monotonic_time() - record->start_us;
+
+    g_debug("Request %s/%s: HTTP %u in %" G_GINT64_FORMAT " ms "
+            "(queue %" G_GINT64_FORMAT ", ttfb %" G_GINT64_FORMAT ", transfer %" G_GINT64_FORMAT " ms)",
+            record->prompt ? record->prompt : kind_to_string(record->kind),
+            record->model ? record->model : "-",
+            record->status,
+            record->total_us / G_TIME_SPAN_MILLISECOND,
+            record->queue_us / G_TIME_SPAN_MILLISECOND,
+            record->ttfb_us / G_TIME_SPAN_MILLISECOND,
+            record->transfer_us / G_TIME_SPAN_MILLISECOND);
+
+    if (log_enabled())
+        append_to_log(record);
+    m_latency_record(record);
+
+    g_mutex_lock(&stats_lock);
+    m_stats_record_free(ring[ring_next]);
+    ring[ring_next] = record;
+    ring_next = (ring_next + 1) % M_STATS_RING_SIZE;
+    ring_count = MIN(ring_count + 1, M_STATS_RING_SIZE);
+    g_mutex_unlock(&stats_lock);
+}
+
+static gint
+compare_int64(gconstpointer a, gconstpointer b)
+{
+    gint64 value_a = *(const gint64 *)a;
+    gint64 value_b = *(const gint64 *)b;
+
+    return value_a < value_b ? -1 : (value_a > value_b ? 1 : 0);
+}
+
+/*
+ * m_stats_percentile:
+ */
+gint64
+m_stats_percentile(gint64 *values, guint n_values, gdouble percentile)
+{
+    gdouble position = percentile / 100.0 * n_values;
+    gint rank = (gint)position;
+
+    if (n_values == 0)
+        return 0;
+
+    qsort(values, n_values, sizeof(gint64), compare_int64);
+
+    /* Nearest rank: the smallest value with at least percentile% at or below it */
+    if (position > rank)
+        rank++;
+    return values[CLAMP(rank - 1, 0, (gint)n_values - 1)];
+}
+
+/* Samples of one model or prompt */
+typedef struct
+{
+    GArray *total;
+    GArray *ttfb;
+    GArray *queue;
+    guint failed;
+    gint64 prompt_tokens;
+    gint64 cached_tokens;
+    gint64 completion_tokens;
+} StatsGroup;
+
+static void
+stats_group_free(StatsGroup *group)
+{
+    g_array_unref(group->total);
+    g_array_unref(group->ttfb);
+    g_array_unref(group->queue);
+    g_free(group);
+}
+
+static void
+stats_group_add(GHashTable *groups, const gchar *name, const MStatsRecord *record)
+{
+    StatsGroup *group = g_hash_table_lookup(groups, name ? name : "-");
+
+    if (!group)
+    {
+        group = g_new0(StatsGroup, 1);
+        group->total = g_array_new(FALSE, FALSE, sizeof(gint64));
+        group->ttfb = g_array_new(FALSE, FALSE, sizeof(gint64));
+        group->queue = g_array_new(FALSE, FALSE, sizeof(gint64));
+        g_hash_table_insert(groups, g_strdup(name ? name : "-"), group);
+    }
+
+    if (!record->success)
+    {
+        group->failed++;
+        return;
+    }
+
+    g_array_append_val(group->total, record->total_us);
+    g_array_append_val(group->ttfb, record->ttfb_us);
+    g_array_append_val(group->queue, record->queue_us);
+    group->prompt_tokens += record->prompt_tokens;
+    group->cached_tokens += record->cached_tokens;
+    group->completion_tokens += record->completion_tokens;
+}
+
+static gdouble
+percentile_ms(GArray *values, gdouble percentile)
+{
+    return m_stats_percentile((gint64 *)values->data, values->len, percentile) /
+           (gdouble)G_TIME_SPAN_MILLISECOND;
+}
+
+static void
+format_groups(GString *report, const gchar *title, GHashTable *groups)
+{
+    GList *names = g_list_sort(g_hash_table_get_keys(groups), (GCompareFunc)g_strcmp0);
+
+    g_string_append_printf(report, "%s\n", title);
+    g_string_append_printf(report, "  %-24s %5s %5s %9s %9s %9s %9s %9s %8s %7s\n",
+                           "", "n", "fail", "p50 ms", "p95 ms",
+                           "ttfb p50", "ttfb p95", "queue p95", "out tok", "cached");
+
+    for (GList *l = names; l != NULL; l = l->next)
+    {
+        StatsGroup *group = g_hash_table_lookup(groups, l->data);
+        guint n = group->total->len;
+
+        g_string_append_printf(report, "  %-24s %5u %5u %9.0f %9.0f %9.0f %9.0f %9.0f %8" G_GINT64_FORMAT " %6.0f%%\n",
+                               (const gchar *)l->data, n, group->failed,
+                               percentile_ms(group->total, 50), percentile_ms(group->total, 95),
+                               percentile_ms(group->ttfb, 50), percentile_ms(group->ttfb, 95),
+                               percentile_ms(group->queue, 95),
+                               n > 0 ? group->completion_tokens / n : 0,
+                               group->prompt_tokens > 0 ?
+                                   100.0 * group->cached_tokens / group->prompt_tokens : 0.0);
+    }
+
+    g_string_append_c(report, '\n');
+    g_list_free(names);
+}
+
+static void
+format_record(GString *report, const MStatsRecord *record)
+{
+    GDateTime *time = g_date_time_new_from_unix_local(record->timestamp / G_USEC_PER_SEC);
+    gchar *when = g_date_time_format(time, "%H:%M:%S");
+
+    g_string_append_printf(report,
+                           "  %s %-12s %-14s %3u %6" G_GINT64_FORMAT " ms"
+                           "  queue %" G_GINT64_FORMAT " dns %" G_GINT64_FORMAT
+                           " connect %" G_GINT64_FORMAT " tls %" G_GINT64_FORMAT
+                           " ttfb %" G_GINT64_FORMAT " transfer %" G_GINT64_FORMAT
+                           " parse %" G_GINT64_FORMAT " insert %" G_GINT64_FORMAT
+                           "  tokens %" G_GINT64_FORMAT "/%" G_GINT64_FORMAT
+                           " (est %" G_GINT64_FORMAT ") cached %" G_GINT64_FORMAT "%s%s%s\n",
+                           when,
+                           record->prompt ? record->prompt : kind_to_string(record->kind),
+                           record->model ? record->model : "-",
+                           record->status,
+                           record->total_us / G_TIME_SPAN_MILLISECOND,
+                           record->queue_us / G_TIME_SPAN_MILLISECOND,
+                           record->dns_us / G_TIME_SPAN_MILLISECOND,
+                           record->connect_us / G_TIME_SPAN_MILLISECOND,
+                           record->tls_us / G_TIME_SPAN_MILLISECOND,
+                           record->ttfb_us / G_TIME_SPAN_MILLISECOND,
+                           record->transfer_us / G_TIME_SPAN_MILLISECOND,
+                           record->parse_us / G_TIME_SPAN_MILLISECOND,
+                           record->insert_us / G_TIME_SPAN_MILLISECOND,
+                           record->prompt_tokens,
+                           record->completion_tokens,
+                           record->estimated_tokens,
+                           record->cached_tokens,
+                           record->retries > 0 ? " (retried)" : "",
+                           record->hedge_won ? " (hedge won)" : (record->hedged ? " (hedged)" : ""),
+                           record->kind == M_STATS_KIND_PREFETCH ? " (background)" : "");
+
+    g_free(when);
+    g_date_time_unref(time);
+}
+
+/*
+ * m_stats_format_report:
+ */
+gchar *
+m_stats_format_report(void)
+{
+    GString *report = g_string_new(NULL);
+    GHashTable *by_model = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                                 (GDestroyNotify)stats_group_free);
+    GHashTable *by_prompt = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                                  (GDestroyNotify)stats_group_free);
+    guint n_proofread = 0;
+    guint n_hedged = 0;
+    guint n_hedge_won = 0;
+    guint n_prefetch = 0;
+    guint n_estimated = 0;
+    gdouble estimate_error = 0;
+    guint oldest;
+
+    g_mutex_lock(&stats_lock);
+
+    oldest = (ring_next + M_STATS_RING_SIZE - ring_count) % M_STATS_RING_SIZE;
+
+    for (guint i = 0; i < ring_count; i++)
+    {
+        const MStatsRecord *record = ring[(oldest + i) % M_STATS_RING_SIZE];
+
+        /* Background requests are not waited for, keep them out of the
+         * latencies */
+        n_prefetch += record->kind == M_STATS_KIND_PREFETCH ? 1 : 0;
+        if (record->kind != M_STATS_KIND_PROOFREAD)
+            continue;
+        stats_group_add(by_model, record->model, record);
+        stats_group_add(by_prompt, record->prompt, record);
+
+        n_proofread++;
+        if (record->estimated_tokens > 0 && record->prompt_tokens > 0)
+        {
+            estimate_error += (gdouble)ABS(record->estimated_tokens - record->prompt_tokens) /
+                              record->prompt_tokens;
+            n_estimated++;
+        }
+        n_hedged += record->hedged ? 1 : 0;
+        n_hedge_won += record->hedge_won ? 1 : 0;
+    }
+
+    g_string_append_printf(report, "%u requests recorded (last %u kept)\n",
+                           ring_count, M_STATS_RING_SIZE);
+    if (n_hedged > 0)
+        g_string_append_printf(report, "Hedged %u of %u requests (%.0f%%), the hedge won %u (%.0f%%)\n",
+                               n_hedged, n_proofread, 100.0 * n_hedged / n_proofread,
+                               n_hedge_won, 100.0 * n_hedge_won / n_hedged);
+    if (n_estimated > 0)
+        g_string_append_printf(report, "Input token estimates were off by %.0f%% on average\n",
+                               100.0 * estimate_error / n_estimated);
+    if (n_prefetch > 0)
+        g_string_append_printf(report, "%u requests run in the background while idle\n", n_prefetch);
+    g_string_append_c(report, '\n');
+    format_groups(report, "Per model:", by_model);
+    format_groups(report, "Per prompt:", by_prompt);
+
+    g_string_append(report, "Recent requests (durations in ms):\n");
+    for (guint i = 0; i < MIN(ring_count, STATS_RECENT_COUNT); i++)
+    {
+        guint index = (ring_next + M_STATS_RING_SIZE - 1 - i) % M_STATS_RING_SIZE;
+        format_record(report, ring[index]);
+    }
+
+    g_mutex_unlock(&stats_lock);
+
+    g_hash_table_unref(by_model);
+    g_hash_table_unref(by_prompt);
+
+    return g_string_free(report, FALSE);
+}
@@ -0,0 +1,168 @@
+/*
+ * m-stats.h - Request statistics for AI Proofread Plugin
+ *
+ * This module records where the time of every API request goes:
+ * - Phase timings (queue wait, DNS, connect, TLS, time to first byte,
+ *   transfer, JSON parsing, editor insertion) and token usage
+ * - A ring buffer of recent requests with p50/p95 per model and prompt
+ * - An optional JSON-lines log in the config directory
+ *
+ * Logging is enabled by the "stats" object in config.json:
+ *
+ *   "stats": { "log": true }
+ */
+
+#ifndef M_STATS_H
+#define M_STATS_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * M_STATS_RING_SIZE:
+ *
+ * Number of recent requests kept in memory.
+ */
+#define M_STATS_RING_SIZE 512
+
+/**
+ * MStatsKind:
+ * @M_STATS_KIND_PROOFREAD: A chat completion
+ * @M_STATS_KIND_MODELS: A model list fetch
+ * @M_STATS_KIND_PREFETCH: A chat completion run in the background while
+ *                         the user is idle
+ */
+typedef enum
+{
+    M_STATS_KIND_PROOFREAD,
+    M_STATS_KIND_MODELS,
+    M_STATS_KIND_PREFETCH
+} MStatsKind;
+
+/**
+ * MStatsRecord:
+ * @kind: The kind of request
+ * @timestamp: Wall clock time the request started, in microseconds
+ * @start_us: Monotonic time the request started
+ * @model: (nullable): The model used
+ * @prompt: (nullable): The prompt name
+ * @status: The final HTTP status, 0 if no response was received
+ * @success: Whether the request produced a result
+ * @retries: Number of retries
+ * @queue_us: Time spent waiting for the scheduler, including backoff
+ * @dns_us: DNS resolution, 0 on a reused connection
+ * @connect_us: TCP connect, 0 on a reused connection
+ * @tls_us: TLS handshake, 0 on a reused connection
+ * @ttfb_us: From sending the request to the first response byte
+ * @transfer_us: From the first to the last response byte
+ * @parse_us: JSON parsing of the response
+ * @insert_us: Inserting the result into the editor
+ * @total_us: The whole request as seen by the user
+ * @estimated_tokens: Input tokens estimated before sending, see m_tokens_estimate()
+ * @prompt_tokens: Input tokens reported in the usage
+ * @cached_tokens: Input tokens served from the server's prompt cache
+ * @completion_tokens: Output tokens reported in the usage
+ * @hedged: Whether a hedge request was sent, see m_hedge_proofread_async()
+ * @hedge_won: Whether the hedge request answered first
+ * @timeout_s: The I/O timeout the request ran with, 0 if unknown
+ * @error_domain: The domain of the error the request failed with, 0 if
+ *                it did not fail or the error is unknown
+ * @error_code: The code of that error
+ *
+ * The timings of one request. Durations are in microseconds; phases
+ * which did not happen are 0.
+ */
+typedef struct _MStatsRecord MStatsRecord;
+
+struct _MStatsRecord
+{
+    MStatsKind kind;
+    gint64 timestamp;
+    gint64 start_us;
+    gchar *model;
+    gchar *prompt;
+    guint status;
+    gboolean success;
+    guint retries;
+    gint64 queue_us;
+    gint64 dns_us;
+    gint64 connect_us;
+    gint64 tls_us;
+    gint64 ttfb_us;
+    gint64 transfer_us;
+    gint64 parse_us;
+    gint64 insert_us;
+    gint64 total_us;
+    gint64 estimated_tokens;
+    gint64 prompt_tokens;
+    gint64 cached_tokens;
+    gint64 completion_tokens;
+    gboolean hedged;
+    gboolean hedge_won;
+    guint timeout_s;
+    GQuark error_domain;
+    gint error_code;
+};
+
+/**
+ * m_stats_record_new:
+ * @kind: The kind of request
+ * @model: (nullable): The model used (will be copied)
+ * @prompt: (nullable): The prompt name (will be copied)
+ *
+ * Start recording a request; the start time is taken now.
+ *
+ * Returns: (transfer full): A new record
+ */
+MStatsRecord *m_stats_record_new(MStatsKind kind, const gchar *model, const gchar *prompt);
+
+/**
+ * m_stats_record_free:
+ * @record: The record to free
+ */
+void m_stats_record_free(MStatsRecord *record);
+
+/**
+ * m_stats_record_set_error:
+ * @record: The record
+ * @error: (nullable): The error the request failed with
+ *
+ * Note why the request failed, so that a timeout can be told apart from
+ * a cancellation or a broken connection.
+ */
+void m_stats_record_set_error(MStatsRecord *record, const GError *error);
+
+/**
+ * m_stats_commit:
+ * @record: (transfer full): The finished record
+ *
+ * Add @record to the ring buffer, the log and the latency history. If
+ * @total_us is not set it is taken as the time since
+ * m_stats_record_new(). Safe to call from any thread.
+ */
+void m_stats_commit(MStatsRecord *record);
+
+/**
+ * m_stats_percentile:
+ * @values: The values, sorted in place
+ * @n_values: Number of values
+ * @percentile: The percentile, between 0 and 100
+ *
+ * Returns: The nearest-rank percentile of @values, 0 if there are none
+ */
+gint64 m_stats_percentile(gint64 *values, guint n_values, gdouble percentile);
+
+/**
+ * m_stats_format_report:
+ *
+ * Format p50/p95 latencies per model and per prompt, the hedge rate and
+ * the most recent requests as plain text.
+ *
+ * Returns: (transfer full): The report
+ */
+gchar *m_stats_format_report(void);
+
+G_END_DECLS
+
+#endif /* M_STATS_H */
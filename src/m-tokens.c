@@ -0,0 +1,121 @@
+/*
+ * m-tokens.c - Local token estimation for AI Proofread Plugin
+ *
+ * Implements the pre-split of text into tokenizer pieces and their
+ * length based cost.
+ */
+
+#include <glib.h>
+
+#include "m-tokens.h"
+
+/* Word lengths are counted in half letters: a non-ASCII letter is
+ * usually split more finely than an ASCII one */
+#define TOKENS_ASCII_LETTER 2
+#define TOKENS_OTHER_LETTER 3
+
+/* Words up to this length are mostly a single token */
+#define TOKENS_WORD_LENGTH 14
+
+/* Length of a token in longer words */
+#define TOKENS_TOKEN_LENGTH 8
+
+/* Numbers are split into groups of up to three digits */
+#define TOKENS_DIGITS_PER_TOKEN 3
+
+/* Tokens the reply is primed with */
+#define TOKENS_REPLY_PRIMING 3
+
+static gboolean
+is_word_char(gunichar c)
+{
+    return (g_unichar_isalpha(c) || g_unichar_ismark(c)) && !g_unichar_iswide(c);
+}
+
+static gboolean
+is_line_break(gunichar c)
+{
+    return c == '\n' || c == '\r';
+}
+
+/*
+ * m_tokens_estimate:
+ */
+guint
+m_tokens_estimate(const gchar *text)
+{
+    const gchar *p = text;
+    guint tokens = 0;
+
+    if (!text)
+        return 0;
+
+    while (*p)
+    {
+        gunichar c = g_utf8_get_char(p);
+        guint length = 0;
+
+        if (is_line_break(c))
+        {
+            /* A run of line breaks is one token */
+            while (is_line_break(g_utf8_get_char(p)))
+                p++;
+            tokens++;
+        }
+        else if (g_unichar_isspace(c))
+        {
+            /* A single space is part of the following word, longer runs
+             * such as indentation are a token of their own */
+            for (; *p && g_unichar_isspace(g_utf8_get_char(p)) && !is_line_break(g_utf8_get_char(p));
+                 p = g_utf8_next_char(p))
+                length++;
+            if (length > 1 || !*p)
+                tokens++;
+        }
+        else if (g_unichar_iswide(c))
+        {
+            /* CJK characters are about one token each */
+            p = g_utf8_next_char(p);
+            tokens++;
+        }
+        else if (is_word_char(c))
+        {
+            for (; *p && is_word_char(g_utf8_get_char(p)); p = g_utf8_next_char(p))
+                length += g_utf8_get_char(p) < 0x80 ? TOKENS_ASCII_LETTER : TOKENS_OTHER_LETTER;
+            tokens += length <= TOKENS_WORD_LENGTH ?
+                1 : (length + TOKENS_TOKEN_LENGTH - 1) / TOKENS_TOKEN_LENGTH;
+        }
+        else if (g_unichar_isdigit(c))
+        {
+            for (; *p && g_unichar_isdigit(g_utf8_get_char(p)); p = g_utf8_next_char(p))
+                length++;
+            tokens += (length + TOKENS_DIGITS_PER_TOKEN - 1) / TOKENS_DIGITS_PER_TOKEN;
+        }
+        else
+        {
+            /* Punctuation and symbols, where pairs like ". or --
+             * usually merge */
+            for (; *p; p = g_utf8_next_char(p))
+            {
+                gunichar d = g_utf8_get_char(p);
+
+                if (g_unichar_isspace(d) || is_word_char(d) || g_unichar_isdigit(d) || g_unichar_iswide(d))
+                    break;
+                length++;
+            }
+            tokens += (length + 1) / 2;
+        }
+    }
+
+    return tokens;
+}
+
+/*
+ * m_tokens_estimate_request:
+ */
+guint
+m_tokens_estimate_request(const gchar *instructions, const gchar *content)
+{
+    return m_tokens_estimate(instructions) + m_tokens_estimate(content) +
+           2 * M_TOKENS_MESSAGE_OVERHEAD + TOKENS_REPLY_PRIMING;
+}
@@ -0,0 +1,49 @@
+/*
+ * m-tokens.h - Local token estimation for AI Proofread Plugin
+ *
+ * This module estimates the size of a request before it is sent:
+ * - Text is split the way the BPE tokenizers of the OpenAI models
+ *   pre-split it: words with their leading space, digit groups,
+ *   punctuation runs and line breaks
+ * - Each piece is costed from its length, calibrated on English and
+ *   European mail against the o200k and cl100k encodings; CJK text
+ *   counts one token per character
+ * - The estimate is usually within 10-15% of the real count, which is
+ *   enough to pick a model, a chunking mode or a quoted history budget
+ */
+
+#ifndef M_TOKENS_H
+#define M_TOKENS_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * M_TOKENS_MESSAGE_OVERHEAD:
+ *
+ * Tokens the chat format adds around each message.
+ */
+#define M_TOKENS_MESSAGE_OVERHEAD 4
+
+/**
+ * m_tokens_estimate:
+ * @text: (nullable): The text
+ *
+ * Returns: The estimated number of tokens in @text, 0 for NULL
+ */
+guint m_tokens_estimate(const gchar *text);
+
+/**
+ * m_tokens_estimate_request:
+ * @instructions: (nullable): The system prompt
+ * @content: (nullable): The user message
+ *
+ * Returns: The estimated number of input tokens of a request sending
+ *          @instructions and @content, including the message framing
+ */
+guint m_tokens_estimate_request(const gchar *instructions, const gchar *content);
+
+G_END_DECLS
+
+#endif /* M_TOKENS_H */
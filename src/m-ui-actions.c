@@ -12,29 +12,74 @@
 #include <evolution/e-util/e-util.h>
 
 #include "m-ui-actions.h"
+#include "m-batch.h"
 #include "m-proofreader.h"
 #include "m-config.h"
+#include "m-stats.h"
 
 /* Forward declarations for E/GTK UI helpers */
 typedef struct _EUIManager EUIManager;
 EUIManager *e_html_editor_get_ui_manager(EHTMLEditor *editor);
 
-/* Static action context - set during registration */
-static MUIActionContext *g_action_context = NULL;
+/* Composer data key holding a reference to the composer's action context */
+#define M_UI_ACTION_CONTEXT_KEY "m-ui-action-context"
+
+/* Composer data key holding the UISetup of a placeholder */
+#define M_UI_SETUP_KEY "m-ui-setup"
+
+/*
+ * UISetup:
+ *
+ * What the placeholder action calls to register the full actions.
+ */
+typedef struct
+{
+    MUISetupFunc func;
+    gpointer user_data;
+} UISetup;
+
+/* Process-wide cache of what is built from the prompts and models, which
+ * all composers share. The generation changes whenever either does;
+ * entries, XML and the dropdown menu are rebuilt only then. Main thread
+ * only. */
+static guint ui_cache_generation = 0;
+static JsonArray *ui_cache_prompts = NULL;
+static GList *ui_cache_models = NULL;
+static MUIActionEntries *ui_cache_entries = NULL;
+static GtkWidget *ui_cache_menu = NULL;
+static guint ui_cache_menu_generation = 0;
+static GWeakRef ui_menu_composer; /* Composer the dropdown was shown for */
+
+/*
+ * action_context_clear:
+ */
+static void
+action_context_clear(gpointer data)
+{
+    MUIActionContext *context = data;
+
+    if (context->prompts)
+        json_array_unref(context->prompts);
+    if (context->backends)
+        g_hash_table_unref(context->backends);
+
+    g_free(context->model);
+    g_list_free_full(context->models, g_free);
+}
 
 /*
  * m_ui_action_context_new:
  */
 MUIActionContext *
 m_ui_action_context_new(JsonArray *prompts,
-                        const gchar *api_key,
+                        GHashTable *backends,
                         const gchar *model,
                         GList *models)
 {
-    MUIActionContext *context = g_new0(MUIActionContext, 1);
+    MUIActionContext *context = g_atomic_rc_box_new0(MUIActionContext);
 
     context->prompts = json_array_ref(prompts);
-    context->api_key = g_strdup(api_key);
+    context->backends = g_hash_table_ref(backends);
     context->model = g_strdup(model ? model : M_CONFIG_DEFAULT_MODEL);
 
     /* Copy models list */
@@ -63,21 +108,47 @@ void m_ui_action_context_set_model(MUIActionContext *context, const gchar *model
 }
 
 /*
- * m_ui_action_context_free:
+ * m_ui_action_context_set_config:
  */
 void
-m_ui_action_context_free(MUIActionContext *context)
+m_ui_action_context_set_config(MUIActionContext *context,
+                               JsonArray *prompts,
+                               GHashTable *backends)
 {
-    if (!context)
-        return;
+    g_return_if_fail(context != NULL);
+    g_return_if_fail(prompts != NULL);
+    g_return_if_fail(backends != NULL);
 
+    json_array_ref(prompts);
     if (context->prompts)
         json_array_unref(context->prompts);
+    context->prompts = prompts;
 
-    g_free(context->api_key);
-    g_free(context->model);
-    g_list_free_full(context->models, g_free);
-    g_free(context);
+    g_hash_table_ref(backends);
+    if (context->backends)
+        g_hash_table_unref(context->backends);
+    context->backends = backends;
+}
+
+/*
+ * m_ui_action_context_ref:
+ */
+MUIActionContext *
+m_ui_action_context_ref(MUIActionContext *context)
+{
+    g_return_val_if_fail(context != NULL, NULL);
+
+    return g_atomic_rc_box_acquire(context);
+}
+
+/*
+ * m_ui_action_context_unref:
+ */
+void
+m_ui_action_context_unref(MUIActionContext *context)
+{
+    if (context)
+        g_atomic_rc_box_release_full(context, action_context_clear);
 }
 
 /*
@@ -130,6 +201,19 @@ get_composer_from_user_data(gpointer user_data,
     return TRUE;
 }
 
+/*
+ * get_action_context:
+ * @composer: The message composer
+ *
+ * Returns: (transfer none) (nullable): The action context registered
+ *          for @composer
+ */
+static MUIActionContext *
+get_action_context(EMsgComposer *composer)
+{
+    return g_object_get_data(G_OBJECT(composer), M_UI_ACTION_CONTEXT_KEY);
+}
+
 /*
  * action_proofread_cb:
  *
@@ -143,8 +227,12 @@ action_proofread_cb(EUIAction *action,
     gchar *action_name = NULL;
     EMsgComposer *composer;
     EContentEditor *cnt_editor;
-    MUIActionContext *ctx = g_action_context;
+    MUIActionContext *ctx;
 
+    if (!get_composer_from_user_data(user_data, &composer, &cnt_editor))
+        return;
+
+    ctx = get_action_context(composer);
     if (!ctx)
     {
         g_warning("No action context available");
@@ -155,15 +243,9 @@ action_proofread_cb(EUIAction *action,
     if (!action_name)
         return;
 
-    if (!get_composer_from_user_data(user_data, &composer, &cnt_editor))
-    {
-        g_free(action_name);
-        return;
-    }
-
     g_debug("Proofread action triggered: %s", action_name);
 
-    m_proofreader_start(cnt_editor, action_name, ctx->prompts, ctx->api_key, ctx->model, composer);
+    m_proofreader_start(cnt_editor, action_name, ctx->prompts, ctx->backends, ctx->model, composer);
 
     g_free(action_name);
 }
@@ -176,25 +258,150 @@ action_proofread_cb(EUIAction *action,
 static void
 menu_item_activate_cb(GtkMenuItem *item, gpointer user_data)
 {
-    gchar *prompt_id = user_data;
+    const gchar *prompt_id = user_data;
     EMsgComposer *composer;
     EHTMLEditor *editor;
     EContentEditor *cnt_editor;
-    MUIActionContext *ctx = g_action_context;
+    MUIActionContext *ctx;
 
-    if (!prompt_id || !ctx)
+    composer = g_weak_ref_get(&ui_menu_composer);
+    if (!composer)
         return;
 
-    composer = g_object_get_data(G_OBJECT(item), "composer");
-    if (!composer)
+    ctx = get_action_context(composer);
+    if (ctx)
+    {
+        editor = e_msg_composer_get_editor(composer);
+        cnt_editor = e_html_editor_get_content_editor(editor);
+
+        m_proofreader_start(cnt_editor, prompt_id, ctx->prompts, ctx->backends, ctx->model, composer);
+    }
+
+    g_object_unref(composer);
+}
+
+/*
+ * ui_cache_update:
+ * @prompts: The prompts of the composer asking
+ * @models: The models of the composer asking
+ *
+ * Drop the cached entries when the prompts or the models differ from the
+ * ones they were built from. Prompts come from immutable configuration
+ * snapshots which share the array until prompts.json changes, so
+ * comparing the pointers is enough.
+ */
+static void
+ui_cache_update(JsonArray *prompts, GList *models)
+{
+    GList *a, *b;
+
+    for (a = models, b = ui_cache_models; a && b; a = a->next, b = b->next)
+    {
+        if (g_strcmp0(a->data, b->data) != 0)
+            break;
+    }
+
+    if (ui_cache_generation != 0 && prompts == ui_cache_prompts && !a && !b)
         return;
 
-    editor = e_msg_composer_get_editor(composer);
-    cnt_editor = e_html_editor_get_content_editor(editor);
+    ui_cache_generation++;
+    g_debug("Rebuilding UI definitions (generation %u)", ui_cache_generation);
+
+    json_array_ref(prompts);
+    if (ui_cache_prompts)
+        json_array_unref(ui_cache_prompts);
+    ui_cache_prompts = prompts;
 
-    m_proofreader_start(cnt_editor, prompt_id, ctx->prompts, ctx->api_key, ctx->model, composer);
+    g_list_free_full(ui_cache_models, g_free);
+    ui_cache_models = g_list_copy_deep(models, (GCopyFunc)g_strdup, NULL);
 
-    g_free(prompt_id);
+    g_clear_pointer(&ui_cache_entries, m_ui_action_entries_free);
+}
+
+/*
+ * get_dropdown_menu:
+ *
+ * Returns: (transfer none): The dropdown menu for the cached prompts,
+ *          built once per generation
+ */
+static GtkWidget *
+get_dropdown_menu(void)
+{
+    guint i, n_prompts;
+
+    if (ui_cache_menu && ui_cache_menu_generation == ui_cache_generation)
+        return ui_cache_menu;
+
+    if (ui_cache_menu)
+    {
+        gtk_widget_destroy(ui_cache_menu);
+        g_object_unref(ui_cache_menu);
+    }
+
+    ui_cache_menu = g_object_ref_sink(gtk_menu_new());
+    ui_cache_menu_generation = ui_cache_generation;
+
+    n_prompts = json_array_get_length(ui_cache_prompts);
+    for (i = 0; i < n_prompts; i++)
+    {
+        JsonObject *prompt = json_array_get_object_element(ui_cache_prompts, i);
+        const gchar *name = json_object_get_string_member(prompt, "name");
+
+        GtkWidget *mi = gtk_menu_item_new_with_label(name);
+        g_signal_connect_data(mi, "activate", G_CALLBACK(menu_item_activate_cb),
+                              g_strdup_printf("ai-proofread-%s", name),
+                              (GClosureNotify)g_free, 0);
+        gtk_menu_shell_append(GTK_MENU_SHELL(ui_cache_menu), mi);
+        gtk_widget_show(mi);
+    }
+
+    return ui_cache_menu;
+}
+
+/*
+ * update_model_labels:
+ * @ui_manager: The composer's UI manager
+ * @previous_model: (nullable): The model selected until now
+ * @current_model: The selected model
+ *
+ * Mark the selected model of a composer in its Model submenu. The shared
+ * entries are built without a selection.
+ */
+static void
+update_model_labels(EUIManager *ui_manager,
+                    const gchar *previous_model,
+                    const gchar *current_model)
+{
+    EUIAction *action;
+    gchar *action_name;
+    gchar *label;
+
+    action = e_ui_manager_get_action(ui_manager, "ai-model-menu");
+    if (action)
+    {
+        label = g_strdup_printf(N_("Model (%s)"), current_model);
+        e_ui_action_set_label(action, label);
+        g_free(label);
+    }
+
+    if (previous_model && g_strcmp0(previous_model, current_model) != 0)
+    {
+        action_name = g_strdup_printf("ai-model-%s", previous_model);
+        action = e_ui_manager_get_action(ui_manager, action_name);
+        if (action)
+            e_ui_action_set_label(action, previous_model);
+        g_free(action_name);
+    }
+
+    action_name = g_strdup_printf("ai-model-%s", current_model);
+    action = e_ui_manager_get_action(ui_manager, action_name);
+    if (action)
+    {
+        label = g_strdup_printf("✓ %s", current_model);
+        e_ui_action_set_label(action, label);
+        g_free(label);
+    }
+    g_free(action_name);
 }
 
 /*
@@ -210,37 +417,50 @@ action_dropdown_cb(EUIAction *action,
     EMsgComposer *composer;
     EContentEditor *cnt_editor;
     GtkWidget *menu;
-    MUIActionContext *ctx = g_action_context;
-    guint i, n_prompts;
+    MUIActionContext *ctx;
+
+    if (!get_composer_from_user_data(user_data, &composer, &cnt_editor))
+        return;
 
+    ctx = get_action_context(composer);
     if (!ctx)
     {
         g_warning("No action context available");
         return;
     }
 
-    if (!get_composer_from_user_data(user_data, &composer, &cnt_editor))
-        return;
+    ui_cache_update(ctx->prompts, ctx->models);
+    menu = get_dropdown_menu();
 
-    menu = gtk_menu_new();
-    n_prompts = json_array_get_length(ctx->prompts);
+    g_weak_ref_set(&ui_menu_composer, composer);
+    gtk_menu_set_screen(GTK_MENU(menu), gtk_widget_get_screen(GTK_WIDGET(composer)));
+    gtk_menu_popup_at_pointer(GTK_MENU(menu), NULL);
+}
 
-    for (i = 0; i < n_prompts; i++)
-    {
-        JsonObject *prompt = json_array_get_object_element(ctx->prompts, i);
-        const gchar *name = json_object_get_string_member(prompt, "name");
-        gchar *action_name = g_strdup_printf("ai-proofread-%s", name);
+/*
+ * action_setup_cb:
+ *
+ * EUI action callback for the placeholder registered until the AI
+ * features are first used. Loads everything, then shows the dropdown.
+ */
+static void
+action_setup_cb(EUIAction *action,
+                GVariant *parameter,
+                gpointer user_data)
+{
+    EMsgComposer *composer;
+    EContentEditor *cnt_editor;
+    UISetup *setup;
 
-        GtkWidget *mi = gtk_menu_item_new_with_label(name);
-        g_object_set_data(G_OBJECT(mi), "composer", composer);
-        g_signal_connect(mi, "activate", G_CALLBACK(menu_item_activate_cb), g_strdup(action_name));
-        gtk_menu_shell_append(GTK_MENU_SHELL(menu), mi);
-        gtk_widget_show(mi);
+    if (!get_composer_from_user_data(user_data, &composer, &cnt_editor))
+        return;
 
-        g_free(action_name);
-    }
+    setup = g_object_get_data(G_OBJECT(composer), M_UI_SETUP_KEY);
+    if (!setup || !setup->func(composer, setup->user_data))
+        return;
 
-    gtk_menu_popup_at_pointer(GTK_MENU(menu), NULL);
+    e_ui_action_set_visible(action, FALSE);
+    action_dropdown_cb(NULL, NULL, composer);
 }
 
 /*
@@ -254,9 +474,14 @@ action_select_model_cb(EUIAction *action,
                        gpointer user_data)
 {
     gchar *action_name = NULL;
-    MUIActionContext *ctx = g_action_context;
+    gchar *previous_model;
+    MUIActionContext *ctx = NULL;
+    EUIManager *ui_manager;
     const gchar *model_id;
 
+    if (user_data && E_IS_MSG_COMPOSER(user_data))
+        ctx = get_action_context(E_MSG_COMPOSER(user_data));
+
     if (!ctx)
     {
         g_warning("No action context available");
@@ -272,22 +497,100 @@ action_select_model_cb(EUIAction *action,
     {
         model_id = action_name + strlen("ai-model-");
         g_debug("Model selected: %s", model_id);
+
+        previous_model = g_strdup(ctx->model);
         m_ui_action_context_set_model(ctx, model_id);
+
+        ui_manager = e_html_editor_get_ui_manager(
+            e_msg_composer_get_editor(E_MSG_COMPOSER(user_data)));
+        update_model_labels(ui_manager, previous_model, ctx->model);
+        g_free(previous_model);
     }
 
     g_free(action_name);
 }
 
+/*
+ * action_statistics_cb:
+ *
+ * EUI action callback showing the request statistics.
+ */
+static void
+action_statistics_cb(EUIAction *action,
+                     GVariant *parameter,
+                     gpointer user_data)
+{
+    GtkWidget *dialog;
+    GtkWidget *scrolled;
+    GtkWidget *text_view;
+    GtkTextBuffer *buffer;
+    gchar *report;
+
+    dialog = gtk_dialog_new_with_buttons(
+        _("AI Statistics"),
+        user_data && GTK_IS_WINDOW(user_data) ? GTK_WINDOW(user_data) : NULL,
+        GTK_DIALOG_DESTROY_WITH_PARENT,
+        _("_Close"), GTK_RESPONSE_CLOSE,
+        NULL);
+    gtk_window_set_default_size(GTK_WINDOW(dialog), 900, 500);
+
+    scrolled = gtk_scrolled_window_new(NULL, NULL);
+    gtk_widget_set_vexpand(scrolled, TRUE);
+    gtk_container_add(GTK_CONTAINER(gtk_dialog_get_content_area(GTK_DIALOG(dialog))), scrolled);
+
+    text_view = gtk_text_view_new();
+    gtk_text_view_set_editable(GTK_TEXT_VIEW(text_view), FALSE);
+    gtk_text_view_set_monospace(GTK_TEXT_VIEW(text_view), TRUE);
+    gtk_container_add(GTK_CONTAINER(scrolled), text_view);
+
+    report = m_stats_format_report();
+    buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
+    gtk_text_buffer_set_text(buffer, report, -1);
+    g_free(report);
+
+    g_signal_connect(dialog, "response", G_CALLBACK(gtk_widget_destroy), NULL);
+    gtk_widget_show_all(dialog);
+}
+
+/*
+ * action_batch_cb:
+ *
+ * EUI action callback proofreading the Drafts or Outbox folder as a
+ * batch job.
+ */
+static void
+action_batch_cb(EUIAction *action,
+                GVariant *parameter,
+                gpointer user_data)
+{
+    MUIActionContext *ctx = NULL;
+    gchar *action_name = NULL;
+
+    if (user_data && E_IS_MSG_COMPOSER(user_data))
+        ctx = get_action_context(E_MSG_COMPOSER(user_data));
+
+    if (!ctx)
+    {
+        g_warning("No action context available");
+        return;
+    }
+
+    g_object_get(action, "name", &action_name, NULL);
+    m_batch_start(g_strcmp0(action_name, "ai-batch-outbox") == 0 ? M_BATCH_FOLDER_OUTBOX
+                                                                 : M_BATCH_FOLDER_DRAFTS,
+                  ctx);
+    g_free(action_name);
+}
+
 /*
  * build_eui_xml:
  * @prompts: Array of prompts
  * @models: List of available models
- * @current_model: Currently selected model
  *
  * Build the EUI XML string for menu and toolbar items.
  */
 static gchar *
-build_eui_xml(JsonArray *prompts, GList *models, const gchar *current_model)
+build_eui_xml(JsonArray *prompts, GList *models)
 {
     GString *xml;
     guint i, n_prompts;
@@ -323,6 +626,8 @@ build_eui_xml(JsonArray *prompts, GList *models, const gchar *current_model)
     }
 
     g_string_append(xml, "</submenu>");
+    g_string_append(xml, "<separator/><item action='ai-batch-drafts'/><item action='ai-batch-outbox'/>");
+    g_string_append(xml, "<separator/><item action='ai-statistics'/>");
 
     g_string_append(xml,
                     "</placeholder>"
@@ -405,16 +710,16 @@ create_dropdown_entry(void)
 /*
  * create_model_menu_entry:
  *
- * Create the Model submenu entry.
+ * Create the Model submenu entry. The selected model is added to the
+ * label per composer by update_model_labels().
  */
 static EUIActionEntry
-create_model_menu_entry(const gchar *current_model)
+create_model_menu_entry(void)
 {
-    gchar *label = g_strdup_printf(N_("Model (%s)"), current_model ? current_model : M_CONFIG_DEFAULT_MODEL);
     return (EUIActionEntry){
         g_strdup("ai-model-menu"),
         NULL,
-        label,
+        g_strdup(N_("Model")),
         NULL,
         g_strdup(N_("Select AI model")),
         NULL,
@@ -423,6 +728,49 @@ create_model_menu_entry(const gchar *current_model)
         NULL};
 }
 
+/*
+ * create_statistics_entry:
+ *
+ * Create the Statistics menu entry.
+ */
+static EUIActionEntry
+create_statistics_entry(void)
+{
+    return (EUIActionEntry){
+        g_strdup("ai-statistics"),
+        NULL,
+        g_strdup(N_("_Statistics")),
+        NULL,
+        g_strdup(N_("Show request latencies and token usage")),
+        action_statistics_cb,
+        NULL,
+        NULL,
+        NULL};
+}
+
+/*
+ * create_batch_entry:
+ * @name: The action name
+ * @label: The menu label
+ * @tooltip: The tooltip
+ *
+ * Create a menu entry starting a batch job on a folder.
+ */
+static EUIActionEntry
+create_batch_entry(const gchar *name, const gchar *label, const gchar *tooltip)
+{
+    return (EUIActionEntry){
+        g_strdup(name),
+        NULL,
+        g_strdup(label),
+        NULL,
+        g_strdup(tooltip),
+        action_batch_cb,
+        NULL,
+        NULL,
+        NULL};
+}
+
 /*
  * create_model_entry:
  * @model_id: The model identifier
@@ -479,7 +827,7 @@ validate_entries(EUIActionEntry *entries, guint count)
 /*
  * m_ui_build_action_entries:
  */
-MUIActionEntries *
+const MUIActionEntries *
 m_ui_build_action_entries(JsonArray *prompts, MUIActionContext *action_context)
 {
     MUIActionEntries *result;
@@ -494,12 +842,16 @@ m_ui_build_action_entries(JsonArray *prompts, MUIActionContext *action_context)
     if (n_prompts == 0)
         return NULL;
 
-    n_models = g_list_length(action_context->models);
+    ui_cache_update(prompts, action_context->models);
+    if (ui_cache_entries)
+        return ui_cache_entries;
+
+    n_models = g_list_length(ui_cache_models);
 
     result = g_new0(MUIActionEntries, 1);
     result->count = n_prompts;
-    /* prompts + ai-menu + dropdown + model-menu + model entries */
-    result->total_count = n_prompts + 3 + n_models;
+    /* prompts + ai-menu + dropdown + model-menu + statistics + 2 batch + model entries */
+    result->total_count = n_prompts + 6 + n_models;
     result->entries = g_new0(EUIActionEntry, result->total_count);
 
     idx = 0;
@@ -516,21 +868,30 @@ m_ui_build_action_entries(JsonArray *prompts, MUIActionContext *action_context)
     result->entries[idx++] = create_dropdown_entry();
 
     /* Add model menu entry */
-    result->entries[idx++] = create_model_menu_entry(action_context->model);
+    result->entries[idx++] = create_model_menu_entry();
+
+    /* Add statistics entry */
+    result->entries[idx++] = create_statistics_entry();
+
+    /* Add batch entries */
+    result->entries[idx++] = create_batch_entry(
+        "ai-batch-drafts", N_("Proofread All _Drafts"),
+        N_("Proofread the messages in Drafts as one batch job"));
+    result->entries[idx++] = create_batch_entry(
+        "ai-batch-outbox", N_("Proofread the _Outbox"),
+        N_("Proofread the messages waiting in the Outbox as one batch job"));
 
     /* Add model selection entries */
-    for (GList *l = action_context->models; l != NULL; l = l->next)
-    {
-        const gchar *model_id = l->data;
-        gboolean is_current = g_strcmp0(model_id, action_context->model) == 0;
-        result->entries[idx++] = create_model_entry(model_id, is_current);
-    }
+    for (GList *l = ui_cache_models; l != NULL; l = l->next)
+        result->entries[idx++] = create_model_entry(l->data, FALSE);
 
     /* Validate all entries */
     validate_entries(result->entries, result->total_count);
 
     /* Build EUI XML */
-    result->eui_xml = build_eui_xml(prompts, action_context->models, action_context->model);
+    result->eui_xml = build_eui_xml(prompts, ui_cache_models);
+
+    ui_cache_entries = result;
 
     return result;
 }
@@ -540,7 +901,7 @@ m_ui_build_action_entries(JsonArray *prompts, MUIActionContext *action_context)
  */
 void
 m_ui_register_actions(EMsgComposer *composer,
-                      MUIActionEntries *action_entries,
+                      const MUIActionEntries *action_entries,
                       MUIActionContext *action_context)
 {
     EHTMLEditor *html_editor;
@@ -550,14 +911,261 @@ m_ui_register_actions(EMsgComposer *composer,
     g_return_if_fail(action_entries != NULL);
     g_return_if_fail(action_context != NULL);
 
-    /* Store action context for callbacks */
-    g_action_context = action_context;
+    /* The callbacks receive the composer; each composer keeps its own
+     * context so a model chosen in one window does not leak into others */
+    g_object_set_data_full(G_OBJECT(composer), M_UI_ACTION_CONTEXT_KEY,
+                           m_ui_action_context_ref(action_context),
+                           (GDestroyNotify)m_ui_action_context_unref);
+
+    html_editor = e_msg_composer_get_editor(composer);
+    ui_manager = e_html_editor_get_ui_manager(html_editor);
+
+    if (e_ui_manager_get_action(ui_manager, "ai-menu"))
+    {
+        /* A placeholder already added the AI menu; the entry follows the
+         * prompt entries */
+        e_ui_manager_add_actions(
+            ui_manager, "core", GETTEXT_PACKAGE,
+            action_entries->entries, action_entries->count,
+            composer);
+        e_ui_manager_add_actions_with_eui_data(
+            ui_manager, "core", GETTEXT_PACKAGE,
+            action_entries->entries + action_entries->count + 1,
+            action_entries->total_count - action_entries->count - 1,
+            composer, action_entries->eui_xml);
+    }
+    else
+    {
+        e_ui_manager_add_actions_with_eui_data(
+            ui_manager, "core", GETTEXT_PACKAGE,
+            action_entries->entries, action_entries->total_count,
+            composer, action_entries->eui_xml);
+    }
+
+    update_model_labels(ui_manager, NULL, action_context->model);
+}
+
+/*
+ * m_ui_register_placeholder:
+ */
+void
+m_ui_register_placeholder(EMsgComposer *composer,
+                          MUISetupFunc setup_func,
+                          gpointer user_data)
+{
+    static const EUIActionEntry entries[] = {
+        {"ai-menu", NULL, N_("AI"), NULL, N_("AI tools"), NULL, NULL, NULL, NULL},
+        {"ai-proofread-setup", "tools-check-spelling", N_("AI _Proofread"), NULL,
+         N_("AI Proofread"), action_setup_cb, NULL, NULL, NULL}};
+    static const gchar *eui =
+        "<eui>"
+        "<menu id='main-menu'>"
+        "<placeholder id='custom-menus'>"
+        "<submenu action='ai-menu'>"
+        "<placeholder id='ai-menu-holder'>"
+        "<item action='ai-proofread-setup'/>"
+        "</placeholder>"
+        "</submenu>"
+        "</placeholder>"
+        "</menu>"
+        "<toolbar id='main-toolbar-with-headerbar'><item action='ai-proofread-setup'/></toolbar>"
+        "<toolbar id='main-toolbar-without-headerbar'><item action='ai-proofread-setup'/></toolbar>"
+        "</eui>";
+    EHTMLEditor *html_editor;
+    EUIManager *ui_manager;
+    UISetup *setup;
+
+    g_return_if_fail(E_IS_MSG_COMPOSER(composer));
+    g_return_if_fail(setup_func != NULL);
+
+    setup = g_new0(UISetup, 1);
+    setup->func = setup_func;
+    setup->user_data = user_data;
+    g_object_set_data_full(G_OBJECT(composer), M_UI_SETUP_KEY, setup, g_free);
 
     html_editor = e_msg_composer_get_editor(composer);
     ui_manager = e_html_editor_get_ui_manager(html_editor);
 
     e_ui_manager_add_actions_with_eui_data(
         ui_manager, "core", GETTEXT_PACKAGE,
-        action_entries->entries, action_entries->total_count,
-        composer, action_entries->eui_xml);
+        entries, G_N_ELEMENTS(entries),
+        composer, eui);
+}
+
+/*
+ * m_ui_update_models:
+ */
+void
+m_ui_update_models(EMsgComposer *composer,
+                   MUIActionContext *action_context,
+                   GList *models)
+{
+    EHTMLEditor *html_editor;
+    EUIManager *ui_manager;
+    GArray *entries;
+    GString *xml;
+    GList *l;
+
+    g_return_if_fail(E_IS_MSG_COMPOSER(composer));
+    g_return_if_fail(action_context != NULL);
+
+    html_editor = e_msg_composer_get_editor(composer);
+    ui_manager = e_html_editor_get_ui_manager(html_editor);
+
+    /* Hide models which disappeared from the list */
+    for (l = action_context->models; l != NULL; l = l->next)
+    {
+        if (!g_list_find_custom(models, l->data, (GCompareFunc)g_strcmp0))
+        {
+            gchar *action_name = g_strdup_printf("ai-model-%s", (const gchar *)l->data);
+            EUIAction *action = e_ui_manager_get_action(ui_manager, action_name);
+            if (action)
+                e_ui_action_set_visible(action, FALSE);
+            g_free(action_name);
+        }
+    }
+
+    /* Add (or show again) models which are new */
+    entries = g_array_new(FALSE, TRUE, sizeof(EUIActionEntry));
+    xml = g_string_new(
+        "<eui>"
+        "<menu id='main-menu'>"
+        "<placeholder id='custom-menus'>"
+        "<submenu action='ai-menu'>"
+        "<placeholder id='ai-menu-holder'>"
+        "<submenu action='ai-model-menu'>");
+
+    for (l = models; l != NULL; l = l->next)
+    {
+        const gchar *model_id = l->data;
+        gchar *action_name;
+        EUIAction *action;
+
+        if (g_list_find_custom(action_context->models, model_id, (GCompareFunc)g_strcmp0))
+            continue;
+
+        action_name = g_strdup_printf("ai-model-%s", model_id);
+        action = e_ui_manager_get_action(ui_manager, action_name);
+        if (action)
+        {
+            e_ui_action_set_visible(action, TRUE);
+        }
+        else
+        {
+            EUIActionEntry entry = create_model_entry(
+                model_id, g_strcmp0(model_id, action_context->model) == 0);
+            g_array_append_val(entries, entry);
+            g_string_append_printf(xml, "<item action='%s'/>", action_name);
+        }
+        g_free(action_name);
+    }
+
+    g_string_append(xml,
+                    "</submenu>"
+                    "</placeholder>"
+                    "</submenu>"
+                    "</placeholder>"
+                    "</menu>"
+                    "</eui>");
+
+    if (entries->len > 0)
+    {
+        EUIActionEntry *new_entries = (EUIActionEntry *)entries->data;
+
+        validate_entries(new_entries, entries->len);
+
+        e_ui_manager_add_actions_with_eui_data(
+            ui_manager, "core", GETTEXT_PACKAGE,
+            new_entries, entries->len,
+            composer, xml->str);
+
+        for (guint i = 0; i < entries->len; i++)
+        {
+            g_free((gpointer)new_entries[i].name);
+            g_free((gpointer)new_entries[i].label);
+            g_free((gpointer)new_entries[i].tooltip);
+        }
+    }
+
+    g_debug("Model submenu refreshed: %u new actions", entries->len);
+
+    g_string_free(xml, TRUE);
+    g_array_free(entries, TRUE);
+
+    /* Remember the new list */
+    g_list_free_full(action_context->models, g_free);
+    action_context->models = g_list_copy_deep(models, (GCopyFunc)g_strdup, NULL);
+}
+
+/*
+ * m_ui_update_prompts:
+ */
+void
+m_ui_update_prompts(EMsgComposer *composer,
+                    MUIActionContext *action_context,
+                    JsonArray *prompts,
+                    GHashTable *backends)
+{
+    static const gchar *shared_actions[] = {
+        "ai-proofread-dropdown", "ai-model-menu", "ai-statistics",
+        "ai-batch-drafts", "ai-batch-outbox"};
+    const MUIActionEntries *action_entries;
+    EHTMLEditor *html_editor;
+    EUIManager *ui_manager;
+    EUIActionGroup *action_group;
+    guint i, n_prompts;
+    GList *l;
+
+    g_return_if_fail(E_IS_MSG_COMPOSER(composer));
+    g_return_if_fail(action_context != NULL);
+    g_return_if_fail(prompts != NULL);
+
+    /* Snapshots share the prompts array until prompts.json changes */
+    if (prompts == action_context->prompts)
+    {
+        m_ui_action_context_set_config(action_context, prompts, backends);
+        return;
+    }
+
+    html_editor = e_msg_composer_get_editor(composer);
+    ui_manager = e_html_editor_get_ui_manager(html_editor);
+    action_group = e_ui_manager_get_action_group(ui_manager, "core");
+
+    /* Remove the actions of the old prompts, and the ones registered
+     * along with them except the AI menu, which m_ui_register_actions()
+     * adds again */
+    n_prompts = json_array_get_length(action_context->prompts);
+    for (i = 0; i < n_prompts; i++)
+    {
+        JsonObject *prompt = json_array_get_object_element(action_context->prompts, i);
+        gchar *action_name = g_strdup_printf("ai-proofread-%s",
+                                             json_object_get_string_member(prompt, "name"));
+
+        e_ui_action_group_remove_by_name(action_group, action_name);
+        g_free(action_name);
+    }
+
+    for (i = 0; i < G_N_ELEMENTS(shared_actions); i++)
+        e_ui_action_group_remove_by_name(action_group, shared_actions[i]);
+
+    for (l = action_context->models; l != NULL; l = l->next)
+    {
+        gchar *action_name = g_strdup_printf("ai-model-%s", (const gchar *)l->data);
+
+        e_ui_action_group_remove_by_name(action_group, action_name);
+        g_free(action_name);
+    }
+
+    m_ui_action_context_set_config(action_context, prompts, backends);
+
+    action_entries = m_ui_build_action_entries(prompts, action_context);
+    if (!action_entries)
+    {
+        g_warning("No prompts configured, AI actions removed");
+        return;
+    }
+
+    m_ui_register_actions(composer, action_entries, action_context);
+
+    g_debug("Prompt actions registered again: %u prompts", action_entries->count);
 }
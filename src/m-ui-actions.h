@@ -21,18 +21,21 @@ G_BEGIN_DECLS
 /**
  * MUIActionContext:
  * @prompts: Array of available prompts
- * @api_key: The API key for the proofreading service
+ * @backends: Table of backend names to #MBackend
  * @model: The currently selected AI model
  * @models: List of available models (GList of gchar*)
  *
- * Context for UI action callbacks.
+ * Context for UI action callbacks. Each composer owns its own
+ * reference-counted context, so selecting a model in one window does not
+ * change it in another. Proofreads copy what they need when they start
+ * and never read the context again.
  */
 typedef struct _MUIActionContext MUIActionContext;
 
 struct _MUIActionContext
 {
     JsonArray *prompts;
-    gchar *api_key;
+    GHashTable *backends;
     gchar *model;
     GList *models;
 };
@@ -40,16 +43,17 @@ struct _MUIActionContext
 /**
  * m_ui_action_context_new:
  * @prompts: The prompts array (will be referenced)
- * @api_key: The API key (will be copied)
+ * @backends: The backends of the configuration (will be referenced)
  * @model: The selected model (will be copied)
  * @models: List of available models (will be copied)
  *
  * Create a new UI action context.
  *
- * Returns: (transfer full): A newly allocated context
+ * Returns: (transfer full): A newly allocated context, free with
+ *          m_ui_action_context_unref()
  */
 MUIActionContext *m_ui_action_context_new(JsonArray *prompts,
-                                          const gchar *api_key,
+                                          GHashTable *backends,
                                           const gchar *model,
                                           GList *models);
 
@@ -63,12 +67,32 @@ MUIActionContext *m_ui_action_context_new(JsonArray *prompts,
 void m_ui_action_context_set_model(MUIActionContext *context, const gchar *model);
 
 /**
- * m_ui_action_context_free:
- * @context: The context to free
+ * m_ui_action_context_set_config:
+ * @context: The action context
+ * @prompts: The new prompts array (will be referenced)
+ * @backends: The new backends (will be referenced)
+ *
+ * Replace the prompts and backends after the configuration was reloaded.
+ */
+void m_ui_action_context_set_config(MUIActionContext *context,
+                                    JsonArray *prompts,
+                                    GHashTable *backends);
+
+/**
+ * m_ui_action_context_ref:
+ * @context: The action context
+ *
+ * Returns: (transfer full): @context with its reference count increased
+ */
+MUIActionContext *m_ui_action_context_ref(MUIActionContext *context);
+
+/**
+ * m_ui_action_context_unref:
+ * @context: (nullable): The action context
  *
- * Free a UI action context and all its resources.
+ * Drop a reference; the context is freed with the last one.
  */
-void m_ui_action_context_free(MUIActionContext *context);
+void m_ui_action_context_unref(MUIActionContext *context);
 
 /**
  * MUIActionEntries:
@@ -100,26 +124,87 @@ void m_ui_action_entries_free(MUIActionEntries *action_entries);
 /**
  * m_ui_build_action_entries:
  * @prompts: Array of prompt configurations
- * @action_context: Context for callbacks (will be stored, caller retains ownership)
+ * @action_context: Context providing the models
  *
- * Build EUI action entries and XML from the prompt configurations.
+ * Build EUI action entries and XML from the prompt configurations. The
+ * result is shared by all composers and only rebuilt when the prompts or
+ * the models changed since the last call.
  *
- * Returns: (transfer full) (nullable): The built entries, or NULL if no prompts
+ * Returns: (transfer none) (nullable): The built entries, valid until the
+ *          next call, or NULL if no prompts
  */
-MUIActionEntries *m_ui_build_action_entries(JsonArray *prompts, MUIActionContext *action_context);
+const MUIActionEntries *m_ui_build_action_entries(JsonArray *prompts, MUIActionContext *action_context);
 
 /**
  * m_ui_register_actions:
  * @composer: The message composer
  * @action_entries: The built action entries
- * @action_context: The UI action context for callbacks
+ * @action_context: The UI action context for callbacks (will be referenced)
  *
- * Register the actions with the composer's UI manager.
+ * Register the actions with the composer's UI manager and mark the model
+ * selected in @action_context. @composer keeps a reference to
+ * @action_context until it is finalized.
  */
 void m_ui_register_actions(EMsgComposer *composer,
-                           MUIActionEntries *action_entries,
+                           const MUIActionEntries *action_entries,
                            MUIActionContext *action_context);
 
+/**
+ * MUISetupFunc:
+ * @composer: The message composer
+ * @user_data: The data passed to m_ui_register_placeholder()
+ *
+ * Load the configuration and register the full actions for @composer
+ * with m_ui_register_actions().
+ *
+ * Returns: TRUE if the actions are now available
+ */
+typedef gboolean (*MUISetupFunc)(EMsgComposer *composer, gpointer user_data);
+
+/**
+ * m_ui_register_placeholder:
+ * @composer: The message composer
+ * @setup_func: Called when the placeholder is activated
+ * @user_data: Data to pass to @setup_func, must outlive @composer
+ *
+ * Register only the AI menu and a single placeholder action in the menu
+ * and the toolbar; nothing is read or built. On activation @setup_func is
+ * called, and if it succeeds the placeholder is hidden and the prompt
+ * dropdown is shown.
+ */
+void m_ui_register_placeholder(EMsgComposer *composer,
+                               MUISetupFunc setup_func,
+                               gpointer user_data);
+
+/**
+ * m_ui_update_models:
+ * @composer: The message composer
+ * @action_context: The UI action context registered for @composer
+ * @models: The new list of available models (GList of gchar*)
+ *
+ * Refresh the Model submenu in place: actions are added for new models,
+ * and actions of models that are no longer available are hidden.
+ */
+void m_ui_update_models(EMsgComposer *composer,
+                        MUIActionContext *action_context,
+                        GList *models);
+
+/**
+ * m_ui_update_prompts:
+ * @composer: The message composer
+ * @action_context: The UI action context registered for @composer
+ * @prompts: The prompts of the new configuration
+ * @backends: The backends of the new configuration
+ *
+ * Take over a reloaded configuration. When the prompts changed, the
+ * actions of the old prompts are removed and the actions and menus are
+ * registered again from the new ones.
+ */
+void m_ui_update_prompts(EMsgComposer *composer,
+                         MUIActionContext *action_context,
+                         JsonArray *prompts,
+                         GHashTable *backends);
+
 G_END_DECLS
 
 #endif /* M_UI_ACTIONS_H */